@@ -0,0 +1,209 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileVSSD.h"
+#include "LogVSSD.h"
+#include "RAMVSSD.h"
+#include "VVSSD.h"
+#include "gf_util.h"
+
+using namespace std;
+
+/**
+ * Block-throughput benchmark.
+ *
+ * Usage: vssdBench [disk-MiB] [seconds] [threads]
+ *
+ * Builds RAM disks of the given size (default 1024 MiB) with 4 KiB
+ * blocks and measures uniformly random single-block reads and writes
+ * against each for the given time (default 2 seconds per run) from the
+ * given number of threads (default 1). Each configuration is a row of
+ * the report, so the effect of a disk option (such as the page size
+ * behind RAMVSSD) shows up as the difference between rows.
+ *
+ * File-backed disks of the same size follow, in the working directory:
+ * FileVSSD updates blocks in place while LogVSSD appends them to a log,
+ * and the log's write amplification and cleaner traffic are reported.
+ * Written blocks are synced before a run's clock stops.
+ *
+ * Last comes the Reed-Solomon parity encoding ErasureVSSD does (4 data
+ * plus 2 parity columns), once for each GF(2^8) kernel the CPU runs, in
+ * MiB of data encoded per second on one core.
+ */
+
+typedef chrono::steady_clock Clock;
+
+constexpr size_t block_size = 4096;
+
+/**
+ * Result of one timed run.
+ */
+struct Throughput {
+  double opsPerSecond;
+  double mibPerSecond;
+};
+
+/**
+ * Hammer the disk with random reads (or writes) from several threads
+ * for the given time, then sync what was written.
+ *
+ * @param disk the disk to exercise
+ * @param writes true to write blocks, false to read them
+ * @param seconds how long to run
+ * @param threads how many threads issue requests
+ * @return operations and MiB per second over all threads
+ */
+Throughput run(VVSSD &disk, bool writes, double seconds, unsigned threads) {
+  vector<unsigned long> counts(threads, 0);
+  vector<thread> workers;
+  auto stop = Clock::now() + chrono::duration_cast<Clock::duration>(
+                                 chrono::duration<double>(seconds));
+  auto start = Clock::now();
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      vector<char> block(block_size, (char)t);
+      // xorshift: cheap enough not to be what we measure
+      unsigned long long x = 88172645463325252ull + t;
+      unsigned long done = 0;
+      while ((done & 255) != 0 || Clock::now() < stop) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        VVSSD::blocknumber_t b = x % disk.blockCount();
+        if (writes)
+          disk.write(b, block.data());
+        else
+          disk.read(b, block.data());
+        done++;
+      }
+      counts[t] = done;
+    });
+  }
+  for (auto &w : workers) w.join();
+  if (writes) disk.sync();
+  chrono::duration<double> elapsed = Clock::now() - start;
+
+  unsigned long total = 0;
+  for (auto c : counts) total += c;
+  double ops = total / elapsed.count();
+  return {ops, ops * block_size / (1024.0 * 1024.0)};
+}
+
+string backingName(RAMVSSD::PageBacking backing) {
+  switch (backing) {
+    case RAMVSSD::HUGETLB_PAGES:
+      return "hugetlb 2MiB";
+    case RAMVSSD::TRANSPARENT_HUGE_PAGES:
+      return "THP 2MiB";
+    default:
+      return "4KiB";
+  }
+}
+
+/**
+ * Encode 2 parity columns from 4 data columns of 1 MiB over and over
+ * for the given time, the way ErasureVSSD does.
+ *
+ * @param kernel the GF(2^8) region kernel to use
+ * @param seconds how long to run
+ * @return MiB of data encoded per second
+ */
+double encodeRate(gf_util::Kernel kernel, double seconds) {
+  constexpr size_t k = 4;
+  constexpr size_t m = 2;
+  constexpr size_t column = 1024 * 1024;
+  vector<vector<uint8_t>> data(k, vector<uint8_t>(column));
+  vector<vector<uint8_t>> parity(m, vector<uint8_t>(column));
+  for (size_t j = 0; j < k; j++)
+    for (size_t i = 0; i < column; i++) data[j][i] = (uint8_t)(i * 31 + j);
+
+  auto stop = Clock::now() + chrono::duration_cast<Clock::duration>(
+                                 chrono::duration<double>(seconds));
+  auto start = Clock::now();
+  unsigned long rounds = 0;
+  while (Clock::now() < stop) {
+    for (size_t p = 0; p < m; p++)
+      for (size_t j = 0; j < k; j++)
+        gf_util::multiply_region(parity[p].data(), data[j].data(),
+                                 (uint8_t)(p * k + j + 2), column, j > 0,
+                                 kernel);
+    rounds++;
+  }
+  chrono::duration<double> elapsed = Clock::now() - start;
+  return rounds * k * (column / (1024.0 * 1024.0)) / elapsed.count();
+}
+
+void report(const string &name, const string &op, Throughput t) {
+  cout << left << setw(28) << name << setw(7) << op << right << fixed
+       << setprecision(0) << setw(12) << t.opsPerSecond << " ops/s"
+       << setw(10) << t.mibPerSecond << " MiB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t mib = (argc > 1) ? stoul(argv[1]) : 1024;
+  double seconds = (argc > 2) ? stod(argv[2]) : 2.0;
+  unsigned threads = (argc > 3) ? stoul(argv[3]) : 1;
+  size_t block_count = mib * 1024 * 1024 / block_size;
+
+  cout << "Random " << block_size << "-byte blocks over " << mib << " MiB, "
+       << threads << " thread(s), " << seconds << " s per run\n\n";
+
+  for (bool huge : {false, true}) {
+    RAMVSSD::Options options;
+    // Populated so page faults are not part of the measurement
+    options.provisioning = RAMVSSD::POPULATE;
+    options.hugePages = huge;
+    RAMVSSD disk(block_size, block_count, options);
+    if (disk.status() != OK) {
+      cout << "RAMVSSD (" << (huge ? "huge pages" : "small pages")
+           << ") unavailable: " << toString(disk.status()) << "\n";
+      continue;
+    }
+    string name = "RAMVSSD " + backingName(disk.pageBacking());
+    report(name, "read", run(disk, false, seconds, threads));
+    report(name, "write", run(disk, true, seconds, threads));
+  }
+
+  for (bool log : {false, true}) {
+    string fname = log ? "vssdBench-log.dat" : "vssdBench-file.dat";
+    unique_ptr<VVSSD> disk;
+    if (log)
+      disk = make_unique<LogVSSD>(block_size, block_count, fname);
+    else
+      disk = make_unique<FileVSSD>(block_size, block_count, fname);
+    if (disk->status() == OK) {
+      string name = log ? "LogVSSD" : "FileVSSD";
+      // Write first, so reads find data in place
+      report(name, "write", run(*disk, true, seconds, threads));
+      report(name, "read", run(*disk, false, seconds, threads));
+      if (log) {
+        LogVSSD &logDisk = static_cast<LogVSSD &>(*disk);
+        LogVSSD::Stats stats = logDisk.stats();
+        cout << "  write amplification " << setprecision(2)
+             << logDisk.writeAmplification() << ", cleaner moved "
+             << stats.cleanerBlocks << " blocks of " << stats.userBlocks
+             << " written\n";
+      }
+    } else {
+      cout << (log ? "LogVSSD" : "FileVSSD")
+           << " unavailable: " << toString(disk->status()) << "\n";
+    }
+    disk.reset();
+    remove(fname.c_str());
+  }
+
+  for (gf_util::Kernel kernel :
+       {gf_util::SCALAR, gf_util::SSSE3, gf_util::AVX2}) {
+    if (!gf_util::supported(kernel)) continue;
+    cout << left << setw(28)
+         << string("RS 4+2 encode ") + gf_util::kernel_name(kernel)
+         << setw(7) << "" << right << fixed << setprecision(0) << setw(28)
+         << encodeRate(kernel, seconds) << " MiB/s\n";
+  }
+}
@@ -0,0 +1,56 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "FileVSSD.h"
+#include "TrackedVSSD.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+/**
+ * Incremental backup export.
+ *
+ * Usage: vssdExport image since stream [next]
+ *
+ * Writes the blocks of the FileVSSD image written since checkpoint
+ * since to the file stream, using the change tracking kept in
+ * image.cbt (see TrackedVSSD). since is "-" when there is no checkpoint
+ * yet, or the tracking was reset because the image was not closed
+ * cleanly or was written without the tracker; the stream then holds
+ * every block, a full backup. Given next, a checkpoint of that name
+ * starts as the stream is finished, with no write in between, ready
+ * for the next backup.
+ *
+ * vssdImport applies the stream to a copy of the image.
+ */
+
+int main(int argc, char *argv[]) {
+  if (argc < 4 || argc > 5) {
+    cout << "Usage: " << argv[0] << " image since stream [next]\n";
+    return 1;
+  }
+  string image = argv[1];
+  string since = (string(argv[2]) == "-") ? "" : argv[2];
+
+  TrackedVSSD disk(make_unique<FileVSSD>(image), image + ".cbt", image);
+  if (disk.status() != OK) return 1;
+
+  ofstream out(argv[3], ios::binary | ios::trunc);
+  if (!out) {
+    cout << "ERROR: Unable to create '" << argv[3] << "'.\n";
+    return 1;
+  }
+  size_t blocks = 0;
+  uint64_t generation = disk.generation();
+  DiskStatus ds = (argc == 5)
+                      ? disk.exportAndCheckpoint(since, out, argv[4], &blocks)
+                      : disk.exportChanges(since, out, &blocks);
+  if (ds != OK) return 1;
+  out.close();
+  cout << "Exported " << blocks << " of " << disk.blockCount()
+       << " blocks (generation " << generation << ")\n";
+  return 0;
+}
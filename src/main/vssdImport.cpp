@@ -0,0 +1,42 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "FileVSSD.h"
+#include "TrackedVSSD.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+/**
+ * Incremental backup import.
+ *
+ * Usage: vssdImport image stream
+ *
+ * Writes the blocks in stream (from vssdExport) onto the FileVSSD
+ * image, which must have the exported image's geometry. Applying a
+ * full stream and then each incremental one in order rebuilds the
+ * image as it was at the last export.
+ */
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    cout << "Usage: " << argv[0] << " image stream\n";
+    return 1;
+  }
+
+  FileVSSD disk(argv[1]);
+  if (disk.status() != OK) return 1;
+  ifstream in(argv[2], ios::binary);
+  if (!in) {
+    cout << "ERROR: Unable to open '" << argv[2] << "'.\n";
+    return 1;
+  }
+
+  size_t blocks = 0;
+  if (TrackedVSSD::importChanges(in, disk, &blocks) != OK ||
+      disk.sync() != OK)
+    return 1;
+  cout << "Imported " << blocks << " blocks\n";
+  return 0;
+}
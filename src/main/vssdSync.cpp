@@ -0,0 +1,131 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "FileVSSD.h"
+#include "MerkleVSSD.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+/**
+ * Replica sync by Merkle tree.
+ *
+ * Usage: vssdSync source target
+ *        vssdSync --pipe source target
+ *        vssdSync --serve source
+ *        vssdSync --verify image
+ *
+ * Makes the FileVSSD image target a copy of source, comparing the hash
+ * trees kept in image.mkl next to each (see MerkleVSSD) and copying
+ * only the blocks that differ. A target that does not exist is created
+ * with the source's geometry. With --pipe the source is opened by a
+ * second vssdSync process (--serve) and every node and block crosses a
+ * pipe, as it would reaching a replica on another machine; --serve
+ * answers on standard input and output.
+ *
+ * A tree is rebuilt when its image was written without it while it was
+ * closed. --verify rehashes every block of an image to correct a tree
+ * that is out of date anyway, say after the image was written by
+ * another program while the tree was open.
+ */
+
+/**
+ * Open an image with its tree; if it does not exist and geometry is
+ * given, create it.
+ */
+unique_ptr<MerkleVSSD> openImage(const string &name, size_t block_size = 0,
+                                 size_t block_count = 0) {
+  unique_ptr<VVSSD> image;
+  if (block_count > 0 && access(name.c_str(), F_OK) != 0)
+    image = make_unique<FileVSSD>(block_size, block_count, name);
+  else
+    image = make_unique<FileVSSD>(name);
+  return make_unique<MerkleVSSD>(move(image), name + ".mkl", name);
+}
+
+/**
+ * Sync target from source and report what it took.
+ */
+int syncImage(MerkleVSSD::Peer &source, const string &target) {
+  if (source.blockCount() == 0) return 1;
+  auto disk = openImage(target, source.blockSize(), source.blockCount());
+  if (disk->status() != OK) return 1;
+  size_t blocks = 0, compared = 0;
+  if (disk->syncFrom(source, &blocks, &compared) != OK) return 1;
+  cout << "Copied " << blocks << " of " << disk->blockCount()
+       << " blocks after comparing " << compared << " nodes\n";
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  string mode = (argc > 1) ? argv[1] : "";
+  if (mode == "--serve" && argc == 3) {
+    // Answers go out on the real standard output; messages go to stderr
+    int out = dup(1);
+    dup2(2, 1);
+    auto source = openImage(argv[2]);
+    if (source->status() != OK) return 1;
+    return (source->serve(0, out) == OK) ? 0 : 1;
+  }
+
+  if (mode == "--verify" && argc == 3) {
+    auto disk = openImage(argv[2]);
+    if (disk->status() != OK) return 1;
+    size_t wrong = 0;
+    if (disk->verify(&wrong) != OK) return 1;
+    cout << "Rehashed " << disk->blockCount() << " blocks; " << wrong
+         << " leaves were out of date\n";
+    return 0;
+  }
+
+  if (mode == "--pipe" && argc == 4) {
+    int requests[2], answers[2];
+    if (pipe(requests) != 0 || pipe(answers) != 0) {
+      cout << "ERROR: Unable to create pipes.\n";
+      return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+      dup2(requests[0], 0);
+      dup2(answers[1], 1);
+      close(requests[1]);
+      close(answers[0]);
+      execl("/proc/self/exe", argv[0], "--serve", argv[2], (char *)nullptr);
+      _exit(127);
+    }
+    close(requests[0]);
+    close(answers[1]);
+    // A server that dies shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    int result;
+    {
+      MerkleVSSD::PipePeer source(answers[0], requests[1]);
+      result = syncImage(source, argv[3]);
+    }
+    close(requests[1]);
+    close(answers[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return (result == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0
+                                                                         : 1;
+  }
+
+  if (argc == 3 && mode.rfind("--", 0) != 0) {
+    auto source = openImage(argv[1]);
+    if (source->status() != OK) return 1;
+    MerkleVSSD::LocalPeer peer(*source);
+    return syncImage(peer, argv[2]);
+  }
+
+  cout << "Usage: " << argv[0] << " source target\n"
+       << "       " << argv[0] << " --pipe source target\n"
+       << "       " << argv[0] << " --serve source\n"
+       << "       " << argv[0] << " --verify image\n";
+  return 1;
+}
@@ -0,0 +1,180 @@
+#include "catch_amalgamated.hpp"
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("AsyncVSSD.h")
+#include "AsyncVSSD.h"
+#include "QueueDepthController.h"
+#include "RAMVSSD.h"
+using block_util::BlockPtr;
+
+TEST_CASE("AsyncVSSD completes queued requests", "[vssd][asyncvssd]") {
+  constexpr int block_size = 1024;
+  constexpr int block_count = 256;
+
+  auto async = make_unique<AsyncVSSD>(
+      make_unique<RAMVSSD>(block_size, block_count), chrono::milliseconds(5), 8);
+
+  REQUIRE(async->status() == OK);
+  REQUIRE(async->blockSize() == block_size);
+  REQUIRE(async->blockCount() == block_count);
+
+  const char * testPhrases[] = {
+    "Africa, Anarctica, Asia, Australia, Europe, North America, South America",
+    "one fish, two fish, red fish, blue fish",
+    "X",
+  };
+  const size_t testPhraseCount = sizeof(testPhrases)/sizeof(testPhrases[0]);
+
+  // one buffer per request: buffers must live until the future is ready
+  vector<vector<char>> written(block_count, vector<char>(block_size));
+  vector<future<DiskStatus>> pending;
+  for (auto writeNdx = 0; writeNdx < block_count; ++writeNdx) {
+    block_util::fill_block(written[writeNdx].data(), block_size,
+                           testPhrases[writeNdx % testPhraseCount]);
+    pending.push_back(async->writeAsync(writeNdx, written[writeNdx].data()));
+  }
+  for (auto & done : pending) REQUIRE(done.get() == OK);
+
+  SECTION("read what was written") {
+    vector<vector<char>> read(block_count, vector<char>(block_size));
+    pending.clear();
+    for (auto readNdx = 0; readNdx < block_count; ++readNdx)
+      pending.push_back(async->readAsync(readNdx, read[readNdx].data()));
+    for (auto readNdx = 0; readNdx < block_count; ++readNdx) {
+      INFO("readNdx = " << readNdx);
+      REQUIRE(pending[readNdx].get() == OK);
+      REQUIRE((memcmp(written[readNdx].data(), read[readNdx].data(), block_size) == 0));
+    }
+  }
+
+  SECTION("synchronous calls go through the queue") {
+    vector<char> read(4 * block_size);
+    REQUIRE(async->readBlocks(3, 4, read.data()) == OK);
+    REQUIRE((memcmp(written[5].data(), read.data() + 2 * block_size, block_size) == 0));
+    REQUIRE(async->read(block_count, read.data()) == BLOCK_OUT_OF_RANGE);
+  }
+
+  SECTION("a zero depth still runs requests; no disk refuses them") {
+    async = make_unique<AsyncVSSD>(
+        make_unique<RAMVSSD>(block_size, block_count), chrono::milliseconds(5), 0);
+    vector<char> read(block_size);
+    REQUIRE(async->read(0, read.data()) == OK);
+
+    async = make_unique<AsyncVSSD>(nullptr, chrono::milliseconds(5));
+    REQUIRE(async->status() == ERROR);
+    REQUIRE(async->blockCount() == 0);
+    REQUIRE(async->read(0, read.data()) == ERROR);
+  }
+}
+
+/**
+ * RAM disk whose first write waits until released, so requests pile up
+ * in the queue behind it.
+ */
+class GatedRAMVSSD : public RAMVSSD {
+ public:
+  GatedRAMVSSD(size_t block_size, size_t block_count, shared_future<void> gate)
+      : RAMVSSD(block_size, block_count), gate(gate) {}
+
+  virtual DiskStatus writeBlocks(blocknumber_t block, size_t count, void* buffer) {
+    gate.wait();
+    return RAMVSSD::writeBlocks(block, count, buffer);
+  }
+
+ private:
+  shared_future<void> gate;
+};
+
+TEST_CASE("AsyncVSSD drops expired and cancelled requests", "[vssd][asyncvssd]") {
+  constexpr int block_size = 512;
+  constexpr int block_count = 16;
+
+  promise<void> open;
+  auto async = make_unique<AsyncVSSD>(
+      make_unique<GatedRAMVSSD>(block_size, block_count, open.get_future().share()),
+      chrono::seconds(1), 1);
+
+  vector<char> zero(block_size, 0);
+  vector<char> ones(block_size, 1);
+  auto now = chrono::steady_clock::now();
+
+  AsyncVSSD::Request blocker{AsyncVSSD::Request::WRITE, 0, 1, ones.data()};
+  future<DiskStatus> first = async->submit(blocker);
+
+  AsyncVSSD::Request expiring{AsyncVSSD::Request::WRITE, 1, 1, ones.data()};
+  expiring.deadline = now + chrono::milliseconds(1);
+  future<DiskStatus> expired = async->submit(expiring);
+
+  auto token = make_shared<AsyncVSSD::CancellationToken>();
+  AsyncVSSD::Request cancelable{AsyncVSSD::Request::WRITE, 2, 1, ones.data()};
+  cancelable.cancellation = token;
+  future<DiskStatus> cancelled = async->submit(cancelable);
+
+  AsyncVSSD::Request patient{AsyncVSSD::Request::WRITE, 3, 1, ones.data()};
+  patient.deadline = now + chrono::hours(1);
+  patient.cancellation = make_shared<AsyncVSSD::CancellationToken>();
+  future<DiskStatus> kept = async->submit(patient);
+
+  token->cancel();
+  this_thread::sleep_for(chrono::milliseconds(10));
+  open.set_value();
+
+  REQUIRE(first.get() == OK);
+  REQUIRE(expired.get() == CANCELLED);
+  REQUIRE(cancelled.get() == CANCELLED);
+  REQUIRE(kept.get() == OK);
+  REQUIRE(async->dropped() == 2);
+
+  SECTION("dropped writes never reached the disk") {
+    vector<char> read(block_size);
+    REQUIRE(async->read(1, read.data()) == OK);
+    REQUIRE(read == zero);
+    REQUIRE(async->read(2, read.data()) == OK);
+    REQUIRE(read == zero);
+    REQUIRE(async->read(3, read.data()) == OK);
+    REQUIRE(read == ones);
+  }
+
+  SECTION("CANCELLED converts to and from a string") {
+    REQUIRE(toString(CANCELLED) == "CANCELLED");
+    REQUIRE(fromString("CANCELLED") == CANCELLED);
+  }
+}
+
+TEST_CASE("QueueDepthController grows under target, backs off over it", "[vssd][asyncvssd]") {
+  QueueDepthController controller(chrono::milliseconds(10), 1, 16);
+  REQUIRE(controller.limit() == 1);
+
+  SECTION("fast completions with demand raise the limit to the maximum") {
+    for (int i = 0; i < 4000; ++i)
+      controller.completed(chrono::milliseconds(1), true);
+    REQUIRE(controller.limit() == 16);
+    REQUIRE(controller.p99() == chrono::milliseconds(1));
+  }
+
+  SECTION("without demand the limit stays put") {
+    for (int i = 0; i < 4000; ++i)
+      controller.completed(chrono::milliseconds(1), false);
+    REQUIRE(controller.limit() == 1);
+  }
+
+  SECTION("a slow tail cuts the limit") {
+    for (int i = 0; i < 4000; ++i)
+      controller.completed(chrono::milliseconds(1), true);
+    // a window whose worst 2% are over the target
+    for (size_t i = 0; i < QueueDepthController::Window; ++i)
+      controller.completed(chrono::milliseconds(i % 50 == 0 ? 50 : 1), true);
+    REQUIRE(controller.limit() < 16);
+    REQUIRE(controller.p99() == chrono::milliseconds(50));
+  }
+}
+#endif
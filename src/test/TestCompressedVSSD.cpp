@@ -0,0 +1,188 @@
+#include "catch_amalgamated.hpp"
+#include <sys/stat.h>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "block_util.h"
+#include "lz_codec.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("CompressedVSSD.h")
+#include "CompressedVSSD.h"
+
+// Bytes from a fixed-seed generator: nothing for the codec to find
+static vector<char> noise(size_t size, unsigned seed) {
+  mt19937 gen(seed);
+  vector<char> bytes(size);
+  for (auto & b : bytes) b = (char)gen();
+  return bytes;
+}
+
+static vector<char> text(size_t size, const string & words) {
+  vector<char> bytes(size);
+  block_util::fill_block(bytes.data(), size, words);
+  return bytes;
+}
+
+TEST_CASE("lz_codec round-trips what it compresses", "[vssd][compressedvssd]") {
+  constexpr size_t size = 4096;
+  vector<char> input = GENERATE(vector<char>(size, 0), text(size, "one fish, two fish, red fish, blue fish\n"),
+                                noise(size, 1), text(size, string(300, 'x') + "y"));
+  vector<char> packed(lz_codec::bound(size));
+  size_t length = lz_codec::compress(input.data(), size, packed.data(), packed.size());
+  REQUIRE(length > 0);
+  REQUIRE(length <= lz_codec::bound(size));
+  vector<char> back(size);
+  REQUIRE(lz_codec::decompress(packed.data(), length, back.data(), size));
+  REQUIRE(back == input);
+
+  SECTION("damaged input is refused, not overrun") {
+    REQUIRE_FALSE(lz_codec::decompress(packed.data(), length, back.data(), size - 1));
+    if (length > 1)
+      REQUIRE_FALSE(lz_codec::decompress(packed.data(), length - 1, back.data(), size));
+  }
+
+  SECTION("too little room is reported") {
+    REQUIRE(lz_codec::compress(input.data(), size, packed.data(), length - 1) == 0);
+  }
+}
+
+TEST_CASE("CompressedVSSD stores blocks compressed", "[vssd][compressedvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 256;
+  const char * fname = "CompressedVSSD-temp-data-file.dat";
+
+  auto vssd = make_unique<CompressedVSSD>(block_size, block_count, fname);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+  REQUIRE(vssd->storedBytes() == 0);
+
+  vector<char> read(block_size);
+  auto block = [&](size_t b) {
+    // Every fourth block is incompressible, the rest are text
+    return (b % 4 == 3) ? noise(block_size, b)
+                        : text(block_size, "block " + to_string(b) + ": one fish, two fish ");
+  };
+
+  SECTION("unwritten blocks read as zeros") {
+    REQUIRE(vssd->read(block_count - 1, read.data()) == OK);
+    REQUIRE(read == vector<char>(block_size, 0));
+  }
+
+  SECTION("read what was written, raw or compressed, before and after reopening") {
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, block(b).data()) == OK);
+    // A quarter raw, the rest a few dozen bytes each
+    REQUIRE(vssd->storedBytes() < block_count * block_size / 3);
+    REQUIRE(vssd->storedBytes() > block_count * block_size / 4);
+    uint64_t stored = vssd->storedBytes();
+
+    for (int reopen = 0; reopen < 2; ++reopen) {
+      for (size_t b = 0; b < block_count; ++b) {
+        REQUIRE(vssd->read(b, read.data()) == OK);
+        INFO("block " << b);
+        REQUIRE(read == block(b));
+      }
+      REQUIRE(vssd->sync() == OK);
+      vssd = make_unique<CompressedVSSD>(fname);
+      REQUIRE(vssd->status() == OK);
+      REQUIRE(vssd->blockSize() == block_size);
+      REQUIRE(vssd->blockCount() == block_count);
+      REQUIRE(vssd->storedBytes() == stored);
+    }
+  }
+
+  SECTION("rewritten blocks reuse freed space") {
+    // Replaced contents are freed by the sync after them
+    for (int round = 0; round < 20; ++round) {
+      for (size_t b = 0; b < 16; ++b)
+        REQUIRE(vssd->write(b, (round % 2 ? noise(block_size, round) : block(b)).data()) == OK);
+      REQUIRE(vssd->sync() == OK);
+    }
+    // Zeroing gives the space back
+    vector<char> zero(block_size, 0);
+    REQUIRE(vssd->write(0, zero.data()) == OK);
+    REQUIRE(vssd->read(0, read.data()) == OK);
+    REQUIRE(read == zero);
+    struct stat info;
+    REQUIRE(stat(fname, &info) == 0);
+    // Map, then at most twice the blocks' raw size in data
+    REQUIRE((size_t)info.st_size < 2 * 4096 + 3 * 16 * block_size);
+  }
+
+  SECTION("replaced contents stay in place until a sync") {
+    // Each rewrite before the sync needs space of its own
+    struct stat before, after;
+    REQUIRE(vssd->sync() == OK);
+    REQUIRE(stat(fname, &before) == 0);
+    for (int round = 0; round < 4; ++round)
+      REQUIRE(vssd->write(1, noise(block_size, round).data()) == OK);
+    REQUIRE(stat(fname, &after) == 0);
+    REQUIRE((size_t)(after.st_size - before.st_size) >= 3 * block_size);
+
+    // After it, the space goes round again
+    REQUIRE(vssd->sync() == OK);
+    REQUIRE(stat(fname, &before) == 0);
+    for (int round = 0; round < 4; ++round) {
+      REQUIRE(vssd->write(1, noise(block_size, round).data()) == OK);
+      REQUIRE(vssd->sync() == OK);
+    }
+    REQUIRE(stat(fname, &after) == 0);
+    REQUIRE(after.st_size == before.st_size);
+  }
+
+  SECTION("extents round-trip") {
+    vector<char> extent;
+    for (size_t b = 10; b < 20; ++b) {
+      auto one = block(b);
+      extent.insert(extent.end(), one.begin(), one.end());
+    }
+    REQUIRE(vssd->writeBlocks(10, 10, extent.data()) == OK);
+    vector<char> back(extent.size());
+    REQUIRE(vssd->readBlocks(10, 10, back.data()) == OK);
+    REQUIRE(back == extent);
+    REQUIRE(vssd->readBlocks(block_count - 1, 2, back.data()) == DiskStatus::BLOCK_OUT_OF_RANGE);
+  }
+
+  vssd.reset();
+  remove(fname);
+}
+
+TEST_CASE("CompressedVSSD will not open other files", "[vssd][compressedvssd]") {
+  const char * fname = "CompressedVSSD-temp-bad-file.dat";
+  {
+    ofstream out(fname);
+    out << "this is not a compressed disk, not even close";
+  }
+  CompressedVSSD vssd(fname);
+  REQUIRE(vssd.status() == DiskStatus::ERROR);
+  remove(fname);
+
+  CompressedVSSD missing("CompressedVSSD-no-such-file.dat");
+  REQUIRE(missing.status() == DiskStatus::ERROR);
+
+  // A real disk whose header claims sizes the file cannot back
+  for (size_t field : {1, 2}) {
+    {
+      CompressedVSSD made(512, 16, fname);
+      REQUIRE(made.status() == DiskStatus::OK);
+    }
+    {
+      fstream image(fname, ios::in | ios::out | ios::binary);
+      uint64_t huge = UINT64_MAX / 4;
+      image.seekp(field * sizeof(uint64_t));
+      image.write((const char *)&huge, sizeof(huge));
+    }
+    CompressedVSSD damaged(fname);
+    REQUIRE(damaged.status() == DiskStatus::ERROR);
+    REQUIRE(damaged.blockCount() == 0);
+  }
+  remove(fname);
+}
+
+#endif
@@ -0,0 +1,239 @@
+#include "catch_amalgamated.hpp"
+#include <unistd.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "block_util.h"
+#include "hash_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("DedupVSSD.h")
+#include "DedupVSSD.h"
+#include "FileVSSD.h"
+#include "RAMVSSD.h"
+
+// Counts writes reaching the slots, to see which writes were deduplicated
+class CountingRAMVSSD : public RAMVSSD {
+ public:
+  using RAMVSSD::RAMVSSD;
+  int writes = 0;
+  virtual DiskStatus writeBlocks(blocknumber_t block, size_t count, void* buffer) {
+    writes++;
+    return RAMVSSD::writeBlocks(block, count, buffer);
+  }
+};
+
+TEST_CASE("murmur3_128 matches the reference", "[vssd][dedupvssd]") {
+  string fox = "The quick brown fox jumps over the lazy dog";
+  hash_util::Hash128 hash = hash_util::murmur3_128(fox.data(), fox.size());
+  REQUIRE(hash.low == 0xe34bbc7bbc071b6cull);
+  REQUIRE(hash.high == 0x7a433ca9c49a9347ull);
+  REQUIRE(hash_util::murmur3_128("", 0) == hash_util::Hash128());
+}
+
+TEST_CASE("DedupVSSD keeps each content once", "[vssd][dedupvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t slot_count = 64;
+  constexpr size_t block_count = 128;
+
+  auto slots = make_unique<CountingRAMVSSD>(block_size, slot_count);
+  CountingRAMVSSD & counter = *slots;
+  auto store = make_shared<ContentStore>(move(slots));
+  auto vssd = make_unique<DedupVSSD>(store, block_count);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+
+  auto content = [](int n) {
+    vector<char> block(block_size);
+    block_util::fill_block(block.data(), block_size, "content " + to_string(n) + " ");
+    return block;
+  };
+  vector<char> read(block_size);
+
+  SECTION("identical blocks cost no data writes") {
+    // 128 blocks, 8 distinct contents
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, content(b % 8).data()) == OK);
+    REQUIRE(counter.writes == 8);
+    REQUIRE(store->slotsInUse() == 8);
+    REQUIRE(vssd->dedupRatio() == 16.0);
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b % 8));
+    }
+  }
+
+  SECTION("views share the store") {
+    DedupVSSD other(store, block_count);
+    REQUIRE(vssd->write(0, content(1).data()) == OK);
+    REQUIRE(other.write(5, content(1).data()) == OK);
+    REQUIRE(counter.writes == 1);
+    REQUIRE(other.read(5, read.data()) == OK);
+    REQUIRE(read == content(1));
+    REQUIRE(other.read(0, read.data()) == OK);
+    REQUIRE(read == vector<char>(block_size, 0));
+  }
+
+  SECTION("garbage collection reclaims unreferenced slots") {
+    REQUIRE(vssd->write(0, content(1).data()) == OK);
+    REQUIRE(vssd->write(1, content(2).data()) == OK);
+    REQUIRE(vssd->write(2, content(2).data()) == OK);
+    // Overwriting with zeros drops content 1 entirely, content 2 once
+    vector<char> zero(block_size, 0);
+    REQUIRE(vssd->write(0, zero.data()) == OK);
+    REQUIRE(vssd->write(1, zero.data()) == OK);
+    REQUIRE(store->slotsInUse() == 1);
+
+    // Uncollected garbage is revived without a write
+    REQUIRE(vssd->write(3, content(1).data()) == OK);
+    REQUIRE(counter.writes == 2);
+    REQUIRE(vssd->write(3, zero.data()) == OK);
+
+    REQUIRE(store->collectGarbage() == 1);
+    REQUIRE(store->collectGarbage() == 0);
+    REQUIRE(vssd->read(2, read.data()) == OK);
+    REQUIRE(read == content(2));
+    // A freed slot takes new content
+    REQUIRE(vssd->write(4, content(3).data()) == OK);
+    REQUIRE(counter.writes == 3);
+    REQUIRE(vssd->read(4, read.data()) == OK);
+    REQUIRE(read == content(3));
+  }
+
+  SECTION("a full store refuses new contents") {
+    for (size_t b = 0; b < slot_count; ++b)
+      REQUIRE(vssd->write(b, content(b).data()) == OK);
+    REQUIRE(vssd->write(slot_count, content(slot_count).data()) == DiskStatus::ERROR);
+    REQUIRE(vssd->write(slot_count, content(0).data()) == OK);
+  }
+
+  SECTION("destroying a view releases its references") {
+    REQUIRE(vssd->write(0, content(1).data()) == OK);
+    vssd.reset();
+    REQUIRE(store->slotsInUse() == 0);
+    REQUIRE(store->collectGarbage() == 1);
+  }
+}
+
+TEST_CASE("DedupVSSD named views persist in the store's table", "[vssd][dedupvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t slot_count = 64;
+  constexpr size_t block_count = 32;
+  const char * slots = "DedupVSSD-temp-slots.dat";
+  const char * table = "DedupVSSD-temp-table.dat";
+  const char * saved = "DedupVSSD-temp-saved.dat";
+
+  auto content = [](int n) {
+    vector<char> block(block_size);
+    block_util::fill_block(block.data(), block_size, "content " + to_string(n) + " ");
+    return block;
+  };
+  auto openStore = [&] {
+    return make_shared<ContentStore>(make_unique<FileVSSD>(slots), table);
+  };
+  vector<char> read(block_size);
+
+  {
+    FileVSSD created(block_size, slot_count, slots);
+    REQUIRE(created.status() == OK);
+  }
+  {
+    auto store = openStore();
+    REQUIRE(store->status() == OK);
+    DedupVSSD a(store, block_count, "a");
+    DedupVSSD b(store, block_count, "b");
+    DedupVSSD scratch(store, block_count);
+    for (size_t i = 0; i < block_count; ++i) {
+      REQUIRE(a.write(i, content(i % 4).data()) == OK);
+      REQUIRE(b.write(i, content(i % 2).data()) == OK);
+    }
+    REQUIRE(scratch.write(0, content(9).data()) == OK);
+    DedupVSSD again(store, block_count, "a");
+    REQUIRE(again.status() == DiskStatus::ERROR);
+  }
+
+  SECTION("views come back after the store is closed") {
+    auto store = openStore();
+    REQUIRE(store->status() == OK);
+    REQUIRE(store->closedCleanly());
+    // The unnamed view's content went with it
+    REQUIRE(store->slotsInUse() == 4);
+    REQUIRE(store->referenceCount() == 2 * block_count);
+    DedupVSSD a(store, block_count, "a");
+    DedupVSSD b(store, block_count, "b");
+    for (size_t i = 0; i < block_count; ++i) {
+      REQUIRE(a.read(i, read.data()) == OK);
+      REQUIRE(read == content(i % 4));
+      REQUIRE(b.read(i, read.data()) == OK);
+      REQUIRE(read == content(i % 2));
+    }
+    // Known contents are still found by hash
+    REQUIRE(a.write(0, content(3).data()) == OK);
+    REQUIRE(store->slotsInUse() == 4);
+  }
+
+  SECTION("dropping a view releases its blocks") {
+    auto store = openStore();
+    REQUIRE(store->dropView("b"));
+    REQUIRE_FALSE(store->dropView("b"));
+    REQUIRE(store->referenceCount() == block_count);
+    {
+      DedupVSSD a(store, block_count, "a");
+      REQUIRE_FALSE(store->dropView("a"));
+      DedupVSSD resized(store, block_count + 1, "a");
+      REQUIRE(resized.status() == DiskStatus::ERROR);
+    }
+    REQUIRE(store->dropView("a"));
+    REQUIRE(store->collectGarbage() == 4);
+  }
+
+  SECTION("a crash leaves the views as of the last sync") {
+    {
+      auto store = openStore();
+      DedupVSSD a(store, block_count, "a");
+      REQUIRE(a.write(0, content(7).data()) == OK);
+      REQUIRE(a.sync() == OK);
+      filesystem::copy_file(table, saved, filesystem::copy_options::overwrite_existing);
+
+      // Content 7 becomes garbage, but its slot stays put until the
+      // next sync, as the saved table still uses it
+      REQUIRE(a.write(0, content(8).data()) == OK);
+      REQUIRE(store->collectGarbage() == 1);
+      REQUIRE(a.write(1, content(9).data()) == OK);
+    }
+    // As if the process had died right after the sync
+    filesystem::copy_file(saved, table, filesystem::copy_options::overwrite_existing);
+
+    auto store = openStore();
+    REQUIRE(store->status() == OK);
+    REQUIRE_FALSE(store->closedCleanly());
+    DedupVSSD a(store, block_count, "a");
+    REQUIRE(a.read(0, read.data()) == OK);
+    REQUIRE(read == content(7));
+    REQUIRE(a.read(1, read.data()) == OK);
+    REQUIRE(read == content(1));
+  }
+
+  SECTION("a damaged table is refused") {
+    {
+      ofstream damaged(table, ios::binary | ios::in | ios::out);
+      damaged.seekp(8);
+      damaged.write("\x01", 1);
+    }
+    auto store = openStore();
+    REQUIRE(store->status() == DiskStatus::ERROR);
+    DedupVSSD view(store, block_count, "a");
+    REQUIRE(view.status() == DiskStatus::ERROR);
+  }
+
+  unlink(slots);
+  unlink(table);
+  unlink(saved);
+}
+
+#endif
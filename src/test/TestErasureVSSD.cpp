@@ -0,0 +1,302 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("ErasureVSSD.h")
+#include "ErasureVSSD.h"
+#include "RAMVSSD.h"
+#include "gf_util.h"
+
+namespace {
+
+/**
+ * A RAMVSSD that counts its reads and writes and can be told to fail
+ * them, standing
+ * in for a child disk that dies.
+ */
+class FaultyChildVSSD : public RAMVSSD {
+ public:
+  atomic<size_t> reads = 0;
+  atomic<size_t> writes = 0;
+  atomic<bool> failing = false;
+
+  FaultyChildVSSD(size_t block_size, size_t block_count)
+      : RAMVSSD(block_size, block_count) {}
+
+  DiskStatus readBlocks(blocknumber_t block, size_t count, void * buffer) override {
+    reads++;
+    if (failing) return ERROR;
+    return RAMVSSD::readBlocks(block, count, buffer);
+  }
+  DiskStatus writeBlocks(blocknumber_t block, size_t count, void * buffer) override {
+    writes += count;
+    if (failing) return ERROR;
+    return RAMVSSD::writeBlocks(block, count, buffer);
+  }
+};
+
+}
+
+TEST_CASE("gf_util kernels agree with the tables", "[vssd][erasurevssd]") {
+  REQUIRE(gf_util::multiply(0x53, 0xca) == gf_util::multiply(0xca, 0x53));
+  for (unsigned a = 1; a < 256; ++a)
+    REQUIRE(gf_util::multiply(a, gf_util::inverse(a)) == 1);
+
+  // Odd lengths exercise the tails after the vector loops
+  vector<uint8_t> src(1000);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = (uint8_t)(i * 37 + 11);
+  for (gf_util::Kernel kernel : {gf_util::SCALAR, gf_util::SSSE3, gf_util::AVX2}) {
+    if (!gf_util::supported(kernel)) continue;
+    INFO(gf_util::kernel_name(kernel));
+    for (unsigned c : {0u, 1u, 2u, 0x1du, 0x80u, 0xffu})
+      for (size_t length : {0, 1, 15, 16, 33, 999}) {
+        vector<uint8_t> dst(length, 0x5a);
+        gf_util::multiply_region(dst.data(), src.data(), c, length, true, kernel);
+        for (size_t i = 0; i < length; ++i)
+          REQUIRE(dst[i] == (0x5a ^ gf_util::multiply(c, src[i])));
+        gf_util::multiply_region(dst.data(), src.data(), c, length, false, kernel);
+        for (size_t i = 0; i < length; ++i)
+          REQUIRE(dst[i] == gf_util::multiply(c, src[i]));
+      }
+  }
+
+  uint8_t matrix[4] = {1, 2, 3, 4};
+  uint8_t inverse[4] = {1, 2, 3, 4};
+  REQUIRE(gf_util::invert_matrix(inverse, 2));
+  // matrix * inverse is the identity
+  for (size_t r = 0; r < 2; ++r)
+    for (size_t c = 0; c < 2; ++c)
+      REQUIRE((gf_util::multiply(matrix[r * 2], inverse[c]) ^
+               gf_util::multiply(matrix[r * 2 + 1], inverse[2 + c])) == (r == c));
+  uint8_t singular[4] = {1, 1, 1, 1};
+  REQUIRE_FALSE(gf_util::invert_matrix(singular, 2));
+}
+
+TEST_CASE("ErasureVSSD survives the loss of any m children", "[vssd][erasurevssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t k = 4;
+  constexpr size_t m = 2;
+  constexpr size_t stripes = 20;
+
+  test_util::VersionedBlocks content(block_size);
+
+  // Keep plain pointers to the children to fail them and count reads
+  vector<FaultyChildVSSD*> raw;
+  auto makeDisk = [&](vector<bool> present) {
+    return make_unique<ErasureVSSD>(
+        test_util::make_children(present.size(), raw, [&](size_t c) {
+          return present[c] ? make_unique<FaultyChildVSSD>(block_size, stripes)
+                            : nullptr;
+        }),
+        k);
+  };
+
+  auto vssd = makeDisk(vector<bool>(k + m, true));
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->dataChildren() == k);
+  REQUIRE(vssd->parityChildren() == m);
+  REQUIRE(vssd->blockSize() == block_size);
+  size_t block_count = vssd->blockCount();
+  REQUIRE(block_count == k * stripes);
+
+  vector<char> read(block_size);
+  for (size_t b = 0; b < block_count; ++b)
+    REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+
+  SECTION("data blocks lie on the data children in order") {
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(raw[b % k]->RAMVSSD::readBlocks(b / k, 1, read.data()) == OK);
+      REQUIRE(read == content(b, 1));
+    }
+  }
+
+  SECTION("extents of every alignment and length round trip") {
+    vector<int> versions(block_count, 1);
+    int version = 1;
+    for (size_t first : {0, 1, 3, 4, 9}) {
+      for (size_t count : {1, 2, 4, 7, 8, 13}) {
+        ++version;
+        vector<char> extent(count * block_size);
+        for (size_t i = 0; i < count; ++i) {
+          memcpy(&extent[i * block_size], content(first + i, version).data(), block_size);
+          versions[first + i] = version;
+        }
+        REQUIRE(vssd->writeBlocks(first, count, extent.data()) == OK);
+
+        vector<char> back(count * block_size);
+        REQUIRE(vssd->readBlocks(first, count, back.data()) == OK);
+        REQUIRE(back == extent);
+      }
+    }
+    // Blocks sharing a stripe with a write are left as they were
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, versions[b]));
+    }
+  }
+
+  SECTION("full-stripe writes read nothing; partial ones do") {
+    auto totalReads = [&] {
+      size_t reads = 0;
+      for (auto disk : raw) reads += disk->reads;
+      return reads;
+    };
+    size_t before = totalReads();
+    vector<char> extent(3 * k * block_size);
+    REQUIRE(vssd->writeBlocks(2 * k, 3 * k, extent.data()) == OK);
+    REQUIRE(totalReads() == before);
+
+    REQUIRE(vssd->writeBlocks(2 * k + 1, 2, extent.data()) == OK);
+    REQUIRE(totalReads() > before);
+  }
+
+  SECTION("partial writes leave the untouched data children alone") {
+    auto writes = [&] {
+      vector<size_t> counts;
+      for (auto disk : raw) counts.push_back(disk->writes);
+      return counts;
+    };
+    // Blocks 1 and 2 of one stripe: children 1 and 2 and the parity
+    vector<char> two(2 * block_size);
+    memcpy(&two[0], content(2 * k + 1, 5).data(), block_size);
+    memcpy(&two[block_size], content(2 * k + 2, 5).data(), block_size);
+    vector<size_t> before = writes();
+    REQUIRE(vssd->writeBlocks(2 * k + 1, 2, two.data()) == OK);
+    vector<size_t> after = writes();
+    for (size_t c = 0; c < k + m; ++c)
+      REQUIRE(after[c] - before[c] == (c == 1 || c == 2 || c >= k ? 1u : 0u));
+    for (size_t b = 2 * k; b < 3 * k; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, b == 2 * k + 1 || b == 2 * k + 2 ? 5 : 1));
+    }
+
+    // From the last block of one stripe to the first of the third: the
+    // middle stripe goes to every child, the edges to theirs only
+    vector<char> extent((k + 2) * block_size);
+    for (size_t i = 0; i < k + 2; ++i)
+      memcpy(&extent[i * block_size], content(3 * k - 1 + i, 5).data(), block_size);
+    before = writes();
+    REQUIRE(vssd->writeBlocks(3 * k - 1, k + 2, extent.data()) == OK);
+    after = writes();
+    for (size_t c = 0; c < k + m; ++c) {
+      size_t expected = c >= k ? 3 : (c == 0 || c == k - 1) ? 2 : 1;
+      REQUIRE(after[c] - before[c] == expected);
+    }
+    for (size_t i = 0; i < k + 2; ++i) {
+      REQUIRE(vssd->read(3 * k - 1 + i, read.data()) == OK);
+      REQUIRE(read == content(3 * k - 1 + i, 5));
+    }
+  }
+
+  SECTION("any m failed children are decoded around") {
+    for (size_t x = 0; x < k + m; ++x)
+      for (size_t y = x + 1; y < k + m; ++y) {
+        vssd = makeDisk(vector<bool>(k + m, true));
+        vector<char> all(block_count * block_size);
+        for (size_t b = 0; b < block_count; ++b)
+          memcpy(&all[b * block_size], content(b, 3).data(), block_size);
+        REQUIRE(vssd->writeBlocks(0, block_count, all.data()) == OK);
+
+        raw[x]->failing = true;
+        raw[y]->failing = true;
+        vector<char> back(block_count * block_size);
+        REQUIRE(vssd->readBlocks(0, block_count, back.data()) == OK);
+        REQUIRE(back == all);
+        for (size_t b = 0; b < block_count; ++b) {
+          REQUIRE(vssd->read(b, read.data()) == OK);
+          REQUIRE(read == content(b, 3));
+        }
+
+        // A degraded disk still takes writes, partial stripes included
+        REQUIRE(vssd->write(5, content(5, 4).data()) == OK);
+        REQUIRE(vssd->read(5, read.data()) == OK);
+        REQUIRE(read == content(5, 4));
+        REQUIRE(vssd->read(6, read.data()) == OK);
+        REQUIRE(read == content(6, 3));
+      }
+    REQUIRE(vssd->childFailed(k + m - 1));
+  }
+
+  SECTION("more than m failures lose the data") {
+    raw[0]->failing = true;
+    raw[1]->failing = true;
+    raw[k]->failing = true;
+    REQUIRE(vssd->read(0, read.data()) == ERROR);
+    REQUIRE(vssd->write(0, read.data()) == ERROR);
+  }
+
+  SECTION("a missing child is rebuilt on the fly") {
+    vector<bool> present(k + m, true);
+    present[1] = false;
+    present[k] = false;
+    vssd = makeDisk(present);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->childFailed(1));
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, content(b, 5).data()) == OK);
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, 5));
+    }
+
+    // One more gone is one too many to build the disk from
+    present[2] = false;
+    vssd = makeDisk(present);
+    REQUIRE(vssd->status() == ERROR);
+  }
+
+  SECTION("out of range extents and bad children are refused") {
+    REQUIRE(vssd->read(block_count, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->readBlocks(1, SIZE_MAX, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->sync() == OK);
+
+    vector<unique_ptr<VVSSD>> disks;
+    disks.push_back(make_unique<RAMVSSD>(block_size, stripes));
+    disks.push_back(make_unique<RAMVSSD>(2 * block_size, stripes));
+    ErasureVSSD mixed(move(disks), 1);
+    REQUIRE(mixed.status() == ERROR);
+    REQUIRE(mixed.blockCount() == 0);
+  }
+
+  SECTION("concurrent partial writes keep parity consistent") {
+    atomic<size_t> failures = 0;
+    vector<thread> threads;
+    // Writers share stripes but not blocks
+    for (size_t w = 0; w < 2; ++w)
+      threads.emplace_back([&, w] {
+        for (int version = 2; version < 6; ++version)
+          for (size_t b = w; b < block_count; b += 2)
+            if (vssd->write(b, content(b, version).data()) != OK) failures++;
+      });
+    threads.emplace_back([&] {
+      vector<char> mine(block_size);
+      for (size_t b = 0; b < block_count; ++b) {
+        if (vssd->read(b, mine.data()) != OK) failures++;
+        bool known = false;
+        for (int version = 1; version < 6; ++version)
+          known |= mine == content(b, version);
+        if (!known) failures++;
+      }
+    });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+
+    // Lose two data children: what decodes must be the last writes
+    raw[0]->failing = true;
+    raw[3]->failing = true;
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, 5));
+    }
+  }
+}
+
+#endif
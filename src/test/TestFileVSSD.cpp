@@ -1,7 +1,10 @@
 #include "catch_amalgamated.hpp"
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 #include "block_util.h"
 #include "VVSSD.h"
@@ -291,4 +294,122 @@ TEST_CASE("FileVSSD will not open broken files", "[vssd][filevssd]") {
   remove(fnameNoSignature);
   remove(fnameBadSize);
 }
+
+TEST_CASE("FileVSSD extents stay whole under concurrent access", "[vssd][filevssd][concurrent]") {
+  constexpr int block_size = 512;
+  constexpr int block_count = 64;
+  constexpr int extent_first = 8;
+  constexpr int extent_count = 16;
+  constexpr int rounds = 200;
+
+  const char * fname = "FileVSSD-temp-data-file-concurrent.dat";
+
+  unique_ptr<VVSSD> vssd = make_unique<FileVSSD>(block_size, block_count, fname);
+  REQUIRE(vssd->status() == OK);
+
+  // Writers fill the shared extent with their own byte value; readers must
+  // never see two values in one extent. Other threads work on disjoint
+  // extents at the same time.
+  atomic<int> torn = 0;
+  atomic<int> failed = 0;
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      vector<char> extent(extent_count * block_size);
+      for (int r = 0; r < rounds; ++r) {
+        if (t < 2) {
+          memset(extent.data(), 'a' + t, extent.size());
+          if (vssd->writeBlocks(extent_first, extent_count, extent.data()) != OK)
+            failed++;
+        } else {
+          if (vssd->readBlocks(extent_first, extent_count, extent.data()) != OK)
+            failed++;
+          for (char ch : extent)
+            if (ch != extent[0]) {
+              torn++;
+              break;
+            }
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    vector<char> other(4 * block_size, 'z');
+    for (int r = 0; r < rounds; ++r)
+      if (vssd->writeBlocks(block_count - 4, 4, other.data()) != OK) failed++;
+  });
+  for (auto & th : threads) th.join();
+
+  REQUIRE(failed == 0);
+  REQUIRE(torn == 0);
+
+  SECTION("extent range check works") {
+    vector<char> extent(2 * block_size);
+    REQUIRE(vssd->readBlocks(block_count - 1, 2, extent.data()) ==
+            DiskStatus::BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, extent.data()) ==
+            DiskStatus::BLOCK_OUT_OF_RANGE);
+  }
+
+  remove(fname);
+}
+
+TEST_CASE("FileVSSD clones are point-in-time copies", "[vssd][filevssd]") {
+  constexpr int block_size = 4096;
+  constexpr int block_count = 512;
+
+  const char * fname = "FileVSSD-temp-data-file-original.dat";
+  const char * cname = "FileVSSD-temp-data-file-clone.dat";
+
+  auto vssd = make_unique<FileVSSD>(block_size, block_count, fname);
+  REQUIRE(vssd->status() == OK);
+  // A few scattered blocks; the rest stay holes
+  auto content = [](int b, const string & who) {
+    vector<char> block(block_size);
+    block_util::fill_block(block.data(), block_size, who + " block " + to_string(b) + " ");
+    return block;
+  };
+  for (int b = 0; b < block_count; b += 37)
+    REQUIRE(vssd->write(b, content(b, "original").data()) == OK);
+
+  FileVSSD::CloneMethod method = FileVSSD::USER_COPY;
+  REQUIRE(vssd->clone(cname, &method) == OK);
+  INFO("clone method " << method);
+
+  // Later writes to either side stay on that side
+  REQUIRE(vssd->write(37, content(37, "later").data()) == OK);
+  {
+    FileVSSD copy(cname);
+    REQUIRE(copy.status() == OK);
+    REQUIRE(copy.blockSize() == block_size);
+    REQUIRE(copy.blockCount() == block_count);
+    vector<char> read(block_size);
+    for (int b = 0; b < block_count; ++b) {
+      REQUIRE(copy.read(b, read.data()) == OK);
+      REQUIRE(read == (b % 37 == 0 ? content(b, "original") : vector<char>(block_size, 0)));
+    }
+    REQUIRE(copy.write(0, content(0, "clone").data()) == OK);
+  }
+  vector<char> read(block_size);
+  REQUIRE(vssd->read(0, read.data()) == OK);
+  REQUIRE(read == content(0, "original"));
+
+  SECTION("an unwritable destination is refused") {
+    REQUIRE(vssd->clone("no-such-directory/clone.dat") == ERROR);
+  }
+
+  SECTION("the image is never cloned onto itself") {
+    REQUIRE(vssd->clone(fname) == ERROR);
+    // Nor onto another name for it
+    remove(cname);
+    REQUIRE(link(fname, cname) == 0);
+    REQUIRE(vssd->clone(cname) == ERROR);
+    REQUIRE(vssd->read(0, read.data()) == OK);
+    REQUIRE(read == content(0, "original"));
+  }
+
+  vssd.reset();
+  remove(fname);
+  remove(cname);
+}
 #endif
@@ -0,0 +1,249 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("MirroredVSSD.h")
+#include "MirroredVSSD.h"
+#include "RAMVSSD.h"
+
+/**
+ * A RAMVSSD that can be told to stall its reads or fail its reads and
+ * writes, standing in for a device that hiccups.
+ */
+class FlakyVSSD : public RAMVSSD {
+ public:
+  atomic<int> readDelayMs = 0;
+  atomic<bool> failReads = false;
+  atomic<bool> failWrites = false;
+  atomic<int> reading = 0;
+  atomic<int> mostReading = 0;
+
+  FlakyVSSD(size_t block_size, size_t block_count)
+      : RAMVSSD(block_size, block_count) {}
+
+  DiskStatus readBlocks(blocknumber_t block, size_t count, void * buffer) override {
+    int now = ++reading;
+    for (int most = mostReading; now > most && !mostReading.compare_exchange_weak(most, now);) {}
+    if (readDelayMs > 0) this_thread::sleep_for(chrono::milliseconds(readDelayMs));
+    reading--;
+    if (failReads) return ERROR;
+    return RAMVSSD::readBlocks(block, count, buffer);
+  }
+  DiskStatus writeBlocks(blocknumber_t block, size_t count, void * buffer) override {
+    if (failWrites) return ERROR;
+    return RAMVSSD::writeBlocks(block, count, buffer);
+  }
+};
+
+TEST_CASE("MirroredVSSD keeps every replica current", "[vssd][mirroredvssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t block_count = 64;
+
+  test_util::VersionedBlocks content(block_size);
+
+  // Keep plain pointers to the replicas to stall them and look inside
+  vector<FlakyVSSD*> raw;
+  auto makeDisk = [&](size_t replicas, bool hedging) {
+    // Each replica is a little longer than the last; the mirror is the shortest
+    return make_unique<MirroredVSSD>(
+        test_util::make_children(replicas, raw, [&](size_t r) {
+          return make_unique<FlakyVSSD>(block_size, block_count + r);
+        }),
+        hedging);
+  };
+
+  auto vssd = makeDisk(2, true);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->replicaCount() == 2);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+
+  vector<char> read(block_size);
+  for (size_t b = 0; b < block_count; ++b)
+    REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+
+  SECTION("writes reach every replica") {
+    vector<char> extent(5 * block_size);
+    for (size_t i = 0; i < 5; ++i)
+      memcpy(&extent[i * block_size], content(30 + i, 2).data(), block_size);
+    REQUIRE(vssd->writeBlocks(30, 5, extent.data()) == OK);
+    for (auto disk : raw) {
+      vector<char> back(5 * block_size);
+      REQUIRE(disk->RAMVSSD::readBlocks(30, 5, back.data()) == OK);
+      REQUIRE(back == extent);
+    }
+    vector<char> back(5 * block_size);
+    REQUIRE(vssd->readBlocks(30, 5, back.data()) == OK);
+    REQUIRE(back == extent);
+    REQUIRE(vssd->sync() == OK);
+  }
+
+  SECTION("reads follow the faster replica") {
+    raw[0]->readDelayMs = 2;
+    for (int pass = 0; pass < 4; ++pass)
+      for (size_t b = 0; b < block_count; ++b) {
+        REQUIRE(vssd->read(b, read.data()) == OK);
+        REQUIRE(read == content(b, 1));
+      }
+    auto slow = vssd->replicaStats(0);
+    auto fast = vssd->replicaStats(1);
+    REQUIRE(slow.ewma > fast.ewma);
+    REQUIRE(fast.reads > slow.reads);
+    REQUIRE(fast.p95 > MirroredVSSD::clock::duration(0));
+  }
+
+  SECTION("a stalled replica is hedged around") {
+    // Teach the mirror that replica 0 is the faster one
+    raw[1]->readDelayMs = 2;
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->read(b, read.data()) == OK);
+    REQUIRE(vssd->replicaStats(0).ewma < vssd->replicaStats(1).ewma);
+
+    // Then have it stall: the read goes there first but is answered by 1
+    raw[0]->readDelayMs = 300;
+    raw[1]->readDelayMs = 0;
+    auto start = chrono::steady_clock::now();
+    REQUIRE(vssd->read(7, read.data()) == OK);
+    auto took = chrono::steady_clock::now() - start;
+    REQUIRE(read == content(7, 1));
+    REQUIRE(took < chrono::milliseconds(300));
+    REQUIRE(vssd->replicaStats(1).hedges == 1);
+    raw[0]->readDelayMs = 0;
+  }
+
+  SECTION("a hung replica falls behind without answering") {
+    raw[1]->readDelayMs = 2;
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->read(b, read.data()) == OK);
+    REQUIRE(vssd->replicaStats(0).ewma < vssd->replicaStats(1).ewma);
+
+    // Replica 0 stops answering: each hedge charges it for the wait,
+    // until the mirror reads from replica 1 first
+    raw[0]->readDelayMs = 1000;
+    raw[1]->readDelayMs = 0;
+    size_t reads = 0;
+    while (vssd->replicaStats(0).ewma <= vssd->replicaStats(1).ewma && reads < 100) {
+      REQUIRE(vssd->read(reads % block_count, read.data()) == OK);
+      reads++;
+    }
+    REQUIRE(vssd->replicaStats(0).ewma > vssd->replicaStats(1).ewma);
+    REQUIRE(vssd->replicaStats(0).inFlight == reads);
+    REQUIRE(vssd->replicaStats(0).inFlight < MirroredVSSD::MaxInFlight);
+    raw[0]->readDelayMs = 0;
+  }
+
+  SECTION("concurrent reads of one replica do not queue") {
+    // Every first attempt goes to replica 0, more at once than a lane runs
+    constexpr int readers = 8;
+    raw[0]->readDelayMs = 50;
+    raw[1]->readDelayMs = 50;
+    vector<thread> threads;
+    atomic<int> failures = 0;
+    for (int r = 0; r < readers; ++r)
+      threads.emplace_back([&, r] {
+        vector<char> mine(block_size);
+        if (vssd->read(r, mine.data()) != OK || mine != content(r, 1)) failures++;
+      });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+    REQUIRE(raw[0]->mostReading > (int)LanePool::DefaultDepth);
+    raw[0]->readDelayMs = 0;
+    raw[1]->readDelayMs = 0;
+  }
+
+  SECTION("hedging off reads on the calling thread") {
+    vssd = makeDisk(3, false);
+    REQUIRE(vssd->replicaCount() == 3);
+    REQUIRE(vssd->write(3, content(3, 1).data()) == OK);
+    raw[0]->readDelayMs = 1;
+    for (int i = 0; i < 100; ++i) REQUIRE(vssd->read(3, read.data()) == OK);
+    REQUIRE(read == content(3, 1));
+    size_t hedges = 0;
+    for (size_t r = 0; r < 3; ++r) hedges += vssd->replicaStats(r).hedges;
+    REQUIRE(hedges == 0);
+  }
+
+  SECTION("failed reads fall back to another replica") {
+    raw[0]->failReads = true;
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, 1));
+    }
+    raw[1]->failReads = true;
+    REQUIRE(vssd->read(0, read.data()) == ERROR);
+    REQUIRE(vssd->replicaStats(0).errors > 0);
+    REQUIRE_FALSE(vssd->replicaStats(0).failed);
+  }
+
+  SECTION("a replica that fails a write is dropped") {
+    raw[1]->failWrites = true;
+    REQUIRE(vssd->write(4, content(4, 2).data()) == OK);
+    REQUIRE(vssd->replicaStats(1).failed);
+    REQUIRE_FALSE(vssd->replicaStats(0).failed);
+
+    // Reads never see the stale copy
+    raw[1]->failWrites = false;
+    for (int i = 0; i < 100; ++i) {
+      REQUIRE(vssd->read(4, read.data()) == OK);
+      REQUIRE(read == content(4, 2));
+    }
+
+    raw[0]->failWrites = true;
+    REQUIRE(vssd->write(4, content(4, 3).data()) == ERROR);
+    REQUIRE(vssd->read(4, read.data()) == ERROR);
+  }
+
+  SECTION("out of range extents and bad replicas are refused") {
+    REQUIRE(vssd->read(block_count, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->readBlocks(1, SIZE_MAX, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, read.data()) == BLOCK_OUT_OF_RANGE);
+
+    vector<unique_ptr<VVSSD>> disks;
+    disks.push_back(make_unique<RAMVSSD>(block_size, block_count));
+    disks.push_back(make_unique<RAMVSSD>(2 * block_size, block_count));
+    MirroredVSSD mixed(move(disks));
+    REQUIRE(mixed.status() == ERROR);
+    REQUIRE(mixed.blockCount() == 0);
+  }
+
+  SECTION("concurrent readers and writers see whole blocks") {
+    raw[0]->readDelayMs = 1;
+    atomic<size_t> failures = 0;
+    vector<thread> threads;
+    for (int w = 0; w < 2; ++w)
+      threads.emplace_back([&, w] {
+        for (int version = 2; version < 6; ++version)
+          for (size_t b = w; b < block_count; b += 2)
+            if (vssd->write(b, content(b, version).data()) != OK) failures++;
+      });
+    for (int r = 0; r < 2; ++r)
+      threads.emplace_back([&] {
+        vector<char> mine(block_size);
+        for (size_t b = 0; b < block_count; ++b) {
+          if (vssd->read(b, mine.data()) != OK) failures++;
+          bool known = false;
+          for (int version = 1; version < 6; ++version)
+            known |= mine == content(b, version);
+          if (!known) failures++;
+        }
+      });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(raw[0]->RAMVSSD::readBlocks(b, 1, read.data()) == OK);
+      REQUIRE(read == content(b, 5));
+      REQUIRE(raw[1]->RAMVSSD::readBlocks(b, 1, read.data()) == OK);
+      REQUIRE(read == content(b, 5));
+    }
+  }
+}
+
+#endif
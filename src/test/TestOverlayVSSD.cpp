@@ -0,0 +1,175 @@
+#include "catch_amalgamated.hpp"
+#include <sys/stat.h>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("OverlayVSSD.h")
+#include "FileVSSD.h"
+#include "OverlayVSSD.h"
+
+TEST_CASE("OverlayVSSD layers a delta over a base image", "[vssd][overlayvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 256;
+  const char * bname = "OverlayVSSD-temp-base-file.dat";
+  const char * dname = "OverlayVSSD-temp-delta-file.dat";
+  const char * d2name = "OverlayVSSD-temp-delta2-file.dat";
+
+  auto content = [](size_t b, const string & who) {
+    vector<char> block(block_size);
+    block_util::fill_block(block.data(), block_size, who + " block " + to_string(b) + " ");
+    return block;
+  };
+  auto fileBytes = [](const char * name) {
+    struct stat info;
+    stat(name, &info);
+    return (size_t)info.st_size;
+  };
+
+  // The golden image
+  {
+    FileVSSD base(block_size, block_count, bname);
+    REQUIRE(base.status() == OK);
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(base.write(b, content(b, "base").data()) == OK);
+  }
+  size_t baseBytes = fileBytes(bname);
+
+  vector<char> read(block_size);
+  auto vssd = make_unique<OverlayVSSD>(bname, dname);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+  REQUIRE(vssd->levelCount() == 2);
+  REQUIRE(vssd->deltaBlocks() == 0);
+
+  SECTION("absent blocks come from the base, written ones from the delta") {
+    REQUIRE(vssd->read(7, read.data()) == OK);
+    REQUIRE(read == content(7, "base"));
+
+    for (size_t b = 10; b < 20; ++b)
+      REQUIRE(vssd->write(b, content(b, "delta").data()) == OK);
+    REQUIRE(vssd->deltaBlocks() == 10);
+
+    // One extent across base, delta, base
+    vector<char> extent(30 * block_size);
+    REQUIRE(vssd->readBlocks(0, 30, extent.data()) == OK);
+    for (size_t b = 0; b < 30; ++b) {
+      string who = (b >= 10 && b < 20) ? "delta" : "base";
+      REQUIRE(memcmp(&extent[b * block_size], content(b, who).data(), block_size) == 0);
+    }
+
+    // The base is untouched, and the delta survives reopening
+    vssd.reset();
+    FileVSSD base(bname);
+    REQUIRE(base.read(15, read.data()) == OK);
+    REQUIRE(read == content(15, "base"));
+    REQUIRE(fileBytes(bname) == baseBytes);
+
+    vssd = make_unique<OverlayVSSD>(dname);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->deltaBlocks() == 10);
+    REQUIRE(vssd->read(15, read.data()) == OK);
+    REQUIRE(read == content(15, "delta"));
+    REQUIRE(vssd->read(25, read.data()) == OK);
+    REQUIRE(read == content(25, "base"));
+  }
+
+  SECTION("the delta only takes space for written blocks") {
+    REQUIRE(vssd->write(100, content(100, "delta").data()) == OK);
+    REQUIRE(vssd->sync() == OK);
+    struct stat info;
+    REQUIRE(stat(dname, &info) == 0);
+    REQUIRE((size_t)info.st_blocks * 512 < baseBytes / 8);
+  }
+
+  SECTION("deltas chain, the topmost level winning") {
+    REQUIRE(vssd->write(1, content(1, "middle").data()) == OK);
+    REQUIRE(vssd->write(2, content(2, "middle").data()) == OK);
+    vssd.reset();
+
+    auto top = make_unique<OverlayVSSD>(dname, d2name);
+    REQUIRE(top->status() == OK);
+    REQUIRE(top->levelCount() == 3);
+    REQUIRE(top->deltaBlocks() == 0);
+    REQUIRE(top->write(2, content(2, "top").data()) == OK);
+
+    vector<char> extent(4 * block_size);
+    REQUIRE(top->readBlocks(0, 4, extent.data()) == OK);
+    REQUIRE(memcmp(&extent[0 * block_size], content(0, "base").data(), block_size) == 0);
+    REQUIRE(memcmp(&extent[1 * block_size], content(1, "middle").data(), block_size) == 0);
+    REQUIRE(memcmp(&extent[2 * block_size], content(2, "top").data(), block_size) == 0);
+    REQUIRE(memcmp(&extent[3 * block_size], content(3, "base").data(), block_size) == 0);
+
+    // Reopened from the top, the chain is followed through the headers
+    top.reset();
+    top = make_unique<OverlayVSSD>(d2name);
+    REQUIRE(top->status() == OK);
+    REQUIRE(top->levelCount() == 3);
+    REQUIRE(top->read(1, read.data()) == OK);
+    REQUIRE(read == content(1, "middle"));
+
+    // The middle delta was opened read-only under the top one
+    vssd = make_unique<OverlayVSSD>(dname);
+    REQUIRE(vssd->read(2, read.data()) == OK);
+    REQUIRE(read == content(2, "middle"));
+  }
+
+  SECTION("bases are found from the delta's directory") {
+    vssd.reset();
+    filesystem::create_directory("OverlayVSSD-temp-dir");
+    string inner = "OverlayVSSD-temp-dir/delta.dat";
+    {
+      OverlayVSSD nested(bname, inner);
+      REQUIRE(nested.status() == OK);
+      REQUIRE(nested.write(3, content(3, "nested").data()) == OK);
+    }
+    // The header says ../ of the delta, which is still right from here
+    OverlayVSSD reopened(inner);
+    REQUIRE(reopened.status() == OK);
+    REQUIRE(reopened.read(4, read.data()) == OK);
+    REQUIRE(read == content(4, "base"));
+
+    // A base beside its delta moves with it
+    filesystem::copy_file(bname, "OverlayVSSD-temp-dir/base.dat");
+    {
+      OverlayVSSD beside("OverlayVSSD-temp-dir/base.dat", inner);
+      REQUIRE(beside.write(3, content(3, "beside").data()) == OK);
+    }
+    filesystem::rename("OverlayVSSD-temp-dir", "OverlayVSSD-temp-moved");
+    OverlayVSSD moved("OverlayVSSD-temp-moved/delta.dat");
+    REQUIRE(moved.status() == OK);
+    REQUIRE(moved.read(3, read.data()) == OK);
+    REQUIRE(read == content(3, "beside"));
+    REQUIRE(moved.read(4, read.data()) == OK);
+    REQUIRE(read == content(4, "base"));
+    filesystem::remove_all("OverlayVSSD-temp-moved");
+  }
+
+  SECTION("bad chains are refused") {
+    vssd.reset();
+    {
+      FileVSSD other(512, block_count, d2name);
+      REQUIRE(other.status() == OK);
+    }
+    // An image is not a delta, and geometries must match
+    REQUIRE(OverlayVSSD(bname).status() == ERROR);
+    OverlayVSSD mismatched(d2name, "OverlayVSSD-temp-delta3-file.dat");
+    REQUIRE(mismatched.status() == OK);
+    REQUIRE(mismatched.blockSize() == 512);
+    REQUIRE(OverlayVSSD("OverlayVSSD-no-such-file.dat", dname).status() == ERROR);
+    remove("OverlayVSSD-temp-delta3-file.dat");
+  }
+
+  vssd.reset();
+  remove(bname);
+  remove(dname);
+  remove(d2name);
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "catch_amalgamated.hpp"
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("QoSVSSD.h")
+#include "QoSVSSD.h"
+#include "RAMVSSD.h"
+
+/**
+ * RAM disk that records the order blocks are read in and can hold its
+ * first read until released, so requests pile up in the QoS queue.
+ */
+class OrderedRAMVSSD : public RAMVSSD {
+ public:
+  OrderedRAMVSSD(size_t block_size, size_t block_count, shared_future<void> gate)
+      : RAMVSSD(block_size, block_count), gate(gate) {}
+
+  virtual DiskStatus readBlocks(blocknumber_t block, size_t count, void* buffer) {
+    gate.wait();
+    {
+      lock_guard<mutex> hold(mtx);
+      order.push_back(block);
+    }
+    return RAMVSSD::readBlocks(block, count, buffer);
+  }
+
+  mutex mtx;
+  vector<blocknumber_t> order;
+
+ private:
+  shared_future<void> gate;
+};
+
+TEST_CASE("QoSVSSD dispatches higher classes first", "[vssd][qosvssd]") {
+  constexpr int block_size = 512;
+  constexpr int block_count = 64;
+
+  promise<void> open;
+  auto disk = make_unique<OrderedRAMVSSD>(block_size, block_count, open.get_future().share());
+  OrderedRAMVSSD & recorder = *disk;
+
+  chrono::milliseconds agingStep = GENERATE(chrono::milliseconds(1), chrono::hours(1));
+  // depth 1: one request at a time, so the order is the scheduler's
+  auto qos = make_unique<QoSVSSD>(move(disk), chrono::seconds(1), 1, agingStep);
+
+  vector<char> buffer(block_count * block_size);
+  vector<future<DiskStatus>> pending;
+  auto submit = [&](VVSSD::blocknumber_t block, unsigned int tenant, unsigned int priority) {
+    AsyncVSSD::Request request;
+    request.block = block;
+    request.buffer = buffer.data() + block * block_size;
+    request.tenant = tenant;
+    request.priority = priority;
+    pending.push_back(qos->submit(request));
+  };
+
+  // block 0 occupies the disk while the rest queue up
+  submit(0, 0, 0);
+  this_thread::sleep_for(chrono::milliseconds(5));
+  for (int b = 10; b < 20; ++b) submit(b, 1, 0);
+  this_thread::sleep_for(chrono::milliseconds(20));
+  for (int b = 20; b < 30; ++b) submit(b, 2, QoSVSSD::PriorityClasses - 1);
+  open.set_value();
+  for (auto & done : pending) REQUIRE(done.get() == OK);
+
+  REQUIRE(recorder.order.size() == 21);
+  if (agingStep == chrono::hours(1)) {
+    INFO("without aging the high class overtakes the queued low class");
+    REQUIRE(recorder.order[1] == 20);
+    REQUIRE(recorder.order[11] == 10);
+  } else {
+    INFO("with aging the long-waiting low class goes first");
+    REQUIRE(recorder.order[1] == 10);
+  }
+}
+
+TEST_CASE("QoSVSSD token buckets throttle only their tenant", "[vssd][qosvssd]") {
+  constexpr int block_size = 512;
+  constexpr int block_count = 64;
+  constexpr int requests = 40;
+
+  auto qos = make_unique<QoSVSSD>(make_unique<RAMVSSD>(block_size, block_count),
+                                  chrono::seconds(1), 4);
+
+  QoSVSSD::Limits slow;
+  slow.iops = 200;
+  slow.burst = chrono::milliseconds(10);
+  qos->setLimits(1, slow);
+
+  vector<char> buffer(block_size);
+  vector<future<DiskStatus>> limited;
+  vector<future<DiskStatus>> unlimited;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < requests; ++i) {
+    AsyncVSSD::Request request;
+    request.block = i;
+    request.buffer = buffer.data();
+    request.tenant = 1;
+    limited.push_back(qos->submit(request));
+    request.tenant = 2;
+    unlimited.push_back(qos->submit(request));
+  }
+
+  for (auto & done : unlimited) REQUIRE(done.get() == OK);
+  auto unlimitedTime = chrono::steady_clock::now() - start;
+  for (auto & done : limited) REQUIRE(done.get() == OK);
+  auto limitedTime = chrono::steady_clock::now() - start;
+
+  // 40 requests at 200/s with 2 in the bucket take at least ~190ms
+  REQUIRE(limitedTime >= chrono::milliseconds(150));
+  REQUIRE(unlimitedTime < limitedTime);
+
+  SECTION("held-back requests past their deadline are dropped") {
+    auto hold = chrono::steady_clock::now();
+    AsyncVSSD::Request request;
+    request.buffer = buffer.data();
+    request.tenant = 3;
+    QoSVSSD::Limits trickle;
+    trickle.iops = 1;
+    qos->setLimits(3, trickle);
+    future<DiskStatus> goes = qos->submit(request);
+    request.deadline = hold + chrono::milliseconds(20);
+    future<DiskStatus> expires = qos->submit(request);
+    REQUIRE(goes.get() == OK);
+    REQUIRE(expires.get() == CANCELLED);
+    // dropped at its deadline, not a second later when a token came
+    REQUIRE(chrono::steady_clock::now() - hold < chrono::milliseconds(500));
+    REQUIRE(qos->stats(3).requests == 1);
+  }
+
+  QoSVSSD::TenantStats one = qos->stats(1);
+  QoSVSSD::TenantStats two = qos->stats(2);
+  REQUIRE(one.requests == requests);
+  REQUIRE(one.bytes == requests * block_size);
+  REQUIRE(one.throttled >= chrono::milliseconds(100));
+  REQUIRE(two.requests == requests);
+  REQUIRE(two.throttled == chrono::steady_clock::duration::zero());
+}
+#endif
@@ -1,12 +1,21 @@
 #include "catch_amalgamated.hpp"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <fstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include "block_util.h"
 #include "VVSSD.h"
 
 using namespace std;
 
 #if (defined __has_include) && __has_include("RAMVSSD.h")
+#include "FileVSSD.h"
 #include "RAMVSSD.h"
 using block_util::BlockPtr;
 
@@ -130,4 +139,361 @@ TEST_CASE("VSSD persistence w/o reopen (cannot reopen)", "[vssd][ramvssd]") {
     REQUIRE((memcmp(written, read, block_size) == 0));
   }
 }
+
+TEST_CASE("RAMVSSD extents stay whole under concurrent access", "[vssd][ramvssd][concurrent]") {
+  constexpr int block_size = 512;
+  constexpr int block_count = 64;
+  constexpr int extent_first = 8;
+  constexpr int extent_count = 16;
+  constexpr int rounds = 200;
+
+  unique_ptr<VVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count);
+  REQUIRE(vssd->status() == OK);
+
+  // Writers fill the shared extent with their own byte value; readers must
+  // never see two values in one extent. Other threads work on disjoint
+  // extents at the same time.
+  atomic<int> torn = 0;
+  atomic<int> failed = 0;
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      vector<char> extent(extent_count * block_size);
+      for (int r = 0; r < rounds; ++r) {
+        if (t < 2) {
+          memset(extent.data(), 'a' + t, extent.size());
+          if (vssd->writeBlocks(extent_first, extent_count, extent.data()) != OK)
+            failed++;
+        } else {
+          if (vssd->readBlocks(extent_first, extent_count, extent.data()) != OK)
+            failed++;
+          for (char ch : extent)
+            if (ch != extent[0]) {
+              torn++;
+              break;
+            }
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    vector<char> other(4 * block_size, 'z');
+    for (int r = 0; r < rounds; ++r)
+      if (vssd->writeBlocks(block_count - 4, 4, other.data()) != OK) failed++;
+  });
+  for (auto & th : threads) th.join();
+
+  REQUIRE(failed == 0);
+  REQUIRE(torn == 0);
+
+  SECTION("extent range check works") {
+    vector<char> extent(2 * block_size);
+    REQUIRE(vssd->readBlocks(block_count - 1, 2, extent.data()) ==
+            DiskStatus::BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, extent.data()) ==
+            DiskStatus::BLOCK_OUT_OF_RANGE);
+  }
+}
+
+TEST_CASE("RAMVSSD optimistic reads are never torn", "[vssd][ramvssd][concurrent]") {
+  constexpr int block_size = 4096;
+  constexpr int block_count = 64;
+  constexpr int hot_blocks = 4;
+  constexpr int thread_count = 8;
+  constexpr int operations = 4000;
+
+  unique_ptr<VVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count);
+  REQUIRE(vssd->status() == OK);
+
+  // 95/5 read/write mix on a handful of hot blocks. Every write fills a
+  // block with one byte value, so any read holding two different byte
+  // values saw a write half done. The blocks after the hot blocks are
+  // only ever read and written as one extent, so the same holds there.
+  atomic<int> torn = 0;
+  atomic<int> failed = 0;
+  vector<thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      vector<char> buffer(hot_blocks * block_size);
+      unsigned int seed = t + 1;
+      for (int op = 0; op < operations; ++op) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int roll = (seed >> 16) % 100;
+        size_t hot = (seed >> 8) % hot_blocks;
+        bool extent = (roll % 2) == 0;
+        size_t first = extent ? hot_blocks : hot;
+        size_t count = extent ? hot_blocks : 1;
+        size_t length = count * block_size;
+
+        if (roll < 5) {
+          memset(buffer.data(), 'A' + (seed % 26), length);
+          if (vssd->writeBlocks(first, count, buffer.data()) != OK) failed++;
+        } else {
+          if (vssd->readBlocks(first, count, buffer.data()) != OK) failed++;
+          for (size_t i = 1; i < length; ++i)
+            if (buffer[i] != buffer[0]) {
+              torn++;
+              break;
+            }
+        }
+      }
+    });
+  }
+  for (auto & th : threads) th.join();
+
+  REQUIRE(failed == 0);
+  REQUIRE(torn == 0);
+}
+
+TEST_CASE("RAMVSSD provisioning modes", "[vssd][ramvssd]") {
+  constexpr int block_size = 4096;
+
+  BlockPtr zero = new char[block_size];
+  memset(zero, 0, block_size);
+  BlockPtr written = new char[block_size];
+  BlockPtr read = new char[block_size];
+  block_util::fill_block(written, block_size, "one fish, two fish, red fish, blue fish");
+
+  SECTION("lazy construction does not touch the memory") {
+    // 1 GiB of blocks, of which only the two touched below get committed
+    constexpr size_t block_count = size_t(256) * 1024;
+    RAMVSSD::Options options;
+    options.provisioning = RAMVSSD::LAZY;
+    unique_ptr<VVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count, options);
+    // A tight address space limit (ulimit -v) can refuse the mapping
+    if (vssd->status() != OK) {
+      WARN("could not map a 1 GiB disk; skipped");
+    } else {
+      REQUIRE(vssd->blockCount() == block_count);
+
+      REQUIRE(vssd->read(block_count - 1, read) == OK);
+      REQUIRE((memcmp(zero, read, block_size) == 0));
+      REQUIRE(vssd->write(block_count / 2, written) == OK);
+      REQUIRE(vssd->read(block_count / 2, read) == OK);
+      REQUIRE((memcmp(written, read, block_size) == 0));
+    }
+  }
+
+  SECTION("populated and locked disks work like any other") {
+    constexpr size_t block_count = 16;
+    RAMVSSD::Provisioning provisioning = GENERATE(RAMVSSD::POPULATE, RAMVSSD::LOCKED);
+    RAMVSSD::Options options;
+    options.provisioning = provisioning;
+    unique_ptr<VVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count, options);
+    INFO("provisioning = " << provisioning);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->read(block_count - 1, read) == OK);
+    REQUIRE((memcmp(zero, read, block_size) == 0));
+    REQUIRE(vssd->write(3, written) == OK);
+    REQUIRE(vssd->read(3, read) == OK);
+    REQUIRE((memcmp(written, read, block_size) == 0));
+  }
+
+  SECTION("a disk that could not be locked stays unusable") {
+    // Without CAP_IPC_LOCK a zero limit makes mlock fail
+    rlimit saved;
+    REQUIRE(getrlimit(RLIMIT_MEMLOCK, &saved) == 0);
+    rlimit none = saved;
+    none.rlim_cur = 0;
+    setrlimit(RLIMIT_MEMLOCK, &none);
+    RAMVSSD::Options options;
+    options.provisioning = RAMVSSD::LOCKED;
+    RAMVSSD vssd(block_size, 256, options);
+    setrlimit(RLIMIT_MEMLOCK, &saved);
+
+    if (vssd.status() != OK) {
+      REQUIRE(vssd.write(3, written) == ERROR);
+      REQUIRE(vssd.read(3, read) == ERROR);
+      REQUIRE(vssd.status() == ERROR);
+    }
+  }
+
+  SECTION("huge pages are reported and work like any other") {
+    constexpr size_t block_count = 1024;
+    RAMVSSD::Options options;
+    options.provisioning = GENERATE(RAMVSSD::LAZY, RAMVSSD::POPULATE);
+    options.hugePages = true;
+    unique_ptr<RAMVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count, options);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->read(block_count - 1, read) == OK);
+    REQUIRE((memcmp(zero, read, block_size) == 0));
+    REQUIRE(vssd->write(block_count - 1, written) == OK);
+    REQUIRE(vssd->read(block_count - 1, read) == OK);
+    REQUIRE((memcmp(written, read, block_size) == 0));
+
+    // Once written, some of the disk is in huge pages if THP is on
+    INFO("page backing = " << vssd->pageBacking());
+    ifstream setting("/sys/kernel/mm/transparent_hugepage/enabled");
+    string thp;
+    getline(setting, thp);
+    if (setting && thp.find("[never]") == string::npos)
+      REQUIRE(vssd->pageBacking() != RAMVSSD::SMALL_PAGES);
+
+    RAMVSSD small(block_size, block_count);
+    REQUIRE(small.pageBacking() == RAMVSSD::SMALL_PAGES);
+  }
+
+  delete[] zero;
+  delete[] written;
+  delete[] read;
+}
+
+TEST_CASE("RAMVSSD stores same-filled blocks as descriptors", "[vssd][ramvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 16 * 1024;
+
+  RAMVSSD::Options options;
+  options.sameFill = true;
+  unique_ptr<RAMVSSD> vssd = make_unique<RAMVSSD>(block_size, block_count, options);
+  REQUIRE(vssd->status() == OK);
+
+  vector<char> written(block_size);
+  vector<char> read(block_size);
+
+  SECTION("repeated words of every width round-trip") {
+    string pattern = GENERATE(string(1, '\0'), string("Z"), string("ab"),
+                              string("wxyz"), string("01234567"));
+    INFO("pattern = " << pattern);
+    block_util::fill_block(written.data(), block_size, pattern);
+    REQUIRE(vssd->write(5, written.data()) == OK);
+    REQUIRE(vssd->sameFilledBlocks() == 1);
+    REQUIRE(vssd->read(5, read.data()) == OK);
+    REQUIRE((memcmp(written.data(), read.data(), block_size) == 0));
+    REQUIRE(vssd->read(4, read.data()) == OK);
+    REQUIRE(all_of(read.begin(), read.end(), [](char ch) { return ch == 0; }));
+  }
+
+  SECTION("other blocks are stored in full, and replace descriptors") {
+    block_util::fill_block(written.data(), block_size, "ab");
+    REQUIRE(vssd->write(7, written.data()) == OK);
+    REQUIRE(vssd->sameFilledBlocks() == 1);
+    // A 3-byte pattern does not repeat every 8 bytes
+    block_util::fill_block(written.data(), block_size, "abc");
+    REQUIRE(vssd->write(7, written.data()) == OK);
+    REQUIRE(vssd->sameFilledBlocks() == 0);
+    REQUIRE(vssd->read(7, read.data()) == OK);
+    REQUIRE((memcmp(written.data(), read.data(), block_size) == 0));
+  }
+
+  SECTION("extents mix both kinds") {
+    vector<char> extent(4 * block_size, 'q');
+    extent[2 * block_size + 100] = 'r';
+    REQUIRE(vssd->writeBlocks(10, 4, extent.data()) == OK);
+    REQUIRE(vssd->sameFilledBlocks() == 3);
+    vector<char> back(extent.size());
+    REQUIRE(vssd->readBlocks(10, 4, back.data()) == OK);
+    REQUIRE(back == extent);
+  }
+
+  SECTION("same-filled blocks give their memory back") {
+    // Resident pages of this process, in pages (second field of statm)
+    auto resident = [] {
+      ifstream statm("/proc/self/statm");
+      size_t size, pages;
+      statm >> size >> pages;
+      return pages;
+    };
+    vector<char> extent(block_count * block_size);
+    block_util::fill_block(extent.data(), extent.size(), "not a repeated word");
+    REQUIRE(vssd->writeBlocks(0, block_count, extent.data()) == OK);
+    size_t full = resident();
+    memset(extent.data(), 0, extent.size());
+    REQUIRE(vssd->writeBlocks(0, block_count, extent.data()) == OK);
+    REQUIRE(vssd->sameFilledBlocks() == block_count);
+    // 64 MiB of blocks went back; allow for noise
+    size_t page = sysconf(_SC_PAGESIZE);
+    REQUIRE(full - resident() > block_count * block_size / page / 2);
+    REQUIRE(vssd->read(block_count - 1, read.data()) == OK);
+    REQUIRE(all_of(read.begin(), read.end(), [](char ch) { return ch == 0; }));
+  }
+
+  SECTION("blocks smaller than a page are refused") {
+    // Such blocks share their pages, so there would be nothing to give back
+    RAMVSSD small(512, block_count, options);
+    REQUIRE(small.status() == ERROR);
+    REQUIRE(small.write(3, written.data()) == ERROR);
+    REQUIRE(small.read(3, read.data()) == ERROR);
+  }
+}
+
+TEST_CASE("RAMVSSD checkpoints to and restores from an image", "[vssd][ramvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 4096;
+  const char * fname = "RAMVSSD-temp-image-file.dat";
+
+  // Every 16th block holds data; the rest stay zero
+  vector<char> expected(block_count * block_size, 0);
+  for (size_t b = 0; b < block_count; b += 16)
+    block_util::fill_block(expected.data() + b * block_size, block_size,
+                           "block " + to_string(b) + " ");
+
+  RAMVSSD original(block_size, block_count);
+  REQUIRE(original.writeBlocks(0, block_count, expected.data()) == OK);
+  REQUIRE(original.checkpoint(fname) == OK);
+
+  SECTION("the image is sparse and FileVSSD reads it") {
+    struct stat info;
+    REQUIRE(stat(fname, &info) == 0);
+    REQUIRE((size_t)info.st_size == (block_count + 1) * block_size);
+    // A sixteenth of the blocks (plus the header) take space on disk,
+    // where the file system can leave holes at all
+    INFO("allocated = " << info.st_blocks * 512);
+    CHECK((size_t)info.st_blocks * 512 < block_count * block_size / 4);
+
+    FileVSSD file(fname);
+    REQUIRE(file.status() == OK);
+    REQUIRE(file.blockSize() == block_size);
+    REQUIRE(file.blockCount() == block_count);
+    vector<char> back(expected.size());
+    REQUIRE(file.readBlocks(0, block_count, back.data()) == OK);
+    REQUIRE(back == expected);
+  }
+
+  SECTION("a restored disk holds the same blocks") {
+    RAMVSSD::Restore restore = GENERATE(RAMVSSD::COPY, RAMVSSD::ADOPT);
+    INFO("restore = " << restore);
+    RAMVSSD restored(fname, restore);
+    REQUIRE(restored.status() == OK);
+    REQUIRE(restored.blockSize() == block_size);
+    REQUIRE(restored.blockCount() == block_count);
+    vector<char> back(expected.size());
+    REQUIRE(restored.readBlocks(0, block_count, back.data()) == OK);
+    REQUIRE(back == expected);
+
+    // Writes stay in memory, even for an adopted image
+    vector<char> block(block_size, 'w');
+    REQUIRE(restored.write(1, block.data()) == OK);
+    FileVSSD file(fname);
+    REQUIRE(file.read(1, block.data()) == OK);
+    REQUIRE(all_of(block.begin(), block.end(), [](char ch) { return ch == 0; }));
+  }
+
+  SECTION("an adopted image can be checkpointed over") {
+    RAMVSSD adopted(fname, RAMVSSD::ADOPT);
+    REQUIRE(adopted.status() == OK);
+    vector<char> block(block_size, 'w');
+    REQUIRE(adopted.write(1, block.data()) == OK);
+    memcpy(expected.data() + block_size, block.data(), block_size);
+    REQUIRE(adopted.checkpoint(fname) == OK);
+
+    // The blocks never written still come from the replaced file
+    vector<char> back(expected.size());
+    REQUIRE(adopted.readBlocks(0, block_count, back.data()) == OK);
+    REQUIRE(back == expected);
+    RAMVSSD restored(fname, RAMVSSD::COPY);
+    REQUIRE(restored.status() == OK);
+    REQUIRE(restored.readBlocks(0, block_count, back.data()) == OK);
+    REQUIRE(back == expected);
+    struct stat info;
+    REQUIRE(stat((string(fname) + ".tmp").c_str(), &info) != 0);
+  }
+
+  SECTION("restoring something that is not an image fails") {
+    RAMVSSD missing("RAMVSSD-no-such-image.dat");
+    REQUIRE(missing.status() == DiskStatus::ERROR);
+  }
+
+  unlink(fname);
+}
+
 #endif
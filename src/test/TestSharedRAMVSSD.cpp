@@ -0,0 +1,119 @@
+#include "catch_amalgamated.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("SharedRAMVSSD.h")
+#include "SharedRAMVSSD.h"
+
+// Run body in a child process; return its exit status (0 for success)
+template <typename Body>
+static int in_child(Body body) {
+  pid_t pid = fork();
+  if (pid == 0) _exit(body() ? 0 : 1);
+  int status = -1;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+TEST_CASE("SharedRAMVSSD named disks are shared by name", "[vssd][sharedramvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 256;
+  const string name = "/SharedRAMVSSD-temp-" + to_string(getpid());
+
+  SharedRAMVSSD creator(block_size, block_count, name);
+  REQUIRE(creator.status() == OK);
+  REQUIRE(creator.blockSize() == block_size);
+  REQUIRE(creator.blockCount() == block_count);
+
+  vector<char> written(block_size);
+  vector<char> read(block_size);
+  block_util::fill_block(written.data(), block_size, "one fish, two fish, red fish, blue fish");
+
+  SECTION("another process attaches and sees writes both ways") {
+    REQUIRE(creator.write(7, written.data()) == OK);
+    int child = in_child([&] {
+      SharedRAMVSSD attached(name);
+      vector<char> seen(block_size);
+      vector<char> reply(block_size, 'c');
+      return attached.status() == OK && attached.blockCount() == block_count &&
+             attached.read(7, seen.data()) == OK && seen == written &&
+             attached.write(8, reply.data()) == OK;
+    });
+    REQUIRE(child == 0);
+    REQUIRE(creator.read(8, read.data()) == OK);
+    REQUIRE(read == vector<char>(block_size, 'c'));
+    REQUIRE(creator.generation() == 2);
+  }
+
+  SECTION("attaching to a removed name fails") {
+    REQUIRE(SharedRAMVSSD::unlink(name));
+    SharedRAMVSSD gone(name);
+    REQUIRE(gone.status() == DiskStatus::ERROR);
+    // The creator's mapping outlives the name
+    REQUIRE(creator.write(0, written.data()) == OK);
+  }
+
+  SECTION("range check works") {
+    REQUIRE(creator.read(block_count, read.data()) == DiskStatus::BLOCK_OUT_OF_RANGE);
+    REQUIRE(creator.write(block_count, written.data()) == DiskStatus::BLOCK_OUT_OF_RANGE);
+  }
+
+  SharedRAMVSSD::unlink(name);
+}
+
+TEST_CASE("SharedRAMVSSD memfd disks serialize writers across processes", "[vssd][sharedramvssd][concurrent]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t block_count = 64;
+  constexpr int children = 4;
+  constexpr int rounds = 500;
+
+  SharedRAMVSSD disk(block_size, block_count);
+  REQUIRE(disk.status() == OK);
+  SharedRAMVSSD view(disk.descriptor());
+  REQUIRE(view.status() == OK);
+  REQUIRE(view.blockCount() == block_count);
+
+  // Children each fill the same extent with their own byte value while
+  // this process reads it; no read may mix two values
+  vector<pid_t> pids;
+  for (int c = 0; c < children; ++c) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      vector<char> extent(8 * block_size, 'a' + c);
+      bool ok = true;
+      for (int r = 0; r < rounds; ++r)
+        ok = disk.writeBlocks(4, 8, extent.data()) == OK && ok;
+      _exit(ok ? 0 : 1);
+    }
+    pids.push_back(pid);
+  }
+
+  int torn = 0;
+  vector<char> extent(8 * block_size);
+  for (int r = 0; r < rounds; ++r) {
+    REQUIRE(view.readBlocks(4, 8, extent.data()) == OK);
+    for (char ch : extent)
+      if (ch != extent[0]) {
+        torn++;
+        break;
+      }
+  }
+  for (pid_t pid : pids) {
+    int status = -1;
+    waitpid(pid, &status, 0);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+
+  REQUIRE(torn == 0);
+  REQUIRE(view.generation() == (uint64_t)children * rounds);
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("SnapshotVSSD.h")
+#include "FileVSSD.h"
+#include "RAMVSSD.h"
+#include "SnapshotVSSD.h"
+
+TEST_CASE("SnapshotVSSD keeps point-in-time views", "[vssd][snapshotvssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 64;
+  constexpr size_t store_count = 32;
+  const char * fname = "SnapshotVSSD-temp-data-file.dat";
+
+  // The same behaviour over a RAM disk and a file
+  bool onFile = GENERATE(false, true);
+  unique_ptr<VVSSD> live;
+  if (onFile)
+    live = make_unique<FileVSSD>(block_size, block_count, fname);
+  else
+    live = make_unique<RAMVSSD>(block_size, block_count);
+  auto vssd = make_unique<SnapshotVSSD>(move(live), make_unique<RAMVSSD>(block_size, store_count));
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+
+  test_util::VersionedBlocks content(block_size);
+  vector<char> read(block_size);
+  for (size_t b = 0; b < block_count; ++b)
+    REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+
+  SECTION("a snapshot copies nothing until a block is overwritten") {
+    auto snap = vssd->snapshot();
+    REQUIRE(snap->status() == OK);
+    REQUIRE(snap->blockCount() == block_count);
+    REQUIRE(vssd->savedBlocks() == 0);
+
+    REQUIRE(vssd->write(3, content(3, 2).data()) == OK);
+    REQUIRE(vssd->write(3, content(3, 3).data()) == OK);  // same epoch: no copy
+    REQUIRE(vssd->savedBlocks() == 1);
+
+    REQUIRE(snap->read(3, read.data()) == OK);
+    REQUIRE(read == content(3, 1));
+    REQUIRE(vssd->read(3, read.data()) == OK);
+    REQUIRE(read == content(3, 3));
+
+    // Extents mix saved and shared blocks
+    vector<char> extent(4 * block_size);
+    REQUIRE(snap->readBlocks(2, 4, extent.data()) == OK);
+    for (size_t i = 0; i < 4; ++i)
+      REQUIRE(memcmp(&extent[i * block_size], content(2 + i, 1).data(), block_size) == 0);
+  }
+
+  SECTION("snapshots share saved copies and deleting them reclaims blocks") {
+    auto first = vssd->snapshot();
+    REQUIRE(vssd->write(0, content(0, 2).data()) == OK);
+    auto second = vssd->snapshot();
+    auto third = vssd->snapshot();
+    REQUIRE(vssd->snapshotCount() == 3);
+    // Block 1 is shared by all three: one copy serves them
+    REQUIRE(vssd->write(1, content(1, 2).data()) == OK);
+    REQUIRE(vssd->write(0, content(0, 3).data()) == OK);
+    REQUIRE(vssd->savedBlocks() == 3);
+
+    REQUIRE(first->read(0, read.data()) == OK);
+    REQUIRE(read == content(0, 1));
+    REQUIRE(second->read(0, read.data()) == OK);
+    REQUIRE(read == content(0, 2));
+    REQUIRE(third->read(1, read.data()) == OK);
+    REQUIRE(read == content(1, 1));
+
+    first.reset();  // its own copy of block 0 goes
+    REQUIRE(vssd->savedBlocks() == 2);
+    second.reset();
+    REQUIRE(vssd->savedBlocks() == 2);  // third still holds both
+    third.reset();
+    REQUIRE(vssd->savedBlocks() == 0);
+    REQUIRE(vssd->snapshotCount() == 0);
+
+    // With nobody sharing the live blocks, writes copy nothing
+    REQUIRE(vssd->write(2, content(2, 2).data()) == OK);
+    REQUIRE(vssd->savedBlocks() == 0);
+  }
+
+  SECTION("snapshots are read-only") {
+    auto snap = vssd->snapshot();
+    REQUIRE(snap->write(0, read.data()) == READ_ONLY);
+    REQUIRE(snap->status() == READ_ONLY);
+    REQUIRE(toString(READ_ONLY) == "READ_ONLY");
+    REQUIRE(fromString("READ_ONLY") == READ_ONLY);
+  }
+
+  SECTION("a full store refuses the write and keeps the snapshot intact") {
+    auto snap = vssd->snapshot();
+    vector<char> all(block_count * block_size);
+    REQUIRE(vssd->writeBlocks(0, block_count, all.data()) == ERROR);
+    REQUIRE(vssd->savedBlocks() == 0);
+    REQUIRE(snap->read(block_count - 1, read.data()) == OK);
+    REQUIRE(read == content(block_count - 1, 1));
+  }
+
+  SECTION("snapshot readers see a stable image while writers run") {
+    auto snap = vssd->snapshot();
+    atomic<size_t> failures = 0;
+    thread writer([&] {
+      for (int version = 2; version < 6; ++version)
+        for (size_t b = 0; b < block_count / 4; ++b)
+          if (vssd->write(b, content(b, version).data()) != OK) failures++;
+    });
+    thread reader([&] {
+      vector<char> mine(block_size);
+      for (int pass = 0; pass < 20; ++pass)
+        for (size_t b = 0; b < block_count / 4; ++b)
+          if (snap->read(b, mine.data()) != OK || mine != content(b, 1)) failures++;
+    });
+    writer.join();
+    reader.join();
+    REQUIRE(failures == 0);
+    REQUIRE(vssd->savedBlocks() == block_count / 4);
+  }
+
+  vssd.reset();
+  remove(fname);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include "catch_amalgamated.hpp"
+#include <sys/stat.h>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("SparseFileVSSD.h")
+#include "SparseFileVSSD.h"
+
+TEST_CASE("SparseFileVSSD allocates blocks on demand", "[vssd][sparsefilevssd]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t block_count = 4 * SparseFileVSSD::TableEntries;
+  const char * fname = "SparseFileVSSD-temp-data-file.dat";
+
+  test_util::VersionedBlocks content(block_size);
+  auto fileBytes = [&] {
+    struct stat info;
+    stat(fname, &info);
+    return (size_t)info.st_size;
+  };
+
+  auto vssd = make_unique<SparseFileVSSD>(block_size, block_count, fname);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+  REQUIRE(vssd->allocatedBlocks() == 0);
+  size_t emptyBytes = fileBytes();
+  REQUIRE(emptyBytes < 4 * block_size);
+
+  vector<char> read(block_size);
+
+  SECTION("unwritten blocks read as zeros and take no space") {
+    vector<char> zeros(block_size, 0);
+    read.assign(block_size, 'x');
+    REQUIRE(vssd->read(block_count - 1, read.data()) == OK);
+    REQUIRE(read == zeros);
+    REQUIRE(vssd->write(5, zeros.data()) == OK);
+    REQUIRE(vssd->allocatedBlocks() == 0);
+    REQUIRE(fileBytes() == emptyBytes);
+  }
+
+  SECTION("the file holds only what was written, and survives reopening") {
+    // A scattered write in each quarter: four tables, four blocks
+    for (size_t t = 0; t < 4; ++t) {
+      size_t b = t * SparseFileVSSD::TableEntries + 7;
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+    }
+    REQUIRE(vssd->allocatedBlocks() == 4);
+    REQUIRE(fileBytes() == emptyBytes + 4 * block_size + 4 * 4096);
+
+    // Overwrites stay in place
+    REQUIRE(vssd->write(7, content(7, 2).data()) == OK);
+    REQUIRE(vssd->allocatedBlocks() == 4);
+
+    vssd = make_unique<SparseFileVSSD>(fname);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->blockCount() == block_count);
+    REQUIRE(vssd->allocatedBlocks() == 4);
+    REQUIRE(vssd->read(7, read.data()) == OK);
+    REQUIRE(read == content(7, 2));
+    size_t b = 3 * SparseFileVSSD::TableEntries + 7;
+    REQUIRE(vssd->read(b, read.data()) == OK);
+    REQUIRE(read == content(b, 1));
+  }
+
+  SECTION("extents across tables mix written and unwritten blocks") {
+    size_t first = SparseFileVSSD::TableEntries - 10;
+    size_t count = 20;
+    vector<char> extent(count * block_size);
+    for (size_t i = 0; i < count; i += 2)
+      memcpy(&extent[i * block_size], content(first + i, 1).data(), block_size);
+    REQUIRE(vssd->writeBlocks(first, count, extent.data()) == OK);
+    REQUIRE(vssd->allocatedBlocks() == count / 2);
+
+    vector<char> back(count * block_size, 'x');
+    REQUIRE(vssd->readBlocks(first, count, back.data()) == OK);
+    REQUIRE(back == extent);
+  }
+
+  SECTION("out of range extents are refused") {
+    REQUIRE(vssd->read(block_count, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->readBlocks(block_count - 1, 2, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(1, SIZE_MAX, read.data()) == BLOCK_OUT_OF_RANGE);
+  }
+
+  SECTION("a small table cache reads tables back in as needed") {
+    for (size_t t = 0; t < 4; ++t) {
+      size_t b = t * SparseFileVSSD::TableEntries;
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+    }
+    vssd = make_unique<SparseFileVSSD>(fname, 2);
+    REQUIRE(vssd->tableMisses() == 0);
+    for (int pass = 0; pass < 2; ++pass)
+      for (size_t t = 0; t < 4; ++t) {
+        size_t b = t * SparseFileVSSD::TableEntries;
+        REQUIRE(vssd->read(b, read.data()) == OK);
+        REQUIRE(read == content(b, 1));
+      }
+    REQUIRE(vssd->tableMisses() == 8);
+    // The two most recent stay cached
+    REQUIRE(vssd->read(3 * SparseFileVSSD::TableEntries, read.data()) == OK);
+    REQUIRE(vssd->tableMisses() == 8);
+  }
+
+  SECTION("other files are refused") {
+    vssd.reset();
+    {
+      FILE * junk = fopen(fname, "w");
+      fputs("not an image", junk);
+      fclose(junk);
+    }
+    vssd = make_unique<SparseFileVSSD>(fname);
+    REQUIRE(vssd->status() == ERROR);
+    REQUIRE(vssd->blockCount() == 0);
+  }
+
+  SECTION("concurrent writers allocate disjoint blocks") {
+    constexpr size_t writers = 4;
+    atomic<size_t> failures = 0;
+    vector<thread> threads;
+    for (size_t w = 0; w < writers; ++w)
+      threads.emplace_back([&, w] {
+        for (size_t b = w; b < block_count; b += writers)
+          if (vssd->write(b, content(b, 1).data()) != OK) failures++;
+      });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+    REQUIRE(vssd->allocatedBlocks() == block_count);
+
+    vssd = make_unique<SparseFileVSSD>(fname);
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, 1));
+    }
+  }
+
+  vssd.reset();
+  remove(fname);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("SparseRAMVSSD.h")
+#include "SparseRAMVSSD.h"
+using block_util::BlockPtr;
+
+TEST_CASE("SparseRAMVSSD allocates only what is written", "[vssd][sparseramvssd]") {
+  constexpr size_t block_size = 4096;
+  // 16 TiB of blocks; a flat disk this size could not even be mapped here
+  constexpr size_t block_count = size_t(4) * 1024 * 1024 * 1024;
+
+  BlockPtr zero = new char[block_size];
+  memset(zero, 0, block_size);
+  BlockPtr written = new char[block_size];
+  BlockPtr read = new char[block_size];
+  block_util::fill_block(written, block_size, "one fish, two fish, red fish, blue fish");
+
+  unique_ptr<SparseRAMVSSD> vssd = make_unique<SparseRAMVSSD>(block_size, block_count);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == block_count);
+  size_t empty = vssd->allocatedBytes();
+  REQUIRE(empty < 16 * 1024 * 1024);
+
+  SECTION("unwritten blocks read as zeros without allocating") {
+    for (size_t q = 0; q < block_count; q += block_count / 64) {
+      REQUIRE(vssd->read(q, read) == OK);
+      REQUIRE((memcmp(zero, read, block_size) == 0));
+    }
+    REQUIRE(vssd->read(block_count - 1, read) == OK);
+    REQUIRE(vssd->allocatedBytes() == empty);
+  }
+
+  SECTION("read what was written, neighbours stay zero") {
+    vector<size_t> blocks = {0, 17, block_count / 3, block_count - 1};
+    for (size_t q : blocks) REQUIRE(vssd->write(q, written) == OK);
+    for (size_t q : blocks) {
+      REQUIRE(vssd->read(q, read) == OK);
+      REQUIRE((memcmp(written, read, block_size) == 0));
+      if (q > 0) {
+        REQUIRE(vssd->read(q - 1, read) == OK);
+        REQUIRE((memcmp(zero, read, block_size) == 0));
+      }
+    }
+    // One chunk (and at most one leaf) per distinct written block here
+    REQUIRE(vssd->allocatedBytes() - empty <=
+            blocks.size() * (SparseRAMVSSD::ChunkBytes +
+                             SparseRAMVSSD::LeafEntries * sizeof(void*)));
+  }
+
+  SECTION("extents span chunks and unwritten gaps") {
+    constexpr size_t count = 3 * SparseRAMVSSD::ChunkBytes / block_size;
+    size_t first = block_count / 2 - count / 2;
+    vector<char> extent(count * block_size, 'x');
+    REQUIRE(vssd->writeBlocks(first + 1, count - 2, extent.data()) == OK);
+    REQUIRE(vssd->readBlocks(first, count, extent.data()) == OK);
+    REQUIRE((memcmp(zero, extent.data(), block_size) == 0));
+    REQUIRE((memcmp(zero, extent.data() + (count - 1) * block_size, block_size) == 0));
+    for (size_t i = block_size; i < (count - 1) * block_size; ++i)
+      if (extent[i] != 'x') FAIL("byte " << i << " of the extent was not written");
+  }
+
+  SECTION("range check works") {
+    REQUIRE(vssd->read(block_count, read) == DiskStatus::BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->write(block_count, written) == DiskStatus::BLOCK_OUT_OF_RANGE);
+    vector<char> extent(2 * block_size);
+    REQUIRE(vssd->readBlocks(block_count - 1, 2, extent.data()) ==
+            DiskStatus::BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->allocatedBytes() == empty);
+  }
+
+  delete[] zero;
+  delete[] written;
+  delete[] read;
+}
+
+TEST_CASE("SparseRAMVSSD reads are never torn while chunks appear", "[vssd][sparseramvssd][concurrent]") {
+  constexpr size_t block_size = 4096;
+  constexpr size_t blocks_per_chunk = SparseRAMVSSD::ChunkBytes / block_size;
+  constexpr size_t block_count = 64 * blocks_per_chunk;
+  constexpr int thread_count = 8;
+  constexpr int operations = 2000;
+
+  unique_ptr<VVSSD> vssd = make_unique<SparseRAMVSSD>(block_size, block_count);
+  REQUIRE(vssd->status() == OK);
+
+  // Writers race to allocate the same chunks while readers read extents
+  // that straddle them. Every write fills its extent with one byte
+  // value, and extents are always the same two-block pairs, so a read
+  // holding two values (zeros included) saw a write half done.
+  atomic<int> torn = 0;
+  atomic<int> failed = 0;
+  vector<thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      vector<char> buffer(2 * block_size);
+      unsigned int seed = t + 1;
+      for (int op = 0; op < operations; ++op) {
+        seed = seed * 1103515245 + 12345;
+        // pairs straddle a chunk boundary: last block of one, first of next
+        size_t chunk = 1 + (seed >> 8) % (block_count / blocks_per_chunk - 1);
+        size_t first = chunk * blocks_per_chunk - 1;
+        if ((seed >> 16) % 4 == 0) {
+          memset(buffer.data(), 'A' + (seed % 26), buffer.size());
+          if (vssd->writeBlocks(first, 2, buffer.data()) != OK) failed++;
+        } else {
+          if (vssd->readBlocks(first, 2, buffer.data()) != OK) failed++;
+          for (size_t i = 1; i < buffer.size(); ++i)
+            if (buffer[i] != buffer[0]) {
+              torn++;
+              break;
+            }
+        }
+      }
+    });
+  }
+  for (auto & th : threads) th.join();
+
+  REQUIRE(failed == 0);
+  REQUIRE(torn == 0);
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include "catch_amalgamated.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+#include "block_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("SpillRAMVSSD.h")
+#include "SpillRAMVSSD.h"
+
+TEST_CASE("SpillRAMVSSD stays within its budget", "[vssd][spillramvssd]") {
+  constexpr size_t block_size = 1024;
+  constexpr size_t block_count = 1024;
+  constexpr size_t budget = 128 * block_size;
+  const char * fname = "SpillRAMVSSD-temp-spill-file.dat";
+
+  SpillRAMVSSD vssd(block_size, block_count, budget, fname);
+  REQUIRE(vssd.status() == OK);
+  REQUIRE(vssd.blockSize() == block_size);
+  REQUIRE(vssd.blockCount() == block_count);
+
+  // Block b holds its own number, so a block read from the wrong place shows
+  auto pattern = [](size_t b, int round) {
+    vector<char> block(block_size);
+    block_util::fill_block(block.data(), block_size,
+                           "block " + to_string(b) + " round " + to_string(round) + " ");
+    return block;
+  };
+  vector<char> read(block_size);
+
+  SECTION("unwritten blocks read as zeros without using memory") {
+    for (size_t b = 0; b < block_count; b += 17) {
+      REQUIRE(vssd.read(b, read.data()) == OK);
+      REQUIRE(read == vector<char>(block_size, 0));
+    }
+    REQUIRE(vssd.residentBytes() == 0);
+  }
+
+  SECTION("every block survives eviction, twice over") {
+    for (int round = 0; round < 2; ++round) {
+      for (size_t b = 0; b < block_count; ++b)
+        REQUIRE(vssd.write(b, pattern(b, round).data()) == OK);
+      REQUIRE(vssd.residentBytes() <= budget);
+      for (size_t b = 0; b < block_count; ++b) {
+        REQUIRE(vssd.read(b, read.data()) == OK);
+        INFO("block " << b);
+        REQUIRE(read == pattern(b, round));
+      }
+      REQUIRE(vssd.residentBytes() <= budget);
+    }
+    REQUIRE(vssd.evictions() > 0);
+    REQUIRE(vssd.faults() > 0);
+  }
+
+  SECTION("extents larger than the budget round-trip") {
+    vector<char> extent(block_count * block_size);
+    for (size_t b = 0; b < block_count; ++b)
+      memcpy(extent.data() + b * block_size, pattern(b, 0).data(), block_size);
+    REQUIRE(vssd.writeBlocks(0, block_count, extent.data()) == OK);
+    vector<char> back(extent.size());
+    REQUIRE(vssd.readBlocks(0, block_count, back.data()) == OK);
+    REQUIRE(back == extent);
+    REQUIRE(vssd.residentBytes() <= budget);
+  }
+
+  SECTION("CLOCK keeps a hot block in memory") {
+    constexpr size_t hot = 3;
+    REQUIRE(vssd.write(hot, pattern(hot, 0).data()) == OK);
+    for (size_t b = 0; b < block_count; ++b) {
+      if (b != hot) REQUIRE(vssd.write(b, pattern(b, 0).data()) == OK);
+      REQUIRE(vssd.read(hot, read.data()) == OK);
+    }
+    // The hot block was used between every sweep, so it never went out
+    REQUIRE(vssd.faults() == 0);
+    REQUIRE(read == pattern(hot, 0));
+  }
+
+  SECTION("range check works") {
+    REQUIRE(vssd.read(block_count, read.data()) == DiskStatus::BLOCK_OUT_OF_RANGE);
+    vector<char> extent(2 * block_size);
+    REQUIRE(vssd.writeBlocks(block_count - 1, 2, extent.data()) == DiskStatus::BLOCK_OUT_OF_RANGE);
+  }
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("StripedVSSD.h")
+#include "RAMVSSD.h"
+#include "StripedVSSD.h"
+
+namespace {
+
+/**
+ * A RAMVSSD with a slow read that remembers the most reads it ever had
+ * in flight at once.
+ */
+class DepthVSSD : public RAMVSSD {
+ public:
+  atomic<size_t> inFlight = 0;
+  atomic<size_t> deepest = 0;
+
+  DepthVSSD(size_t block_size, size_t block_count)
+      : RAMVSSD(block_size, block_count) {}
+
+  DiskStatus readBlocks(blocknumber_t block, size_t count, void * buffer) override {
+    size_t now = ++inFlight;
+    size_t seen = deepest;
+    while (now > seen && !deepest.compare_exchange_weak(seen, now)) {}
+    this_thread::sleep_for(chrono::milliseconds(2));
+    DiskStatus ds = RAMVSSD::readBlocks(block, count, buffer);
+    inFlight--;
+    return ds;
+  }
+};
+
+}
+
+TEST_CASE("StripedVSSD deals stripe units over its children", "[vssd][stripedvssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t children = 3;
+  constexpr size_t unit = 4;
+
+  test_util::VersionedBlocks content(block_size);
+
+  // Keep plain pointers to the children to check where blocks landed
+  vector<RAMVSSD*> raw;
+  auto makeDisk = [&](vector<size_t> counts, size_t stripe) {
+    return make_unique<StripedVSSD>(
+        test_util::make_children(counts.size(), raw, [&](size_t c) {
+          return make_unique<RAMVSSD>(block_size, counts[c]);
+        }),
+        stripe);
+  };
+
+  // The smallest child (41 blocks) holds 10 whole units
+  auto vssd = makeDisk({41, 64, 50}, unit);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->childCount() == children);
+  REQUIRE(vssd->stripeBlocks() == unit);
+  REQUIRE(vssd->blockSize() == block_size);
+  REQUIRE(vssd->blockCount() == children * 10 * unit);
+  size_t block_count = vssd->blockCount();
+
+  vector<char> read(block_size);
+
+  SECTION("blocks land on the child and place the layout says") {
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+    for (size_t b = 0; b < block_count; ++b) {
+      size_t u = b / unit;
+      REQUIRE(raw[u % children]->read((u / children) * unit + b % unit, read.data()) == OK);
+      REQUIRE(read == content(b, 1));
+      REQUIRE(vssd->read(b, read.data()) == OK);
+      REQUIRE(read == content(b, 1));
+    }
+  }
+
+  SECTION("extents of every alignment and length round trip") {
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+
+    for (size_t first : {0, 1, 3, 4, 7, 13}) {
+      for (size_t count : {1, 2, 5, 12, 13, 27}) {
+        vector<char> extent(count * block_size);
+        for (size_t i = 0; i < count; ++i)
+          memcpy(&extent[i * block_size], content(first + i, 2).data(), block_size);
+        REQUIRE(vssd->writeBlocks(first, count, extent.data()) == OK);
+
+        vector<char> back(count * block_size);
+        REQUIRE(vssd->readBlocks(first, count, back.data()) == OK);
+        REQUIRE(back == extent);
+        for (size_t i = 0; i < count; ++i) {
+          REQUIRE(vssd->read(first + i, read.data()) == OK);
+          REQUIRE(read == content(first + i, 2));
+        }
+      }
+    }
+
+    // The whole disk at once
+    vector<char> all(block_count * block_size);
+    REQUIRE(vssd->readBlocks(0, block_count, all.data()) == OK);
+    REQUIRE(memcmp(&all[(block_count - 1) * block_size],
+                   content(block_count - 1, 1).data(), block_size) == 0);
+  }
+
+  SECTION("out of range extents are refused") {
+    REQUIRE(vssd->read(block_count, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->readBlocks(1, SIZE_MAX, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->sync() == OK);
+  }
+
+  SECTION("a single child is a plain pass-through") {
+    vssd = makeDisk({37}, unit);
+    REQUIRE(vssd->blockCount() == 36);
+    vector<char> extent(36 * block_size);
+    for (size_t b = 0; b < 36; ++b)
+      memcpy(&extent[b * block_size], content(b, 1).data(), block_size);
+    REQUIRE(vssd->writeBlocks(0, 36, extent.data()) == OK);
+    REQUIRE(raw[0]->read(35, read.data()) == OK);
+    REQUIRE(read == content(35, 1));
+  }
+
+  SECTION("children must agree on the block size") {
+    vector<unique_ptr<VVSSD>> disks;
+    disks.push_back(make_unique<RAMVSSD>(block_size, 64));
+    disks.push_back(make_unique<RAMVSSD>(2 * block_size, 64));
+    StripedVSSD mixed(move(disks), unit);
+    REQUIRE(mixed.status() == ERROR);
+    REQUIRE(mixed.blockCount() == 0);
+
+    StripedVSSD empty({}, unit);
+    REQUIRE(empty.status() == ERROR);
+    REQUIRE(empty.blockCount() == 0);
+  }
+
+  SECTION("concurrent writers of overlapping extents leave whole extents") {
+    atomic<size_t> failures = 0;
+    vector<thread> threads;
+    for (int w = 0; w < 4; ++w)
+      threads.emplace_back([&, w] {
+        vector<char> extent(10 * block_size);
+        vector<char> back(10 * block_size);
+        for (int pass = 0; pass < 50; ++pass) {
+          size_t first = (pass * 7 + w * 3) % (block_count - 10);
+          for (size_t i = 0; i < 10; ++i)
+            memcpy(&extent[i * block_size], content(first + i, w).data(), block_size);
+          if (vssd->writeBlocks(first, 10, extent.data()) != OK) failures++;
+          if (vssd->readBlocks(first, 10, back.data()) != OK) failures++;
+          // Each block read was written by someone, whole
+          for (size_t i = 0; i < 10; ++i) {
+            bool known = false;
+            for (int v = 0; v < 4; ++v)
+              known |= memcmp(&back[i * block_size], content(first + i, v).data(),
+                              block_size) == 0;
+            vector<char> zeros(block_size, 0);
+            known |= memcmp(&back[i * block_size], zeros.data(), block_size) == 0;
+            if (!known) failures++;
+          }
+        }
+      });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+  }
+}
+
+TEST_CASE("StripedVSSD keeps several requests in flight per child", "[vssd][stripedvssd]") {
+  constexpr size_t block_size = 512;
+  vector<DepthVSSD*> raw;
+  StripedVSSD vssd(test_util::make_children(3, raw, [&](size_t) {
+                     return make_unique<DepthVSSD>(block_size, 64);
+                   }),
+                   4);
+  REQUIRE(vssd.status() == OK);
+
+  // Every read spans all three children; all but the first child's part
+  // go through the lanes
+  atomic<size_t> failures = 0;
+  vector<thread> threads;
+  for (int r = 0; r < 8; ++r)
+    threads.emplace_back([&] {
+      vector<char> extent(12 * block_size);
+      for (int pass = 0; pass < 20; ++pass)
+        if (vssd.readBlocks(0, 12, extent.data()) != OK) failures++;
+    });
+  for (auto & t : threads) t.join();
+  REQUIRE(failures == 0);
+  for (int c : {1, 2}) {
+    INFO("child " << c);
+    REQUIRE(raw[c]->deepest > 1);
+    REQUIRE(raw[c]->deepest <= LanePool::DefaultDepth);
+  }
+}
+
+#endif
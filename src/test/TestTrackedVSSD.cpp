@@ -0,0 +1,199 @@
+#include "catch_amalgamated.hpp"
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("TrackedVSSD.h")
+#include "FileVSSD.h"
+#include "RAMVSSD.h"
+#include "TrackedVSSD.h"
+
+TEST_CASE("TrackedVSSD records blocks changed since a checkpoint", "[vssd][trackedvssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t block_count = 1000;
+  const char * fname = "TrackedVSSD-temp-cbt-file.cbt";
+  const char * copyname = "TrackedVSSD-temp-copy-file.cbt";
+
+  test_util::VersionedBlocks content(block_size);
+
+  remove(fname);
+  auto vssd = make_unique<TrackedVSSD>(make_unique<RAMVSSD>(block_size, block_count), fname);
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockCount() == block_count);
+
+  // A new tracker has no checkpoint: everything counts as changed
+  REQUIRE(vssd->checkpointName() == "");
+  REQUIRE(vssd->generation() == 1);
+  REQUIRE(vssd->changedBlocks() == block_count);
+
+  for (size_t b = 0; b < block_count; ++b)
+    REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+  REQUIRE(vssd->checkpoint("monday") == OK);
+  REQUIRE(vssd->checkpointName() == "monday");
+  REQUIRE(vssd->generation() == 2);
+  REQUIRE(vssd->changedBlocks() == 0);
+
+  vector<char> read(block_size);
+
+  SECTION("writes are tracked and survive a clean close") {
+    REQUIRE(vssd->write(3, content(3, 2).data()) == OK);
+    vector<char> extent(5 * block_size);
+    REQUIRE(vssd->writeBlocks(500, 5, extent.data()) == OK);
+    REQUIRE(vssd->changedBlocks() == 6);
+    REQUIRE(vssd->changed(3));
+    REQUIRE_FALSE(vssd->changed(4));
+    REQUIRE(vssd->changed(504));
+
+    vssd.reset();
+    vssd = make_unique<TrackedVSSD>(make_unique<RAMVSSD>(block_size, block_count), fname);
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->checkpointName() == "monday");
+    REQUIRE(vssd->generation() == 2);
+    REQUIRE(vssd->changedBlocks() == 6);
+    REQUIRE(vssd->changed(502));
+  }
+
+  SECTION("a sidecar not closed cleanly starts over") {
+    REQUIRE(vssd->write(3, content(3, 2).data()) == OK);
+    REQUIRE(vssd->sync() == OK);
+    // A copy taken while the tracker runs looks like a crash
+    filesystem::copy_file(fname, copyname, filesystem::copy_options::overwrite_existing);
+    auto crashed = make_unique<TrackedVSSD>(make_unique<RAMVSSD>(block_size, block_count), copyname);
+    REQUIRE(crashed->status() == OK);
+    REQUIRE(crashed->checkpointName() == "");
+    REQUIRE(crashed->generation() == 3);
+    REQUIRE(crashed->changedBlocks() == block_count);
+    crashed.reset();
+    remove(copyname);
+  }
+
+  SECTION("a sidecar for another geometry is refused") {
+    vssd.reset();
+    vssd = make_unique<TrackedVSSD>(make_unique<RAMVSSD>(block_size, block_count / 2), fname);
+    REQUIRE(vssd->status() == ERROR);
+  }
+
+  SECTION("an incremental export carries just the changes") {
+    // The backup is a full copy taken at the checkpoint
+    RAMVSSD backup(block_size, block_count);
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(backup.write(b, content(b, 1).data()) == OK);
+
+    for (size_t b = 100; b < 110; ++b)
+      REQUIRE(vssd->write(b, content(b, 2).data()) == OK);
+    REQUIRE(vssd->write(999, content(999, 2).data()) == OK);
+
+    stringstream stream;
+    size_t exported = 0;
+    REQUIRE(vssd->exportChanges("sunday", stream, &exported) == ERROR);
+    REQUIRE(vssd->exportChanges("monday", stream, &exported) == OK);
+    REQUIRE(exported == 11);
+    REQUIRE(stream.str().size() < 12 * block_size + 200);
+    REQUIRE(vssd->checkpoint("tuesday") == OK);
+
+    size_t imported = 0;
+    REQUIRE(TrackedVSSD::importChanges(stream, backup, &imported) == OK);
+    REQUIRE(imported == 11);
+    vector<char> live(block_size);
+    for (size_t b = 0; b < block_count; ++b) {
+      REQUIRE(backup.read(b, read.data()) == OK);
+      REQUIRE(vssd->read(b, live.data()) == OK);
+      REQUIRE(read == live);
+    }
+  }
+
+  SECTION("an export can start the next checkpoint with it") {
+    REQUIRE(vssd->write(3, content(3, 2).data()) == OK);
+    stringstream stream;
+    size_t exported = 0;
+    REQUIRE(vssd->exportAndCheckpoint("sunday", stream, "tuesday") == ERROR);
+    REQUIRE(vssd->checkpointName() == "monday");
+    REQUIRE(vssd->changedBlocks() == 1);
+
+    REQUIRE(vssd->exportAndCheckpoint("monday", stream, "tuesday", &exported) == OK);
+    REQUIRE(exported == 1);
+    REQUIRE(vssd->checkpointName() == "tuesday");
+    REQUIRE(vssd->generation() == 3);
+    REQUIRE(vssd->changedBlocks() == 0);
+  }
+
+  SECTION("damaged streams are refused") {
+    REQUIRE(vssd->write(7, content(7, 2).data()) == OK);
+    stringstream stream;
+    REQUIRE(vssd->exportChanges("monday", stream) == OK);
+    string bytes = stream.str();
+    RAMVSSD backup(block_size, block_count);
+
+    // Truncated
+    stringstream shortStream(bytes.substr(0, bytes.size() - 100));
+    REQUIRE(TrackedVSSD::importChanges(shortStream, backup) == ERROR);
+
+    // One byte of data flipped
+    bytes[bytes.size() - 100] ^= 1;
+    stringstream flipped(bytes);
+    REQUIRE(TrackedVSSD::importChanges(flipped, backup) == ERROR);
+    REQUIRE(backup.read(7, read.data()) == OK);
+    REQUIRE(read == vector<char>(block_size, 0));
+
+    // Another geometry
+    stream.seekg(0);
+    RAMVSSD other(block_size, block_count + 1);
+    REQUIRE(TrackedVSSD::importChanges(stream, other) == ERROR);
+  }
+
+  vssd.reset();
+  remove(fname);
+}
+
+TEST_CASE("TrackedVSSD notices writes made without it", "[vssd][trackedvssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t block_count = 64;
+  const char * iname = "TrackedVSSD-temp-image-file.dat";
+  const string cname = string(iname) + ".cbt";
+
+  remove(cname.c_str());
+  {
+    FileVSSD image(block_size, block_count, iname);
+    REQUIRE(image.status() == OK);
+  }
+  auto track = [&] {
+    return make_unique<TrackedVSSD>(make_unique<FileVSSD>(iname), cname, iname);
+  };
+  vector<char> block(block_size, 'x');
+  {
+    auto vssd = track();
+    REQUIRE(vssd->status() == OK);
+    REQUIRE(vssd->write(1, block.data()) == OK);
+    REQUIRE(vssd->checkpoint("monday") == OK);
+    REQUIRE(vssd->write(2, block.data()) == OK);
+  }
+
+  // Left alone, the image keeps its checkpoint
+  auto vssd = track();
+  REQUIRE(vssd->checkpointName() == "monday");
+  REQUIRE(vssd->changedBlocks() == 1);
+  vssd.reset();
+
+  // Written behind the tracker's back, it has to start over
+  {
+    FileVSSD image(iname);
+    REQUIRE(image.write(5, block.data()) == OK);
+  }
+  vssd = track();
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->checkpointName() == "");
+  REQUIRE(vssd->changedBlocks() == block_count);
+  REQUIRE(vssd->changed(5));
+
+  vssd.reset();
+  remove(iname);
+  remove(cname.c_str());
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include "catch_amalgamated.hpp"
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.h"
+#include "VVSSD.h"
+
+using namespace std;
+
+#if (defined __has_include) && __has_include("VersionedVSSD.h")
+#include "RAMVSSD.h"
+#include "VersionedVSSD.h"
+
+TEST_CASE("VersionedVSSD reads blocks as they were", "[vssd][versionedvssd]") {
+  constexpr size_t block_size = 512;
+  constexpr size_t block_count = 64;
+  constexpr size_t log_count = 32;
+
+  test_util::VersionedBlocks content(block_size);
+
+  auto vssd = make_unique<VersionedVSSD>(make_unique<RAMVSSD>(block_size, block_count),
+                                         make_unique<RAMVSSD>(block_size, log_count));
+  REQUIRE(vssd->status() == OK);
+  REQUIRE(vssd->blockCount() == block_count);
+  REQUIRE(vssd->now() == 0);
+
+  vector<char> read(block_size);
+  vector<char> zeros(block_size, 0);
+
+  SECTION("each version is there at the sequence after its write") {
+    vector<VersionedVSSD::sequence_t> at;
+    for (int version = 1; version <= 4; ++version) {
+      REQUIRE(vssd->write(5, content(5, version).data()) == OK);
+      at.push_back(vssd->now());
+    }
+    REQUIRE(at.back() == 4);
+    REQUIRE(vssd->retainedVersions() == 4);
+
+    REQUIRE(vssd->readAt(5, 0, read.data()) == OK);
+    REQUIRE(read == zeros);
+    for (int version = 1; version <= 4; ++version) {
+      REQUIRE(vssd->readAt(5, at[version - 1], read.data()) == OK);
+      REQUIRE(read == content(5, version));
+    }
+    REQUIRE(vssd->read(5, read.data()) == OK);
+    REQUIRE(read == content(5, 4));
+
+    // Blocks never written are the same at every point
+    REQUIRE(vssd->readAt(6, 2, read.data()) == OK);
+    REQUIRE(read == zeros);
+  }
+
+  SECTION("extents mix current and old versions") {
+    vector<char> extent(4 * block_size);
+    for (size_t i = 0; i < 4; ++i)
+      memcpy(&extent[i * block_size], content(10 + i, 1).data(), block_size);
+    REQUIRE(vssd->writeBlocks(10, 4, extent.data()) == OK);
+    auto before = vssd->now();
+    REQUIRE(vssd->write(11, content(11, 2).data()) == OK);
+    REQUIRE(vssd->write(13, content(13, 2).data()) == OK);
+
+    vector<char> back(4 * block_size);
+    REQUIRE(vssd->readBlocksAt(10, 4, before, back.data()) == OK);
+    REQUIRE(back == extent);
+    REQUIRE(vssd->readBlocksAt(10, 4, vssd->now(), back.data()) == OK);
+    REQUIRE(memcmp(&back[3 * block_size], content(13, 2).data(), block_size) == 0);
+  }
+
+  SECTION("versions older than the log holds are unavailable") {
+    REQUIRE(vssd->write(1, content(1, 1).data()) == OK);
+    auto early = vssd->now();
+    REQUIRE(vssd->write(1, content(1, 2).data()) == OK);
+    REQUIRE(vssd->readAt(1, early, read.data()) == OK);
+
+    for (size_t b = 20; b < 20 + log_count; ++b)
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+    REQUIRE(vssd->retainedVersions() == log_count);
+    REQUIRE(vssd->readAt(1, early, read.data()) == VERSION_UNAVAILABLE);
+    REQUIRE(vssd->status() == VERSION_UNAVAILABLE);
+    REQUIRE(toString(VERSION_UNAVAILABLE) == "VERSION_UNAVAILABLE");
+    REQUIRE(fromString("VERSION_UNAVAILABLE") == VERSION_UNAVAILABLE);
+
+    // The current version is always there
+    REQUIRE(vssd->readAt(1, vssd->now(), read.data()) == OK);
+    REQUIRE(read == content(1, 2));
+
+    // An extent longer than the log keeps only what fits
+    vector<char> big(block_count * block_size);
+    REQUIRE(vssd->writeBlocks(0, block_count, big.data()) == OK);
+    REQUIRE(vssd->readAt(block_count - 1, 0, read.data()) == OK);
+    REQUIRE(vssd->readAt(1, 0, read.data()) == VERSION_UNAVAILABLE);
+  }
+
+  SECTION("out of range extents are refused") {
+    REQUIRE(vssd->readAt(block_count, 0, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->readBlocksAt(1, SIZE_MAX, 0, read.data()) == BLOCK_OUT_OF_RANGE);
+    REQUIRE(vssd->writeBlocks(block_count - 1, 2, read.data()) == BLOCK_OUT_OF_RANGE);
+  }
+
+  SECTION("a point-in-time reader sees one image while writers run") {
+    // Plenty of log so nothing the reader needs is dropped
+    vssd = make_unique<VersionedVSSD>(make_unique<RAMVSSD>(block_size, block_count),
+                                      make_unique<RAMVSSD>(block_size, 1024));
+    for (size_t b = 0; b < block_count; ++b)
+      REQUIRE(vssd->write(b, content(b, 1).data()) == OK);
+    auto at = vssd->now();
+
+    atomic<size_t> failures = 0;
+    vector<thread> threads;
+    for (size_t w = 0; w < 2; ++w)
+      threads.emplace_back([&, w] {
+        for (int version = 2; version < 8; ++version)
+          for (size_t b = w; b < block_count; b += 2)
+            if (vssd->write(b, content(b, version).data()) != OK) failures++;
+      });
+    threads.emplace_back([&] {
+      vector<char> mine(4 * block_size);
+      for (int pass = 0; pass < 10; ++pass)
+        for (size_t b = 0; b < block_count; b += 4) {
+          if (vssd->readBlocksAt(b, 4, at, mine.data()) != OK) failures++;
+          for (size_t i = 0; i < 4; ++i)
+            if (memcmp(&mine[i * block_size], content(b + i, 1).data(), block_size) != 0)
+              failures++;
+        }
+    });
+    for (auto & t : threads) t.join();
+    REQUIRE(failures == 0);
+    REQUIRE(vssd->read(0, read.data()) == OK);
+    REQUIRE(read == content(0, 7));
+  }
+}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * test_util holds what several tests need: blocks whose contents say
+ * where and when they were written, and the children of the composite
+ * disks with plain pointers kept to them.
+ */
+
+#ifndef TEST_UTIL_H
+  #define TEST_UTIL_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "VVSSD.h"
+#include "block_util.h"
+
+namespace test_util {
+
+/**
+ * Makes blocks that name their block number and version ("block 7 v2
+ * block 7 v2 ..."), so one read from the wrong place, or left over from
+ * an older write, stands out.
+ */
+class VersionedBlocks {
+  std::size_t blockSize;
+
+ public:
+  explicit VersionedBlocks(std::size_t block_size) : blockSize(block_size) {}
+
+  std::vector<char> operator()(std::size_t block, int version) const {
+    std::vector<char> contents(blockSize);
+    block_util::fill_block(contents.data(), blockSize,
+                           "block " + std::to_string(block) + " v" +
+                               std::to_string(version) + " ");
+    return contents;
+  }
+};
+
+/**
+ * Build count children for a composite disk with make(i), which returns
+ * a std::unique_ptr<Disk> (null for a missing child), and keep a plain
+ * pointer to each in raw, to look inside or upset a child once the
+ * composite owns it.
+ */
+template <class Disk, class Make>
+std::vector<std::unique_ptr<VVSSD>> make_children(std::size_t count,
+                                                  std::vector<Disk*>& raw,
+                                                  Make make) {
+  raw.clear();
+  std::vector<std::unique_ptr<VVSSD>> disks;
+  for (std::size_t i = 0; i < count; i++) {
+    std::unique_ptr<Disk> disk = make(i);
+    raw.push_back(disk.get());
+    disks.push_back(std::move(disk));
+  }
+  return disks;
+}
+
+}
+
+  #endif /* TEST_UTIL_H */
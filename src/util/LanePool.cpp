@@ -0,0 +1,72 @@
+/**
+ * See LanePool.h for header comment
+ */
+
+#include "LanePool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+LanePool::LanePool(size_t count, size_t depth) : depth(max<size_t>(depth, 1)) {
+  for (size_t i = 0; i < count; i++) lanes.push_back(make_unique<Lane>());
+}
+
+LanePool::~LanePool() {
+  for (auto& lane : lanes) {
+    {
+      lock_guard<mutex> hold(lane->mtx);
+      lane->stopping = true;
+    }
+    lane->ready.notify_all();
+  }
+  for (auto& lane : lanes)
+    for (auto& worker : lane->workers) worker.join();
+}
+
+void LanePool::work(Lane& lane) {
+  while (true) {
+    packaged_task<DiskStatus()> job;
+    {
+      unique_lock<mutex> hold(lane.mtx);
+      lane.idle++;
+      lane.ready.wait(hold, [&] { return lane.stopping || !lane.jobs.empty(); });
+      lane.idle--;
+      if (lane.jobs.empty()) return;
+      job = move(lane.jobs.front());
+      lane.jobs.pop_front();
+    }
+    job();
+  }
+}
+
+future<DiskStatus> LanePool::submit(size_t lane, Job job) {
+  packaged_task<DiskStatus()> task(move(job));
+  future<DiskStatus> result = task.get_future();
+  Lane& target = *lanes.at(lane);
+  {
+    lock_guard<mutex> hold(target.mtx);
+    target.jobs.push_back(move(task));
+    // Another worker only if every one there is (or is about to be) busy
+    if (target.jobs.size() > target.idle && target.workers.size() < depth)
+      target.workers.emplace_back([&target] { work(target); });
+  }
+  target.ready.notify_one();
+  return result;
+}
+
+DiskStatus LanePool::run(vector<pair<size_t, Job>>& jobs) {
+  if (jobs.empty()) return DiskStatus::OK;
+
+  vector<future<DiskStatus>> others;
+  for (size_t i = 1; i < jobs.size(); i++)
+    others.push_back(submit(jobs[i].first, move(jobs[i].second)));
+  DiskStatus ds = jobs[0].second();
+
+  // Wait for every job, even after a failure: they use the caller's buffers
+  for (auto& other : others) {
+    DiskStatus theirs = other.get();
+    if (ds == DiskStatus::OK) ds = theirs;
+  }
+  return ds;
+}
@@ -0,0 +1,94 @@
+#ifndef LANEPOOL_H
+  #define LANEPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "DiskStatus.h"
+
+/**
+ * LanePool runs disk calls for a composite disk on its children in
+ * parallel: one queue per lane (per child), served by up to depth worker
+ * threads of its own, so a slow child delays only the jobs sent to it
+ * and each child sees up to depth requests at once, as a device with a
+ * queue wants. Workers are started as a lane's queue first needs them.
+ * A lane starts its jobs in the order they were queued; with a depth
+ * of 1 it also finishes each before starting the next.
+ *
+ * submit() queues a job on a lane and returns a future for its status;
+ * run() dispatches a set of jobs, one per lane, and waits for all of
+ * them, running the first on the calling thread so a request that
+ * touches a single child never changes threads. Destroying the pool
+ * finishes every queued job first.
+ *
+ * All members are safe to call from several threads.
+ */
+class LanePool {
+ public:
+  typedef std::function<DiskStatus()> Job;
+
+  /// jobs a lane runs at once unless the constructor is told otherwise
+  static constexpr std::size_t DefaultDepth = 4;
+
+  /**
+   * LanePool constructor
+   *
+   * @param  {std::size_t} lanes : number of lanes
+   * @param  {std::size_t} depth : most jobs running at once on a lane
+   *                               (worker threads per lane), at least 1
+   */
+  LanePool(std::size_t lanes, std::size_t depth = DefaultDepth);
+
+  /**
+   * ~LanePool finishes the queued jobs and stops the workers.
+   */
+  ~LanePool();
+
+  LanePool(const LanePool&) = delete;
+  LanePool& operator=(const LanePool&) = delete;
+
+  /**
+   * Queue job on lane; the future holds its status once it has run.
+   */
+  std::future<DiskStatus> submit(std::size_t lane, Job job);
+
+  /**
+   * Run each job on its lane, the first on this thread, and wait for
+   * them all.
+   *
+   * @param  {std::vector<std::pair<std::size_t, Job>>} jobs : lane, job
+   * @return OK if every job returned OK, otherwise the first other status
+   *         (in the order given).
+   */
+  DiskStatus run(std::vector<std::pair<std::size_t, Job>>& jobs);
+
+ private:
+  struct Lane {
+    std::vector<std::thread> workers;
+    /// workers waiting for a job
+    std::size_t idle = 0;
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::deque<std::packaged_task<DiskStatus()>> jobs;
+    bool stopping = false;
+  };
+
+  std::vector<std::unique_ptr<Lane>> lanes;
+  std::size_t depth;
+
+  /**
+   * Body of each worker: run the lane's jobs until it is stopped and
+   * empty. Several workers may share a lane.
+   */
+  static void work(Lane& lane);
+};
+
+  #endif /* LANEPOOL_H */
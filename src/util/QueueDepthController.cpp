@@ -0,0 +1,56 @@
+/**
+ * See QueueDepthController.h for header comment
+ */
+
+#include "QueueDepthController.h"
+
+#include <algorithm>
+
+using namespace std;
+
+QueueDepthController::QueueDepthController(clock::duration p99Target,
+                                           size_t minDepth, size_t maxDepth)
+    : target(p99Target),
+      minDepth(max<size_t>(minDepth, 1)),
+      maxDepth(max(maxDepth, max<size_t>(minDepth, 1))),
+      depth(max<size_t>(minDepth, 1)) {
+  samples.reserve(Window);
+}
+
+size_t QueueDepthController::limit() const { return depth; }
+
+QueueDepthController::clock::duration QueueDepthController::p99() const {
+  return clock::duration(lastP99.load());
+}
+
+void QueueDepthController::completed(clock::duration latency,
+                                     bool saturated) {
+  lock_guard<mutex> hold(mtx);
+  size_t current = depth;
+
+  // Additive increase: about one more slot per `current` completions,
+  // but only while there is demand for more than we allow
+  if (saturated && current < maxDepth) {
+    growth += 1.0 / current;
+    if (growth >= 1.0) {
+      growth = 0.0;
+      depth = ++current;
+    }
+  }
+
+  samples.push_back(latency.count());
+  if (samples.size() < Window) return;
+
+  // Window closed: the p99 sample is the one with 1% of samples above it
+  size_t rank = samples.size() - 1 - samples.size() / 100;
+  nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  clock::rep windowP99 = samples[rank];
+  samples.clear();
+  lastP99 = windowP99;
+
+  // Multiplicative decrease when the tail missed the target
+  if (clock::duration(windowP99) > target) {
+    depth = max(minDepth, (size_t)(current * Backoff));
+    growth = 0.0;
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef QUEUEDEPTHCONTROLLER_H
+  #define QUEUEDEPTHCONTROLLER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * QueueDepthController decides how many requests may be in flight at a
+ * device at once, aiming for the highest throughput that keeps the p99
+ * completion latency under a target. It is an AIMD loop driven by the
+ * latencies its owner reports:
+ *
+ *  - completions are collected into windows of Window samples; at the
+ *    end of each window the p99 of that window is computed;
+ *  - if the p99 is over the target the limit is cut multiplicatively
+ *    (by Backoff), never below the minimum depth;
+ *  - otherwise, while the device is kept busy (the caller reports that
+ *    the limit was reached), the limit grows additively by about one
+ *    request per limit completions, never above the maximum depth.
+ *
+ * The limit settles just under the depth at which queuing in the device
+ * starts to push the tail past the target, whatever that depth happens
+ * to be on the current host and image.
+ *
+ * All members are safe to call from several threads.
+ */
+class QueueDepthController {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  /// completions per p99 window
+  static const std::size_t Window = 128;
+  /// multiplicative decrease applied when a window misses the target
+  static constexpr double Backoff = 0.7;
+
+  /**
+   * QueueDepthController constructor
+   *
+   * @param  {clock::duration} p99Target : latency the p99 must stay under
+   * @param  {std::size_t} minDepth      : smallest limit ever allowed (>= 1)
+   * @param  {std::size_t} maxDepth      : largest limit ever allowed
+   */
+  QueueDepthController(clock::duration p99Target, std::size_t minDepth,
+                       std::size_t maxDepth);
+
+  /**
+   * Return the number of requests that may currently be in flight.
+   */
+  std::size_t limit() const;
+
+  /**
+   * Report one completion.
+   *
+   * @param  {clock::duration} latency : dispatch-to-completion time
+   * @param  {bool} saturated          : true if the in-flight count had
+   *                                     reached limit() when the request
+   *                                     was dispatched (demand exceeded
+   *                                     the limit)
+   */
+  void completed(clock::duration latency, bool saturated);
+
+  /**
+   * Return the p99 latency of the last complete window (zero before
+   * the first window closes).
+   */
+  clock::duration p99() const;
+
+ private:
+  const clock::duration target;
+  const std::size_t minDepth;
+  const std::size_t maxDepth;
+
+  std::atomic<std::size_t> depth;
+  std::atomic<clock::rep> lastP99{0};
+
+  mutable std::mutex mtx;
+  std::vector<clock::rep> samples;
+  double growth = 0.0;
+};
+
+  #endif /* QUEUEDEPTHCONTROLLER_H */
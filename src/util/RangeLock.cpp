@@ -0,0 +1,70 @@
+/**
+ * See RangeLock.h for header comment
+ */
+
+#include "RangeLock.h"
+
+using namespace std;
+
+RangeLock::Guard::Guard(RangeLock * owner, RequestIndex::iterator entry)
+    : owner(owner), entry(entry) {}
+
+RangeLock::Guard::Guard(Guard && other) : owner(other.owner), entry(other.entry) {
+  other.owner = nullptr;
+}
+
+RangeLock::Guard & RangeLock::Guard::operator=(Guard && other) {
+  if (this != &other) {
+    release();
+    owner = other.owner;
+    entry = other.entry;
+    other.owner = nullptr;
+  }
+  return *this;
+}
+
+RangeLock::Guard::~Guard() { release(); }
+
+void RangeLock::Guard::release() {
+  if (owner != nullptr) owner->unlock(entry);
+  owner = nullptr;
+}
+
+RangeLock::Guard RangeLock::lock(position_t first, position_t last,
+                                 Mode mode) {
+  unique_lock<mutex> hold(mtx);
+  auto entry =
+      requests.emplace(first, Request{last, mode, nextTicket++});
+  lengths.insert(last - first);
+
+  changed.wait(hold, [&] { return !blocked(entry); });
+  return Guard(this, entry);
+}
+
+bool RangeLock::blocked(RequestIndex::iterator entry) const {
+  position_t first = entry->first;
+  const Request & mine = entry->second;
+
+  // No live range is longer than the longest length, so anything that
+  // overlaps [first, last) must start after first - longest.
+  position_t longest = *lengths.rbegin();
+  position_t from = (first >= longest) ? first - longest + 1 : 0;
+
+  for (auto other = requests.lower_bound(from);
+       other != requests.end() && other->first < mine.last; ++other) {
+    const Request & theirs = other->second;
+    if (theirs.ticket >= mine.ticket) continue;
+    if (theirs.last <= first) continue;
+    if (mine.mode == EXCLUSIVE || theirs.mode == EXCLUSIVE) return true;
+  }
+  return false;
+}
+
+void RangeLock::unlock(RequestIndex::iterator entry) {
+  {
+    lock_guard<mutex> hold(mtx);
+    lengths.erase(lengths.find(entry->second.last - entry->first));
+    requests.erase(entry);
+  }
+  changed.notify_all();
+}
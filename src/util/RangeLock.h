@@ -0,0 +1,105 @@
+#ifndef RANGELOCK_H
+  #define RANGELOCK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <set>
+
+/**
+ * RangeLock hands out shared (reader) and exclusive (writer) locks on
+ * half-open ranges [first, last) of positions, typically block numbers.
+ * Requests on disjoint ranges never wait for each other; overlapping
+ * requests wait only if one of them is exclusive.
+ *
+ * Every request (granted or waiting) is kept in an interval index: a
+ * multimap ordered by the first position plus a multiset of range
+ * lengths. The longest live range bounds how far left of a request an
+ * overlapping range can start, so a conflict check visits only the
+ * ranges that can actually overlap instead of every held lock.
+ *
+ * Requests are granted in arrival order among the ranges they overlap:
+ * a request waits for any earlier overlapping request it conflicts with,
+ * granted or not, so a steady stream of readers cannot starve a writer.
+ *
+ * The internal mutex is held only while the index is updated, never
+ * while the caller works on the locked range.
+ */
+class RangeLock {
+ public:
+  /// position type (block numbers for the disks)
+  typedef std::size_t position_t;
+
+  /// kind of access requested on a range
+  enum Mode { SHARED, EXCLUSIVE };
+
+ private:
+  struct Request {
+    position_t last;
+    Mode mode;
+    unsigned long ticket;
+  };
+  typedef std::multimap<position_t, Request> RequestIndex;
+
+ public:
+  /**
+   * Guard is the RAII handle for a granted range. The range is
+   * released when the guard is destroyed (or release() is called).
+   * Guards can be moved but not copied.
+   */
+  class Guard {
+   public:
+    Guard() = default;
+    Guard(Guard && other);
+    Guard & operator=(Guard && other);
+    Guard(const Guard &) = delete;
+    Guard & operator=(const Guard &) = delete;
+    ~Guard();
+
+    /**
+     * Release the range early. Safe to call more than once.
+     */
+    void release();
+
+   private:
+    friend class RangeLock;
+    Guard(RangeLock * owner, RequestIndex::iterator entry);
+
+    RangeLock * owner = nullptr;
+    RequestIndex::iterator entry;
+  };
+
+  RangeLock() = default;
+  RangeLock(const RangeLock &) = delete;
+  RangeLock & operator=(const RangeLock &) = delete;
+
+  /**
+   * Lock the range [first, last), waiting until no conflicting earlier
+   * request overlaps it.
+   *
+   * @param  {position_t} first : first position in the range
+   * @param  {position_t} last  : one past the last position; must be > first
+   * @param  {Mode} mode        : SHARED or EXCLUSIVE
+   * @return {Guard}            : handle that releases the range
+   */
+  Guard lock(position_t first, position_t last, Mode mode);
+
+ private:
+  std::mutex mtx;
+  std::condition_variable changed;
+  RequestIndex requests;
+  std::multiset<position_t> lengths;
+  unsigned long nextTicket = 0;
+
+  /**
+   * blocked reports whether the request at entry must keep waiting: an
+   * earlier request overlaps it and one of the two is exclusive. Caller
+   * holds mtx.
+   */
+  bool blocked(RequestIndex::iterator entry) const;
+
+  void unlock(RequestIndex::iterator entry);
+};
+
+  #endif /* RANGELOCK_H */
@@ -0,0 +1,90 @@
+/**
+ * See StripedSeqLock.h for header comment
+ */
+
+#include "StripedSeqLock.h"
+
+#include <new>
+
+using namespace std;
+
+// Small ranges get a counter per position, larger ones share MaxStripes
+static size_t stripesFor(size_t positions) {
+  size_t stripeCount = 1;
+  while (stripeCount < positions && stripeCount < StripedSeqLock::MaxStripes)
+    stripeCount *= 2;
+  return stripeCount;
+}
+
+StripedSeqLock::StripedSeqLock(size_t positions) {
+  size_t stripeCount = stripesFor(positions);
+  owned = make_unique<Stripe[]>(stripeCount);
+  stripes = owned.get();
+  stripeMask = stripeCount - 1;
+}
+
+StripedSeqLock::StripedSeqLock(void* memory, size_t positions,
+                               bool initialize) {
+  size_t stripeCount = stripesFor(positions);
+  stripes = static_cast<Stripe*>(memory);
+  if (initialize)
+    for (size_t i = 0; i < stripeCount; i++) new (&stripes[i]) Stripe();
+  stripeMask = stripeCount - 1;
+}
+
+size_t StripedSeqLock::bytes(size_t positions) {
+  return stripesFor(positions) * sizeof(Stripe);
+}
+
+template <typename Visitor>
+void StripedSeqLock::forStripes(position_t first, size_t count,
+                                Visitor visit) const {
+  size_t stripeCount = stripeMask + 1;
+  if (count == 0) return;
+  if (count >= stripeCount) {
+    for (size_t i = 0; i < stripeCount; i++) visit(stripes[i]);
+    return;
+  }
+  // The run's stripes may wrap past the last stripe; walk the wrapped
+  // part (from stripe 0) first to keep the order
+  size_t from = first & stripeMask;
+  size_t to = (first + count - 1) & stripeMask;
+  if (to < from) {
+    for (size_t i = 0; i <= to; i++) visit(stripes[i]);
+    to = stripeMask;
+  }
+  for (size_t i = from; i <= to; i++) visit(stripes[i]);
+}
+
+void StripedSeqLock::lock(position_t first, size_t count) {
+  forStripes(first, count, [](Stripe& stripe) {
+    uint64_t seq = stripe.seq.load(memory_order_relaxed);
+    // Even means no writer; claim it by making it odd
+    while ((seq & 1) ||
+           !stripe.seq.compare_exchange_weak(seq, seq + 1,
+                                             memory_order_acquire)) {
+      this_thread::yield();
+      seq = stripe.seq.load(memory_order_relaxed);
+    }
+  });
+  // Data stores must not move ahead of the odd counters
+  atomic_thread_fence(memory_order_release);
+}
+
+void StripedSeqLock::unlock(position_t first, size_t count) {
+  forStripes(first, count, [](Stripe& stripe) {
+    stripe.seq.fetch_add(1, memory_order_release);
+  });
+}
+
+uint64_t StripedSeqLock::sum(position_t first, size_t count,
+                             bool& locked) const {
+  uint64_t total = 0;
+  locked = false;
+  forStripes(first, count, [&](const Stripe& stripe) {
+    uint64_t seq = stripe.seq.load(memory_order_acquire);
+    locked = locked || (seq & 1);
+    total += seq;
+  });
+  return total;
+}
@@ -0,0 +1,138 @@
+#ifndef STRIPEDSEQLOCK_H
+  #define STRIPEDSEQLOCK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/**
+ * StripedSeqLock guards runs of consecutive positions (typically block
+ * numbers) so readers take no lock at all.
+ *
+ * Positions are grouped into stripes (position modulo the stripe count),
+ * each with a sequence counter that doubles as the stripe's writer lock:
+ * a writer makes the counter odd before it changes the data and even
+ * again after. A reader notes the counters of its run, copies
+ * optimistically, and retries if any counter was odd or moved meanwhile;
+ * after a few failed tries it locks the stripes like a writer so it
+ * cannot be starved. Readers therefore never write to a shared cache
+ * line. Writers of runs that share no stripe proceed in parallel.
+ *
+ * Stripes are always taken in increasing index order, so overlapping
+ * writers cannot deadlock.
+ *
+ * The counters can also live in memory the caller provides, such as a
+ * shared mapping; being lock-free atomics, they then guard the data for
+ * every process that maps them.
+ */
+class StripedSeqLock {
+ public:
+  /// position type (block numbers for the disks)
+  typedef std::size_t position_t;
+
+  /// most stripes (sequence counters) a lock uses; a power of 2
+  static const std::size_t MaxStripes = 1024;
+  /// optimistic read attempts before a reader locks its stripes
+  static const int OptimisticTries = 16;
+
+ private:
+  // One counter per cache line so writers to one stripe do not disturb
+  // readers of its neighbours
+  struct alignas(64) Stripe {
+    std::atomic<std::uint64_t> seq{0};
+  };
+  std::unique_ptr<Stripe[]> owned;
+  Stripe* stripes;
+  std::size_t stripeMask;
+
+  /**
+   * Call visit(stripe) once for each stripe the run touches, in
+   * increasing stripe order.
+   */
+  template <typename Visitor>
+  void forStripes(position_t first, std::size_t count, Visitor visit) const;
+
+  /**
+   * Sum of the run's stripe counters; locked is set if any of them is
+   * odd. Counters only grow, so equal sums before and after a copy mean
+   * no counter moved.
+   */
+  std::uint64_t sum(position_t first, std::size_t count, bool& locked) const;
+
+ public:
+  /**
+   * StripedSeqLock Constructor
+   *
+   * @param  {std::size_t} positions : number of positions guarded; small
+   *                                   ranges get a stripe per position
+   */
+  explicit StripedSeqLock(std::size_t positions);
+
+  /**
+   * StripedSeqLock Constructor over counters in caller memory
+   *
+   * @param  {void*} memory          : bytes(positions) bytes, 64-byte
+   *                                   aligned, that outlive the lock
+   * @param  {std::size_t} positions : number of positions guarded
+   * @param  {bool} initialize       : true to reset the counters; false
+   *                                   to use counters already set up
+   */
+  StripedSeqLock(void* memory, std::size_t positions, bool initialize);
+
+  /**
+   * Return the bytes of counters a lock over positions needs.
+   */
+  static std::size_t bytes(std::size_t positions);
+
+  /**
+   * Make the counters of every stripe the run touches odd, waiting for
+   * other writers.
+   */
+  void lock(position_t first, std::size_t count);
+
+  /**
+   * Make the counters taken by lock() even again, publishing the writes
+   * made in between.
+   */
+  void unlock(position_t first, std::size_t count);
+
+  /**
+   * Run copy() over the run until it was not disturbed by a writer.
+   * copy must only read the guarded data and may be called repeatedly.
+   */
+  template <typename Copy>
+  void read(position_t first, std::size_t count, Copy copy);
+
+  /**
+   * Run update() over the run with its stripes locked.
+   */
+  template <typename Update>
+  void write(position_t first, std::size_t count, Update update) {
+    lock(first, count);
+    update();
+    unlock(first, count);
+  }
+};
+
+template <typename Copy>
+void StripedSeqLock::read(position_t first, std::size_t count, Copy copy) {
+  // Optimistic copy: keep it only if no writer touched the run meanwhile
+  for (int tries = 0; tries < OptimisticTries; tries++) {
+    bool locked;
+    std::uint64_t before = sum(first, count, locked);
+    if (locked) {
+      std::this_thread::yield();
+      continue;
+    }
+    copy();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sum(first, count, locked) == before) return;
+  }
+
+  // Writers kept winning; hold the stripes so this copy cannot be torn
+  write(first, count, copy);
+}
+
+  #endif /* STRIPEDSEQLOCK_H */
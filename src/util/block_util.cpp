@@ -1,5 +1,8 @@
 #include "block_util.h"
 #include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 using namespace std;
 
 namespace block_util {
@@ -23,4 +26,44 @@ namespace block_util {
     return fout;
   }
 
+  bool same_filled(const void * block, size_t block_size, uint64_t & word) {
+    const char * bytes = static_cast<const char *>(block);
+    if (block_size < sizeof(word) || block_size % sizeof(word) != 0)
+      return false;
+    memcpy(&word, bytes, sizeof(word));
+    size_t offset = sizeof(word);
+#ifdef __SSE2__
+    // Compare 64 bytes per round against the word in both lanes; the
+    // differences are OR-ed so there is one branch per round
+    __m128i pattern = _mm_set1_epi64x((long long)word);
+    for (; offset + 64 <= block_size; offset += 64) {
+      __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(bytes + offset)), pattern);
+      __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(bytes + offset + 16)), pattern);
+      __m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(bytes + offset + 32)), pattern);
+      __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(bytes + offset + 48)), pattern);
+      __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF)
+        return false;
+    }
+#endif
+    for (; offset < block_size; offset += sizeof(word)) {
+      uint64_t next;
+      memcpy(&next, bytes + offset, sizeof(next));
+      if (next != word) return false;
+    }
+    return true;
+  }
+
+  void fill_word(void * block, size_t block_size, uint64_t word) {
+    char * bytes = static_cast<char *>(block);
+    size_t offset = 0;
+#ifdef __SSE2__
+    __m128i pattern = _mm_set1_epi64x((long long)word);
+    for (; offset + 16 <= block_size; offset += 16)
+      _mm_storeu_si128((__m128i *)(bytes + offset), pattern);
+#endif
+    for (; offset < block_size; offset += sizeof(word))
+      memcpy(bytes + offset, &word, sizeof(word));
+  }
+
 }
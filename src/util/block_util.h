@@ -1,5 +1,6 @@
 #ifndef BLOCK_UTIL_H
 #define BLOCK_UTIL_H
+#include <cstdint>
 #include <fstream>
 #include <string>
 
@@ -27,6 +28,27 @@ namespace block_util {
    * @param block_size size, in bytes of buffer to print
    */
   std::ostream & dump_block(std::ostream & fout, BlockPtr block, size_t block_size);
+
+  /**
+   * Check whether the block is one 8-byte word repeated, which covers
+   * all-zero blocks and 1, 2 and 4-byte patterns too. Uses SSE2 where
+   * the compiler targets it.
+   *
+   * @param block the buffer to check
+   * @param block_size size in bytes of the buffer; must be a multiple of 8
+   * @param word set to the repeated word (as it lies in memory) if so
+   * @return true if the block is the word repeated
+   */
+  bool same_filled(const void * block, size_t block_size, std::uint64_t & word);
+
+  /**
+   * Fill the buffer with copies of an 8-byte word, undoing same_filled.
+   *
+   * @param block a naked pointer into memory that has room for block_size bytes
+   * @param block_size size in bytes of the buffer; must be a multiple of 8
+   * @param word the word to repeat, as same_filled returned it
+   */
+  void fill_word(void * block, size_t block_size, std::uint64_t word);
 }
 
 
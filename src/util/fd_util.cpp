@@ -0,0 +1,91 @@
+#include "fd_util.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <ctime>
+#include <thread>
+using namespace std;
+
+namespace fd_util {
+/**
+ * pread may move fewer bytes than asked; keep going until the whole
+ * buffer is done. Return false on error or unexpected end of file.
+ */
+bool pread_all(int fd, char * buffer, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t got = pread(fd, buffer, length, offset);
+    if (got <= 0) return false;
+    buffer += got;
+    length -= got;
+    offset += got;
+  }
+  return true;
+}
+
+/**
+ * pwrite counterpart of pread_all.
+ */
+bool pwrite_all(int fd, const char * buffer, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t put = pwrite(fd, buffer, length, offset);
+    if (put <= 0) return false;
+    buffer += put;
+    length -= put;
+    offset += put;
+  }
+  return true;
+}
+
+/**
+ * read counterpart of pread_all, for descriptors without an offset.
+ */
+bool read_all(int fd, char * buffer, size_t length) {
+  while (length > 0) {
+    ssize_t got = read(fd, buffer, length);
+    if (got <= 0) return false;
+    buffer += got;
+    length -= got;
+  }
+  return true;
+}
+
+/**
+ * write counterpart of pwrite_all, for descriptors without an offset.
+ */
+bool write_all(int fd, const char * buffer, size_t length) {
+  while (length > 0) {
+    ssize_t put = write(fd, buffer, length);
+    if (put <= 0) return false;
+    buffer += put;
+    length -= put;
+  }
+  return true;
+}
+
+bool file_identity(const char * path, uint64_t id[4]) {
+  struct stat info;
+  if (stat(path, &info) != 0) return false;
+  id[0] = info.st_dev;
+  id[1] = info.st_ino;
+  id[2] = info.st_size;
+  id[3] = (uint64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+  return true;
+}
+
+/**
+ * File times come from a clock that ticks every few milliseconds, so a
+ * write in the tick a file was last written in would not change its
+ * mtime. Wait for the tick to pass, and not much longer should the
+ * mtime be in the future.
+ */
+void wait_past(uint64_t mtime) {
+  timespec now;
+  for (int tries = 0; tries < 100; tries++) {
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &now) != 0 ||
+        (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec > mtime)
+      return;
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+}
+
+}
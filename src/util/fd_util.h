@@ -0,0 +1,36 @@
+#ifndef FD_UTIL_H
+  #define FD_UTIL_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+// Free functions for whole-buffer I/O on POSIX file descriptors.
+
+namespace fd_util {
+
+// pread until length bytes are in buffer; false on error or end of file
+bool pread_all(int fd, char * buffer, std::size_t length, off_t offset);
+
+// pwrite until all length bytes of buffer are written; false on error
+bool pwrite_all(int fd, const char * buffer, std::size_t length, off_t offset);
+
+// read until length bytes are in buffer (pipes, sockets); false on error
+// or end of file
+bool read_all(int fd, char * buffer, std::size_t length);
+
+// write until all length bytes of buffer are written; false on error
+bool write_all(int fd, const char * buffer, std::size_t length);
+
+// device, inode, size and modification time (ns) of the file at path,
+// which together change when it is written or replaced; false if it
+// cannot be found
+bool file_identity(const char * path, std::uint64_t id[4]);
+
+// wait (a few milliseconds at most) until file times are later than
+// mtime, so any later write to a file with that mtime changes it
+void wait_past(std::uint64_t mtime);
+
+}
+
+  #endif /* FD_UTIL_H */
@@ -0,0 +1,201 @@
+#include "gf_util.h"
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define GF_UTIL_X86
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace gf_util {
+
+/**
+ * Log and exponent tables (generator 2), full products for the scalar
+ * kernel, and for every constant the products of the 16 low nibbles and
+ * the 16 high nibbles, which is what the pshufb kernels look up.
+ */
+struct Tables {
+  uint8_t exp[512];
+  uint8_t log[256];
+  uint8_t product[256][256];
+  alignas(16) uint8_t low[256][16];
+  alignas(16) uint8_t high[256][16];
+
+  Tables() {
+    unsigned x = 1;
+    for (unsigned i = 0; i < 255; i++) {
+      exp[i] = exp[i + 255] = (uint8_t)x;
+      log[x] = (uint8_t)i;
+      x <<= 1;
+      if (x & 0x100) x ^= 0x11d;
+    }
+    exp[510] = exp[511] = exp[0];
+    log[0] = 0;
+    for (unsigned a = 0; a < 256; a++)
+      for (unsigned b = 0; b < 256; b++)
+        product[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+    for (unsigned c = 0; c < 256; c++)
+      for (unsigned n = 0; n < 16; n++) {
+        low[c][n] = product[c][n];
+        high[c][n] = product[c][n << 4];
+      }
+  }
+};
+
+static const Tables & tables() {
+  static const Tables built;
+  return built;
+}
+
+uint8_t multiply(uint8_t a, uint8_t b) { return tables().product[a][b]; }
+
+uint8_t inverse(uint8_t a) {
+  const Tables & t = tables();
+  return a ? t.exp[255 - t.log[a]] : 0;
+}
+
+static void region_scalar(uint8_t * dst, const uint8_t * src, uint8_t c,
+                          size_t length, bool add) {
+  const uint8_t * row = tables().product[c];
+  if (add)
+    for (size_t i = 0; i < length; i++) dst[i] ^= row[src[i]];
+  else
+    for (size_t i = 0; i < length; i++) dst[i] = row[src[i]];
+}
+
+#ifdef GF_UTIL_X86
+/**
+ * 16 bytes per step: split each byte into nibbles, look both up in the
+ * constant's nibble tables with pshufb and XOR the halves together.
+ */
+__attribute__((target("ssse3")))
+static void region_ssse3(uint8_t * dst, const uint8_t * src, uint8_t c,
+                         size_t length, bool add) {
+  const Tables & t = tables();
+  __m128i low = _mm_load_si128((const __m128i *)t.low[c]);
+  __m128i high = _mm_load_si128((const __m128i *)t.high[c]);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i p = _mm_xor_si128(
+        _mm_shuffle_epi8(low, _mm_and_si128(s, mask)),
+        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+    if (add) p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst + i)));
+    _mm_storeu_si128((__m128i *)(dst + i), p);
+  }
+  region_scalar(dst + i, src + i, c, length - i, add);
+}
+
+/**
+ * The same, 32 bytes per step; vpshufb looks up within each 128-bit
+ * lane, so the tables are repeated in both.
+ */
+__attribute__((target("avx2")))
+static void region_avx2(uint8_t * dst, const uint8_t * src, uint8_t c,
+                        size_t length, bool add) {
+  const Tables & t = tables();
+  __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)t.low[c]));
+  __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)t.high[c]));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i p = _mm256_xor_si256(
+        _mm256_shuffle_epi8(low, _mm256_and_si256(s, mask)),
+        _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+    if (add) p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst + i)));
+    _mm256_storeu_si256((__m256i *)(dst + i), p);
+  }
+  region_ssse3(dst + i, src + i, c, length - i, add);
+}
+#endif
+
+bool supported(Kernel kernel) {
+#ifdef GF_UTIL_X86
+  switch (kernel) {
+    case AVX2:
+      return __builtin_cpu_supports("avx2");
+    case SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    default:
+      return true;
+  }
+#else
+  return kernel == SCALAR;
+#endif
+}
+
+Kernel best_kernel() {
+  static const Kernel best = supported(AVX2)    ? AVX2
+                             : supported(SSSE3) ? SSSE3
+                                                : SCALAR;
+  return best;
+}
+
+const char * kernel_name(Kernel kernel) {
+  switch (kernel) {
+    case AVX2:
+      return "avx2";
+    case SSSE3:
+      return "ssse3";
+    default:
+      return "scalar";
+  }
+}
+
+void multiply_region(uint8_t * dst, const uint8_t * src, uint8_t c,
+                     size_t length, bool add, Kernel kernel) {
+  if (length == 0) return;
+  // Multiplying by 0 or 1 needs no tables
+  if (c == 0) {
+    if (!add) memset(dst, 0, length);
+    return;
+  }
+  if (c == 1 && !add) {
+    memmove(dst, src, length);
+    return;
+  }
+#ifdef GF_UTIL_X86
+  if (kernel == AVX2 && supported(AVX2))
+    return region_avx2(dst, src, c, length, add);
+  if (kernel != SCALAR && supported(SSSE3))
+    return region_ssse3(dst, src, c, length, add);
+#endif
+  region_scalar(dst, src, c, length, add);
+}
+
+/**
+ * Gauss-Jordan elimination on [matrix | identity]; subtraction is XOR,
+ * so eliminating a row is a multiply-and-add.
+ */
+bool invert_matrix(uint8_t * matrix, size_t n) {
+  vector<uint8_t> work(n * 2 * n, 0);
+  for (size_t r = 0; r < n; r++) {
+    memcpy(&work[r * 2 * n], matrix + r * n, n);
+    work[r * 2 * n + n + r] = 1;
+  }
+  for (size_t col = 0; col < n; col++) {
+    size_t pivot = col;
+    while (pivot < n && work[pivot * 2 * n + col] == 0) pivot++;
+    if (pivot == n) return false;
+    if (pivot != col)
+      for (size_t j = 0; j < 2 * n; j++)
+        swap(work[pivot * 2 * n + j], work[col * 2 * n + j]);
+
+    uint8_t * row = &work[col * 2 * n];
+    uint8_t scale = inverse(row[col]);
+    for (size_t j = 0; j < 2 * n; j++) row[j] = multiply(row[j], scale);
+    for (size_t r = 0; r < n; r++) {
+      uint8_t factor = work[r * 2 * n + col];
+      if (r == col || factor == 0) continue;
+      for (size_t j = 0; j < 2 * n; j++)
+        work[r * 2 * n + j] ^= multiply(factor, row[j]);
+    }
+  }
+  for (size_t r = 0; r < n; r++)
+    memcpy(matrix + r * n, &work[r * 2 * n + n], n);
+  return true;
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef GF_UTIL_H
+  #define GF_UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+// Arithmetic in GF(2^8) (polynomial 0x11d), the field Reed-Solomon
+// codes over bytes work in: addition is XOR, multiplication is by table.
+
+namespace gf_util {
+
+// Ways to multiply a region by a constant; the SIMD ones look up the
+// products of the low and high nibbles of 16 (or 32) bytes at once
+// with pshufb
+enum Kernel { SCALAR, SSSE3, AVX2 };
+
+// Product and inverse of single elements (inverse(0) is 0)
+std::uint8_t multiply(std::uint8_t a, std::uint8_t b);
+std::uint8_t inverse(std::uint8_t a);
+
+// True if this CPU can run the kernel
+bool supported(Kernel kernel);
+
+// The fastest kernel this CPU can run (decided once)
+Kernel best_kernel();
+
+// Name of a kernel, for reports
+const char * kernel_name(Kernel kernel);
+
+// dst = c * src over length bytes, or dst ^= c * src if add is true
+void multiply_region(std::uint8_t * dst, const std::uint8_t * src,
+                     std::uint8_t c, std::size_t length, bool add,
+                     Kernel kernel = best_kernel());
+
+// Invert the n x n row-major matrix in place; false if it is singular
+bool invert_matrix(std::uint8_t * matrix, std::size_t n);
+
+}
+
+  #endif /* GF_UTIL_H */
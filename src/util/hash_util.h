@@ -0,0 +1,34 @@
+#ifndef HASH_UTIL_H
+  #define HASH_UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+// Fast non-cryptographic hashing of blocks.
+
+namespace hash_util {
+
+// A 128-bit hash value
+struct Hash128 {
+  std::uint64_t low = 0;
+  std::uint64_t high = 0;
+
+  bool operator==(const Hash128 & other) const {
+    return low == other.low && high == other.high;
+  }
+  bool operator!=(const Hash128 & other) const { return !(*this == other); }
+};
+
+// MurmurHash3 x64_128 (Austin Appleby's public-domain algorithm) of
+// length bytes at data
+Hash128 murmur3_128(const void * data, std::size_t length,
+                    std::uint64_t seed = 0);
+
+// Hasher for unordered containers keyed by Hash128; the value is
+// already well mixed, so one half will do
+struct Hash128Hasher {
+  std::size_t operator()(const Hash128 & hash) const { return hash.low; }
+};
+
+}
+
+  #endif /* HASH_UTIL_H */
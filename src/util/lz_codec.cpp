@@ -0,0 +1,147 @@
+#include "lz_codec.h"
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+namespace lz_codec {
+
+// Matches are found through a hash of the next 4 bytes
+static const int HashBits = 12;
+static const size_t MinMatch = 4;
+static const size_t MaxOffset = 65535;
+
+static uint32_t read32(const char * p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint32_t hash4(const char * p) {
+  return (read32(p) * 2654435761u) >> (32 - HashBits);
+}
+
+// Append a length's extra bytes (the part that did not fit the nibble)
+static bool put_length(char *& out, const char * end, size_t extra) {
+  while (extra >= 255) {
+    if (out >= end) return false;
+    *out++ = (char)255;
+    extra -= 255;
+  }
+  if (out >= end) return false;
+  *out++ = (char)extra;
+  return true;
+}
+
+static bool get_length(const unsigned char *& in, const unsigned char * end,
+                       size_t & length) {
+  unsigned char byte;
+  do {
+    if (in >= end) return false;
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/**
+ * Write one sequence: literals [literal, literal + literals) and, if
+ * matchLength is not 0, a match of that length at offset.
+ */
+static bool put_sequence(char *& out, const char * end, const char * literal,
+                         size_t literals, size_t offset, size_t matchLength) {
+  if (out >= end) return false;
+  char * token = out++;
+  size_t matchCode = matchLength ? matchLength - MinMatch : 0;
+  *token = (char)(((literals < 15 ? literals : 15) << 4) |
+                  (matchCode < 15 ? matchCode : 15));
+  if (literals >= 15 && !put_length(out, end, literals - 15)) return false;
+  if ((size_t)(end - out) < literals) return false;
+  memcpy(out, literal, literals);
+  out += literals;
+  if (matchLength == 0) return true;
+  if (end - out < 2) return false;
+  *out++ = (char)(offset & 0xFF);
+  *out++ = (char)(offset >> 8);
+  if (matchCode >= 15 && !put_length(out, end, matchCode - 15)) return false;
+  return true;
+}
+
+size_t bound(size_t length) { return length + length / 255 + 16; }
+
+size_t compress(const char * in, size_t length, char * out, size_t capacity) {
+  const char * start = out;
+  const char * outEnd = out + capacity;
+  const char * inEnd = in + length;
+  const char * anchor = in;  // first literal not yet written
+
+  // Positions (from in) of the last place each hash was seen
+  uint32_t table[1 << HashBits];
+  memset(table, 0xFF, sizeof(table));
+
+  const char * p = in;
+  while (length >= MinMatch && p + MinMatch <= inEnd) {
+    uint32_t h = hash4(p);
+    uint32_t candidate = table[h];
+    table[h] = (uint32_t)(p - in);
+    const char * match = in + candidate;
+    if (candidate == UINT32_MAX || (size_t)(p - match) > MaxOffset ||
+        read32(match) != read32(p)) {
+      p++;
+      continue;
+    }
+
+    // Extend the match as far as it goes
+    size_t matchLength = MinMatch;
+    while (p + matchLength < inEnd && match[matchLength] == p[matchLength])
+      matchLength++;
+    if (!put_sequence(out, outEnd, anchor, p - anchor, p - match, matchLength))
+      return 0;
+    p += matchLength;
+    anchor = p;
+  }
+
+  // Whatever is left goes out as literals
+  if (!put_sequence(out, outEnd, anchor, inEnd - anchor, 0, 0)) return 0;
+  return out - start;
+}
+
+bool decompress(const char * in, size_t length, char * out, size_t size) {
+  const unsigned char * ip = reinterpret_cast<const unsigned char *>(in);
+  const unsigned char * inEnd = ip + length;
+  char * op = out;
+  char * outEnd = out + size;
+
+  // Only a literals-only sequence may end the input
+  bool ended = false;
+  while (ip < inEnd) {
+    unsigned char token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(ip, inEnd, literals)) return false;
+    if ((size_t)(inEnd - ip) < literals || (size_t)(outEnd - op) < literals)
+      return false;
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == inEnd) {
+      ended = true;  // the literals-only last sequence
+      break;
+    }
+
+    if (inEnd - ip < 2) return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t matchLength = token & 0x0F;
+    if (matchLength == 15 && !get_length(ip, inEnd, matchLength)) return false;
+    matchLength += MinMatch;
+    if (offset == 0 || offset > (size_t)(op - out) ||
+        (size_t)(outEnd - op) < matchLength)
+      return false;
+    // Byte by byte: the match may overlap what it is copying
+    const char * match = op - offset;
+    for (size_t i = 0; i < matchLength; i++) op[i] = match[i];
+    op += matchLength;
+  }
+  return ended && op == outEnd;
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef LZ_CODEC_H
+  #define LZ_CODEC_H
+
+#include <cstddef>
+// A small, fast LZ77 block codec in the LZ4 style: no entropy coding,
+// byte-aligned sequences of literals followed by a back-reference. It
+// compresses one buffer at a time (a disk block) and needs no state
+// between calls.
+//
+// Each sequence is a token byte (high nibble: literal count, low
+// nibble: match length - 4; 15 in either means more length bytes
+// follow, each added in until one is below 255), the literals, then a
+// 2-byte little-endian offset back into the output. The last sequence
+// holds literals only and ends the input.
+
+namespace lz_codec {
+
+// worst-case compressed size of length input bytes
+std::size_t bound(std::size_t length);
+
+// compress length bytes of in into out, which has room for capacity
+// bytes; return the compressed size, or 0 if it does not fit
+std::size_t compress(const char * in, std::size_t length,
+                     char * out, std::size_t capacity);
+
+// expand length bytes of compressed in into exactly size bytes of out;
+// false if the input is damaged or does not expand to size bytes
+bool decompress(const char * in, std::size_t length,
+                char * out, std::size_t size);
+
+}
+
+  #endif /* LZ_CODEC_H */
@@ -0,0 +1,169 @@
+/**
+ * See AsyncVSSD.h for header comment
+ */
+
+#include "AsyncVSSD.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+AsyncVSSD::AsyncVSSD(unique_ptr<VVSSD> disk, clock::duration p99Target,
+                     size_t maxDepth)
+    : disk(move(disk)),
+      controller(p99Target, 1, maxDepth),
+      // Without a worker no request would ever complete
+      workerCount(max<size_t>(maxDepth, 1)) {
+  if (this->disk == nullptr) {
+    cout << "ERROR: AsyncVSSD needs a disk\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = this->disk->status();
+}
+
+AsyncVSSD::~AsyncVSSD() { shutdown(); }
+
+void AsyncVSSD::shutdown() {
+  {
+    lock_guard<mutex> hold(mtx);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (auto& worker : workers)
+    if (worker.joinable()) worker.join();
+}
+
+void AsyncVSSD::enqueue(Pending pending) { queue.push_back(move(pending)); }
+
+bool AsyncVSSD::dequeue(Pending& next, clock::time_point& wakeAt) {
+  if (queue.empty()) return false;
+  next = move(queue.front());
+  queue.pop_front();
+  return true;
+}
+
+bool AsyncVSSD::queued() const { return !queue.empty(); }
+
+bool AsyncVSSD::abandoned(const Request& request, clock::time_point now) {
+  return now >= request.deadline ||
+         (request.cancellation && request.cancellation->cancelled());
+}
+
+void AsyncVSSD::drop(Pending& pending) {
+  droppedCount++;
+  pending.done.set_value(DiskStatus::CANCELLED);
+}
+
+void AsyncVSSD::work() {
+  unique_lock<mutex> hold(mtx);
+  while (true) {
+    if (stopping && !queued()) return;
+
+    // Wait for a free slot, then for the policy to release a request
+    Pending next;
+    clock::time_point wakeAt = clock::time_point::max();
+    if (inFlight >= controller.limit() || !dequeue(next, wakeAt)) {
+      if (wakeAt == clock::time_point::max())
+        ready.wait(hold);
+      else
+        ready.wait_until(hold, wakeAt);
+      continue;
+    }
+    // Last chance to skip work nobody is waiting for any more
+    if (abandoned(next.request, clock::now())) {
+      drop(next);
+      continue;
+    }
+    bool saturated = ++inFlight >= controller.limit();
+    hold.unlock();
+
+    Request& request = next.request;
+    auto start = clock::now();
+    DiskStatus ds =
+        (request.op == Request::READ)
+            ? disk->readBlocks(request.block, request.count, request.buffer)
+            : disk->writeBlocks(request.block, request.count, request.buffer);
+    controller.completed(clock::now() - start, saturated);
+    stat = ds;
+
+    hold.lock();
+    inFlight--;
+    // A slot opened (and the limit may have grown): let the next one go
+    ready.notify_all();
+    next.done.set_value(ds);
+  }
+}
+
+future<DiskStatus> AsyncVSSD::submit(Request request) {
+  if (disk == nullptr) {
+    promise<DiskStatus> refused;
+    refused.set_value(DiskStatus::ERROR);
+    return refused.get_future();
+  }
+
+  // Workers start here rather than in the constructor so that a
+  // subclass's queue is fully built before they use it
+  call_once(started, [&] {
+    for (size_t i = 0; i < workerCount; i++)
+      workers.emplace_back(&AsyncVSSD::work, this);
+  });
+
+  Pending pending{request, promise<DiskStatus>(), clock::now()};
+  future<DiskStatus> result = pending.done.get_future();
+  {
+    lock_guard<mutex> hold(mtx);
+    enqueue(move(pending));
+  }
+  ready.notify_all();
+  return result;
+}
+
+future<DiskStatus> AsyncVSSD::readAsync(blocknumber_t block, void* buffer) {
+  return submit(Request{Request::READ, block, 1, buffer});
+}
+
+future<DiskStatus> AsyncVSSD::writeAsync(blocknumber_t block, void* buffer) {
+  return submit(Request{Request::WRITE, block, 1, buffer});
+}
+
+size_t AsyncVSSD::queueDepth() const { return controller.limit(); }
+
+AsyncVSSD::clock::duration AsyncVSSD::p99Latency() const {
+  return controller.p99();
+}
+
+size_t AsyncVSSD::dropped() const { return droppedCount; }
+
+size_t AsyncVSSD::blockSize() const { return disk ? disk->blockSize() : 0; }
+
+size_t AsyncVSSD::blockCount() const {
+  return disk ? disk->blockCount() : 0;
+}
+
+DiskStatus AsyncVSSD::status() const { return stat; }
+
+DiskStatus AsyncVSSD::read(blocknumber_t block, void* buffer) {
+  return readAsync(block, buffer).get();
+}
+
+DiskStatus AsyncVSSD::write(blocknumber_t block, void* buffer) {
+  return writeAsync(block, buffer).get();
+}
+
+DiskStatus AsyncVSSD::readBlocks(blocknumber_t block, size_t count,
+                                 void* buffer) {
+  return submit(Request{Request::READ, block, count, buffer}).get();
+}
+
+DiskStatus AsyncVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                  void* buffer) {
+  return submit(Request{Request::WRITE, block, count, buffer}).get();
+}
+
+DiskStatus AsyncVSSD::sync() {
+  if (disk == nullptr) return stat;
+  stat = disk->sync();
+  return stat;
+}
@@ -0,0 +1,249 @@
+/**
+ * AsyncVSSD adds an asynchronous submission path in front of any VVSSD.
+ *
+ * Requests are queued with submit() (or readAsync/writeAsync) and return
+ * at once with a future for their status. A pool of worker threads
+ * dispatches queued requests to the wrapped disk, in arrival order,
+ * while the number in flight is below the limit chosen by a
+ * QueueDepthController: the limit grows while the device keeps up and is
+ * cut when the p99 dispatch-to-completion latency goes over the target.
+ * The depth therefore adapts to each host and image instead of being
+ * tuned by hand.
+ *
+ * AsyncVSSD is itself a VVSSD; the synchronous calls submit a request
+ * and wait for it, so it can stand in wherever a disk is expected.
+ * Buffers handed to submit() must stay valid until the future is ready.
+ * Destroying the AsyncVSSD completes every queued request first.
+ *
+ * A request may carry a deadline and a CancellationToken. One whose
+ * deadline has passed, or whose token was cancelled, by the time it
+ * would be dispatched is never sent to the disk; it completes with
+ * DiskStatus::CANCELLED, so an overloaded disk spends no bandwidth on
+ * answers nobody is waiting for. Requests already dispatched run to
+ * completion.
+ *
+ * The order in which queued requests go out is a policy: subclasses can
+ * replace the FIFO queue by overriding enqueue/dequeue/queued (see
+ * QoSVSSD). Workers start with the first submission, so the overrides
+ * are in place before they are ever called; a subclass destructor must
+ * call shutdown() before its own members go away.
+ */
+
+#ifndef ASYNCVSSD_H
+  #define ASYNCVSSD_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "QueueDepthController.h"
+#include "VVSSD.h"
+
+class AsyncVSSD : public VVSSD {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  /**
+   * Shared flag a submitter sets to call off requests that have not been
+   * dispatched yet. One token may cover any number of requests.
+   */
+  class CancellationToken {
+   public:
+    void cancel() { flag = true; }
+    bool cancelled() const { return flag; }
+
+   private:
+    std::atomic<bool> flag = false;
+  };
+
+  /**
+   * One queued disk operation on a contiguous extent of blocks.
+   */
+  struct Request {
+    enum Op { READ, WRITE };
+    Op op = READ;
+    blocknumber_t block = 0;
+    std::size_t count = 1;
+    void* buffer = nullptr;
+    /// scheduling tags; plain AsyncVSSD ignores them (see QoSVSSD)
+    unsigned int tenant = 0;
+    unsigned int priority = 0;
+    /// drop the request if it has not been dispatched by then
+    clock::time_point deadline = clock::time_point::max();
+    /// drop the request if this is cancelled before it is dispatched
+    std::shared_ptr<CancellationToken> cancellation;
+  };
+
+ protected:
+  /**
+   * A queued request and the promise its submitter is waiting on.
+   */
+  struct Pending {
+    Request request;
+    std::promise<DiskStatus> done;
+    clock::time_point queued;
+  };
+
+  /// guards the queue (and any subclass scheduling state)
+  mutable std::mutex mtx;
+
+  /**
+   * Add a submitted request to the queue. Called with mtx held.
+   */
+  virtual void enqueue(Pending pending);
+
+  /**
+   * Take the next request to dispatch if one may go now. If none may,
+   * return false and set wakeAt to when one might, or leave it at
+   * clock::time_point::max() if only a new submission can change that.
+   * Called with mtx held.
+   */
+  virtual bool dequeue(Pending& next, clock::time_point& wakeAt);
+
+  /**
+   * Return true if any request is queued. Called with mtx held.
+   */
+  virtual bool queued() const;
+
+  /**
+   * Return true if the request should be dropped instead of dispatched:
+   * its deadline has passed or it was cancelled.
+   */
+  static bool abandoned(const Request& request, clock::time_point now);
+
+  /**
+   * Complete an abandoned request with CANCELLED without dispatching it.
+   * Scheduling policies may drop requests this way while they choose.
+   */
+  void drop(Pending& pending);
+
+  /**
+   * Complete every queued request and stop the workers. Idempotent;
+   * subclasses that override the queue call it from their destructor.
+   */
+  void shutdown();
+
+ private:
+  std::unique_ptr<VVSSD> disk;
+  QueueDepthController controller;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+
+  std::condition_variable ready;
+  std::deque<Pending> queue;
+  std::size_t inFlight = 0;
+  std::atomic<std::size_t> droppedCount = 0;
+  bool stopping = false;
+  std::size_t workerCount;
+  std::once_flag started;
+  std::vector<std::thread> workers;
+
+  /**
+   * Worker thread body: take requests while the controller allows,
+   * run them against the disk and report their latency.
+   */
+  void work();
+
+ public:
+  /**
+   * AsyncVSSD Constructor
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : disk to submit requests to
+   * @param  {clock::duration} p99Target   : completion latency the p99
+   *                                         must stay under
+   * @param  {std::size_t} maxDepth        : most requests ever in flight
+   *                                         (one worker thread each; at
+   *                                         least 1)
+   */
+  AsyncVSSD(std::unique_ptr<VVSSD> disk, clock::duration p99Target,
+            std::size_t maxDepth = 32);
+
+  /**
+   * ~AsyncVSSD completes all queued requests, then stops the workers.
+   */
+  virtual ~AsyncVSSD();
+
+  /**
+   * Queue a request.
+   *
+   * @param  {Request} request : the operation; its buffer must stay
+   *                             valid until the future is ready
+   * @return {std::future<DiskStatus>} : status of the operation
+   */
+  std::future<DiskStatus> submit(Request request);
+
+  /**
+   * Queue a one-block read.
+   */
+  std::future<DiskStatus> readAsync(blocknumber_t block, void* buffer);
+
+  /**
+   * Queue a one-block write.
+   */
+  std::future<DiskStatus> writeAsync(blocknumber_t block, void* buffer);
+
+  /**
+   * Return the number of requests currently allowed in flight.
+   */
+  std::size_t queueDepth() const;
+
+  /**
+   * Return the p99 completion latency of the last controller window.
+   */
+  clock::duration p99Latency() const;
+
+  /**
+   * Return the number of requests dropped as expired or cancelled.
+   */
+  std::size_t dropped() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (the last completed request).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block, waiting for the queued request.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block, waiting for the queued request.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent, waiting for the queued request.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent, waiting for the queued request.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize the wrapped disk. Requests already completed are on the
+   * disk; queued ones are not waited for.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* ASYNCVSSD_H */
@@ -0,0 +1,369 @@
+/**
+ * See CompressedVSSD.h for header comment
+ */
+
+#include "CompressedVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "block_util.h"
+#include "fd_util.h"
+#include "lz_codec.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+static const size_t LengthBits = 24;
+
+uint64_t CompressedVSSD::pack(uint64_t granule, size_t length) {
+  return (granule << LengthBits) | length;
+}
+
+uint64_t CompressedVSSD::granuleOf(uint64_t entry) {
+  return entry >> LengthBits;
+}
+
+size_t CompressedVSSD::lengthOf(uint64_t entry) {
+  return entry & ((uint64_t(1) << LengthBits) - 1);
+}
+
+size_t CompressedVSSD::granulesFor(size_t length) {
+  return (length + Granule - 1) / Granule;
+}
+
+CompressedVSSD::CompressedVSSD(size_t block_size, size_t block_count,
+                               string filename) {
+  fn = filename;
+  bs = block_size;
+  bc = block_count;
+
+  if (bs == 0 || bs >= (size_t(1) << LengthBits)) {
+    cout << "ERROR: Block size must be between 1 and "
+         << (size_t(1) << LengthBits) - 1 << " bytes.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Open the file, truncating
+  fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  layout();
+
+  // Header, then an all-zero map: every block unwritten
+  char header[HeaderBytes] = {};
+  uint64_t fields[3] = {Signature, bs, bc};
+  memcpy(header, fields, sizeof(fields));
+  if (!pwrite_all(fd, header, sizeof(header), 0) ||
+      ftruncate(fd, dataStart) != 0) {
+    cout << "ERROR: Unable to initialize '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  stat = DiskStatus::OK;
+}
+
+CompressedVSSD::CompressedVSSD(string filename) {
+  fn = filename;
+
+  fd = open(filename.c_str(), O_RDWR);
+  struct stat info;
+  off_t fsize = 0;
+  if (fd >= 0 && fstat(fd, &info) == 0) fsize = info.st_size;
+  if (fsize == 0) {
+    cout << "ERROR: File '" << filename
+         << "' does not exist. Unable to open.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  uint64_t fields[3] = {};
+  if (!pread_all(fd, (char*)fields, sizeof(fields), 0) ||
+      fields[0] != Signature) {
+    cout << "ERROR: '" << filename << "' is not a compressed disk.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  bs = fields[1];
+  bc = fields[2];
+
+  // A damaged header must not size the map: the block size has to be
+  // one the map can describe and the whole map has to be in the file
+  if (bs == 0 || bs >= (size_t(1) << LengthBits) ||
+      (uint64_t)fsize < HeaderBytes ||
+      bc > ((uint64_t)fsize - HeaderBytes) / sizeof(uint64_t)) {
+    cout << "ERROR: File size does not match header information.\n";
+    bs = bc = 0;
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  layout();
+
+  if ((uint64_t)fsize < dataStart ||
+      !pread_all(fd, (char*)map.data(), bc * sizeof(uint64_t), HeaderBytes)) {
+    cout << "ERROR: File size does not match header information.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  dataGranules = granulesFor(fsize - dataStart);
+
+  for (uint64_t entry : map) {
+    size_t length = lengthOf(entry);
+    if (length > bs ||
+        (length > 0 && granuleOf(entry) + granulesFor(length) > dataGranules)) {
+      cout << "ERROR: The allocation map of '" << filename
+           << "' is damaged.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    stored += length;
+  }
+  rebuildFreeLists();
+
+  stat = DiskStatus::OK;
+}
+
+CompressedVSSD::~CompressedVSSD() {
+  if (fd >= 0) close(fd);
+}
+
+void CompressedVSSD::layout() {
+  size_t mapBytes = bc * sizeof(uint64_t);
+  dataStart = (HeaderBytes + mapBytes + 4095) / 4096 * 4096;
+  map.assign(bc, 0);
+  freeLists.assign(granulesFor(bs) + 1, vector<uint64_t>());
+}
+
+void CompressedVSSD::rebuildFreeLists() {
+  vector<pair<uint64_t, uint64_t>> used;  // first granule, granules
+  for (uint64_t entry : map)
+    if (lengthOf(entry) > 0)
+      used.emplace_back(granuleOf(entry), granulesFor(lengthOf(entry)));
+  sort(used.begin(), used.end());
+
+  // Gaps become free extents, cut to the largest size class
+  size_t largest = freeLists.size() - 1;
+  uint64_t at = 0;
+  used.emplace_back(dataGranules, 0);
+  for (auto [first, granules] : used) {
+    while (first > at) {
+      size_t piece = min<uint64_t>(first - at, largest);
+      release(at, piece);
+      at += piece;
+    }
+    at = max(at, first + granules);
+  }
+}
+
+uint64_t CompressedVSSD::allocate(size_t granules) {
+  lock_guard<mutex> hold(allocation);
+  if (!freeLists[granules].empty()) {
+    uint64_t granule = freeLists[granules].back();
+    freeLists[granules].pop_back();
+    return granule;
+  }
+  // Split the smallest larger extent; the rest goes back on its list
+  for (size_t larger = granules + 1; larger < freeLists.size(); larger++) {
+    if (freeLists[larger].empty()) continue;
+    uint64_t granule = freeLists[larger].back();
+    freeLists[larger].pop_back();
+    freeLists[larger - granules].push_back(granule + granules);
+    return granule;
+  }
+  // Grow the data area
+  uint64_t granule = dataGranules;
+  dataGranules += granules;
+  return granule;
+}
+
+void CompressedVSSD::release(uint64_t granule, size_t granules) {
+  if (granules == 0) return;
+  lock_guard<mutex> hold(allocation);
+  freeLists[granules].push_back(granule);
+}
+
+uint64_t CompressedVSSD::storedBytes() const { return stored; }
+
+size_t CompressedVSSD::blockSize() const { return bs; }
+
+size_t CompressedVSSD::blockCount() const { return bc; }
+
+DiskStatus CompressedVSSD::status() const { return stat; }
+
+DiskStatus CompressedVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus CompressedVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus CompressedVSSD::readBlock(blocknumber_t block, char* buffer,
+                                     char* scratch) {
+  uint64_t entry = map[block];
+  size_t length = lengthOf(entry);
+  off_t offset = dataStart + granuleOf(entry) * Granule;
+
+  if (length == 0) {
+    memset(buffer, 0, bs);
+  } else if (length == bs) {
+    // Stored raw
+    if (!pread_all(fd, buffer, bs, offset)) {
+      cout << "ERROR: Unable to read block " << block << "\n";
+      return DiskStatus::ERROR;
+    }
+  } else if (!pread_all(fd, scratch, length, offset) ||
+             !lz_codec::decompress(scratch, length, buffer, bs)) {
+    cout << "ERROR: Unable to expand block " << block << "\n";
+    return DiskStatus::ERROR;
+  }
+  return DiskStatus::OK;
+}
+
+DiskStatus CompressedVSSD::writeBlock(blocknumber_t block, const char* buffer,
+                                      char* scratch, uint64_t& entry) {
+  // Zero blocks take no space; others are kept compressed if that saves
+  // at least a granule
+  uint64_t word;
+  bool zero = block_util::same_filled(buffer, bs, word) && word == 0;
+  size_t length = 0;
+  const char* source = buffer;
+  if (!zero) {
+    size_t packed = lz_codec::compress(buffer, bs, scratch, bs);
+    if (packed > 0 && granulesFor(packed) < granulesFor(bs)) {
+      length = packed;
+      source = scratch;
+    } else {
+      length = bs;
+    }
+  }
+
+  entry = 0;
+  if (length == 0) return DiskStatus::OK;
+  uint64_t granule = allocate(granulesFor(length));
+  if (!pwrite_all(fd, source, length, dataStart + granule * Granule)) {
+    release(granule, granulesFor(length));
+    cout << "ERROR: Unable to write block " << block << "\n";
+    return DiskStatus::ERROR;
+  }
+  entry = pack(granule, length);
+  return DiskStatus::OK;
+}
+
+DiskStatus CompressedVSSD::readBlocks(blocknumber_t block, size_t count,
+                                      void* buffer) {
+  if (fd < 0) return stat = DiskStatus::ERROR;
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  vector<char> scratch(bs);
+  for (size_t i = 0; i < count; i++) {
+    DiskStatus ds =
+        readBlock(block + i, static_cast<char*>(buffer) + i * bs, scratch.data());
+    if (ds != DiskStatus::OK) return stat = ds;
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus CompressedVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                       void* buffer) {
+  if (fd < 0) return stat = DiskStatus::ERROR;
+
+  // Set to not ready. If command fails, status will still be not ready
+  stat = DiskStatus::NOT_READY;
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  // New contents go to new space and reach the device before the map
+  // entries that point at them
+  vector<char> scratch(bs);
+  vector<uint64_t> entries(count, 0);
+  bool written = false;
+  bool failed = false;
+  for (size_t i = 0; !failed && i < count; i++) {
+    failed = writeBlock(block + i, static_cast<const char*>(buffer) + i * bs,
+                        scratch.data(), entries[i]) != DiskStatus::OK;
+    written |= entries[i] != 0;
+  }
+  if (!failed && written && fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to sync the data\n";
+    failed = true;
+  }
+  if (failed) {
+    for (uint64_t entry : entries)
+      release(granuleOf(entry), granulesFor(lengthOf(entry)));
+    return stat = DiskStatus::ERROR;
+  }
+  if (!pwrite_all(fd, (const char*)entries.data(), count * sizeof(uint64_t),
+                  HeaderBytes + block * sizeof(uint64_t))) {
+    // Some entries may be out; keep their space rather than reuse it
+    cout << "ERROR: Unable to write the map\n";
+    return stat = DiskStatus::ERROR;
+  }
+
+  // The old contents must stay until the new map is surely on the
+  // device, so their space is free only after the next sync()
+  for (size_t i = 0; i < count; i++) {
+    uint64_t old = map[block + i];
+    map[block + i] = entries[i];
+    stored += lengthOf(entries[i]);
+    stored -= lengthOf(old);
+    if (lengthOf(old) == 0) continue;
+    lock_guard<mutex> hold(allocation);
+    pendingFree.emplace_back(granuleOf(old), granulesFor(lengthOf(old)));
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus CompressedVSSD::sync() {
+  // Space released before the fsync is free once it is done
+  vector<pair<uint64_t, size_t>> releasing;
+  {
+    lock_guard<mutex> hold(allocation);
+    releasing.swap(pendingFree);
+  }
+
+  // Push everything the kernel is holding for us out to the device
+  stat = DiskStatus::NOT_READY;
+  bool ok = fsync(fd) == 0;
+  if (ok) {
+    for (auto [granule, granules] : releasing) release(granule, granules);
+  } else {
+    lock_guard<mutex> hold(allocation);
+    pendingFree.insert(pendingFree.end(), releasing.begin(), releasing.end());
+  }
+  stat = ok ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
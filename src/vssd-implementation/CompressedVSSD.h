@@ -0,0 +1,201 @@
+/**
+ * CompressedVSSD stores every block compressed in a backing file.
+ *
+ * Blocks are compressed with the in-tree LZ codec (util/lz_codec) on
+ * write and expanded on read. A block that does not shrink by at least
+ * one allocation granule is stored raw; an all-zero block is not stored
+ * at all. Compressible images therefore move fewer bytes per logical
+ * byte and take less room on the host.
+ *
+ * The file holds a header, the allocation map and the data area:
+ *
+ *   | header (HeaderBytes) | map: 8 bytes per block | data ...
+ *
+ * Each map entry packs where a block's bytes are and how many there
+ * are: the offset into the data area in granules (40 bits) and the
+ * stored length in bytes (24 bits). A length of 0 is an unwritten (zero)
+ * block; a length equal to the block size is a raw block. Block sizes
+ * up to 16 MiB - 1 are supported.
+ *
+ * A rewritten block is stored in a new place, and a write's map entries
+ * are written only once its data has been flushed (fdatasync), so the
+ * map on the device never points at data that is not there. The old
+ * space goes back to a free list at the next sync(), once the new
+ * entries are surely on the device too: until then a crash leaves each
+ * block with its old contents or its new ones. There is one free list
+ * per size class (whole granules), rebuilt from the map when the file
+ * is opened; an allocation takes its class, or splits the smallest
+ * larger free extent, or grows the file.
+ *
+ * A RangeLock over block numbers keeps a block's map entry, and the
+ * extent it points at, from being replaced while it is read: readers
+ * of overlapping blocks share it, a writer holds its blocks alone. The
+ * allocator's free lists have their own mutex.
+ */
+
+#ifndef COMPRESSEDVSSD_H
+  #define COMPRESSEDVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class CompressedVSSD : public VVSSD {
+ public:
+  /// bytes reserved for the header at the start of the file
+  static const std::size_t HeaderBytes = 4096;
+  /// unit of allocation in the data area
+  static const std::size_t Granule = 16;
+
+ private:
+  std::string fn;
+  int fd = -1;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// offset of the data area in the file
+  std::uint64_t dataStart = 0;
+  /// in-memory copy of the map; an entry changes only under the
+  /// block's exclusive lock
+  std::vector<std::uint64_t> map;
+
+  std::mutex allocation;
+  /// free extents (granule offsets) by size in granules
+  std::vector<std::vector<std::uint64_t>> freeLists;
+  /// granules in the data area, free or not
+  std::uint64_t dataGranules = 0;
+  /// extents released since the last sync() (granule offset, granules)
+  std::vector<std::pair<std::uint64_t, std::size_t>> pendingFree;
+  std::atomic<std::uint64_t> stored = 0;
+
+  /// "VSSDLZ01" as a little-endian word
+  static const std::uint64_t Signature = 0x31305a4c44535356ull;
+
+  // Map entries: granule offset in the high 40 bits, length in the low 24
+  static std::uint64_t pack(std::uint64_t granule, std::size_t length);
+  static std::uint64_t granuleOf(std::uint64_t entry);
+  static std::size_t lengthOf(std::uint64_t entry);
+  static std::size_t granulesFor(std::size_t length);
+
+  /**
+   * Set up the map region and free lists; bs and bc must be set.
+   */
+  void layout();
+
+  /**
+   * Rebuild the free lists from the gaps between mapped extents.
+   */
+  void rebuildFreeLists();
+
+  /**
+   * Return the granule offset of a free extent of the given granules.
+   */
+  std::uint64_t allocate(std::size_t granules);
+
+  /**
+   * Return an extent to its free list.
+   */
+  void release(std::uint64_t granule, std::size_t granules);
+
+  DiskStatus readBlock(blocknumber_t block, char* buffer, char* scratch);
+
+  /**
+   * Store a block's new contents in fresh space and set entry to the map
+   * entry for them (0 for a zero block); the map is left alone.
+   */
+  DiskStatus writeBlock(blocknumber_t block, const char* buffer,
+                        char* scratch, std::uint64_t& entry);
+
+ public:
+  /**
+   * CompressedVSSD Constructor #1
+   * Creates a new file. Truncates if necessary.
+   *
+   * @param  {std::size_t} block_size  : amount of bytes in block
+   * @param  {std::size_t} block_count : amount of blocks
+   * @param  {std::string} filename    : filename
+   */
+  CompressedVSSD(std::size_t block_size, std::size_t block_count,
+                 std::string filename);
+
+  /**
+   * CompressedVSSD Constructor #2
+   * Opens an existing file, if header info is set right
+   *
+   * @param  {std::string} filename : filename to open
+   */
+  CompressedVSSD(std::string filename);
+
+  virtual ~CompressedVSSD();
+
+  /**
+   * Return the bytes of block data stored, after compression.
+   */
+  std::uint64_t storedBytes() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  DiskStatus status() const;
+
+  /**
+   * Read indicated block if possible, expanding it.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block if possible, compressing it.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize all in-memory structures out to the disk, then free the
+   * space of the contents replaced before it.
+   *
+   * @return returns a status code for the operation. OK if all went well.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* COMPRESSEDVSSD_H */
@@ -0,0 +1,310 @@
+/**
+ * See ContentStore.h for header comment
+ */
+
+#include "ContentStore.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "fd_util.h"
+
+using namespace std;
+
+static const uint64_t Signature = 0x3154534344535356;  // "VSSDCST1"
+/// signature, block size, slot count, view count, hash count, in use
+static const size_t HeaderFields = 6;
+/// longest view name
+static const size_t MaxName = 4096;
+
+ContentStore::ContentStore(unique_ptr<VVSSD> disk, string table)
+    : disk(move(disk)), fn(table), slots(this->disk->blockCount()) {
+  if (this->disk->status() != DiskStatus::OK) {
+    cout << "ERROR: Disk is not ready.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (fn.empty()) {
+    stat = DiskStatus::OK;
+    return;
+  }
+
+  // No table yet is a new, empty store
+  int fd = ::open(fn.c_str(), O_RDONLY);
+  if (fd < 0 && errno != ENOENT) {
+    cout << "ERROR: Unable to open '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (fd >= 0) {
+    struct stat info;
+    vector<char> contents;
+    bool read = fstat(fd, &info) == 0;
+    if (read) {
+      contents.resize(info.st_size);
+      read = fd_util::pread_all(fd, contents.data(), contents.size(), 0);
+    }
+    close(fd);
+    if (!read || !loadTable(contents)) {
+      cout << "ERROR: '" << fn << "' is not a content store table.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+  }
+  stat = saveTable(closedViews, true) ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+ContentStore::~ContentStore() {
+  // Every view is closed by now: each holds a reference to the store
+  if (fn.empty() || stat != DiskStatus::OK) return;
+  if (disk->sync() == DiskStatus::OK) saveTable(closedViews, false);
+}
+
+bool ContentStore::loadTable(const vector<char>& table) {
+  size_t at = 0;
+  auto take = [&](void* out, size_t bytes) {
+    if (table.size() - at < bytes) return false;
+    memcpy(out, &table[at], bytes);
+    at += bytes;
+    return true;
+  };
+
+  uint64_t fields[HeaderFields];
+  if (!take(fields, sizeof(fields)) || fields[0] != Signature ||
+      fields[1] != blockSize() || fields[2] != slots.size())
+    return false;
+  clean = fields[5] == 0;
+
+  for (uint64_t v = 0; v < fields[3]; v++) {
+    uint64_t sizes[2];  // name length, block count
+    if (!take(sizes, sizeof(sizes)) || sizes[0] > MaxName ||
+        sizes[1] > (table.size() - at) / sizeof(slot_t))
+      return false;
+    string name(sizes[0], '\0');
+    vector<slot_t> map(sizes[1]);
+    if (!take(name.data(), name.size()) ||
+        !take(map.data(), map.size() * sizeof(slot_t)) ||
+        closedViews.count(name) != 0)
+      return false;
+    for (slot_t s : map) {
+      if (s == NoSlot) continue;
+      if (s >= slots.size()) return false;
+      if (slots[s].references++ == 0) slotsReferenced++;
+      references++;
+      nextUnused = max(nextUnused, s + 1);
+    }
+    closedViews.emplace(move(name), move(map));
+  }
+
+  for (uint64_t h = 0; h < fields[4]; h++) {
+    uint64_t entry[3];  // slot, hash
+    if (!take(entry, sizeof(entry)) || entry[0] >= slots.size()) return false;
+    Slot& slot = slots[entry[0]];
+    if (slot.references == 0 || slot.indexed) return false;
+    slot.hash.low = entry[1];
+    slot.hash.high = entry[2];
+    slot.indexed = true;
+    index.emplace(slot.hash, entry[0]);
+  }
+  // Every slot in use needs its hash; the rest are free
+  for (slot_t s = nextUnused; s-- > 0;) {
+    if (slots[s].references > 0 && !slots[s].indexed) return false;
+    if (slots[s].references == 0) freeSlots.push_back(s);
+  }
+  return at == table.size();
+}
+
+bool ContentStore::saveTable(const map<string, vector<slot_t>>& views,
+                             bool inUse) {
+  vector<uint64_t> hashes;
+  vector<char> table(HeaderFields * sizeof(uint64_t));
+  auto put = [&](const void* in, size_t bytes) {
+    table.insert(table.end(), (const char*)in, (const char*)in + bytes);
+  };
+  {
+    lock_guard<mutex> hold(mtx);
+    vector<bool> seen(slots.size(), false);
+    for (auto& [name, map] : views) {
+      uint64_t sizes[2] = {name.size(), map.size()};
+      put(sizes, sizeof(sizes));
+      put(name.data(), name.size());
+      put(map.data(), map.size() * sizeof(slot_t));
+      // The hash of a slot is set before any map refers to it, and stays
+      // until the slot is reused, which waits for this table to be saved
+      for (slot_t s : map) {
+        if (s == NoSlot || seen[s]) continue;
+        seen[s] = true;
+        hashes.insert(hashes.end(), {s, slots[s].hash.low, slots[s].hash.high});
+      }
+    }
+  }
+  put(hashes.data(), hashes.size() * sizeof(uint64_t));
+  uint64_t fields[HeaderFields] = {Signature,    blockSize(),
+                                   slots.size(), views.size(),
+                                   hashes.size() / 3, inUse};
+  memcpy(table.data(), fields, sizeof(fields));
+
+  // Replace the old table only once the new one is safely written
+  string temp = fn + ".tmp";
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && fd_util::pwrite_all(fd, table.data(), table.size(), 0) &&
+            fsync(fd) == 0;
+  if (fd >= 0) close(fd);
+  if (ok) ok = rename(temp.c_str(), fn.c_str()) == 0;
+  if (!ok) {
+    unlink(temp.c_str());
+    cout << "ERROR: Unable to write '" << fn << "'.\n";
+  }
+  return ok;
+}
+
+DiskStatus ContentStore::status() const { return stat; }
+
+bool ContentStore::closedCleanly() const { return clean; }
+
+bool ContentStore::openView(const string& name, size_t block_count,
+                            vector<slot_t>& map, MapCopier copier) {
+  lock_guard<mutex> views(viewMtx);
+  if (openViews.count(name) != 0) {
+    cout << "ERROR: View '" << name << "' is open already.\n";
+    return false;
+  }
+  auto saved = closedViews.find(name);
+  if (saved == closedViews.end()) {
+    map.assign(block_count, NoSlot);
+  } else if (saved->second.size() != block_count) {
+    cout << "ERROR: View '" << name << "' has " << saved->second.size()
+         << " blocks, not " << block_count << ".\n";
+    return false;
+  } else {
+    map = move(saved->second);
+    closedViews.erase(saved);
+  }
+  openViews.emplace(name, move(copier));
+  return true;
+}
+
+void ContentStore::closeView(const string& name, vector<slot_t> map) {
+  lock_guard<mutex> views(viewMtx);
+  openViews.erase(name);
+  closedViews[name] = move(map);
+}
+
+bool ContentStore::dropView(const string& name) {
+  lock_guard<mutex> views(viewMtx);
+  auto saved = closedViews.find(name);
+  if (saved == closedViews.end()) return false;
+  for (slot_t s : saved->second)
+    if (s != NoSlot) release(s);
+  closedViews.erase(saved);
+  return true;
+}
+
+DiskStatus ContentStore::sync() {
+  if (stat != DiskStatus::OK) return stat;
+  if (fn.empty()) return disk->sync();
+
+  lock_guard<mutex> views(viewMtx);
+  // Slots collected from here on may be in the maps about to be saved
+  vector<slot_t> releasing;
+  {
+    lock_guard<mutex> hold(mtx);
+    releasing.swap(pendingSlots);
+  }
+  map<string, vector<slot_t>> maps = closedViews;
+  for (auto& [name, copier] : openViews) maps[name] = copier();
+
+  // Slot data first, then the table that refers to it
+  bool ok = disk->sync() == DiskStatus::OK && saveTable(maps, true);
+  lock_guard<mutex> hold(mtx);
+  vector<slot_t>& to = ok ? freeSlots : pendingSlots;
+  to.insert(to.end(), releasing.begin(), releasing.end());
+  return ok ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+size_t ContentStore::blockSize() const { return disk->blockSize(); }
+
+ContentStore::slot_t ContentStore::acquire(const char* block) {
+  hash_util::Hash128 hash = hash_util::murmur3_128(block, blockSize());
+  lock_guard<mutex> hold(mtx);
+
+  // Known content (even garbage not yet collected): just count it
+  auto found = index.find(hash);
+  if (found != index.end()) {
+    Slot& slot = slots[found->second];
+    if (slot.references++ == 0) slotsReferenced++;
+    references++;
+    return found->second;
+  }
+
+  slot_t s;
+  if (!freeSlots.empty()) {
+    s = freeSlots.back();
+    freeSlots.pop_back();
+  } else if (nextUnused < slots.size()) {
+    s = nextUnused++;
+  } else {
+    cout << "ERROR: The content store is full\n";
+    return NoSlot;
+  }
+  if (disk->write(s, const_cast<char*>(block)) != DiskStatus::OK) {
+    freeSlots.push_back(s);
+    return NoSlot;
+  }
+
+  slots[s].hash = hash;
+  slots[s].references = 1;
+  slots[s].indexed = true;
+  index.emplace(hash, s);
+  slotsReferenced++;
+  references++;
+  return s;
+}
+
+void ContentStore::release(slot_t s) {
+  lock_guard<mutex> hold(mtx);
+  // Left indexed until collected, so the content can still be revived
+  if (--slots[s].references == 0) slotsReferenced--;
+  references--;
+}
+
+DiskStatus ContentStore::read(slot_t s, char* buffer) const {
+  // Referenced slots are never rewritten, so no lock is needed here
+  return disk->read(s, buffer);
+}
+
+size_t ContentStore::collectGarbage() {
+  lock_guard<mutex> hold(mtx);
+  size_t freed = 0;
+  for (slot_t s = 0; s < nextUnused; s++) {
+    Slot& slot = slots[s];
+    if (!slot.indexed || slot.references > 0) continue;
+    index.erase(slot.hash);
+    slot.indexed = false;
+    // The saved table may still use it until the next one replaces it
+    (fn.empty() ? freeSlots : pendingSlots).push_back(s);
+    freed++;
+  }
+  return freed;
+}
+
+uint64_t ContentStore::slotsInUse() const {
+  lock_guard<mutex> hold(mtx);
+  return slotsReferenced;
+}
+
+uint64_t ContentStore::referenceCount() const {
+  lock_guard<mutex> hold(mtx);
+  return references;
+}
+
+double ContentStore::dedupRatio() const {
+  lock_guard<mutex> hold(mtx);
+  return slotsReferenced == 0 ? 1.0 : (double)references / slotsReferenced;
+}
@@ -0,0 +1,217 @@
+/**
+ * ContentStore keeps each distinct block content once, for any number
+ * of DedupVSSD views.
+ *
+ * Contents live in slots, the blocks of a backing VVSSD. Each content is
+ * hashed (MurmurHash3 x64_128) and found through a hash -> slot index,
+ * so storing a block whose content is already present costs an index
+ * lookup and a reference count increment instead of a data write.
+ *
+ * A slot whose count drops to zero is not reused at once: it stays in
+ * the index, and a later write of the same content revives it for free.
+ * collectGarbage() removes such slots from the index and frees them for
+ * new contents.
+ *
+ * Identical hashes are taken to mean identical contents; at 128 bits a
+ * collision among non-adversarial blocks is not a practical concern.
+ *
+ * Given a table filename, the store persists: sync() saves the map of
+ * every named view (open or not) and the hash of every slot they use to
+ * the table, and a store opened on that table later gets them back. The
+ * reference counts and the free slots are rebuilt from the maps, so
+ * they cannot disagree with them. The table is written to a temporary
+ * file and renamed over the old one once the backing disk and it are
+ * synced, so a crash leaves the views as they were at the last sync().
+ * Slots the last saved table may still use are not reused until the
+ * next sync() has replaced it: collectGarbage() only frees them then.
+ * The table is marked in use while the store is open; closedCleanly()
+ * tells whether the last session ended with the store being destroyed
+ * (and its final state saved) rather than with a crash.
+ *
+ * One mutex guards the slots and another the views, taken before a
+ * view's own locks when the views are saved.
+ */
+
+#ifndef CONTENTSTORE_H
+  #define CONTENTSTORE_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "VVSSD.h"
+#include "hash_util.h"
+
+class ContentStore {
+ public:
+  typedef std::uint64_t slot_t;
+  /// returned when a content cannot be stored (store full, or I/O error)
+  static constexpr slot_t NoSlot = UINT64_MAX;
+  /// returns a consistent copy of an open view's map
+  typedef std::function<std::vector<slot_t>()> MapCopier;
+
+ private:
+  struct Slot {
+    hash_util::Hash128 hash;
+    std::uint64_t references = 0;
+    bool indexed = false;
+  };
+
+  std::unique_ptr<VVSSD> disk;
+  std::string fn;
+  DiskStatus stat = DiskStatus::NOT_READY;
+  bool clean = true;
+
+  /// guards the views and saving them
+  std::mutex viewMtx;
+  /// maps of the named views that are not open
+  std::map<std::string, std::vector<slot_t>> closedViews;
+  std::map<std::string, MapCopier> openViews;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  std::unordered_map<hash_util::Hash128, slot_t, hash_util::Hash128Hasher>
+      index;
+  std::vector<Slot> slots;
+  std::vector<slot_t> freeSlots;
+  /// collected, but maybe still used by the saved table
+  std::vector<slot_t> pendingSlots;
+  /// slots never used so far start here
+  slot_t nextUnused = 0;
+  std::uint64_t references = 0;
+  std::uint64_t slotsReferenced = 0;
+
+  /**
+   * Load the table: the views' maps and their slots' hashes, then the
+   * counts and free slots they imply. Returns false if it is damaged.
+   */
+  bool loadTable(const std::vector<char>& table);
+
+  /**
+   * Write views (name, map) and their slots' hashes to the table, marked
+   * in use or not, through a temporary file.
+   */
+  bool saveTable(const std::map<std::string, std::vector<slot_t>>& views,
+                 bool inUse);
+
+ public:
+  /**
+   * ContentStore Constructor
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : disk whose blocks are the slots
+   * @param  {std::string} table           : filename of the table that
+   *                                         persists the views (none: the
+   *                                         store lives in memory only)
+   */
+  explicit ContentStore(std::unique_ptr<VVSSD> disk, std::string table = "");
+
+  /**
+   * ~ContentStore saves the table one last time, marked closed.
+   */
+  ~ContentStore();
+
+  ContentStore(const ContentStore&) = delete;
+  ContentStore& operator=(const ContentStore&) = delete;
+
+  /**
+   * Return OK once the store is ready (its table loaded), ERROR if not.
+   */
+  DiskStatus status() const;
+
+  /**
+   * Return false if the table was left in use: the store was not
+   * destroyed at the end of its last session, which lost the writes
+   * made since its last sync().
+   */
+  bool closedCleanly() const;
+
+  /**
+   * Open a named view: its map as last saved (the references it holds
+   * are already counted), or all NoSlot for a new view.
+   *
+   * @param  {std::string} name           : the view's name
+   * @param  {std::size_t} block_count    : the view's size; must match
+   *                                        a saved view's
+   * @param  {std::vector<slot_t>&} map   : set to the view's map
+   * @param  {MapCopier} copier           : how sync() reads the map
+   * @return {bool}                       : false if the view is open
+   *                                        already or has another size
+   */
+  bool openView(const std::string& name, std::size_t block_count,
+                std::vector<slot_t>& map, MapCopier copier);
+
+  /**
+   * Close a named view, keeping its map (and its references) for the
+   * next openView().
+   */
+  void closeView(const std::string& name, std::vector<slot_t> map);
+
+  /**
+   * Release every reference of a named view that is not open and forget
+   * it.
+   *
+   * @return {bool} : false if it is open or unknown
+   */
+  bool dropView(const std::string& name);
+
+  /**
+   * Save the table (see above). Without a table, just sync the disk.
+   */
+  DiskStatus sync();
+
+  /**
+   * Return the size (in bytes) of the contents stored.
+   */
+  std::size_t blockSize() const;
+
+  /**
+   * Store a block's content (or find it stored) and take a reference to
+   * it.
+   *
+   * @param  {const char*} block : blockSize() bytes of content
+   * @return {slot_t}            : slot holding the content, or NoSlot
+   */
+  slot_t acquire(const char* block);
+
+  /**
+   * Drop a reference taken by acquire().
+   */
+  void release(slot_t slot);
+
+  /**
+   * Copy a slot's content to buffer.
+   */
+  DiskStatus read(slot_t slot, char* buffer) const;
+
+  /**
+   * Free every slot no longer referenced; with a table, for reuse after
+   * the next sync().
+   *
+   * @return {std::size_t} : number of slots freed
+   */
+  std::size_t collectGarbage();
+
+  /**
+   * Return the number of slots holding referenced content.
+   */
+  std::uint64_t slotsInUse() const;
+
+  /**
+   * Return the references held on slots: the blocks stored through the
+   * store, before deduplication.
+   */
+  std::uint64_t referenceCount() const;
+
+  /**
+   * Return references per slot in use (1.0 with nothing shared, or
+   * nothing stored).
+   */
+  double dedupRatio() const;
+};
+
+  #endif /* CONTENTSTORE_H */
@@ -0,0 +1,128 @@
+/**
+ * See DedupVSSD.h for header comment
+ */
+
+#include "DedupVSSD.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "block_util.h"
+
+using namespace std;
+
+DedupVSSD::DedupVSSD(shared_ptr<ContentStore> store, size_t block_count,
+                     string name)
+    : store(store), bc(block_count), name(name) {
+  if (store->status() != DiskStatus::OK) {
+    cout << "ERROR: The content store is not ready.\n";
+    bc = 0;
+    this->name.clear();
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (name.empty()) {
+    map.assign(bc, ContentStore::NoSlot);
+  } else if (!store->openView(name, bc, map, [this] {
+               // Whole, as of one moment
+               auto held = locks.lock(0, bc, RangeLock::SHARED);
+               return map;
+             })) {
+    bc = 0;
+    this->name.clear();
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = DiskStatus::OK;
+}
+
+DedupVSSD::~DedupVSSD() {
+  // A named view's blocks stay in the store for the next time it opens
+  if (!name.empty()) {
+    store->closeView(name, move(map));
+    return;
+  }
+  for (auto slot : map)
+    if (slot != ContentStore::NoSlot) store->release(slot);
+}
+
+double DedupVSSD::dedupRatio() const { return store->dedupRatio(); }
+
+size_t DedupVSSD::blockSize() const { return store->blockSize(); }
+
+size_t DedupVSSD::blockCount() const { return bc; }
+
+DiskStatus DedupVSSD::status() const { return stat; }
+
+DiskStatus DedupVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus DedupVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus DedupVSSD::readBlocks(blocknumber_t block, size_t count,
+                                 void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  size_t bs = blockSize();
+  for (size_t i = 0; i < count; i++) {
+    char* out = static_cast<char*>(buffer) + i * bs;
+    ContentStore::slot_t slot = map[block + i];
+    if (slot == ContentStore::NoSlot) {
+      memset(out, 0, bs);
+    } else {
+      DiskStatus ds = store->read(slot, out);
+      if (ds != DiskStatus::OK) return stat = ds;
+    }
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus DedupVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                  void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  size_t bs = blockSize();
+  for (size_t i = 0; i < count; i++) {
+    const char* in = static_cast<const char*>(buffer) + i * bs;
+    uint64_t word;
+    ContentStore::slot_t slot = ContentStore::NoSlot;
+    if (!(block_util::same_filled(in, bs, word) && word == 0)) {
+      slot = store->acquire(in);
+      if (slot == ContentStore::NoSlot) return stat = DiskStatus::ERROR;
+    }
+    // Take the new reference before dropping the old: rewriting a block
+    // with its own content must not let its slot go
+    ContentStore::slot_t old = map[block + i];
+    map[block + i] = slot;
+    if (old != ContentStore::NoSlot) store->release(old);
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus DedupVSSD::sync() {
+  stat = store->sync();
+  return stat;
+}
@@ -0,0 +1,128 @@
+/**
+ * DedupVSSD is a deduplicating disk: a view whose blocks are references
+ * into a ContentStore.
+ *
+ * Each logical block maps to the store slot holding its content, so
+ * blocks with the same content (within one disk or across every view
+ * sharing the store) are kept once. Writing a block whose content is
+ * already stored updates the map and a reference count; no data is
+ * written. All-zero blocks map to no slot at all, and a block never
+ * written reads as zeros.
+ *
+ * Overwritten contents lose a reference; the store reclaims slots left
+ * without any when collectGarbage() runs. Destroying a view releases
+ * its references, unless the view is named: the store then keeps its
+ * map, and a view opened later under the same name carries on from it.
+ * With a table behind the store, named views outlast the process; see
+ * ContentStore for when their maps are saved.
+ *
+ * A RangeLock over block numbers guards this view's map: readers of
+ * overlapping blocks share it, and a writer holds its blocks alone
+ * while it swaps their slot references. The store locks its own slots.
+ */
+
+#ifndef DEDUPVSSD_H
+  #define DEDUPVSSD_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ContentStore.h"
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class DedupVSSD : public VVSSD {
+ private:
+  std::shared_ptr<ContentStore> store;
+  std::size_t bc;
+  std::string name;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+  /// slot of each block, or NoSlot for a zero block; an entry changes
+  /// only under the block's exclusive lock
+  std::vector<ContentStore::slot_t> map;
+
+ public:
+  /**
+   * DedupVSSD Constructor. All blocks start out zero, except in a named
+   * view the store already knows.
+   *
+   * @param  {std::shared_ptr<ContentStore>} store : where contents live;
+   *                                                 sets the block size
+   * @param  {std::size_t} block_count             : the amount of blocks
+   * @param  {std::string} name                    : the view's name in
+   *                                                 the store, if it is
+   *                                                 to be kept
+   */
+  DedupVSSD(std::shared_ptr<ContentStore> store, std::size_t block_count,
+            std::string name = "");
+
+  /**
+   * ~DedupVSSD releases every block's reference, or leaves a named
+   * view's map with the store.
+   */
+  virtual ~DedupVSSD();
+
+  /**
+   * Return the store's ratio of blocks written to contents kept.
+   */
+  double dedupRatio() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block if possible.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block if possible; identical contents are shared.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Sync the store, saving the maps of the named views (this one
+   * included) if it has a table.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* DEDUPVSSD_H */
@@ -0,0 +1,301 @@
+/**
+ * See ErasureVSSD.h for header comment
+ */
+
+#include "ErasureVSSD.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "gf_util.h"
+
+using namespace std;
+
+ErasureVSSD::ErasureVSSD(vector<unique_ptr<VVSSD>> disks,
+                         size_t data_children)
+    : k(data_children) {
+  size_t n = disks.size();
+  if (k == 0 || n < k || n > MaxChildren) {
+    cout << "ERROR: Need 1 to " << MaxChildren
+         << " children, at least the data children.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  size_t size = 0;
+  size_t present = 0;
+  size_t stripes = SIZE_MAX;
+  for (auto& disk : disks) {
+    if (disk == nullptr) continue;
+    if (size == 0) size = disk->blockSize();
+    if (disk->status() != DiskStatus::OK || disk->blockSize() != size) {
+      cout << "ERROR: Children must be ready and share one block size.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    present++;
+    stripes = min(stripes, disk->blockCount());
+  }
+  if (present < k) {
+    cout << "ERROR: Only " << present << " children of the " << k
+         << " needed are present.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  for (auto& disk : disks) {
+    children.push_back(make_unique<Child>());
+    children.back()->failed = disk == nullptr;
+    children.back()->disk = move(disk);
+  }
+  m = n - k;
+  // Cauchy rows: 1 / (x_i + y_j) with x_i = k + i and y_j = j all distinct
+  cauchy.resize(m * k);
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < k; j++)
+      cauchy[i * k + j] = gf_util::inverse((uint8_t)((k + i) ^ j));
+  bs = size;
+  bc = k * stripes;
+  lanes = make_unique<LanePool>(n);
+  stat = DiskStatus::OK;
+}
+
+ErasureVSSD::~ErasureVSSD() {}
+
+size_t ErasureVSSD::dataChildren() const { return k; }
+
+size_t ErasureVSSD::parityChildren() const { return m; }
+
+bool ErasureVSSD::childFailed(size_t child) const {
+  return children.at(child)->failed;
+}
+
+size_t ErasureVSSD::blockSize() const { return bs; }
+
+size_t ErasureVSSD::blockCount() const { return bc; }
+
+DiskStatus ErasureVSSD::status() const { return stat; }
+
+DiskStatus ErasureVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus ErasureVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+void ErasureVSSD::readColumns(const vector<size_t>& which, blocknumber_t first,
+                              size_t count, Columns& columns,
+                              vector<bool>& have) {
+  vector<DiskStatus> results(children.size(), DiskStatus::ERROR);
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t c : which) {
+    columns[c].resize(count * bs);
+    jobs.emplace_back(c, [&, c] {
+      return results[c] =
+                 children[c]->disk->readBlocks(first, count, columns[c].data());
+    });
+  }
+  lanes->run(jobs);
+
+  for (size_t c : which) {
+    if (results[c] == DiskStatus::OK) {
+      have[c] = true;
+      continue;
+    }
+    cout << "ERROR: Child " << c << " failed a read; dropping it\n";
+    children[c]->failed = true;
+  }
+}
+
+DiskStatus ErasureVSSD::gather(blocknumber_t first, size_t count,
+                               const vector<bool>& want, Columns& columns) {
+  size_t n = children.size();
+  vector<bool> have(n, false);
+  vector<bool> tried(n, false);
+  vector<size_t> which;
+  for (size_t c = 0; c < k; c++)
+    if (want[c] && !children[c]->failed) which.push_back(c);
+
+  vector<size_t> missing;
+  while (true) {
+    for (size_t c : which) tried[c] = true;
+    readColumns(which, first, count, columns, have);
+
+    missing.clear();
+    for (size_t c = 0; c < k; c++)
+      if (want[c] && !have[c]) missing.push_back(c);
+    if (missing.empty()) return DiskStatus::OK;
+
+    // Make up k columns to decode from, trying children not read yet
+    size_t sources = count_if(have.begin(), have.end(), [](bool h) { return h; });
+    if (sources >= k) break;
+    which.clear();
+    for (size_t c = 0; c < n && sources + which.size() < k; c++)
+      if (!tried[c] && !children[c]->failed) which.push_back(c);
+    if (sources + which.size() < k) {
+      cout << "ERROR: Too few children left to recover the data\n";
+      return DiskStatus::ERROR;
+    }
+  }
+
+  // Rows of the generator for k children we have, inverted, give the
+  // data in terms of those children's columns
+  vector<size_t> sources;
+  for (size_t c = 0; c < n && sources.size() < k; c++)
+    if (have[c]) sources.push_back(c);
+  vector<uint8_t> matrix(k * k, 0);
+  for (size_t r = 0; r < k; r++) {
+    if (sources[r] < k)
+      matrix[r * k + sources[r]] = 1;
+    else
+      memcpy(&matrix[r * k], &cauchy[(sources[r] - k) * k], k);
+  }
+  if (!gf_util::invert_matrix(matrix.data(), k)) {
+    cout << "ERROR: Singular decoding matrix\n";
+    return DiskStatus::ERROR;
+  }
+
+  size_t length = count * bs;
+  for (size_t j : missing) {
+    columns[j].resize(length);
+    for (size_t r = 0; r < k; r++)
+      gf_util::multiply_region(columns[j].data(), columns[sources[r]].data(),
+                               matrix[j * k + r], length, r > 0);
+  }
+  return DiskStatus::OK;
+}
+
+void ErasureVSSD::encode(Columns& columns, size_t length) {
+  for (size_t i = 0; i < m; i++) {
+    columns[k + i].resize(length);
+    for (size_t j = 0; j < k; j++)
+      gf_util::multiply_region(columns[k + i].data(), columns[j].data(),
+                               cauchy[i * k + j], length, j > 0);
+  }
+}
+
+DiskStatus ErasureVSSD::readBlocks(blocknumber_t block, size_t count,
+                                   void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  blocknumber_t first = block / k;
+  size_t stripes = (block + count - 1) / k - first + 1;
+  // Readers of overlapping stripes share; writers wait for us
+  auto held = locks.lock(first, first + stripes, RangeLock::SHARED);
+
+  vector<bool> want(children.size(), false);
+  for (size_t i = 0; i < min(count, k); i++) want[(block + i) % k] = true;
+  Columns columns(children.size());
+  stat = gather(first, stripes, want, columns);
+  if (stat != DiskStatus::OK) return stat;
+
+  char* bytes = static_cast<char*>(buffer);
+  for (size_t i = 0; i < count; i++) {
+    blocknumber_t b = block + i;
+    memcpy(bytes + i * bs, &columns[b % k][(b / k - first) * bs], bs);
+  }
+  return stat;
+}
+
+DiskStatus ErasureVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  size_t n = children.size();
+  blocknumber_t first = block / k;
+  blocknumber_t last = (block + count - 1) / k;
+  size_t stripes = last - first + 1;
+  // One writer per stripe, as a write rewrites its stripes' parity
+  auto held = locks.lock(first, last + 1, RangeLock::EXCLUSIVE);
+
+  Columns columns(n);
+  for (size_t c = 0; c < k; c++) columns[c].resize(stripes * bs);
+
+  // Partly covered stripes (only the first and last can be) need the
+  // data this write leaves alone; covered ones skip reading entirely
+  vector<blocknumber_t> edges = {first};
+  if (last != first) edges.push_back(last);
+  for (blocknumber_t s : edges) {
+    vector<bool> want(n, false);
+    bool partial = false;
+    for (size_t c = 0; c < k; c++) {
+      blocknumber_t b = s * k + c;
+      want[c] = b < block || b >= block + count;
+      partial |= want[c];
+    }
+    if (!partial) continue;
+
+    Columns old(n);
+    stat = gather(s, 1, want, old);
+    if (stat != DiskStatus::OK) return stat;
+    for (size_t c = 0; c < k; c++)
+      if (want[c]) memcpy(&columns[c][(s - first) * bs], old[c].data(), bs);
+  }
+
+  const char* bytes = static_cast<const char*>(buffer);
+  for (size_t i = 0; i < count; i++) {
+    blocknumber_t b = block + i;
+    memcpy(&columns[b % k][(b / k - first) * bs], bytes + i * bs, bs);
+  }
+  encode(columns, stripes * bs);
+
+  // Parity changes in every stripe, but a data child only where this
+  // write gives it new blocks: in covered stripes that is every child,
+  // while a partial write leaves the others' blocks as they were
+  vector<DiskStatus> results(n, DiskStatus::ERROR);
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t c = 0; c < n; c++) {
+    if (children[c]->failed) continue;
+    blocknumber_t from = first;
+    blocknumber_t end = last + 1;
+    if (c < k) {
+      // The edge stripes count if they hold one of child c's new blocks
+      if (block > first * k + c) from++;
+      if (block + count - 1 < last * k + c) end--;
+      if (from >= end) continue;
+    }
+    jobs.emplace_back(c, [&, c, from, end] {
+      return results[c] = children[c]->disk->writeBlocks(
+                 from, end - from, &columns[c][(from - first) * bs]);
+    });
+  }
+  lanes->run(jobs);
+
+  // A child that missed a write is stale from now on
+  for (auto& job : jobs) {
+    if (results[job.first] == DiskStatus::OK) continue;
+    cout << "ERROR: Child " << job.first << " failed a write; dropping it\n";
+    children[job.first]->failed = true;
+  }
+  size_t healthy = 0;
+  for (auto& child : children) healthy += !child->failed;
+  if (healthy < k) {
+    cout << "ERROR: Too few children left to hold the data\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus ErasureVSSD::sync() {
+  if (lanes == nullptr) return stat;
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t c = 0; c < children.size(); c++)
+    if (!children[c]->failed)
+      jobs.emplace_back(c, [this, c] { return children[c]->disk->sync(); });
+  stat = lanes->run(jobs);
+  return stat;
+}
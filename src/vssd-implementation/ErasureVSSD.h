@@ -0,0 +1,180 @@
+/**
+ * ErasureVSSD stores its blocks Reed-Solomon coded over k + m child
+ * disks (any VVSSDs of the same block size): any k of the children are
+ * enough to recover everything, so up to m of them may be missing or
+ * fail, as with an (m + 1)-way mirror, for k + m blocks of space per k
+ * blocks of data rather than (m + 1) k.
+ *
+ * Stripe s is block s of every child: logical block b is data block
+ * b % k of stripe b / k and lives on child b % k; children k .. k+m-1
+ * hold the stripe's m parity blocks. Parity row i is row i of a Cauchy
+ * matrix over GF(2^8), so every k x k submatrix of the whole generator
+ * [identity; Cauchy] is invertible. Encoding and decoding multiply whole
+ * columns (a child's run of stripes) by a constant at a time with
+ * gf_util's pshufb kernels, picked for the CPU at run time.
+ *
+ * A read fetches the data children it needs in parallel (a LanePool
+ * lane per child). If any of them is missing or fails, further
+ * children are read until k are at hand and the missing columns are
+ * decoded from them. A write re-encodes the stripes it touches: stripes
+ * it covers completely are encoded from the new data alone, while the
+ * (at most two) partly covered ones first read the rest of their data
+ * (read-modify-write). The parity columns then go to their children in
+ * parallel, along with each data column's run of new blocks: a partial
+ * write leaves alone the data children (and edge stripes) it does not
+ * touch, so only full stripes rewrite every child.
+ *
+ * A child that fails a read or write is marked failed and left alone
+ * from then on (there is no rebuild); the disk stays usable while at
+ * least k children remain. Reads share and writes exclude a RangeLock
+ * over the stripes they touch, since a partial write rewrites its
+ * stripes' parity.
+ */
+
+#ifndef ERASUREVSSD_H
+  #define ERASUREVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "LanePool.h"
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class ErasureVSSD : public VVSSD {
+ public:
+  /// the most children GF(2^8) Cauchy codes allow
+  static const std::size_t MaxChildren = 256;
+
+ private:
+  struct Child {
+    std::unique_ptr<VVSSD> disk;
+    std::atomic<bool> failed = false;
+  };
+
+  // A run of stripes of every child: columns[c] holds child c's blocks
+  typedef std::vector<std::vector<std::uint8_t>> Columns;
+
+  std::vector<std::unique_ptr<Child>> children;
+  std::size_t k = 0;
+  std::size_t m = 0;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  // Row-major m x k parity rows of the generator
+  std::vector<std::uint8_t> cauchy;
+  RangeLock locks;
+  std::unique_ptr<LanePool> lanes;
+
+  /**
+   * Read the given children's blocks of stripes [first, first + count)
+   * into columns, in parallel; a child that fails is marked failed.
+   * Sets have[c] for every column read.
+   */
+  void readColumns(const std::vector<std::size_t>& which,
+                   blocknumber_t first, std::size_t count, Columns& columns,
+                   std::vector<bool>& have);
+
+  /**
+   * Fill the data columns in want for stripes [first, first + count),
+   * reading them or, when their children are gone, decoding them from k
+   * others.
+   */
+  DiskStatus gather(blocknumber_t first, std::size_t count,
+                    const std::vector<bool>& want, Columns& columns);
+
+  /**
+   * Compute the parity columns from the k data columns.
+   */
+  void encode(Columns& columns, std::size_t length);
+
+ public:
+  /**
+   * ErasureVSSD Constructor
+   * Codes over children, the first data_children of which hold data and
+   * the rest parity. A missing child may be given as nullptr; at least
+   * data_children must be present, ready and of one block size.
+   *
+   * @param  {std::vector<std::unique_ptr<VVSSD>>} children : the disks
+   * @param  {std::size_t} data_children                    : k
+   */
+  ErasureVSSD(std::vector<std::unique_ptr<VVSSD>> children,
+              std::size_t data_children);
+
+  virtual ~ErasureVSSD();
+
+  /**
+   * Return the number of data children, k.
+   */
+  std::size_t dataChildren() const;
+
+  /**
+   * Return the number of parity children, m.
+   */
+  std::size_t parityChildren() const;
+
+  /**
+   * Return true if the child is missing or has failed.
+   *
+   * @param  {std::size_t} child : index, in the order given
+   */
+  bool childFailed(std::size_t child) const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block, decoding it if its child is gone.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block and its stripe's parity.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on its
+   * stripes.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks and its stripes' parity under an
+   * exclusive lock on its stripes.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if at least k children took the write, an error otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize every healthy child, in parallel.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* ERASUREVSSD_H */
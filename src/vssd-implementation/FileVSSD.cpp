@@ -4,10 +4,65 @@
 
 #include "FileVSSD.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+#include "fd_util.h"
 
 using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+// Bytes handed to one copy call when cloning
+static const size_t CloneChunk = 64 * 1024 * 1024;
+
+/**
+ * Copy the data extents of the first size bytes of in to the same
+ * offsets in out, skipping holes (the whole range counts as data if
+ * the filesystem cannot say where they are).
+ *
+ * @param in file to copy from
+ * @param out file to copy to
+ * @param size bytes to cover
+ * @param inKernel true to use copy_file_range, false to go through a buffer
+ * @return true if every extent was copied
+ */
+static bool copyExtents(int in, int out, off_t size, bool inKernel) {
+  vector<char> buffer(inKernel ? 0 : 1024 * 1024);
+  off_t at = 0;
+  while (at < size) {
+    off_t start = lseek(in, at, SEEK_DATA);
+    if (start < 0 && errno == ENXIO) break;  // only a hole is left
+    if (start < 0) start = at;
+    off_t end = lseek(in, start, SEEK_HOLE);
+    if (end < 0 || end > size) end = size;
+
+    while (start < end) {
+      size_t piece = min<off_t>(end - start, inKernel ? CloneChunk : buffer.size());
+      if (inKernel) {
+        loff_t from = start, to = start;
+        ssize_t copied = copy_file_range(in, &from, out, &to, piece, 0);
+        if (copied <= 0) return false;
+        piece = copied;
+      } else if (!pread_all(in, buffer.data(), piece, start) ||
+                 !pwrite_all(out, buffer.data(), piece, start)) {
+        return false;
+      }
+      start += piece;
+    }
+    at = end;
+  }
+  return true;
+}
 
 FileVSSD::FileVSSD(size_t block_size, size_t block_count, string filename) {
   // Set count, size, and name variables. fn is used by sync().
@@ -16,110 +71,129 @@ FileVSSD::FileVSSD(size_t block_size, size_t block_count, string filename) {
   bc = block_count;
 
   // Open the file, truncating
-  file.open(filename, ios::in | ios::out | ios::binary | ios::trunc);
+  fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  if (!writeImageHeader(fd, bs, bc)) {
+    cout << "ERROR: Unable to initialize '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  stat = DiskStatus::OK;
+}
+
+FileVSSD::FileVSSD(string filename) {
+  fn = filename;
+
+  fd = open(filename.c_str(), O_RDWR);
+
+  size_t block_size, block_count;
+  if (!readImageHeader(fd, filename, block_size, block_count)) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  bs = block_size;
+  bc = block_count;
+  stat = DiskStatus::OK;
+}
+
+bool FileVSSD::writeImageHeader(int fd, size_t block_size, size_t block_count) {
+  unsigned int bs = block_size;
+  unsigned int bc = block_count;
+
+  // The header block is assembled in memory and written in one go
+  unique_ptr<char[]> header = make_unique<char[]>(bs);
   // Write block info
-  file.write((const char*)&bs, sizeof(bs));
-  file.write((const char*)&bc, sizeof(bc));
+  memcpy(header.get(), &bs, sizeof(bs));
+  memcpy(header.get() + sizeof(bs), &bc, sizeof(bc));
 
   // Signature: CAFECA75 (Cafe Cats). Hopefully our endianess is synced
   // If not, swap cases 1 and 3
   unsigned char ca = 202;
   unsigned char fe = 254;
   unsigned char ts = 117;
-  unsigned char zero = 0;
   if (bs > 8) {
     for (unsigned int i = 8; i < bs; i++) {
       switch (i % 4) {
         case 0:
         case 2:
-          file.write((const char*)&ca, sizeof(ca));
+          header[i] = ca;
           break;
         case 1:
-          file.write((const char*)&fe, sizeof(fe));
+          header[i] = fe;
           break;
         case 3:
-          file.write((const char*)&ts, sizeof(ts));
+          header[i] = ts;
           break;
       }
     }
   }
 
-  // Zero out the rest
-  for (unsigned int i = 0; i < block_count; i++) {
-    for (unsigned int j = 0; j < block_size; j++) {
-      file.write((const char*)&zero, sizeof(zero));
-    }
-  }
-
-  stat = DiskStatus::OK;
+  // Zero out the rest: extending the file reads back as zero bytes
+  return pwrite_all(fd, header.get(), bs, 0) &&
+         ftruncate(fd, (off_t)bs * (bc + 1)) == 0;
 }
 
-FileVSSD::FileVSSD(string filename) {
-  fn = filename;
-
-  file.open(filename, ios::in | ios::out | ios::binary);
-
+bool FileVSSD::readImageHeader(int fd, const string& filename,
+                               size_t& block_size, size_t& block_count) {
   // file size calculation. fsize is the filesize.
-  std::streampos fsize = 0;
-  // Seek to beginning of file
-  file.seekg(0);
-  // Set the size to the read position (should be 0)
-  fsize = file.tellg();
-  // Seek to end of file
-  file.seekg(0, std::ios::end);
-  // Set size to end-beginning.
-  fsize = file.tellg() - fsize;
-  // Seek back to beginning
-  file.seekg(0);
+  struct stat info;
+  off_t fsize = 0;
+  if (fd >= 0 && fstat(fd, &info) == 0) fsize = info.st_size;
 
   // Make sure file exists.
   if (fsize == 0) {
     cout << "ERROR: File '" << filename
          << "' does not exist. Unable to open.\n";
-    stat = DiskStatus::ERROR;
-  } else {
-    // Value is were header ints will be stored temporarily
-    unsigned int value;
-    // Buffer is for reading header ints.
-    char* buffer = new char[4];
-    // Read four bytes into the buffer
-    file.read(buffer, 4);
-    // Copy the first four bytes into value. Should be a readable int now
-    memcpy(&value, buffer, sizeof(value));
-    // Copy over to block size variable
-    bs = value;
-    // Read four more bytes (seeked already)
-    file.read(buffer, 4);
-    // Copy over into value
-    memcpy(&value, buffer, sizeof(value));
-    // Copy into block size variable
-    bc = value;
-
-    // Check size in header to see if it matches actual filesize
-    if (fsize != bs * (bc + 1)) {
-      stat = DiskStatus::ERROR;
-      cout << "ERROR: File size does not match header information.\n";
-      cout << "\tFile size is: " << fsize << " Bytes.\n";
-      cout << "\tExpected file size is: " << bs * (bc + 1)
-           << " Bytes (8 Bytes for Geometry, " << bs - 8
-           << " Bytes for the signature, \n\tand " << bs * bc
-           << " Bytes for data) \n";
-    } else {
-      // Read four more bytes (seeked already)
-      file.read(buffer, 4);
-      // Copy over into value
-      memcpy(&value, buffer, sizeof(value));
-      // check to see if signature is right
-      if (value != 1976237770) {
-        stat = DiskStatus::ERROR;
-        cout << "ERROR: Signature does not match CA FE CA 75\n";
-      } else
-        stat = DiskStatus::OK;
-    }
+    return false;
+  }
+
+  // Value is were header ints will be stored temporarily
+  unsigned int value = 0;
+  // Buffer is for reading header ints: geometry and first signature word
+  char buffer[12] = {};
+  pread_all(fd, buffer, min<off_t>(sizeof(buffer), fsize), 0);
+  // Copy the first four bytes into value. Should be a readable int now
+  memcpy(&value, buffer, sizeof(value));
+  // Copy over to block size variable
+  unsigned int bs = value;
+  // Copy the next four bytes into value
+  memcpy(&value, buffer + 4, sizeof(value));
+  // Copy into block size variable
+  unsigned int bc = value;
+
+  // Check size in header to see if it matches actual filesize
+  if (fsize != (off_t)bs * (bc + 1)) {
+    cout << "ERROR: File size does not match header information.\n";
+    cout << "\tFile size is: " << fsize << " Bytes.\n";
+    cout << "\tExpected file size is: " << (off_t)bs * (bc + 1)
+         << " Bytes (8 Bytes for Geometry, " << bs - 8
+         << " Bytes for the signature, \n\tand " << (off_t)bs * bc
+         << " Bytes for data) \n";
+    return false;
+  }
+
+  // Copy the signature's first four bytes into value
+  memcpy(&value, buffer + 8, sizeof(value));
+  // check to see if signature is right
+  if (value != 1976237770) {
+    cout << "ERROR: Signature does not match CA FE CA 75\n";
+    return false;
   }
+
+  block_size = bs;
+  block_count = bc;
+  return true;
 }
 
-FileVSSD::~FileVSSD() { file.close(); }
+FileVSSD::~FileVSSD() {
+  if (fd >= 0) close(fd);
+}
 
 size_t FileVSSD::blockSize() const { return bs; }
 
@@ -128,21 +202,38 @@ size_t FileVSSD::blockCount() const { return bc; }
 DiskStatus FileVSSD::status() const { return stat; }
 
 DiskStatus FileVSSD::read(blocknumber_t sector, void* buffer) {
-  // Range Checking
-  if (sector >= bc) {
+  return readBlocks(sector, 1, buffer);
+}
+
+DiskStatus FileVSSD::write(blocknumber_t sector, void* buffer) {
+  return writeBlocks(sector, 1, buffer);
+}
+
+DiskStatus FileVSSD::readBlocks(blocknumber_t sector, size_t count,
+                                void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (sector >= bc || count > bc - sector) {
     cout << "ERROR: Index out of range\n";
     stat = DiskStatus::BLOCK_OUT_OF_RANGE;
     return stat;
   }
 
-  // Seek to the right sector. +1 for header sector
-  file.seekg((sector + 1) * bs);
-  // Don't ask me why this type-casting is needed please
-  file.read((std::basic_istream<char>::char_type*)buffer, bs);
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(sector, sector + count, RangeLock::SHARED);
+
+  // Offset of the right sector. +1 for header sector
+  if (!pread_all(fd, (char*)buffer, count * bs, (off_t)(sector + 1) * bs)) {
+    cout << "ERROR: Unable to read block " << sector << "\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  stat = DiskStatus::OK;
   return stat;
 }
 
-DiskStatus FileVSSD::write(blocknumber_t sector, void* buffer) {
+DiskStatus FileVSSD::writeBlocks(blocknumber_t sector, size_t count,
+                                 void* buffer) {
   // The following code block allows you to easily disable write on unsafe
   // DiskStatus.
 
@@ -156,27 +247,80 @@ DiskStatus FileVSSD::write(blocknumber_t sector, void* buffer) {
   // Set to not ready. If command fails, status will still be not ready
   stat = DiskStatus::NOT_READY;
 
-  // Range Checking
-  if (sector >= bc) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (sector >= bc || count > bc - sector) {
     cout << "ERROR: Index out of range\n";
     stat = DiskStatus::BLOCK_OUT_OF_RANGE;
     return stat;
   }
 
-  // Seek to the right sector. +1 for header sector
-  file.seekp((sector + 1) * bs);
-  // Don't ask me why this type-casting is needed please
-  file.write((std::basic_istream<char>::char_type*)buffer, bs);
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(sector, sector + count, RangeLock::EXCLUSIVE);
+
+  // Offset of the right sector. +1 for header sector
+  if (!pwrite_all(fd, (const char*)buffer, count * bs,
+                 (off_t)(sector + 1) * bs)) {
+    cout << "ERROR: Unable to write block " << sector << "\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
 
   stat = DiskStatus::OK;
   return stat;
 }
 
+DiskStatus FileVSSD::clone(const string& filename, CloneMethod* method) {
+  // Writers wait, so the clone is one point in time
+  auto held = locks.lock(0, bc, RangeLock::SHARED);
+
+  // Truncated only once it is known not to be the image itself (under
+  // any name), which O_TRUNC would have emptied
+  int out = open(filename.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (out < 0) {
+    cout << "ERROR: Unable to create '" << filename << "'.\n";
+    return DiskStatus::ERROR;
+  }
+  struct stat source, target;
+  if (fstat(fd, &source) != 0 || fstat(out, &target) != 0 ||
+      (source.st_dev == target.st_dev && source.st_ino == target.st_ino)) {
+    cout << "ERROR: Unable to clone '" << fn << "' onto itself.\n";
+    close(out);
+    return DiskStatus::ERROR;
+  }
+  if (ftruncate(out, 0) != 0) {
+    cout << "ERROR: Unable to truncate '" << filename << "'.\n";
+    close(out);
+    return DiskStatus::ERROR;
+  }
+
+  // Share extents if the filesystem can; otherwise copy them, in the
+  // kernel if it will
+  off_t size = (off_t)bs * (bc + 1);
+  CloneMethod used = REFLINK;
+  bool ok = ioctl(out, FICLONE, fd) == 0;
+  if (!ok) {
+    used = COPY_FILE_RANGE;
+    ok = copyExtents(fd, out, size, true);
+  }
+  if (!ok) {
+    used = USER_COPY;
+    ok = copyExtents(fd, out, size, false);
+  }
+  // The trailing hole (if any) is not copied: size the file to match
+  ok = ok && ftruncate(out, size) == 0;
+  close(out);
+
+  if (!ok) {
+    cout << "ERROR: Unable to clone '" << fn << "' to '" << filename << "'.\n";
+    return DiskStatus::ERROR;
+  }
+  if (method != nullptr) *method = used;
+  return DiskStatus::OK;
+}
+
 DiskStatus FileVSSD::sync() {
-  // Pretty sure this is never called.
+  // Push everything the kernel is holding for us out to the device
   stat = DiskStatus::NOT_READY;
-  file.close();
-  file.open(fn, ios::in | ios::out | ios::binary);
-  stat = DiskStatus::OK;
+  stat = (fsync(fd) == 0) ? DiskStatus::OK : DiskStatus::ERROR;
   return stat;
 }
@@ -1,8 +1,14 @@
 /**
  * FileVSSD Provides a Virtual Simple Simulated Disk stored in memory
  *
- * This implementation works with the fstream library. It has all the
- * functionality of RAMVSSD, plus persistence.
+ * This implementation works with POSIX file descriptors; blocks move
+ * with pread/pwrite, which carry their own offsets, so threads never
+ * share a file position. It has all the functionality of RAMVSSD, plus
+ * persistence.
+ *
+ * Contiguous extents (readBlocks/writeBlocks) are locked through a
+ * RangeLock: extents that do not overlap are read and written in
+ * parallel, overlapping ones see each other whole or not at all.
  *
  * @author Dylan C. Morgen
  * @email morgendc203@potsdam.edu
@@ -11,19 +17,34 @@
  * @due 10/4/2021
  */
 
-#include <fstream>
+#ifndef FILEVSSD_H
+  #define FILEVSSD_H
+
+#include <atomic>
 #include <iostream>
 #include <string>
 
+#include "RangeLock.h"
 #include "VVSSD.h"
 
 class FileVSSD : public VVSSD {
+ public:
+  /**
+   * How clone() copied the image, fastest first.
+   */
+  enum CloneMethod {
+    REFLINK,          // FICLONE: the clone shares the image's extents
+    COPY_FILE_RANGE,  // in-kernel copy of the data extents
+    USER_COPY         // pread/pwrite through a buffer
+  };
+
  private:
   std::string fn;
-  std::fstream file;
-  unsigned int bs;
-  unsigned int bc;
-  DiskStatus stat = DiskStatus::NOT_READY;
+  int fd = -1;
+  unsigned int bs = 0;
+  unsigned int bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
 
  public:
   /**
@@ -47,6 +68,52 @@ class FileVSSD : public VVSSD {
 
   virtual ~FileVSSD();
 
+  /**
+   * Copy the image to a new file that FileVSSD can open.
+   *
+   * On filesystems with reflinks (XFS, btrfs) the clone shares the
+   * image's extents and is made in constant time. Elsewhere the data
+   * extents are copied in the kernel with copy_file_range, in large
+   * chunks, and holes stay holes; if the kernel cannot do that either,
+   * the blocks are copied through user space. Writes wait until the
+   * clone is made, so it is a point-in-time copy.
+   *
+   * @param  {std::string} filename : filename of the clone; truncated if
+   *                                  it exists, unless it is the image
+   * @param  {CloneMethod*} method  : if not null, set to how it was done
+   * @return {DiskStatus}           : OK if the clone was made
+   */
+  DiskStatus clone(const std::string& filename, CloneMethod* method = nullptr);
+
+  /**
+   * Write the header block of an image (geometry and CAFECA75 signature)
+   * at the start of an open file and size the file for the blocks, which
+   * read as zeros until written. Other disks use this to save images
+   * FileVSSD can open.
+   *
+   * @param  {int} fd                  : file open for writing
+   * @param  {std::size_t} block_size  : amount of bytes in block
+   * @param  {std::size_t} block_count : amount of blocks
+   * @return {bool}                    : true if the file was set up
+   */
+  static bool writeImageHeader(int fd, std::size_t block_size,
+                               std::size_t block_count);
+
+  /**
+   * Read the header of an open image file and check it against the
+   * signature and the file size, explaining any mismatch on cout.
+   *
+   * @param  {int} fd                   : file open for reading (or -1)
+   * @param  {std::string} filename     : name used in messages
+   * @param  {std::size_t} block_size   : set to the image's block size
+   * @param  {std::size_t} block_count  : set to the image's block count
+   * @return {bool}                     : true if the image is valid; block
+   *                                      n is at offset (n + 1) * block_size
+   */
+  static bool readImageHeader(int fd, const std::string& filename,
+                              std::size_t& block_size,
+                              std::size_t& block_count);
+
   /**
    * Return the size (in bytes) of the blocks used by this device.
    *o
@@ -93,6 +160,29 @@ class FileVSSD : public VVSSD {
    */
   virtual DiskStatus write(blocknumber_t block, void* buffer);
 
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
   /**
    * Synchronize all in-memory structures out to the disk.
    *
@@ -100,3 +190,5 @@ class FileVSSD : public VVSSD {
    */
   virtual DiskStatus sync();
 };
+
+  #endif /* FILEVSSD_H */
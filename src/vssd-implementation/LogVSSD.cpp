@@ -0,0 +1,561 @@
+/**
+ * See LogVSSD.h for header comment
+ */
+
+#include "LogVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "fd_util.h"
+#include "hash_util.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+static const uint64_t Signature = 0x31474f4c44535356;            // "VSSDLOG1"
+static const uint64_t CheckpointSignature = 0x31504b4344535356;  // "VSSDCKP1"
+static const uint64_t SummarySignature = 0x3147455344535356;     // "VSSDSEG1"
+static const size_t SuperblockBytes = 4096;
+/// signature, sequence number, entry count (or replay point), checksum
+static const size_t RecordHeaderBytes = 4 * sizeof(uint64_t);
+
+static uint64_t checksum(const void* entries, size_t entryBytes,
+                         const void* data, size_t dataBytes, uint64_t seed) {
+  uint64_t first = hash_util::murmur3_128(entries, entryBytes, seed).low;
+  return hash_util::murmur3_128(data, dataBytes, first).low;
+}
+
+LogVSSD::LogVSSD(size_t block_size, size_t block_count, string filename)
+    : LogVSSD(block_size, block_count, filename, Options()) {}
+
+LogVSSD::LogVSSD(size_t block_size, size_t block_count, string filename,
+                 Options options) {
+  fn = filename;
+  bs = block_size;
+  bc = block_count;
+
+  // The summary block must index at least one data block
+  if (bs < RecordHeaderBytes + sizeof(uint64_t) || bc == 0) {
+    cout << "ERROR: Block size must be at least "
+         << RecordHeaderBytes + sizeof(uint64_t)
+         << " bytes and the disk must have blocks.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Open the file, truncating
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  layout(options);
+  allocate();
+  if (!create() || !rebuild() || !checkpoint()) {
+    cout << "ERROR: Unable to initialize '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  stat = DiskStatus::OK;
+  broken = false;
+  cleaner = thread(&LogVSSD::cleanerLoop, this);
+}
+
+LogVSSD::LogVSSD(string filename) {
+  fn = filename;
+
+  fd = ::open(filename.c_str(), O_RDWR);
+  struct stat info;
+  off_t fsize = 0;
+  if (fd >= 0 && fstat(fd, &info) == 0) fsize = info.st_size;
+  if (fsize == 0) {
+    cout << "ERROR: File '" << filename
+         << "' does not exist. Unable to open.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  uint64_t fields[6] = {};
+  if (!pread_all(fd, (char*)fields, sizeof(fields), 0) ||
+      fields[0] != Signature) {
+    cout << "ERROR: '" << filename << "' is not a log-structured disk.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  bs = fields[1];
+  bc = fields[2];
+  segmentBlocks = fields[3];
+  segmentCount = fields[4];
+  checkpointSegments = fields[5];
+
+  // Check the geometry before sizing anything by it: a summary block
+  // that indexes its segment's data blocks, room in the log for every
+  // block plus the reserve, and nothing bigger than the file. Dividing
+  // the file size keeps the products from wrapping.
+  uint64_t size = fsize;
+  if (bs < RecordHeaderBytes + sizeof(uint64_t) || bs > size || bc == 0 ||
+      bc > size / sizeof(uint64_t) || segmentBlocks < 2 ||
+      segmentBlocks - 1 > (bs - RecordHeaderBytes) / sizeof(uint64_t) ||
+      segmentCount < Reserve + 2 || segmentCount > size / bs / segmentBlocks ||
+      bc > (segmentCount - Reserve - 1) * (segmentBlocks - 1) ||
+      checkpointSegments == 0) {
+    cout << "ERROR: The superblock of '" << filename << "' is damaged.\n";
+    bs = bc = 0;
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  entriesPerSegment = segmentBlocks - 1;
+  allocate();
+
+  if ((uint64_t)fsize < segmentStart + (uint64_t)segmentCount * segmentBlocks * bs) {
+    cout << "ERROR: File size does not match header information.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (!recover() || !rebuild() || !checkpoint()) {
+    cout << "ERROR: Unable to recover '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  stat = DiskStatus::OK;
+  broken = false;
+  cleaner = thread(&LogVSSD::cleanerLoop, this);
+}
+
+LogVSSD::~LogVSSD() {
+  if (cleaner.joinable()) {
+    {
+      lock_guard<shared_mutex> hold(mtx);
+      stopping = true;
+    }
+    cleanerWake.notify_all();
+    cleaner.join();
+  }
+  // A checkpoint on close saves the next open a roll-forward
+  if (!broken) {
+    lock_guard<shared_mutex> hold(mtx);
+    checkpoint();
+  }
+  if (fd >= 0) close(fd);
+}
+
+off_t LogVSSD::segmentOffset(size_t segment) const {
+  return segmentStart + (off_t)segment * segmentBlocks * bs;
+}
+
+off_t LogVSSD::checkpointOffset(uint64_t seq) const {
+  return SuperblockBytes + (seq % 2) * checkpointBytes;
+}
+
+void LogVSSD::layout(const Options& options) {
+  size_t indexable = (bs - RecordHeaderBytes) / sizeof(uint64_t);
+  segmentBlocks = min(max<size_t>(options.segmentBytes / bs, 2), indexable + 1);
+  entriesPerSegment = segmentBlocks - 1;
+
+  // Enough segments for the logical size plus the spare capacity, and
+  // never so few that a sealed segment could be all live
+  size_t needed = (bc + entriesPerSegment - 1) / entriesPerSegment;
+  size_t spare = (size_t)ceil(bc * max(options.overProvision, 0.0) /
+                              entriesPerSegment);
+  segmentCount = needed + max<size_t>(spare, 1) + Reserve + 1;
+  checkpointSegments = max<size_t>(options.checkpointSegments, 1);
+}
+
+void LogVSSD::allocate() {
+  checkpointBytes =
+      (RecordHeaderBytes + bc * sizeof(uint64_t) + 4095) / 4096 * 4096;
+  segmentStart = SuperblockBytes + 2 * checkpointBytes;
+  lowWater = max<size_t>(Reserve + 2, segmentCount / 16);
+
+  map.assign(bc, Unmapped);
+  live.assign(segmentCount, 0);
+  state.assign(segmentCount, FREE);
+  head.assign(segmentBlocks * bs, 0);
+  headEntries.assign(entriesPerSegment, 0);
+}
+
+bool LogVSSD::create() {
+  char superblock[SuperblockBytes] = {};
+  uint64_t fields[6] = {Signature,    bs,           bc,
+                        segmentBlocks, segmentCount, checkpointSegments};
+  memcpy(superblock, fields, sizeof(fields));
+  // Checkpoint slots start out zero (invalid); segments stay sparse
+  return pwrite_all(fd, superblock, sizeof(superblock), 0) &&
+         ftruncate(fd, segmentOffset(segmentCount)) == 0;
+}
+
+bool LogVSSD::recover() {
+  // Newest checkpoint whose checksum holds; none means replay everything
+  uint64_t replayFrom = 0;
+  vector<char> image(checkpointBytes);
+  for (uint64_t slot = 0; slot < 2; slot++) {
+    uint64_t fields[4];
+    if (!pread_all(fd, image.data(), image.size(), checkpointOffset(slot)))
+      return false;
+    memcpy(fields, image.data(), sizeof(fields));
+    const char* mapBytes = image.data() + RecordHeaderBytes;
+    if (fields[0] != CheckpointSignature || fields[1] < checkpointSeq ||
+        fields[3] != checksum(nullptr, 0, mapBytes, bc * sizeof(uint64_t),
+                              fields[1] ^ fields[2]))
+      continue;
+    checkpointSeq = fields[1];
+    replayFrom = fields[2];
+    memcpy(map.data(), mapBytes, bc * sizeof(uint64_t));
+  }
+  for (physical_t where : map)
+    if (where != Unmapped && where >= segmentCount * entriesPerSegment)
+      return false;
+
+  // Segments written since, in the order they were written
+  vector<pair<uint64_t, size_t>> later;  // sequence number, segment
+  nextSeq = replayFrom;
+  for (size_t s = 0; s < segmentCount; s++) {
+    uint64_t fields[4];
+    if (!pread_all(fd, (char*)fields, sizeof(fields), segmentOffset(s)))
+      return false;
+    if (fields[0] != SummarySignature) continue;
+    nextSeq = max(nextSeq, fields[1] + 1);
+    if (fields[1] >= replayFrom && fields[2] <= entriesPerSegment)
+      later.emplace_back(fields[1], s);
+  }
+  sort(later.begin(), later.end());
+
+  for (auto [seq, s] : later) {
+    if (!pread_all(fd, head.data(), head.size(), segmentOffset(s)))
+      return false;
+    uint64_t fields[4];
+    memcpy(fields, head.data(), sizeof(fields));
+    size_t count = fields[2];
+    memcpy(headEntries.data(), head.data() + RecordHeaderBytes,
+           count * sizeof(uint64_t));
+    // A torn write fails its checksum; it was never synced, so skip it
+    if (fields[3] != checksum(headEntries.data(), count * sizeof(uint64_t),
+                              head.data() + bs, count * bs, seq))
+      continue;
+    for (size_t i = 0; i < count; i++)
+      if (headEntries[i] < bc)
+        map[headEntries[i]] = s * entriesPerSegment + i;
+  }
+  return true;
+}
+
+bool LogVSSD::rebuild() {
+  live.assign(segmentCount, 0);
+  for (physical_t where : map)
+    if (where != Unmapped) live[where / entriesPerSegment]++;
+
+  freeSegments.clear();
+  cleaned.clear();
+  for (size_t s = segmentCount; s-- > 0;) {
+    state[s] = live[s] > 0 ? SEALED : FREE;
+    if (state[s] == FREE) freeSegments.push_back(s);
+  }
+  fill = 0;
+  return openSegment();
+}
+
+bool LogVSSD::openSegment() {
+  if (freeSegments.empty()) {
+    cout << "ERROR: No free segment in '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    broken = true;
+    return false;
+  }
+  headSegment = freeSegments.back();
+  freeSegments.pop_back();
+  state[headSegment] = OPEN;
+  headSeq = nextSeq++;
+  fill = 0;
+  return true;
+}
+
+bool LogVSSD::append(blocknumber_t block, const char* data, bool cleaning) {
+  if (fill == entriesPerSegment) {
+    if (!seal()) return false;
+    if (!cleaning) {
+      // Keep the reserve for the cleaner's own relocations
+      while (freeSegments.size() + cleaned.size() < Reserve && clean()) {
+      }
+      if (sealedSinceCheckpoint >= checkpointSegments && !checkpoint())
+        return false;
+      if (cleaningWanted()) cleanerWake.notify_one();
+    }
+  }
+  // The cleaner may have filled the new segment already
+  if (fill == entriesPerSegment && !seal()) return false;
+  if (state[headSegment] != OPEN) return false;
+
+  memcpy(head.data() + (1 + fill) * bs, data, bs);
+  headEntries[fill] = block;
+  physical_t was = map[block];
+  if (was != Unmapped) live[was / entriesPerSegment]--;
+  map[block] = headSegment * entriesPerSegment + fill;
+  live[headSegment]++;
+  fill++;
+  return true;
+}
+
+bool LogVSSD::seal() {
+  if (fill == 0 || state[headSegment] != OPEN) return true;
+
+  uint64_t fields[4] = {SummarySignature, headSeq, fill, 0};
+  fields[3] = checksum(headEntries.data(), fill * sizeof(uint64_t),
+                       head.data() + bs, fill * bs, headSeq);
+  memset(head.data(), 0, bs);
+  memcpy(head.data(), fields, sizeof(fields));
+  memcpy(head.data() + RecordHeaderBytes, headEntries.data(),
+         fill * sizeof(uint64_t));
+  if (!pwrite_all(fd, head.data(), (1 + fill) * bs, segmentOffset(headSegment))) {
+    cout << "ERROR: Unable to write to '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    broken = true;
+    return false;
+  }
+  counters.deviceBlocks += 1 + fill;
+  state[headSegment] = SEALED;
+  sealedSinceCheckpoint++;
+
+  // Cleaned segments are reused only once their relocated blocks are
+  // durable; syncing for that is put off until free segments run short
+  if (freeSegments.size() <= Reserve && !reclaim(headSeq + 1, false))
+    return false;
+  return openSegment();
+}
+
+bool LogVSSD::reclaim(uint64_t before, bool synced) {
+  auto kept = stable_partition(
+      cleaned.begin(), cleaned.end(),
+      [&](const pair<size_t, uint64_t>& c) { return c.second < before; });
+  if (kept == cleaned.begin()) return true;
+  if (!synced && fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to sync '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    broken = true;
+    return false;
+  }
+  for (auto c = cleaned.begin(); c != kept; ++c) {
+    state[c->first] = FREE;
+    freeSegments.push_back(c->first);
+  }
+  cleaned.erase(cleaned.begin(), kept);
+  return true;
+}
+
+bool LogVSSD::clean() {
+  // Greedy: the sealed segment with the fewest live blocks
+  size_t victim = segmentCount;
+  uint32_t least = entriesPerSegment;
+  for (size_t s = 0; s < segmentCount; s++)
+    if (state[s] == SEALED && live[s] < least) {
+      victim = s;
+      least = live[s];
+    }
+  if (victim == segmentCount) return false;
+  state[victim] = CLEANING;
+
+  if (least > 0) {
+    vector<char> segment(segmentBlocks * bs);
+    if (!pread_all(fd, segment.data(), segment.size(), segmentOffset(victim))) {
+      cout << "ERROR: Unable to read from '" << fn << "'.\n";
+      stat = DiskStatus::ERROR;
+      broken = true;
+      return false;
+    }
+    uint64_t count;
+    memcpy(&count, segment.data() + 2 * sizeof(uint64_t), sizeof(count));
+    count = min<uint64_t>(count, entriesPerSegment);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t block;
+      memcpy(&block, segment.data() + RecordHeaderBytes + i * sizeof(uint64_t),
+             sizeof(block));
+      if (block >= bc || map[block] != victim * entriesPerSegment + i)
+        continue;
+      if (!append(block, segment.data() + (1 + i) * bs, true)) return false;
+      counters.cleanerBlocks++;
+    }
+  }
+  cleaned.emplace_back(victim, headSeq);
+  counters.segmentsCleaned++;
+  return true;
+}
+
+bool LogVSSD::checkpoint() {
+  if (!seal()) return false;
+
+  // Everything before the open segment is covered by the map
+  uint64_t seq = checkpointSeq + 1;
+  vector<char> image(checkpointBytes, 0);
+  char* mapBytes = image.data() + RecordHeaderBytes;
+  memcpy(mapBytes, map.data(), bc * sizeof(uint64_t));
+  uint64_t fields[4] = {CheckpointSignature, seq, headSeq, 0};
+  fields[3] = checksum(nullptr, 0, mapBytes, bc * sizeof(uint64_t),
+                       seq ^ headSeq);
+  memcpy(image.data(), fields, sizeof(fields));
+
+  if (!pwrite_all(fd, image.data(), image.size(), checkpointOffset(seq)) ||
+      fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to write a checkpoint to '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    broken = true;
+    return false;
+  }
+  checkpointSeq = seq;
+  sealedSinceCheckpoint = 0;
+  if (!reclaim(headSeq, true)) return false;
+  counters.checkpoints++;
+  counters.deviceBlocks += (checkpointBytes + bs - 1) / bs;
+  return true;
+}
+
+bool LogVSSD::cleaningWanted() const {
+  return freeSegments.size() + cleaned.size() < lowWater;
+}
+
+void LogVSSD::cleanerLoop() {
+  unique_lock<shared_mutex> hold(mtx);
+  while (!stopping) {
+    if (!cleaningWanted() || broken) {
+      cleanerWake.wait(hold);
+      continue;
+    }
+    // Nothing left to gain until more blocks are overwritten
+    if (!clean()) {
+      cleanerWake.wait(hold);
+      continue;
+    }
+    // One segment at a time, so readers and writers get a turn
+    hold.unlock();
+    this_thread::yield();
+    hold.lock();
+  }
+}
+
+LogVSSD::Stats LogVSSD::stats() const {
+  shared_lock<shared_mutex> hold(mtx);
+  return counters;
+}
+
+double LogVSSD::writeAmplification() const {
+  Stats current = stats();
+  if (current.userBlocks == 0) return 0;
+  return (double)current.deviceBlocks / current.userBlocks;
+}
+
+size_t LogVSSD::blockSize() const { return bs; }
+
+size_t LogVSSD::blockCount() const { return bc; }
+
+DiskStatus LogVSSD::status() const { return stat; }
+
+DiskStatus LogVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus LogVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus LogVSSD::readBlocks(blocknumber_t block, size_t count,
+                               void* buffer) {
+  if (broken) {
+    cout << "ERROR: The log of '" << fn << "' is unusable.\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  shared_lock<shared_mutex> hold(mtx);
+  char* out = (char*)buffer;
+  size_t i = 0;
+  while (i < count) {
+    physical_t where = map[block + i];
+    if (where == Unmapped) {
+      memset(out + i * bs, 0, bs);
+      i++;
+      continue;
+    }
+    size_t segment = where / entriesPerSegment;
+    size_t slot = where % entriesPerSegment;
+    if (segment == headSegment && state[headSegment] == OPEN) {
+      memcpy(out + i * bs, head.data() + (1 + slot) * bs, bs);
+      i++;
+      continue;
+    }
+    // Blocks written together sit together: read them with one call
+    size_t run = 1;
+    while (i + run < count && slot + run < entriesPerSegment &&
+           map[block + i + run] == where + run)
+      run++;
+    if (!pread_all(fd, out + i * bs, run * bs,
+                   segmentOffset(segment) + (1 + slot) * bs)) {
+      cout << "ERROR: Unable to read from '" << fn << "'.\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    i += run;
+  }
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus LogVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                void* buffer) {
+  if (broken) {
+    cout << "ERROR: The log of '" << fn << "' is unusable.\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  lock_guard<shared_mutex> hold(mtx);
+  const char* in = (const char*)buffer;
+  for (size_t i = 0; i < count; i++) {
+    if (!append(block + i, in + i * bs, false)) {
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    counters.userBlocks++;
+  }
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus LogVSSD::sync() {
+  if (broken) {
+    cout << "ERROR: The log of '" << fn << "' is unusable.\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  lock_guard<shared_mutex> hold(mtx);
+  if (!seal() || fsync(fd) != 0) {
+    cout << "ERROR: Unable to sync '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  if (!reclaim(headSeq, true)) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  stat = DiskStatus::OK;
+  return stat;
+}
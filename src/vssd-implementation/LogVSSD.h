@@ -0,0 +1,309 @@
+/**
+ * LogVSSD is a log-structured disk: every write is appended to the head
+ * of a log, so random writes reach the file as large sequential ones.
+ *
+ * The file is a superblock, two checkpoint slots and a run of equal
+ * segments. A segment is a summary block (sequence number, the logical
+ * block number of each entry, a checksum) followed by data blocks.
+ * Writes fill an in-memory segment buffer; a full buffer is written out
+ * with one pwrite and a fresh segment opened. An in-memory map gives
+ * each logical block's current place in the log, so reads go straight
+ * there (or to the buffer).
+ *
+ * Every checkpointSegments segments (and on close), the map is written
+ * to the older of the two checkpoint slots, so a crash mid-checkpoint
+ * leaves the other one intact. Opening a disk loads the newest valid
+ * checkpoint and rolls forward through the segments written after it,
+ * in sequence order, skipping any whose checksum fails (a torn last
+ * write). sync() writes out the open segment, partial or not, and
+ * fsyncs; segments are never rewritten in place.
+ *
+ * Overwritten blocks leave dead entries behind. A background cleaner
+ * keeps free segments available: it picks the sealed segments with
+ * the fewest live blocks, appends their live blocks to the log, and
+ * frees them once the copies are durable. A writer that runs short of
+ * free segments cleans for itself; a couple of segments are held back
+ * so the cleaner can always make progress. The file is sized with
+ * overProvision spare capacity beyond the logical size, which bounds
+ * how much cleaning costs.
+ *
+ * stats() reports user blocks written, blocks written to the file
+ * (data, summaries and checkpoints) and blocks moved by the cleaner;
+ * writeAmplification() is their ratio to what the user wrote.
+ *
+ * A shared mutex guards the disk: reads share it, and writes, segment
+ * I/O and cleaning hold it exclusively.
+ */
+
+#ifndef LOGVSSD_H
+  #define LOGVSSD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "VVSSD.h"
+
+class LogVSSD : public VVSSD {
+ public:
+  /**
+   * Layout and cleaning options for a new disk.
+   */
+  struct Options {
+    /// bytes per segment (fewer if a summary block cannot index them)
+    std::size_t segmentBytes = 1024 * 1024;
+    /// spare log capacity, as a fraction of the logical size
+    double overProvision = 0.25;
+    /// segments sealed between checkpoints
+    std::size_t checkpointSegments = 64;
+  };
+
+  /**
+   * Counters since the disk was opened.
+   */
+  struct Stats {
+    std::uint64_t userBlocks = 0;
+    std::uint64_t deviceBlocks = 0;
+    std::uint64_t cleanerBlocks = 0;
+    std::uint64_t segmentsCleaned = 0;
+    std::uint64_t checkpoints = 0;
+  };
+
+  /// free segments kept back for the cleaner
+  static const std::size_t Reserve = 2;
+
+ private:
+  typedef std::uint64_t physical_t;
+  static constexpr physical_t Unmapped = UINT64_MAX;
+
+  /// CLEANING segments have been emptied by the cleaner; they become
+  /// FREE once the segment holding their relocated blocks is synced
+  enum SegmentState { FREE, OPEN, SEALED, CLEANING };
+
+  std::string fn;
+  int fd = -1;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  /// set until the disk is open, and after a failed log write
+  std::atomic<bool> broken = true;
+
+  /// blocks per segment, summary included; data entries per segment
+  std::size_t segmentBlocks = 0;
+  std::size_t entriesPerSegment = 0;
+  std::size_t segmentCount = 0;
+  std::size_t checkpointSegments = 0;
+  std::uint64_t checkpointBytes = 0;
+  std::uint64_t segmentStart = 0;
+
+  mutable std::shared_mutex mtx;
+  std::vector<physical_t> map;
+  std::vector<std::uint32_t> live;
+  std::vector<SegmentState> state;
+  std::vector<std::size_t> freeSegments;
+  /// cleaned segments and the sequence number of the segment their
+  /// live blocks were moved to
+  std::vector<std::pair<std::size_t, std::uint64_t>> cleaned;
+  std::size_t lowWater = 0;
+
+  /// the segment being filled: summary block, then fill data blocks
+  std::size_t headSegment = 0;
+  std::uint64_t headSeq = 0;
+  std::size_t fill = 0;
+  std::vector<char> head;
+  std::vector<std::uint64_t> headEntries;
+
+  std::uint64_t nextSeq = 0;
+  std::uint64_t checkpointSeq = 0;
+  std::size_t sealedSinceCheckpoint = 0;
+  Stats counters;
+
+  std::condition_variable_any cleanerWake;
+  bool stopping = false;
+  std::thread cleaner;
+
+  off_t segmentOffset(std::size_t segment) const;
+  off_t checkpointOffset(std::uint64_t seq) const;
+
+  /**
+   * Work out the segment geometry of a new disk from bs, bc and the
+   * options.
+   */
+  void layout(const Options& options);
+
+  /**
+   * Size the file regions and in-memory tables from the geometry.
+   */
+  void allocate();
+
+  /**
+   * Create the file for a new disk.
+   */
+  bool create();
+
+  /**
+   * Load the newest checkpoint and roll forward through later segments.
+   */
+  bool recover();
+
+  /**
+   * Rebuild live counts, segment states and the free list from the map,
+   * then open a segment.
+   */
+  bool rebuild();
+
+  /**
+   * Take a free segment as the open one. False if none is free.
+   */
+  bool openSegment();
+
+  /**
+   * Append a block to the open segment, sealing it first if it is full.
+   */
+  bool append(blocknumber_t block, const char* data, bool cleaning);
+
+  /**
+   * Write out the open segment if it holds anything and open another,
+   * reclaiming cleaned segments first if free ones are short.
+   */
+  bool seal();
+
+  /**
+   * Free the cleaned segments whose blocks went to segments numbered
+   * below before, syncing the file first unless it was just synced.
+   */
+  bool reclaim(std::uint64_t before, bool synced);
+
+  /**
+   * Relocate the live blocks of the sealed segment with the fewest and
+   * queue it to be freed. Returns false if no segment has a dead block.
+   */
+  bool clean();
+
+  /**
+   * Seal, then write the map to the older checkpoint slot.
+   */
+  bool checkpoint();
+
+  /**
+   * Cleaner thread body.
+   */
+  void cleanerLoop();
+
+  /**
+   * True when the background cleaner should run. Called with mtx held.
+   */
+  bool cleaningWanted() const;
+
+ public:
+  /**
+   * LogVSSD Constructor #1
+   * Creates a new file with default options. Truncates if necessary.
+   *
+   * @param  {std::size_t} block_size  : amount of bytes in block
+   * @param  {std::size_t} block_count : amount of blocks
+   * @param  {std::string} filename    : filename
+   */
+  LogVSSD(std::size_t block_size, std::size_t block_count,
+          std::string filename);
+
+  /**
+   * LogVSSD Constructor #2
+   * Creates a new file. Truncates if necessary.
+   *
+   * @param  {std::size_t} block_size  : amount of bytes in block
+   * @param  {std::size_t} block_count : amount of blocks
+   * @param  {std::string} filename    : filename
+   * @param  {Options} options         : segment size, spare capacity and
+   *                                     checkpoint interval
+   */
+  LogVSSD(std::size_t block_size, std::size_t block_count,
+          std::string filename, Options options);
+
+  /**
+   * LogVSSD Constructor #3
+   * Opens an existing file, recovering from its last checkpoint.
+   *
+   * @param  {std::string} filename : filename to open
+   */
+  LogVSSD(std::string filename);
+
+  /**
+   * ~LogVSSD stops the cleaner and checkpoints.
+   */
+  virtual ~LogVSSD();
+
+  /**
+   * Return a copy of the counters.
+   */
+  Stats stats() const;
+
+  /**
+   * Return blocks written to the file per block written by the user
+   * (0 before any write).
+   */
+  double writeAmplification() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block if possible.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Append indicated block to the log.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Append a contiguous extent of blocks to the log.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Write out the open segment and fsync, so every completed write
+   * survives a crash.
+   *
+   * @return returns a status code for the operation. OK if all went well.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* LOGVSSD_H */
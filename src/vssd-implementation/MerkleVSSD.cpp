@@ -0,0 +1,474 @@
+/**
+ * See MerkleVSSD.h for header comment
+ */
+
+#include "MerkleVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "fd_util.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+using fd_util::read_all;
+using fd_util::write_all;
+
+static const uint64_t Signature = 0x314c4b4d44535356;  // "VSSDMKL1"
+/// signature, block size, block count, in use, image identity (device,
+/// inode, size, mtime); the nodes follow
+static const size_t HeaderBytes = 4096;
+static const size_t IdentityStart = 4;
+
+/// requests a PipePeer sends: {op, a, b}
+enum Op : uint64_t { HELLO = 1, NODES = 2, BLOCKS = 3, DONE = 4 };
+
+/**
+ * Return the hash of an interior node from its children's.
+ */
+static MerkleVSSD::Hash combine(const MerkleVSSD::Hash& left,
+                                const MerkleVSSD::Hash& right) {
+  MerkleVSSD::Hash pair[2] = {left, right};
+  return hash_util::murmur3_128(pair, sizeof(pair));
+}
+
+MerkleVSSD::MerkleVSSD(unique_ptr<VVSSD> disk, string sidecar, string image)
+    : disk(move(disk)), fn(sidecar), image(image) {
+  bs = this->disk->blockSize();
+  bc = this->disk->blockCount();
+  if (this->disk->status() != DiskStatus::OK) {
+    cout << "ERROR: Disk is not ready.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  leaves = 1;
+  while (leaves < bc) leaves *= 2;
+  tree.assign(2 * leaves, Hash());
+
+  fd = ::open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    cout << "ERROR: Unable to open '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  uint64_t fields[8] = {};
+  bool current = false;
+  if (info.st_size > 0) {
+    if (!pread_all(fd, (char*)fields, sizeof(fields), 0) ||
+        fields[0] != Signature) {
+      cout << "ERROR: '" << fn << "' is not a hash tree file.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    if (fields[1] != bs || fields[2] != bc) {
+      cout << "ERROR: '" << fn << "' holds the tree of a disk of "
+           << fields[2] << " blocks of " << fields[1] << " bytes.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    // A sidecar not closed cleanly may have missed writes, and so has
+    // one whose image was written without it since
+    uint64_t id[4] = {};
+    bool found = image.empty() || fd_util::file_identity(image.c_str(), id);
+    bool same = found && memcmp(id, &fields[IdentityStart], sizeof(id)) == 0;
+    current = fields[3] == 0 && same &&
+              pread_all(fd, (char*)tree.data(), tree.size() * sizeof(Hash),
+                        HeaderBytes);
+  }
+
+  lock_guard<mutex> hold(mtx);
+  if (!current && !rebuild()) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (!writeHeader(true)) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  opened = true;
+  stat = DiskStatus::OK;
+}
+
+MerkleVSSD::~MerkleVSSD() {
+  if (fd < 0) return;
+  lock_guard<mutex> hold(mtx);
+  if (opened) {
+    refresh();
+    if (writeNodes()) writeHeader(false);
+  }
+  close(fd);
+}
+
+bool MerkleVSSD::rebuild() {
+  vector<char> data(RunBlocks * bs);
+  for (size_t b = 0; b < bc; b += RunBlocks) {
+    size_t run = min(RunBlocks, bc - b);
+    if (disk->readBlocks(b, run, data.data()) != DiskStatus::OK) {
+      cout << "ERROR: Unable to read block " << b << " to hash it.\n";
+      return false;
+    }
+    for (size_t i = 0; i < run; i++)
+      tree[leaves + b + i] = hash_util::murmur3_128(&data[i * bs], bs);
+  }
+  for (size_t k = leaves; k-- > 1;)
+    tree[k] = combine(tree[2 * k], tree[2 * k + 1]);
+
+  if (!pwrite_all(fd, (const char*)tree.data(), tree.size() * sizeof(Hash),
+                  HeaderBytes)) {
+    cout << "ERROR: Unable to write the tree to '" << fn << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+void MerkleVSSD::refresh() {
+  if (stale.empty()) return;
+  sort(stale.begin(), stale.end());
+  stale.erase(unique(stale.begin(), stale.end()), stale.end());
+
+  // One level at a time, so each parent is hashed once
+  vector<size_t> level;
+  level.swap(stale);
+  while (level.front() > 1) {
+    vector<size_t> parents;
+    for (size_t k : level)
+      if (parents.empty() || parents.back() != k / 2)
+        parents.push_back(k / 2);
+    for (size_t p : parents) {
+      tree[p] = combine(tree[2 * p], tree[2 * p + 1]);
+      unsaved.push_back(p);
+    }
+    level.swap(parents);
+  }
+}
+
+bool MerkleVSSD::writeHeader(bool inUse) {
+  char header[HeaderBytes] = {};
+  uint64_t fields[8] = {Signature, bs, bc, inUse};
+  if (!inUse && !image.empty() &&
+      fd_util::file_identity(image.c_str(), &fields[IdentityStart]))
+    fd_util::wait_past(fields[IdentityStart + 3]);
+  memcpy(header, fields, sizeof(fields));
+  if (!pwrite_all(fd, header, sizeof(header), 0) || fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to write the header of '" << fn << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+bool MerkleVSSD::writeNodes() {
+  sort(unsaved.begin(), unsaved.end());
+  unsaved.erase(unique(unsaved.begin(), unsaved.end()), unsaved.end());
+
+  // Neighbouring nodes go out together
+  size_t i = 0;
+  while (i < unsaved.size()) {
+    size_t run = 1;
+    while (i + run < unsaved.size() && unsaved[i + run] == unsaved[i] + run)
+      run++;
+    if (!pwrite_all(fd, (const char*)&tree[unsaved[i]], run * sizeof(Hash),
+                    HeaderBytes + unsaved[i] * sizeof(Hash))) {
+      cout << "ERROR: Unable to write the tree to '" << fn << "'.\n";
+      return false;
+    }
+    i += run;
+  }
+  unsaved.clear();
+  if (fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to write the tree to '" << fn << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+size_t MerkleVSSD::leafCount() const { return leaves; }
+
+MerkleVSSD::Hash MerkleVSSD::node(size_t index) {
+  lock_guard<mutex> hold(mtx);
+  refresh();
+  return (index < tree.size()) ? tree[index] : Hash();
+}
+
+MerkleVSSD::Hash MerkleVSSD::rootHash() { return node(1); }
+
+DiskStatus MerkleVSSD::syncFrom(Peer& source, size_t* blocks,
+                                size_t* compared) {
+  if (source.blockSize() != bs || source.blockCount() != bc) {
+    cout << "ERROR: The source has " << source.blockCount() << " blocks of "
+         << source.blockSize() << " bytes, not " << bc << " of " << bs
+         << ".\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Down the tree a level at a time, into the nodes that differ only
+  vector<size_t> frontier = {1};
+  vector<blocknumber_t> differ;
+  size_t looked = 0;
+  while (!frontier.empty()) {
+    vector<Hash> theirs;
+    if (!source.nodes(frontier, theirs) || theirs.size() != frontier.size()) {
+      cout << "ERROR: The source did not send its tree.\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    looked += frontier.size();
+    vector<size_t> next;
+    {
+      lock_guard<mutex> hold(mtx);
+      refresh();
+      for (size_t i = 0; i < frontier.size(); i++) {
+        size_t k = frontier[i];
+        if (theirs[i] == tree[k]) continue;
+        if (k < leaves) {
+          next.push_back(2 * k);
+          next.push_back(2 * k + 1);
+        } else if (k - leaves < bc) {
+          differ.push_back(k - leaves);
+        }
+      }
+    }
+    frontier.swap(next);
+  }
+
+  // Copy the differing blocks, neighbours together
+  vector<char> data(RunBlocks * bs);
+  size_t i = 0;
+  while (i < differ.size()) {
+    size_t run = 1;
+    while (run < RunBlocks && i + run < differ.size() &&
+           differ[i + run] == differ[i] + run)
+      run++;
+    DiskStatus ds = source.readBlocks(differ[i], run, data.data());
+    if (ds == DiskStatus::OK) ds = writeBlocks(differ[i], run, data.data());
+    if (ds != DiskStatus::OK) {
+      stat = ds;
+      return stat;
+    }
+    i += run;
+  }
+
+  if (blocks != nullptr) *blocks = differ.size();
+  if (compared != nullptr) *compared = looked;
+  return sync();
+}
+
+DiskStatus MerkleVSSD::verify(size_t* wrong) {
+  // Writers wait, so every leaf is checked against settled data
+  auto held = locks.lock(0, bc, RangeLock::SHARED);
+  vector<char> data(RunBlocks * bs);
+  size_t corrected = 0;
+  for (size_t b = 0; b < bc; b += RunBlocks) {
+    size_t run = min(RunBlocks, bc - b);
+    stat = disk->readBlocks(b, run, data.data());
+    if (stat != DiskStatus::OK) return stat;
+    vector<Hash> hashes(run);
+    for (size_t i = 0; i < run; i++)
+      hashes[i] = hash_util::murmur3_128(&data[i * bs], bs);
+
+    lock_guard<mutex> hold(mtx);
+    for (size_t i = 0; i < run; i++) {
+      size_t k = leaves + b + i;
+      if (tree[k] == hashes[i]) continue;
+      tree[k] = hashes[i];
+      stale.push_back(k);
+      unsaved.push_back(k);
+      corrected++;
+    }
+  }
+
+  if (wrong != nullptr) *wrong = corrected;
+  lock_guard<mutex> hold(mtx);
+  refresh();
+  stat = writeNodes() ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
+
+DiskStatus MerkleVSSD::serve(int in, int out) {
+  vector<char> data(RunBlocks * bs);
+  while (true) {
+    uint64_t request[3];
+    if (!read_all(in, (char*)request, sizeof(request))) break;
+    bool ok = true;
+    switch (request[0]) {
+      case HELLO: {
+        uint64_t geometry[2] = {bs, bc};
+        ok = write_all(out, (const char*)geometry, sizeof(geometry));
+        break;
+      }
+      case NODES: {
+        if (request[1] > tree.size()) {
+          ok = false;
+          break;
+        }
+        vector<uint64_t> index(request[1]);
+        vector<Hash> hashes(request[1]);
+        ok = read_all(in, (char*)index.data(), index.size() * sizeof(uint64_t));
+        if (!ok) break;
+        {
+          lock_guard<mutex> hold(mtx);
+          refresh();
+          for (size_t i = 0; i < index.size(); i++)
+            if (index[i] < tree.size()) hashes[i] = tree[index[i]];
+        }
+        ok = write_all(out, (const char*)hashes.data(),
+                       hashes.size() * sizeof(Hash));
+        break;
+      }
+      case BLOCKS: {
+        uint64_t result = DiskStatus::BLOCK_OUT_OF_RANGE;
+        if (request[2] <= RunBlocks)
+          result = readBlocks(request[1], request[2], data.data());
+        ok = write_all(out, (const char*)&result, sizeof(result)) &&
+             (result != DiskStatus::OK ||
+              write_all(out, data.data(), request[2] * bs));
+        break;
+      }
+      case DONE:
+        return DiskStatus::OK;
+      default:
+        ok = false;
+    }
+    if (!ok) break;
+  }
+  cout << "ERROR: The connection to the peer failed.\n";
+  return DiskStatus::ERROR;
+}
+
+size_t MerkleVSSD::blockSize() const { return bs; }
+
+size_t MerkleVSSD::blockCount() const { return bc; }
+
+DiskStatus MerkleVSSD::status() const { return stat; }
+
+DiskStatus MerkleVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus MerkleVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus MerkleVSSD::readBlocks(blocknumber_t block, size_t count,
+                                  void* buffer) {
+  stat = disk->readBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus MerkleVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                   void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // The leaves match the blocks by the time anyone else can look
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+  stat = disk->writeBlocks(block, count, buffer);
+  if (stat != DiskStatus::OK) return stat;
+
+  const char* in = static_cast<const char*>(buffer);
+  vector<Hash> hashes(count);
+  for (size_t i = 0; i < count; i++)
+    hashes[i] = hash_util::murmur3_128(in + i * bs, bs);
+
+  lock_guard<mutex> hold(mtx);
+  for (size_t i = 0; i < count; i++) {
+    tree[leaves + block + i] = hashes[i];
+    stale.push_back(leaves + block + i);
+    unsaved.push_back(leaves + block + i);
+  }
+  // Many writes between syncs: fold the repeats
+  if (stale.size() > tree.size()) refresh();
+  if (unsaved.size() > 2 * tree.size()) {
+    sort(unsaved.begin(), unsaved.end());
+    unsaved.erase(unique(unsaved.begin(), unsaved.end()), unsaved.end());
+  }
+  return stat;
+}
+
+DiskStatus MerkleVSSD::sync() {
+  stat = disk->sync();
+  if (stat != DiskStatus::OK) return stat;
+  lock_guard<mutex> hold(mtx);
+  refresh();
+  stat = writeNodes() ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
+
+MerkleVSSD::LocalPeer::LocalPeer(MerkleVSSD& tree) : tree(tree) {}
+
+size_t MerkleVSSD::LocalPeer::blockSize() { return tree.blockSize(); }
+
+size_t MerkleVSSD::LocalPeer::blockCount() { return tree.blockCount(); }
+
+bool MerkleVSSD::LocalPeer::nodes(const vector<size_t>& index,
+                                  vector<Hash>& hashes) {
+  lock_guard<mutex> hold(tree.mtx);
+  tree.refresh();
+  hashes.assign(index.size(), Hash());
+  for (size_t i = 0; i < index.size(); i++)
+    if (index[i] < tree.tree.size()) hashes[i] = tree.tree[index[i]];
+  return true;
+}
+
+DiskStatus MerkleVSSD::LocalPeer::readBlocks(blocknumber_t block,
+                                             size_t count, void* buffer) {
+  return tree.readBlocks(block, count, buffer);
+}
+
+MerkleVSSD::PipePeer::PipePeer(int in, int out) : in(in), out(out) {
+  uint64_t request[3] = {HELLO, 0, 0};
+  uint64_t geometry[2];
+  if (write_all(out, (const char*)request, sizeof(request)) &&
+      read_all(in, (char*)geometry, sizeof(geometry))) {
+    bs = geometry[0];
+    bc = geometry[1];
+  } else {
+    cout << "ERROR: The peer did not answer.\n";
+  }
+}
+
+MerkleVSSD::PipePeer::~PipePeer() {
+  uint64_t request[3] = {DONE, 0, 0};
+  write_all(out, (const char*)request, sizeof(request));
+}
+
+size_t MerkleVSSD::PipePeer::blockSize() { return bs; }
+
+size_t MerkleVSSD::PipePeer::blockCount() { return bc; }
+
+bool MerkleVSSD::PipePeer::nodes(const vector<size_t>& index,
+                                 vector<Hash>& hashes) {
+  vector<uint64_t> request = {NODES, index.size(), 0};
+  request.insert(request.end(), index.begin(), index.end());
+  hashes.assign(index.size(), Hash());
+  return write_all(out, (const char*)request.data(),
+                   request.size() * sizeof(uint64_t)) &&
+         read_all(in, (char*)hashes.data(), hashes.size() * sizeof(Hash));
+}
+
+DiskStatus MerkleVSSD::PipePeer::readBlocks(blocknumber_t block, size_t count,
+                                            void* buffer) {
+  uint64_t request[3] = {BLOCKS, block, count};
+  uint64_t result;
+  if (!write_all(out, (const char*)request, sizeof(request)) ||
+      !read_all(in, (char*)&result, sizeof(result)) ||
+      (result == DiskStatus::OK &&
+       !read_all(in, static_cast<char*>(buffer), count * bs))) {
+    cout << "ERROR: The peer did not send blocks " << block << " to "
+         << block + count - 1 << ".\n";
+    return DiskStatus::ERROR;
+  }
+  return static_cast<DiskStatus>(result);
+}
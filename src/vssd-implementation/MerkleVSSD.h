@@ -0,0 +1,296 @@
+/**
+ * MerkleVSSD keeps a Merkle tree of block hashes over any disk (a
+ * RAMVSSD, a FileVSSD, ...), so two copies of an image can be compared,
+ * and repaired, by looking only where they differ.
+ *
+ * The tree is binary and complete: its leaves are the hashes of the
+ * blocks (padded with empty hashes up to a power of two), and each
+ * interior node hashes its two children. Node 1 is the root and node k
+ * has children 2k and 2k + 1, so leaf b is node leafCount() + b. A
+ * write updates its leaves at once; interior nodes above them are
+ * recomputed when the tree is next looked at, or at sync(), which also
+ * writes the changed nodes to a sidecar file next to the image.
+ *
+ * The sidecar is marked in use while the disk is open, like
+ * TrackedVSSD's. A sidecar that is missing or was not closed cleanly is
+ * rebuilt by reading every block once. Given the image's filename, a
+ * clean close also records the image's device, inode, size and
+ * modification time, and the tree is rebuilt as well if they differ
+ * when it is next opened (the image was written without it). Writes
+ * made while the disk is open must still go through it; verify()
+ * rehashes every block to find and correct leaves that went stale
+ * anyway.
+ *
+ * syncFrom() makes this disk a copy of another by walking both trees
+ * from the root, one level at a time, descending only into nodes whose
+ * hashes differ, then copying just the blocks under differing leaves:
+ * with d differing blocks it compares O(d log n) nodes in O(log n)
+ * exchanges. The other tree is a Peer: another MerkleVSSD in this
+ * process (LocalPeer) or one serve()d by another process over a pair of
+ * pipes (PipePeer). Neither disk should be written meanwhile.
+ *
+ * Writers lock their extent (a RangeLock) while they write and hash
+ * their blocks.
+ */
+
+#ifndef MERKLEVSSD_H
+  #define MERKLEVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+#include "hash_util.h"
+
+class MerkleVSSD : public VVSSD {
+ public:
+  typedef hash_util::Hash128 Hash;
+
+  /// most blocks copied by one call during syncFrom()
+  static constexpr std::size_t RunBlocks = 256;
+
+  /**
+   * The far side of syncFrom(): the geometry, nodes and blocks of the
+   * tree being copied.
+   */
+  class Peer {
+   public:
+    virtual ~Peer() = default;
+    virtual std::size_t blockSize() = 0;
+    virtual std::size_t blockCount() = 0;
+
+    /**
+     * Fill hashes with the nodes at the given indexes.
+     *
+     * @return false if the peer could not answer
+     */
+    virtual bool nodes(const std::vector<std::size_t>& index,
+                       std::vector<Hash>& hashes) = 0;
+
+    virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                  void* buffer) = 0;
+  };
+
+  /**
+   * A MerkleVSSD in this process.
+   */
+  class LocalPeer : public Peer {
+   private:
+    MerkleVSSD& tree;
+
+   public:
+    LocalPeer(MerkleVSSD& tree);
+    virtual std::size_t blockSize();
+    virtual std::size_t blockCount();
+    virtual bool nodes(const std::vector<std::size_t>& index,
+                       std::vector<Hash>& hashes);
+    virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                  void* buffer);
+  };
+
+  /**
+   * A MerkleVSSD serve()d by another process: requests go out on one
+   * descriptor and answers come back on the other.
+   */
+  class PipePeer : public Peer {
+   private:
+    int in;
+    int out;
+    std::size_t bs = 0;
+    std::size_t bc = 0;
+
+   public:
+    /**
+     * Ask the server for its geometry; blockCount() is 0 if it does not
+     * answer.
+     *
+     * @param  {int} in  : descriptor the server's answers arrive on
+     * @param  {int} out : descriptor requests are sent on
+     */
+    PipePeer(int in, int out);
+
+    /**
+     * ~PipePeer tells the server it is done.
+     */
+    virtual ~PipePeer();
+
+    virtual std::size_t blockSize();
+    virtual std::size_t blockCount();
+    virtual bool nodes(const std::vector<std::size_t>& index,
+                       std::vector<Hash>& hashes);
+    virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                  void* buffer);
+  };
+
+ private:
+  std::unique_ptr<VVSSD> disk;
+  std::string fn;
+  std::string image;
+  int fd = -1;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::size_t leaves = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  /// tree[1] is the root; tree[0] is unused
+  std::vector<Hash> tree;
+  /// leaves written since the interior was last recomputed
+  std::vector<std::size_t> stale;
+  /// nodes changed since the sidecar was last written
+  std::vector<std::size_t> unsaved;
+  bool opened = false;
+
+  /**
+   * Recompute the interior nodes above the stale leaves. Called with
+   * mtx held.
+   */
+  void refresh();
+
+  /**
+   * Hash every block and rebuild the whole tree.
+   */
+  bool rebuild();
+
+  /**
+   * Write the header (marked in use or not) to the sidecar and flush
+   * it; a clean close records the image as it is left. Called with mtx
+   * held.
+   */
+  bool writeHeader(bool inUse);
+
+  /**
+   * Write the unsaved nodes to the sidecar and flush it. Called with mtx
+   * held.
+   */
+  bool writeNodes();
+
+ public:
+  /**
+   * MerkleVSSD Constructor
+   * Keeps the tree of disk in the sidecar, building it (from every
+   * block) if the sidecar does not exist or was not closed cleanly.
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : the disk to hash
+   * @param  {std::string} sidecar         : filename of the tree
+   * @param  {std::string} image           : filename of the disk's image,
+   *                                         if it has one, to notice
+   *                                         writes made without the tree
+   */
+  MerkleVSSD(std::unique_ptr<VVSSD> disk, std::string sidecar,
+             std::string image = "");
+
+  /**
+   * ~MerkleVSSD writes the tree out and marks the sidecar closed.
+   */
+  virtual ~MerkleVSSD();
+
+  /**
+   * Return the number of leaves: blockCount() rounded up to a power of
+   * two.
+   */
+  std::size_t leafCount() const;
+
+  /**
+   * Return node index of the tree (1 is the root).
+   */
+  Hash node(std::size_t index);
+
+  /**
+   * Return the root of the tree; two disks with the same root hold the
+   * same blocks.
+   */
+  Hash rootHash();
+
+  /**
+   * Make this disk a copy of source, copying only the blocks under
+   * leaves that differ, then sync.
+   *
+   * @param  {Peer} source          : the tree to copy; same geometry
+   * @param  {std::size_t*} blocks  : set to the number of blocks copied
+   * @param  {std::size_t*} compared : set to the number of nodes compared
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  DiskStatus syncFrom(Peer& source, std::size_t* blocks = nullptr,
+                      std::size_t* compared = nullptr);
+
+  /**
+   * Rehash every block and correct the leaves that do not match, then
+   * write the tree out. Writers wait meanwhile.
+   *
+   * @param  {std::size_t*} wrong : set to the number of leaves corrected
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  DiskStatus verify(std::size_t* wrong = nullptr);
+
+  /**
+   * Answer a PipePeer's requests until it is done or the pipe closes.
+   *
+   * @param  {int} in  : descriptor requests arrive on
+   * @param  {int} out : descriptor answers are sent on
+   * @return OK if the peer finished normally, ERROR otherwise.
+   */
+  DiskStatus serve(int in, int out);
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block from the disk.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block and update its leaf.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks from the disk.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent, and update their leaves.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Sync the disk, then recompute the tree and write it to the sidecar.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* MERKLEVSSD_H */
@@ -0,0 +1,276 @@
+/**
+ * See MirroredVSSD.h for header comment
+ */
+
+#include "MirroredVSSD.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+MirroredVSSD::MirroredVSSD(vector<unique_ptr<VVSSD>> disks, bool hedging)
+    : hedging(hedging) {
+  if (disks.empty()) {
+    cout << "ERROR: Mirroring needs at least one replica.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  size_t size = disks.front()->blockSize();
+  size_t count = SIZE_MAX;
+  for (auto& disk : disks) {
+    if (disk->status() != DiskStatus::OK || disk->blockSize() != size) {
+      cout << "ERROR: Replicas must be ready and share one block size.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    count = min(count, disk->blockCount());
+  }
+
+  for (auto& disk : disks) {
+    replicas.push_back(make_unique<Replica>());
+    replicas.back()->disk = move(disk);
+    replicas.back()->samples.reserve(Window);
+  }
+  bs = size;
+  bc = count;
+  lanes = make_unique<LanePool>(replicas.size(), MaxInFlight);
+  stat = DiskStatus::OK;
+}
+
+MirroredVSSD::~MirroredVSSD() {}
+
+size_t MirroredVSSD::replicaCount() const { return replicas.size(); }
+
+MirroredVSSD::ReplicaStats MirroredVSSD::replicaStats(size_t replica) const {
+  const Replica& r = *replicas.at(replica);
+  ReplicaStats stats;
+  stats.reads = r.reads;
+  stats.hedges = r.hedges;
+  stats.errors = r.errors;
+  stats.inFlight = r.inFlight;
+  stats.failed = r.failed;
+  stats.ewma = clock::duration(r.ewma.load());
+  stats.p95 = clock::duration(r.p95.load());
+  return stats;
+}
+
+size_t MirroredVSSD::blockSize() const { return bs; }
+
+size_t MirroredVSSD::blockCount() const { return bc; }
+
+DiskStatus MirroredVSSD::status() const { return stat; }
+
+DiskStatus MirroredVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus MirroredVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+void MirroredVSSD::record(Replica& replica, clock::duration latency) {
+  lock_guard<mutex> hold(replica.mtx);
+  clock::rep sample = latency.count();
+  clock::rep old = replica.ewma;
+  replica.ewma = old == 0 ? sample : old + (clock::rep)(Alpha * (sample - old));
+
+  replica.samples.push_back(sample);
+  if (replica.samples.size() < Window) return;
+
+  // Window closed: the p95 sample is the one with 5% of samples above it
+  auto& samples = replica.samples;
+  size_t rank = samples.size() - 1 - samples.size() / 20;
+  nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  replica.p95 = samples[rank];
+  samples.clear();
+}
+
+vector<size_t> MirroredVSSD::readOrder() {
+  vector<size_t> order;
+  for (size_t r = 0; r < replicas.size(); r++)
+    if (!replicas[r]->failed) order.push_back(r);
+  stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return replicas[a]->ewma < replicas[b]->ewma;
+  });
+
+  // Now and then read from another replica to keep its EWMA current
+  size_t n = readCount++;
+  if (order.size() > 1 && n % ProbeEvery == ProbeEvery - 1)
+    rotate(order.begin(),
+           order.begin() + 1 + (n / ProbeEvery) % (order.size() - 1),
+           order.end());
+
+  // A replica this far behind may be hung: ask it only if nothing else
+  stable_partition(order.begin(), order.end(), [this](size_t r) {
+    return replicas[r]->inFlight < MaxInFlight;
+  });
+  return order;
+}
+
+DiskStatus MirroredVSSD::readFrom(size_t r, blocknumber_t block, size_t count,
+                                  void* buffer) {
+  Replica& replica = *replicas[r];
+  auto start = clock::now();
+  replica.inFlight++;
+  DiskStatus ds = replica.disk->readBlocks(block, count, buffer);
+  replica.inFlight--;
+  if (ds != DiskStatus::OK) {
+    replica.errors++;
+    return ds;
+  }
+  record(replica, clock::now() - start);
+  replica.reads++;
+  return ds;
+}
+
+DiskStatus MirroredVSSD::hedgedRead(const vector<size_t>& order,
+                                    blocknumber_t block, size_t count,
+                                    void* buffer) {
+  /**
+   * The attempts at one read; shared with them, as the loser may finish
+   * after the caller has returned.
+   */
+  struct Race {
+    mutex mtx;
+    condition_variable done;
+    size_t running = 0;
+    int winner = -1;
+    DiskStatus failure = DiskStatus::ERROR;
+    vector<char> buffers[2];
+  };
+
+  auto race = make_shared<Race>();
+  clock::time_point started[2];
+  // Called with race->mtx held
+  auto launch = [&](int slot) {
+    Replica& replica = *replicas[order[slot]];
+    race->buffers[slot].resize(count * bs);
+    race->running++;
+    replica.inFlight++;
+    auto start = started[slot] = clock::now();
+    lanes->submit(order[slot], [this, race, &replica, slot, block, count,
+                                start] {
+      DiskStatus ds =
+          replica.disk->readBlocks(block, count, race->buffers[slot].data());
+      replica.inFlight--;
+      if (ds == DiskStatus::OK) record(replica, clock::now() - start);
+      lock_guard<mutex> hold(race->mtx);
+      race->running--;
+      if (ds != DiskStatus::OK) {
+        replica.errors++;
+        race->failure = ds;
+      } else if (race->winner < 0) {
+        race->winner = slot;
+      }
+      race->done.notify_all();
+      return ds;
+    });
+  };
+  auto over = [&] { return race->winner >= 0 || race->running == 0; };
+
+  unique_lock<mutex> hold(race->mtx);
+  launch(0);
+  auto threshold = max<clock::duration>(
+      clock::duration(replicas[order[0]]->p95.load()), MinHedgeDelay);
+  if (!race->done.wait_for(hold, threshold, over) &&
+      replicas[order[1]]->inFlight < MaxInFlight) {
+    replicas[order[1]]->hedges++;
+    launch(1);
+  }
+  race->done.wait(hold, over);
+
+  // The first attempt may never answer: charge it for the wait so far
+  if (race->winner == 1 && race->running > 0)
+    record(*replicas[order[0]],
+           max<clock::duration>(clock::now() - started[0], threshold));
+
+  if (race->winner < 0) return race->failure;
+  replicas[order[race->winner]]->reads++;
+  memcpy(buffer, race->buffers[race->winner].data(), count * bs);
+  return DiskStatus::OK;
+}
+
+DiskStatus MirroredVSSD::readBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+  vector<size_t> order = readOrder();
+  if (order.empty()) {
+    cout << "ERROR: No replica left to read from\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  DiskStatus ds = hedging && order.size() > 1
+                      ? hedgedRead(order, block, count, buffer)
+                      : readFrom(order[0], block, count, buffer);
+  // Failed everywhere we asked: try the others in turn
+  for (size_t i = 1; ds != DiskStatus::OK && i < order.size(); i++)
+    ds = readFrom(order[i], block, count, buffer);
+  stat = ds;
+  return stat;
+}
+
+DiskStatus MirroredVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // One writer per extent, so overlapping writes land in one order
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+  vector<DiskStatus> results(replicas.size(), DiskStatus::ERROR);
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t r = 0; r < replicas.size(); r++) {
+    if (replicas[r]->failed) continue;
+    jobs.emplace_back(r, [&, r] {
+      return results[r] = replicas[r]->disk->writeBlocks(block, count, buffer);
+    });
+  }
+  if (jobs.empty()) {
+    cout << "ERROR: No replica left to write to\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  lanes->run(jobs);
+
+  // A replica that missed a write is stale from now on
+  DiskStatus ds = DiskStatus::ERROR;
+  bool taken = false;
+  for (auto& job : jobs) {
+    Replica& replica = *replicas[job.first];
+    if (results[job.first] == DiskStatus::OK) {
+      taken = true;
+      continue;
+    }
+    cout << "ERROR: Replica " << job.first << " failed a write; dropping it\n";
+    replica.errors++;
+    replica.failed = true;
+    ds = results[job.first];
+  }
+  stat = taken ? DiskStatus::OK : ds;
+  return stat;
+}
+
+DiskStatus MirroredVSSD::sync() {
+  if (lanes == nullptr) return stat;
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t r = 0; r < replicas.size(); r++)
+    if (!replicas[r]->failed)
+      jobs.emplace_back(r, [this, r] { return replicas[r]->disk->sync(); });
+  stat = lanes->run(jobs);
+  return stat;
+}
@@ -0,0 +1,208 @@
+/**
+ * MirroredVSSD (RAID-1) keeps a full copy of the disk on each of two or
+ * more replicas (any VVSSDs of the same block size), both for
+ * redundancy and to keep read latency low when one device hiccups.
+ *
+ * Writes go to every replica in parallel (one LanePool lane each) and
+ * hold an exclusive RangeLock on their extent, so overlapping writes
+ * reach all replicas in the same order. A replica whose write fails no
+ * longer has the current data; it is marked failed and left out of
+ * reads and writes from then on (there is no rebuild). A write
+ * succeeds while at least one replica takes it.
+ *
+ * A read goes to one replica, picked by latency: each replica keeps an
+ * EWMA of its read latencies (dispatch to completion, as the caller sees
+ * it) and the one with the lowest wins, except that every ProbeEvery-th
+ * read goes to the next replica in turn so every estimate stays current.
+ * If the chosen replica has not answered by its hedge threshold (the p95
+ * of its last window of Window reads, at least MinHedgeDelay), the same
+ * read is sent to the next best replica too, and whichever answers first
+ * is used. A first attempt that loses is charged the time it had taken
+ * (at least the threshold) at once, so a replica that hangs rather than
+ * answering slowly still falls behind. Each lane runs up to MaxInFlight
+ * attempts at once, so concurrent reads of one replica do not queue
+ * behind each other, and a replica with that many reads outstanding is
+ * tried last and not hedged to, so a hung one cannot tie up threads
+ * without end. Each attempt reads into its own buffer, shared with the
+ * attempt, so a loser finishing late never writes into memory the caller
+ * has moved on from; its latency is still recorded, which is how a slow
+ * replica's EWMA catches up with it. A read that fails on every attempt
+ * is retried on the remaining replicas.
+ *
+ * With hedging off (or a single healthy replica) reads run on the
+ * calling thread and never change threads.
+ */
+
+#ifndef MIRROREDVSSD_H
+  #define MIRROREDVSSD_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "LanePool.h"
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class MirroredVSSD : public VVSSD {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  /// reads per p95 window
+  static const std::size_t Window = 128;
+  /// weight of each new sample in the latency EWMA
+  static constexpr double Alpha = 0.125;
+  /// every ProbeEvery-th read goes to the next replica rather than the best
+  static const std::size_t ProbeEvery = 32;
+  /// hedge thresholds never go below this
+  static constexpr std::chrono::microseconds MinHedgeDelay{200};
+  /// reads a replica may have outstanding before it is read from last
+  static constexpr std::size_t MaxInFlight = 32;
+
+  /**
+   * What a replica has seen so far.
+   */
+  struct ReplicaStats {
+    std::size_t reads = 0;      // reads it answered (won)
+    std::size_t hedges = 0;     // hedged reads sent to it
+    std::size_t errors = 0;     // failed reads and writes
+    std::size_t inFlight = 0;   // reads sent to it and not yet answered
+    bool failed = false;        // out of service after a failed write
+    clock::duration ewma{0};    // read latency EWMA
+    clock::duration p95{0};     // p95 read latency of the last window
+  };
+
+ private:
+  struct Replica {
+    std::unique_ptr<VVSSD> disk;
+    std::atomic<bool> failed = false;
+    std::atomic<std::size_t> reads = 0;
+    std::atomic<std::size_t> hedges = 0;
+    std::atomic<std::size_t> errors = 0;
+    std::atomic<std::size_t> inFlight = 0;
+    std::atomic<clock::rep> ewma{0};
+    std::atomic<clock::rep> p95{0};
+
+    std::mutex mtx;                    // guards samples
+    std::vector<clock::rep> samples;
+  };
+
+  std::vector<std::unique_ptr<Replica>> replicas;
+  bool hedging = true;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  std::atomic<std::size_t> readCount = 0;
+  RangeLock locks;
+  std::unique_ptr<LanePool> lanes;
+
+  /**
+   * Fold one read latency into a replica's EWMA and p95 window.
+   */
+  void record(Replica& replica, clock::duration latency);
+
+  /**
+   * Return the healthy replicas, the one to read from first; those with
+   * MaxInFlight reads outstanding come last.
+   */
+  std::vector<std::size_t> readOrder();
+
+  /**
+   * Read an extent from one replica on the calling thread.
+   */
+  DiskStatus readFrom(std::size_t replica, blocknumber_t block,
+                      std::size_t count, void* buffer);
+
+  /**
+   * Read an extent from order[0], hedging to order[1] if it is slow.
+   * Return OK with the data in buffer, or the last error.
+   */
+  DiskStatus hedgedRead(const std::vector<std::size_t>& order,
+                        blocknumber_t block, std::size_t count, void* buffer);
+
+ public:
+  /**
+   * MirroredVSSD Constructor
+   * Mirrors over replicas, which must all be ready and have the same
+   * block size; the disk is as long as the shortest.
+   *
+   * @param  {std::vector<std::unique_ptr<VVSSD>>} replicas : the disks
+   * @param  {bool} hedging                                 : send slow
+   *                                                          reads to a
+   *                                                          second replica
+   */
+  MirroredVSSD(std::vector<std::unique_ptr<VVSSD>> replicas,
+               bool hedging = true);
+
+  virtual ~MirroredVSSD();
+
+  /**
+   * Return the number of replicas (failed ones included).
+   */
+  std::size_t replicaCount() const;
+
+  /**
+   * Return the latency and error counts of a replica.
+   *
+   * @param  {std::size_t} replica : index, in the order given
+   */
+  ReplicaStats replicaStats(std::size_t replica) const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block from the fastest replica.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block to every replica.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent,
+   * from the fastest replica (or the first of two to answer).
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent, to every healthy replica in parallel.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if any replica took the write, its error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize every healthy replica, in parallel.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* MIRROREDVSSD_H */
@@ -0,0 +1,295 @@
+/**
+ * See OverlayVSSD.h for header comment
+ */
+
+#include "OverlayVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "FileVSSD.h"
+#include "fd_util.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+static const uint64_t Signature = 0x314c564f44535356;  // "VSSDOVL1"
+/// signature, block size, block count, base name length, base name
+static const size_t HeaderBytes = 4096;
+static const size_t NameStart = 4 * sizeof(uint64_t);
+
+OverlayVSSD::OverlayVSSD(string base, string delta) {
+  // The chain under the new delta sets the geometry
+  if (!openChain(base, O_RDONLY)) {
+    // Nothing to read from: refuse every block
+    bc = 0;
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  // The header names the base relative to the delta's directory, so
+  // opening the delta works from anywhere and the two can move together
+  error_code failed;
+  string named = filesystem::relative(
+      base, filesystem::absolute(delta).parent_path(), failed);
+  if (failed || named.empty())
+    named = filesystem::absolute(base, failed).string();
+  if (named.size() > HeaderBytes - NameStart) {
+    cout << "ERROR: Base filename '" << named << "' is too long.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  Level top;
+  top.fn = delta;
+  top.fd = open(delta.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (top.fd < 0) {
+    cout << "ERROR: Unable to create '" << delta << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  top.dataStart = HeaderBytes + bitmapBytes();
+  top.present.assign(bitmapBytes(), 0);
+
+  // Header, then an all-clear bitmap; the blocks stay holes until written
+  char header[HeaderBytes] = {};
+  uint64_t fields[4] = {Signature, bs, bc, named.size()};
+  memcpy(header, fields, sizeof(fields));
+  memcpy(header + NameStart, named.data(), named.size());
+  bool ok = pwrite_all(top.fd, header, sizeof(header), 0) &&
+            ftruncate(top.fd, top.dataStart + (off_t)bc * bs) == 0;
+  levels.insert(levels.begin(), move(top));
+  if (!ok) {
+    cout << "ERROR: Unable to initialize '" << delta << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Everything is still where the chain had it, one level further down
+  for (auto& level : owner) level++;
+  stat = DiskStatus::OK;
+}
+
+OverlayVSSD::OverlayVSSD(string delta) {
+  if (!openChain(delta, O_RDWR)) {
+    bc = 0;
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (levels.front().image) {
+    cout << "ERROR: '" << delta << "' is an image, not a delta.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = DiskStatus::OK;
+}
+
+OverlayVSSD::~OverlayVSSD() {
+  for (auto& level : levels)
+    if (level.fd >= 0) close(level.fd);
+}
+
+size_t OverlayVSSD::bitmapBytes() const {
+  return ((bc + 7) / 8 + 4095) / 4096 * 4096;
+}
+
+bool OverlayVSSD::openLevel(const string& filename, int flags, Level& level,
+                            string& base) {
+  level.fn = filename;
+  level.fd = open(filename.c_str(), flags);
+  uint64_t fields[4] = {};
+  if (level.fd < 0 ||
+      !pread_all(level.fd, (char*)fields, sizeof(fields), 0) ||
+      fields[0] != Signature) {
+    // Not a delta: it must be an image
+    size_t block_size, block_count;
+    if (!FileVSSD::readImageHeader(level.fd, filename, block_size,
+                                   block_count))
+      return false;
+    level.image = true;
+    level.dataStart = block_size;
+    fields[1] = block_size;
+    fields[2] = block_count;
+  }
+
+  if (levels.empty()) {
+    bs = fields[1];
+    bc = fields[2];
+  } else if (fields[1] != bs || fields[2] != bc) {
+    cout << "ERROR: '" << filename << "' does not match the geometry of '"
+         << levels.front().fn << "'.\n";
+    return false;
+  }
+  if (level.image) return true;
+
+  struct stat info;
+  level.dataStart = HeaderBytes + bitmapBytes();
+  level.present.assign(bitmapBytes(), 0);
+  if (fields[3] > HeaderBytes - NameStart || fstat(level.fd, &info) != 0 ||
+      info.st_size < level.dataStart + (off_t)(bc * bs)) {
+    cout << "ERROR: File size does not match header information.\n";
+    return false;
+  }
+  base.assign(fields[3], '\0');
+  if (!pread_all(level.fd, base.data(), base.size(), NameStart) ||
+      !pread_all(level.fd, (char*)level.present.data(), level.present.size(),
+                 HeaderBytes)) {
+    cout << "ERROR: Unable to read the header of '" << filename << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+bool OverlayVSSD::openChain(const string& filename, int topFlags) {
+  string next = filename;
+  int flags = topFlags;
+  while (true) {
+    if (levels.size() == MaxLevels) {
+      cout << "ERROR: The chain under '" << filename << "' is deeper than "
+           << MaxLevels << " levels.\n";
+      return false;
+    }
+    Level level;
+    string base;
+    bool ok = openLevel(next, flags, level, base);
+    bool image = level.image;
+    levels.push_back(move(level));
+    if (!ok) return false;
+    if (image) break;
+    // Relative names are from the directory of the delta holding them
+    next = (filesystem::path(next).parent_path() / base).string();
+    flags = O_RDONLY;
+  }
+
+  // Each block belongs to the topmost level holding it; the image holds all
+  owner.assign(bc, levels.size() - 1);
+  for (size_t b = 0; b < bc; b++)
+    for (size_t l = 0; l + 1 < levels.size(); l++)
+      if (levels[l].present[b / 8] & (1 << (b % 8))) {
+        owner[b] = l;
+        break;
+      }
+  return true;
+}
+
+size_t OverlayVSSD::levelCount() const { return levels.size(); }
+
+size_t OverlayVSSD::deltaBlocks() const {
+  lock_guard<mutex> hold(bitmapLock);
+  size_t held = 0;
+  for (uint8_t bits : levels.front().present) held += __builtin_popcount(bits);
+  return held;
+}
+
+size_t OverlayVSSD::blockSize() const { return bs; }
+
+size_t OverlayVSSD::blockCount() const { return bc; }
+
+DiskStatus OverlayVSSD::status() const { return stat; }
+
+DiskStatus OverlayVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus OverlayVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus OverlayVSSD::readBlocks(blocknumber_t block, size_t count,
+                                   void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  char* out = static_cast<char*>(buffer);
+  size_t i = 0;
+  while (i < count) {
+    const Level& level = levels[owner[block + i]];
+    size_t run = 1;
+    while (i + run < count && owner[block + i + run] == owner[block + i])
+      run++;
+    if (!pread_all(level.fd, out + i * bs, run * bs,
+                   level.dataStart + (off_t)(block + i) * bs)) {
+      cout << "ERROR: Unable to read block " << block + i << " from '"
+           << level.fn << "'\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    i += run;
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus OverlayVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  Level& top = levels.front();
+  if (!pwrite_all(top.fd, (const char*)buffer, count * bs,
+                  top.dataStart + (off_t)block * bs)) {
+    cout << "ERROR: Unable to write block " << block << "\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Only blocks new to the delta change the bitmap. Their bits are ours
+  // alone while we hold the extent, though the bytes are shared.
+  bool marked = true;
+  {
+    lock_guard<mutex> hold(bitmapLock);
+    for (size_t b = block; b < block + count && marked; b++)
+      marked = top.present[b / 8] & (1 << (b % 8));
+  }
+
+  // The data has to be on disk before the bitmap says it is there
+  if (!marked && fdatasync(top.fd) != 0) {
+    cout << "ERROR: Unable to flush block " << block << "\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Mark the blocks present; neighbouring extents share bitmap bytes
+  if (!marked) {
+    lock_guard<mutex> hold(bitmapLock);
+    for (size_t b = block; b < block + count; b++)
+      top.present[b / 8] |= 1 << (b % 8);
+    size_t first = block / 8;
+    size_t last = (block + count - 1) / 8;
+    if (!pwrite_all(top.fd, (const char*)top.present.data() + first,
+                    last - first + 1, HeaderBytes + first)) {
+      cout << "ERROR: Unable to update the bitmap of '" << top.fn << "'\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+  }
+  for (size_t b = block; b < block + count; b++) owner[b] = 0;
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus OverlayVSSD::sync() {
+  stat = (fsync(levels.front().fd) == 0) ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
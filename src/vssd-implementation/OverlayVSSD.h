@@ -0,0 +1,179 @@
+/**
+ * OverlayVSSD layers a small writable delta file over a read-only base
+ * image, so a new disk starts from a shared golden image without
+ * copying it.
+ *
+ * The delta keeps a block at the same place a FileVSSD image would
+ * (after a header and a presence bitmap), in a sparse file: only
+ * blocks written through the overlay take space. Reads of blocks whose
+ * presence bit is clear go to the base. The base is an image in the
+ * CAFECA75 format (see FileVSSD) or another delta, so overlays chain;
+ * the delta's header names its base (relative to the delta's own
+ * directory, so a chain can be moved as a whole), and opening a delta
+ * opens the whole chain read-only.
+ *
+ * Each level's bitmap is loaded when the chain is opened, and the
+ * topmost level holding each block is worked out once (O(levels) per
+ * block) and kept, so a read finds its level in constant time however
+ * deep the chain. Writes always go to the top delta.
+ *
+ * A RangeLock over block numbers keeps a writer's blocks in the top
+ * delta, and the level kept for each, from changing under a reader of
+ * the same blocks; the bitmap has its own mutex.
+ *
+ * A write that marks blocks present for the first time flushes its
+ * data (fdatasync) before writing the bitmap, so even after a crash a
+ * block is never marked present before it is. Rewrites of blocks
+ * already present leave the bitmap alone and pay nothing extra.
+ */
+
+#ifndef OVERLAYVSSD_H
+  #define OVERLAYVSSD_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class OverlayVSSD : public VVSSD {
+ public:
+  /// deepest chain of deltas followed before giving up (cycles)
+  static const std::size_t MaxLevels = 64;
+
+ private:
+  /**
+   * One file in the chain: a delta (with a presence bitmap) or the
+   * base image at the bottom.
+   */
+  struct Level {
+    std::string fn;
+    int fd = -1;
+    bool image = false;
+    /// offset of block 0; block n is n blocks further on
+    off_t dataStart = 0;
+    std::vector<std::uint8_t> present;
+  };
+
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// levels[0] is the writable delta, levels.back() the base image
+  std::vector<Level> levels;
+  /// topmost level holding each block
+  std::vector<std::uint16_t> owner;
+  /// serializes bitmap updates of the top delta
+  mutable std::mutex bitmapLock;
+
+  /**
+   * Open a delta or image; for a delta, set base to the file under it.
+   */
+  bool openLevel(const std::string& filename, int flags, Level& level,
+                 std::string& base);
+
+  /**
+   * Open filename and every level under it (all but the first
+   * read-only), then work out each block's owner.
+   */
+  bool openChain(const std::string& filename, int topFlags);
+
+  /**
+   * Return the bitmap size of a delta, rounded up to whole pages.
+   */
+  std::size_t bitmapBytes() const;
+
+ public:
+  /**
+   * OverlayVSSD Constructor #1
+   * Creates a new, empty delta over base. Truncates if necessary.
+   *
+   * @param  {std::string} base  : image (CAFECA75) or delta to layer over;
+   *                               never written, and recorded relative
+   *                               to the delta's directory
+   * @param  {std::string} delta : filename of the new delta
+   */
+  OverlayVSSD(std::string base, std::string delta);
+
+  /**
+   * OverlayVSSD Constructor #2
+   * Opens an existing delta and the chain of bases under it.
+   *
+   * @param  {std::string} delta : filename of the delta
+   */
+  OverlayVSSD(std::string delta);
+
+  virtual ~OverlayVSSD();
+
+  /**
+   * Return the number of files in the chain, the delta included.
+   */
+  std::size_t levelCount() const;
+
+  /**
+   * Return the number of blocks the top delta holds.
+   */
+  std::size_t deltaBlocks() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block from the topmost level holding it.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block to the delta.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent;
+   * runs held by one level are read with one call.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks to the delta under an exclusive
+   * lock on the extent, then mark them present.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Flush the delta to the device.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* OVERLAYVSSD_H */
@@ -0,0 +1,139 @@
+/**
+ * See QoSVSSD.h for header comment
+ */
+
+#include "QoSVSSD.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void QoSVSSD::Bucket::refill(clock::time_point now) {
+  if (rate > 0) {
+    chrono::duration<double> elapsed = now - refilled;
+    tokens = min(capacity, tokens + elapsed.count() * rate);
+  }
+  refilled = now;
+}
+
+QoSVSSD::clock::duration QoSVSSD::Bucket::wait(double need) const {
+  // Requests bigger than the bucket go once it is full (and overdraw it)
+  need = min(need, capacity);
+  if (rate <= 0 || tokens >= need) return clock::duration::zero();
+  return chrono::duration_cast<clock::duration>(
+             chrono::duration<double>((need - tokens) / rate)) +
+         clock::duration(1);
+}
+
+QoSVSSD::QoSVSSD(unique_ptr<VVSSD> disk, clock::duration p99Target,
+                 size_t maxDepth, clock::duration agingStep)
+    : AsyncVSSD(move(disk), p99Target, maxDepth), agingStep(agingStep) {}
+
+QoSVSSD::~QoSVSSD() {
+  // The workers call our dequeue(); stop them while tenants still exist
+  shutdown();
+}
+
+void QoSVSSD::setLimits(tenant_t tenant, Limits limits) {
+  lock_guard<mutex> hold(mtx);
+  auto now = clock::now();
+  chrono::duration<double> burst = limits.burst;
+  Tenant& t = tenants[tenant];
+  t.iops.rate = limits.iops;
+  t.iops.capacity = max(1.0, limits.iops * burst.count());
+  t.iops.tokens = t.iops.capacity;
+  t.iops.refilled = now;
+  t.bytes.rate = limits.bytesPerSecond;
+  t.bytes.capacity = max<double>(blockSize(), limits.bytesPerSecond * burst.count());
+  t.bytes.tokens = t.bytes.capacity;
+  t.bytes.refilled = now;
+}
+
+QoSVSSD::TenantStats QoSVSSD::stats(tenant_t tenant) const {
+  lock_guard<mutex> hold(mtx);
+  auto match = tenants.find(tenant);
+  if (match == tenants.end()) return TenantStats();
+  TenantStats result = match->second.stats;
+  // Include a throttled stretch that has not ended yet
+  if (match->second.throttling)
+    result.throttled += clock::now() - match->second.throttledSince;
+  return result;
+}
+
+void QoSVSSD::enqueue(Pending pending) {
+  unsigned int cls = min(pending.request.priority, PriorityClasses - 1);
+  tenants[pending.request.tenant].waiting[cls].push_back(move(pending));
+}
+
+bool QoSVSSD::queued() const {
+  for (auto& [id, tenant] : tenants)
+    for (auto& waiting : tenant.waiting)
+      if (!waiting.empty()) return true;
+  return false;
+}
+
+bool QoSVSSD::dequeue(Pending& next, clock::time_point& wakeAt) {
+  auto now = clock::now();
+  Tenant* bestTenant = nullptr;
+  deque<Pending>* bestQueue = nullptr;
+  double bestScore = 0;
+
+  // Candidates are the oldest request of each tenant and class
+  for (auto& [id, tenant] : tenants) {
+    tenant.iops.refill(now);
+    tenant.bytes.refill(now);
+
+    bool held = false;
+    for (unsigned int cls = 0; cls < PriorityClasses; cls++) {
+      auto& waiting = tenant.waiting[cls];
+      // Expired and cancelled requests neither wait nor use up tokens
+      while (!waiting.empty() && abandoned(waiting.front().request, now)) {
+        drop(waiting.front());
+        waiting.pop_front();
+      }
+      if (waiting.empty()) continue;
+      Pending& head = waiting.front();
+
+      double bytes = (double)head.request.count * blockSize();
+      clock::duration hold =
+          max(tenant.iops.wait(1), tenant.bytes.wait(bytes));
+      if (hold > clock::duration::zero()) {
+        held = true;
+        // Wake for the tokens, or sooner to drop the request if it expires
+        wakeAt = min({wakeAt, now + hold, head.request.deadline});
+        continue;
+      }
+
+      // Aging: every agingStep waited counts as one class higher
+      double score = cls + chrono::duration<double>(now - head.queued) /
+                               chrono::duration<double>(agingStep);
+      if (bestQueue == nullptr || score > bestScore ||
+          (score == bestScore && head.queued < bestQueue->front().queued)) {
+        bestTenant = &tenant;
+        bestQueue = &waiting;
+        bestScore = score;
+      }
+    }
+
+    // Track stretches where the tenant's own limits hold its work back
+    if (held && !tenant.throttling) {
+      tenant.throttling = true;
+      tenant.throttledSince = now;
+    } else if (!held && tenant.throttling) {
+      tenant.throttling = false;
+      tenant.stats.throttled += now - tenant.throttledSince;
+    }
+  }
+
+  if (bestQueue == nullptr) return false;
+
+  next = move(bestQueue->front());
+  bestQueue->pop_front();
+
+  double bytes = (double)next.request.count * blockSize();
+  if (bestTenant->iops.rate > 0) bestTenant->iops.tokens -= 1;
+  if (bestTenant->bytes.rate > 0) bestTenant->bytes.tokens -= bytes;
+  bestTenant->stats.requests++;
+  bestTenant->stats.bytes += (uint64_t)bytes;
+  return true;
+}
@@ -0,0 +1,122 @@
+/**
+ * QoSVSSD shares one disk among tenants with per-tenant limits and
+ * priority classes.
+ *
+ * It is an AsyncVSSD whose queue honours the tenant and priority tags
+ * carried by every Request:
+ *
+ *  - each tenant may have token-bucket limits on requests per second
+ *    and bytes per second; a tenant out of tokens waits (only its own
+ *    requests are held back) until the buckets refill;
+ *  - among the requests that may go, the one with the highest priority
+ *    class (0 is lowest, PriorityClasses - 1 highest) goes first, the
+ *    oldest first within a class;
+ *  - a request's class rises by one for every agingStep it has waited,
+ *    so a bulk tenant's low-priority work is delayed, never starved.
+ *
+ * Requests that expire or are cancelled while held back are dropped
+ * without using up their tenant's tokens.
+ *
+ * Each tenant's requests of one class stay in submission order. Time a
+ * tenant spends with work held back by its own limits is accumulated
+ * in its statistics, along with requests and bytes dispatched.
+ */
+
+#ifndef QOSVSSD_H
+  #define QOSVSSD_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+
+#include "AsyncVSSD.h"
+
+class QoSVSSD : public AsyncVSSD {
+ public:
+  typedef unsigned int tenant_t;
+
+  /// number of priority classes; higher classes dispatch first
+  static const unsigned int PriorityClasses = 4;
+
+  /**
+   * Token-bucket limits for one tenant. A rate of 0 means unlimited.
+   * Each bucket holds at most burst's worth of its rate.
+   */
+  struct Limits {
+    double iops = 0;
+    double bytesPerSecond = 0;
+    clock::duration burst = std::chrono::milliseconds(100);
+  };
+
+  /**
+   * What a tenant has been given (and denied) so far.
+   */
+  struct TenantStats {
+    std::uint64_t requests = 0;
+    std::uint64_t bytes = 0;
+    clock::duration throttled = clock::duration::zero();
+  };
+
+ private:
+  struct Bucket {
+    double rate = 0;
+    double capacity = 0;
+    double tokens = 0;
+    clock::time_point refilled;
+
+    void refill(clock::time_point now);
+    /// time from now until need tokens are available (zero if they are)
+    clock::duration wait(double need) const;
+  };
+
+  struct Tenant {
+    Bucket iops;
+    Bucket bytes;
+    std::deque<Pending> waiting[PriorityClasses];
+    bool throttling = false;
+    clock::time_point throttledSince;
+    TenantStats stats;
+  };
+
+  const clock::duration agingStep;
+  std::map<tenant_t, Tenant> tenants;
+
+ protected:
+  virtual void enqueue(Pending pending);
+  virtual bool dequeue(Pending& next, clock::time_point& wakeAt);
+  virtual bool queued() const;
+
+ public:
+  /**
+   * QoSVSSD Constructor
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : disk shared by the tenants
+   * @param  {clock::duration} p99Target   : see AsyncVSSD
+   * @param  {std::size_t} maxDepth        : see AsyncVSSD
+   * @param  {clock::duration} agingStep   : wait that lifts a request
+   *                                         by one priority class
+   */
+  QoSVSSD(std::unique_ptr<VVSSD> disk, clock::duration p99Target,
+          std::size_t maxDepth = 32,
+          clock::duration agingStep = std::chrono::milliseconds(20));
+
+  virtual ~QoSVSSD();
+
+  /**
+   * Set (or replace) a tenant's limits. Tenants without limits are
+   * never throttled.
+   *
+   * @param  {tenant_t} tenant : tenant to limit
+   * @param  {Limits} limits   : the new limits; buckets start full
+   */
+  void setLimits(tenant_t tenant, Limits limits);
+
+  /**
+   * Return a copy of a tenant's statistics.
+   *
+   * @param  {tenant_t} tenant : tenant to report
+   */
+  TenantStats stats(tenant_t tenant) const;
+};
+
+  #endif /* QOSVSSD_H */
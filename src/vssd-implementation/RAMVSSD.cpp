@@ -4,33 +4,417 @@
 
 #include "RAMVSSD.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <vector>
+
+#include "FileVSSD.h"
+#include "block_util.h"
+#include "fd_util.h"
 
 using namespace std;
 
+// Older headers name only the shift for the huge page size flags
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
 // Some secret sauce of mine, stolen from stack overflow, used in printRAM()
 #define HEX(x) setw(2) << setfill('0') << hex << (unsigned int)(x)
 
-RAMVSSD::RAMVSSD(size_t block_size, size_t block_count) {
+RAMVSSD::RAMVSSD(size_t block_size, size_t block_count)
+    : RAMVSSD(block_size, block_count, Options()) {}
+
+RAMVSSD::RAMVSSD(size_t block_size, size_t block_count, Options options)
+    : stripes(block_count) {
   // Set count and size variables
   bc = block_count;
   bs = block_size;
 
+  if (!mapMemory(options)) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Data should be 0'd out by default
+
+  setUp(options);
+}
+
+RAMVSSD::RAMVSSD(const string& filename, Restore restore)
+    : RAMVSSD(filename, restore, Options()) {}
+
+RAMVSSD::RAMVSSD(const string& filename, Restore restore, Options options)
+    : RAMVSSD(Image(filename), restore, options) {}
+
+RAMVSSD::RAMVSSD(const Image& image, Restore restore, Options options)
+    : stripes(image.bc) {
+  bc = image.bc;
+  bs = image.bs;
+
+  if (!image.valid) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  bool mapped = (restore == ADOPT) ? adoptImage(image, options.provisioning)
+                                   : mapMemory(options);
+  if (!mapped) {
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  setUp(options);
+  if (stat == DiskStatus::OK && restore == COPY && !loadImage(image)) {
+    cout << "ERROR: Unable to load the image\n";
+    stat = DiskStatus::ERROR;
+  }
+}
+
+RAMVSSD::Image::Image(const string& filename) {
+  fd = open(filename.c_str(), O_RDONLY);
+  valid = FileVSSD::readImageHeader(fd, filename, bs, bc);
+}
+
+RAMVSSD::Image::~Image() {
+  if (fd >= 0) close(fd);
+}
+
+bool RAMVSSD::mapMemory(Options options) {
   // size_t is an unsigned long
-  size_t size = block_size * block_count;
+  size_t size = (size_t)bs * bc;
 
-  // make_unique returns a pointer to a dynamically managed block of memory
-  // `size` bytes long
-  data = make_unique<char[]>(size);
+  // An anonymous mapping reads as zeros; nothing is committed until a
+  // page is written unless we ask for it up front. NORESERVE keeps a
+  // lazy disk bigger than RAM + swap from being refused outright.
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (options.provisioning == LAZY)
+    flags |= MAP_NORESERVE;
+  else
+    flags |= MAP_POPULATE;
 
-  // Data should be 0'd out by default
+  if (options.hugePages) {
+    if (!mapHugePages(size, options.provisioning)) {
+      cout << "ERROR: Unable to map " << size << " bytes for the RAM disk\n";
+      return false;
+    }
+  } else {
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mapped == MAP_FAILED) {
+      cout << "ERROR: Unable to map " << size << " bytes for the RAM disk\n";
+      return false;
+    }
+    data = static_cast<char*>(mapped);
+    mappedBytes = size;
+  }
+  return true;
+}
+
+bool RAMVSSD::adoptImage(const Image& image, Provisioning provisioning) {
+  // Map the whole file, header included: mmap offsets must be page
+  // aligned and the blocks start one block in
+  size_t size = (size_t)bs * (bc + 1);
+  int flags = MAP_PRIVATE;
+  if (provisioning != LAZY) flags |= MAP_POPULATE;
+  void* mapped =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, image.fd, 0);
+  if (mapped == MAP_FAILED) {
+    cout << "ERROR: Unable to map the image\n";
+    return false;
+  }
+  data = static_cast<char*>(mapped) + bs;
+  mapOffset = bs;
+  mappedBytes = size;
+  return true;
+}
+
+void RAMVSSD::setUp(Options options) {
+  // Failures unmap the disk, so it stays unusable rather than running
+  // without what was asked for
+  if (options.provisioning == LOCKED &&
+      mlock(data - mapOffset, mappedBytes) != 0) {
+    cout << "ERROR: Unable to lock " << mappedBytes
+         << " bytes for the RAM disk (check RLIMIT_MEMLOCK)\n";
+    unmapMemory();
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  if (options.sameFill) {
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (bs < pageSize) {
+      cout << "ERROR: Same-fill needs blocks of at least a page ("
+           << pageSize << " bytes)\n";
+      unmapMemory();
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    // Words, then the bitmap; untouched parts stay uncommitted
+    descriptorBytes = ((size_t)bc + (bc + 63) / 64) * sizeof(uint64_t);
+    void* mapped = mmap(nullptr, max<size_t>(descriptorBytes, 1),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) {
+      cout << "ERROR: Unable to map the same-fill descriptors\n";
+      descriptorBytes = 0;
+      unmapMemory();
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    sameFill = true;
+    fillWords = static_cast<uint64_t*>(mapped);
+    filledMap = fillWords + bc;
+  }
 
   stat = DiskStatus::OK;
 }
 
-RAMVSSD::~RAMVSSD() { data.release(); }
+void RAMVSSD::unmapMemory() {
+  // munmap also drops any mlock()
+  if (data != nullptr) munmap(data - mapOffset, mappedBytes);
+  data = nullptr;
+  mappedBytes = 0;
+  if (fillWords != nullptr) munmap(fillWords, max<size_t>(descriptorBytes, 1));
+  fillWords = filledMap = nullptr;
+  descriptorBytes = 0;
+  sameFill = false;
+}
+
+bool RAMVSSD::loadImage(const Image& image) {
+  size_t dataBytes = (size_t)bs * bc;
+  if (dataBytes == 0) return true;
+  size_t fileBytes = dataBytes + bs;
+  void* mapped = mmap(nullptr, fileBytes, PROT_READ, MAP_SHARED, image.fd, 0);
+  if (mapped == MAP_FAILED) return false;
+  char* blocks = static_cast<char*>(mapped) + bs;
+
+  // Only the parts of the file holding data need copying: holes are
+  // zero blocks, and so is fresh memory. Each data extent is cut into
+  // pieces for the copying threads.
+  vector<pair<size_t, size_t>> pieces;  // first block, block count
+  size_t pieceBlocks = max<size_t>(1, LoadPieceBytes / bs);
+  off_t end = fileBytes;
+  for (off_t at = bs; at < end;) {
+    off_t from = lseek(image.fd, at, SEEK_DATA);
+    if (from < 0 && errno == ENXIO) break;  // only a hole is left
+    // Holes unknown: copy the rest as data
+    if (from < 0) from = at;
+    off_t to = lseek(image.fd, from, SEEK_HOLE);
+    if (to < 0 || to > end) to = end;
+    size_t first = (from - bs) / bs;
+    size_t last = min<size_t>(bc, (to - bs + bs - 1) / bs);
+    for (size_t b = first; b < last; b += pieceBlocks)
+      pieces.emplace_back(b, min(pieceBlocks, last - b));
+    at = to;
+  }
+  madvise(mapped, fileBytes, MADV_WILLNEED);
+
+  atomic<size_t> next = 0;
+  atomic<bool> failed = false;
+  auto copy = [&] {
+    for (size_t i = next++; i < pieces.size(); i = next++)
+      if (writeBlocks(pieces[i].first, pieces[i].second,
+                      blocks + pieces[i].first * bs) != DiskStatus::OK)
+        failed = true;
+  };
+  size_t threadCount =
+      min<size_t>(max(1u, thread::hardware_concurrency()), pieces.size());
+  vector<thread> threads;
+  for (size_t t = 1; t < threadCount; t++) threads.emplace_back(copy);
+  copy();
+  for (auto& t : threads) t.join();
+
+  munmap(mapped, fileBytes);
+  stat = failed ? DiskStatus::ERROR : DiskStatus::OK;
+  return !failed;
+}
+
+DiskStatus RAMVSSD::checkpoint(const string& filename) {
+  if (data == nullptr) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Written aside and renamed over the old image once synced, so a
+  // crash leaves one image or the other, and an adopted file keeps the
+  // contents its mapping still pages in from
+  string temp = filename + ".tmp";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || !FileVSSD::writeImageHeader(fd, bs, bc)) {
+    cout << "ERROR: Unable to create '" << temp << "'.\n";
+    if (fd >= 0) {
+      close(fd);
+      unlink(temp.c_str());
+    }
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Stream the disk through a batch buffer. Zero blocks stay holes in
+  // the file (writeImageHeader sized it); runs of other blocks go out
+  // in one write each.
+  size_t batchBlocks = max<size_t>(1, LoadPieceBytes / bs);
+  unique_ptr<char[]> batch = make_unique<char[]>(batchBlocks * bs);
+  bool ok = true;
+  for (size_t first = 0; ok && first < bc; first += batchBlocks) {
+    size_t count = min(batchBlocks, (size_t)bc - first);
+    if (readBlocks(first, count, batch.get()) != DiskStatus::OK) {
+      ok = false;
+      break;
+    }
+    size_t runStart = 0;
+    for (size_t i = 0; ok && i <= count; i++) {
+      uint64_t word;
+      bool zero = i < count &&
+                  block_util::same_filled(batch.get() + i * bs, bs, word) &&
+                  word == 0;
+      if (i < count && !zero) continue;
+      // Block i ends the run of data blocks before it
+      if (i > runStart)
+        ok = fd_util::pwrite_all(fd, batch.get() + runStart * bs,
+                                 (i - runStart) * bs,
+                                 (off_t)(first + runStart + 1) * bs);
+      runStart = i + 1;
+    }
+  }
+  if (ok) ok = fsync(fd) == 0;
+  close(fd);
+  if (ok) ok = rename(temp.c_str(), filename.c_str()) == 0;
+  if (!ok) unlink(temp.c_str());
+
+  if (!ok) cout << "ERROR: Unable to write '" << filename << "'.\n";
+  stat = ok ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
+
+bool RAMVSSD::mapHugePages(size_t size, Provisioning provisioning) {
+  // Huge page mappings come in whole huge pages
+  size_t rounded = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+
+  // First choice: the hugetlb pool. Without NORESERVE the kernel
+  // reserves the pool pages for the whole mapping at mmap time (still
+  // without faulting them in), so the call fails at once if the pool is
+  // not set up or too small, instead of the disk dying of SIGBUS later.
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB;
+  if (provisioning != LAZY) flags |= MAP_POPULATE;
+  void* mapped = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (mapped != MAP_FAILED) {
+    data = static_cast<char*>(mapped);
+    mappedBytes = rounded;
+    backing = HUGETLB_PAGES;
+    return true;
+  }
+
+  // Otherwise transparent huge pages: they need 2 MiB alignment, so map
+  // an extra huge page's worth and trim the ends. Populate only after
+  // the advice, or the pages would already be small ones.
+  size_t slop = rounded + HugePageSize;
+  mapped = mmap(nullptr, slop, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapped == MAP_FAILED) return false;
+  char* base = static_cast<char*>(mapped);
+  char* aligned = reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(base) + HugePageSize - 1) &
+      ~(uintptr_t)(HugePageSize - 1));
+  if (aligned > base) munmap(base, aligned - base);
+  if (base + slop > aligned + rounded)
+    munmap(aligned + rounded, base + slop - (aligned + rounded));
+  data = aligned;
+  mappedBytes = rounded;
+
+  // The advice is accepted even when THP is switched off system-wide;
+  // pageBacking() looks at what the mapping actually got
+  if (madvise(data, mappedBytes, MADV_HUGEPAGE) == 0)
+    backing = TRANSPARENT_HUGE_PAGES;
+
+  if (provisioning != LAZY)
+    for (size_t offset = 0; offset < mappedBytes; offset += 4096)
+      data[offset] = 0;
+  return true;
+}
+
+RAMVSSD::PageBacking RAMVSSD::pageBacking() const {
+  if (backing != TRANSPARENT_HUGE_PAGES) return backing;
+  return anonHugeBytes() > 0 ? TRANSPARENT_HUGE_PAGES : SMALL_PAGES;
+}
+
+size_t RAMVSSD::anonHugeBytes() const {
+  // Find our mapping's entry (its address range heads it), then its
+  // AnonHugePages line
+  ifstream smaps("/proc/self/smaps");
+  uintptr_t at = reinterpret_cast<uintptr_t>(data);
+  bool ours = false;
+  string line;
+  while (getline(smaps, line)) {
+    size_t dash = line.find('-');
+    size_t space = line.find(' ');
+    if (dash != string::npos && space != string::npos && dash < space &&
+        isxdigit((unsigned char)line[0])) {
+      uintptr_t from = stoull(line.substr(0, dash), nullptr, 16);
+      uintptr_t to = stoull(line.substr(dash + 1, space - dash - 1), nullptr, 16);
+      ours = from <= at && at < to;
+    } else if (ours && line.rfind("AnonHugePages:", 0) == 0) {
+      return stoull(line.substr(line.find(':') + 1)) * 1024;
+    }
+  }
+  return 0;
+}
+
+size_t RAMVSSD::sameFilledBlocks() const { return filledCount; }
+
+bool RAMVSSD::isFilled(blocknumber_t sector) const {
+  uint64_t bits =
+      atomic_ref(filledMap[sector / 64]).load(memory_order_relaxed);
+  return (bits >> (sector % 64)) & 1;
+}
+
+void RAMVSSD::storeBlock(blocknumber_t sector, const char* buffer) {
+  char* seek = data + (sector * bs);
+  uint64_t bit = uint64_t(1) << (sector % 64);
+  atomic_ref bits(filledMap[sector / 64]);
+  uint64_t word;
+
+  if (!block_util::same_filled(buffer, bs, word)) {
+    if (bits.fetch_and(~bit, memory_order_relaxed) & bit)
+      filledCount--;
+    memcpy(seek, buffer, bs);
+    return;
+  }
+
+  atomic_ref(fillWords[sector]).store(word, memory_order_relaxed);
+  if (!(bits.fetch_or(bit, memory_order_relaxed) & bit))
+    filledCount++;
+
+  // Give back the pages that hold nothing but this block; they come back
+  // zeroed if the block is later stored in full. Fails harmlessly on
+  // huge or locked pages.
+  uintptr_t from = (reinterpret_cast<uintptr_t>(seek) + pageSize - 1) &
+                   ~(uintptr_t)(pageSize - 1);
+  uintptr_t to =
+      (reinterpret_cast<uintptr_t>(seek) + bs) & ~(uintptr_t)(pageSize - 1);
+  if (backing == SMALL_PAGES && to > from)
+    madvise(reinterpret_cast<void*>(from), to - from, MADV_DONTNEED);
+}
+
+void RAMVSSD::loadBlock(blocknumber_t sector, char* buffer) const {
+  if (isFilled(sector))
+    block_util::fill_word(
+        buffer, bs, atomic_ref(fillWords[sector]).load(memory_order_relaxed));
+  else
+    memcpy(buffer, data + (sector * bs), bs);
+}
+
+RAMVSSD::~RAMVSSD() { unmapMemory(); }
 
 void RAMVSSD::printRAM() {
   // For every byte
@@ -38,7 +422,7 @@ void RAMVSSD::printRAM() {
     // NL on block. Each row is one block now.
     if (i == 0 || ((i % bs) == 0)) cout << "\n";
     // Format to hex and print. See the macro for HEX()
-    cout << HEX(data.get()[i]) << " ";
+    cout << HEX(data[i]) << " ";
   }
   cout << "\n";
 }
@@ -50,8 +434,23 @@ size_t RAMVSSD::blockCount() const { return bc; }
 DiskStatus RAMVSSD::status() const { return stat; }
 
 DiskStatus RAMVSSD::read(blocknumber_t sector, void* buffer) {
-  // Range Checking
-  if (sector >= bc) {
+  return readBlocks(sector, 1, buffer);
+}
+
+DiskStatus RAMVSSD::write(blocknumber_t sector, void* buffer) {
+  return writeBlocks(sector, 1, buffer);
+}
+
+DiskStatus RAMVSSD::readBlocks(blocknumber_t sector, size_t count,
+                               void* buffer) {
+  // Nothing to work with if the memory could not be mapped
+  if (data == nullptr) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (sector >= bc || count > bc - sector) {
     cout << "ERROR: Index out of range\n";
     stat = DiskStatus::BLOCK_OUT_OF_RANGE;
     return stat;
@@ -59,31 +458,61 @@ DiskStatus RAMVSSD::read(blocknumber_t sector, void* buffer) {
 
   // I could not for the life of me get this to work inline. So it's defined
   // explicitly
-  void* seek = data.get() + (sector * bs);
-  // Copy bs bytes from seek (void*) which points at relevant chunk of data to
-  // buffer (void*)
-  memcpy(buffer, seek, bs);
+  void* seek = data + (sector * bs);
+
+  // Copy the extent from seek (void*) which points at relevant chunk of
+  // data to buffer (void*), again if a writer got in the way
+  if (!sameFill) {
+    stripes.read(sector, count, [&] { memcpy(buffer, seek, count * bs); });
+    stat = DiskStatus::OK;
+    return stat;
+  }
+
+  // Same-filled blocks are expanded from their descriptors
+  stripes.read(sector, count, [&] {
+    for (size_t i = 0; i < count; i++)
+      loadBlock(sector + i, static_cast<char*>(buffer) + i * bs);
+  });
 
   stat = DiskStatus::OK;
   return stat;
 }
 
-DiskStatus RAMVSSD::write(blocknumber_t sector, void* buffer) {
+DiskStatus RAMVSSD::writeBlocks(blocknumber_t sector, size_t count,
+                                void* buffer) {
   // Set to not ready. If command fails, status will be still not ready
   stat = DiskStatus::NOT_READY;
 
-  // Range Checking
-  if (sector >= bc) {
+  // Nothing to work with if the memory could not be mapped
+  if (data == nullptr) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (sector >= bc || count > bc - sector) {
     cout << "ERROR: Index out of range\n";
     stat = DiskStatus::BLOCK_OUT_OF_RANGE;
     return stat;
   }
 
   // Not done inline as per earlier comment.
-  void* seek = data.get() + (sector * bs);
-  // Copy bs bytes from buffer (void*) to seek (void*), which points at relevant
-  // chunk of data
-  memcpy(seek, buffer, bs);
+  void* seek = data + (sector * bs);
+
+  // Copy the extent from buffer (void*) to seek (void*), which points at
+  // relevant chunk of data. Locked stripes tell readers a copy in
+  // progress is not to be trusted
+  if (!sameFill) {
+    stripes.write(sector, count, [&] { memcpy(seek, buffer, count * bs); });
+    stat = DiskStatus::OK;
+    return stat;
+  }
+
+  // Each block is checked for a repeated word on its way in
+  stripes.write(sector, count, [&] {
+    for (size_t i = 0; i < count; i++)
+      storeBlock(sector + i, static_cast<char*>(buffer) + i * bs);
+  });
 
   stat = DiskStatus::OK;
   return stat;
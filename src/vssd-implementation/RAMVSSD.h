@@ -1,10 +1,66 @@
 /**
  * RAMVSSD Provides a Virtual Simple Simulated Disk stored in memory
  *
- * This implementation works using the unique_ptr method in c++
+ * This implementation keeps the blocks in one anonymous memory mapping.
  * It has all the functionality of the file based implementation aside from
  * persistence
  *
+ * How the mapping is committed is a provisioning option:
+ *  - LAZY (default) maps the extent without touching it; the kernel
+ *    supplies zero pages as blocks are first written, so construction
+ *    takes constant time whatever the size and memory is committed
+ *    only for blocks in use;
+ *  - POPULATE pre-faults every page at construction (MAP_POPULATE) for
+ *    predictable latency from the first access;
+ *  - LOCKED populates and then mlock()s the extent so it is never
+ *    swapped out. If the lock cannot be had (see RLIMIT_MEMLOCK), the
+ *    disk reports ERROR.
+ *
+ * Random access across a large disk spends much of its time on TLB
+ * misses with 4 KiB pages, so the mapping can also be backed by 2 MiB
+ * pages: from the hugetlb pool (MAP_HUGETLB) when one is configured
+ * and has room for the whole disk (the pages are reserved when the
+ * disk is mapped, even a LAZY one, so they cannot run out later),
+ * otherwise as transparent huge pages (a 2 MiB-aligned mapping advised
+ * with MADV_HUGEPAGE). pageBacking() reports which one was actually
+ * obtained; for transparent huge pages that is whether any of the
+ * mapping is in huge pages right now (AnonHugePages in
+ * /proc/self/smaps), so a LAZY disk reports them once written.
+ *
+ * With the sameFill option, a block written as one 8-byte word repeated
+ * (all zeros, or a 1, 2, 4 or 8-byte pattern, as fill_block and the `w`
+ * command produce) is kept as that word plus a bit in a bitmap, like
+ * zram's same-filled pages, and expanded again on read. The memory
+ * pages wholly inside such a block are handed back to the kernel, so
+ * an image of mostly pattern blocks costs little more than its
+ * descriptors (8 bytes per block, committed lazily like the blocks).
+ * Pages shared with a neighbouring block are kept, so the saving needs
+ * blocks of at least a page: with smaller blocks the option is refused
+ * (the disk reports ERROR). No saving is possible on huge pages or a
+ * LOCKED disk either.
+ *
+ * checkpoint() saves the disk as an image FileVSSD can open, streaming
+ * it out in batches and leaving zero blocks as holes in the file. The
+ * image constructor rebuilds a disk from such a file in bulk, either
+ * by COPY (the file is mapped and its data extents, holes skipped, are
+ * copied in by one thread per core) or by ADOPT (the file itself
+ * becomes the disk's memory as a private copy-on-write mapping, so
+ * start-up is immediate and blocks are paged in as they are used;
+ * writes never reach the file, and the file must not change while it
+ * is adopted). A checkpoint taken while writers are busy is consistent
+ * batch by batch, not as a whole.
+ *
+ * Readers take no lock (see StripedSeqLock). Blocks are grouped into
+ * stripes (block number modulo the stripe count), each with a sequence
+ * counter that doubles as the stripe's writer lock: a writer makes the
+ * counter odd before its memcpy and even again after it. A reader notes
+ * the counters of its extent, copies optimistically, and retries if any
+ * counter was odd or moved meanwhile; after a few failed tries it locks
+ * the stripes like a writer so it cannot be starved. Readers therefore
+ * never write to a shared cache line, and hot blocks scale across cores
+ * for read-mostly loads. Writers of extents that share no stripe run in
+ * parallel. Single-block read and write are one-block extents.
+ *
  * @author Dylan C. Morgen
  * @email morgendc203@potsdam.edu
  * @course CIS 310 Operating Systems
@@ -12,18 +68,146 @@
  * @due 10/4/2021
  */
 
+#ifndef RAMVSSD_H
+  #define RAMVSSD_H
+
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 #include <string>
 
+#include "StripedSeqLock.h"
 #include "VVSSD.h"
 
 class RAMVSSD : public VVSSD {
+ public:
+  /// how the memory behind the blocks is committed (see above)
+  enum Provisioning { LAZY, POPULATE, LOCKED };
+
+  /**
+   * Construction options; the defaults match the two-argument
+   * constructor.
+   */
+  struct Options {
+    Provisioning provisioning = LAZY;
+    bool hugePages = false;
+    bool sameFill = false;
+  };
+
+  /// the kind of pages actually backing the blocks
+  enum PageBacking { SMALL_PAGES, HUGETLB_PAGES, TRANSPARENT_HUGE_PAGES };
+
+  /// size of the huge pages asked for
+  static const std::size_t HugePageSize = 2 * 1024 * 1024;
+
+  /// how a disk restored from an image gets its blocks (see above)
+  enum Restore { COPY, ADOPT };
+
  private:
-  std::unique_ptr<char[]> data;
+  char* data = nullptr;
+  std::size_t mappedBytes = 0;
+  /// bytes mapped ahead of data (an adopted image's header)
+  std::size_t mapOffset = 0;
+  PageBacking backing = SMALL_PAGES;
+
+  /// bytes copied per batch by checkpoint() and per piece by a restore
+  static const std::size_t LoadPieceBytes = 8 * 1024 * 1024;
+
+  /**
+   * An image file opened for restoring, with its header checked.
+   */
+  struct Image {
+    int fd = -1;
+    std::size_t bs = 0;
+    std::size_t bc = 0;
+    bool valid = false;
+
+    explicit Image(const std::string& filename);
+    ~Image();
+  };
+
+  /**
+   * Restore from an opened image; see the public image constructor.
+   */
+  RAMVSSD(const Image& image, Restore restore, Options options);
+
+  /**
+   * Map anonymous memory for the blocks as the options ask, setting
+   * data, mappedBytes and backing. Returns false (after saying why) if
+   * nothing could be mapped.
+   */
+  bool mapMemory(Options options);
+
+  /**
+   * Map the image's blocks copy-on-write as the disk's memory.
+   */
+  bool adoptImage(const Image& image, Provisioning provisioning);
+
+  /**
+   * Copy the data extents of the image into the mapped memory, in
+   * parallel.
+   */
+  bool loadImage(const Image& image);
+
+  /**
+   * Finish construction once memory is mapped: lock it if asked, set up
+   * the same-fill tables and set the status.
+   */
+  void setUp(Options options);
+
+  /**
+   * Map size bytes backed by huge pages if at all possible, setting
+   * data, mappedBytes and backing. Returns false if nothing could be
+   * mapped.
+   */
+  bool mapHugePages(std::size_t size, Provisioning provisioning);
+
+  /**
+   * Return the bytes of the mapping currently in transparent huge pages,
+   * from /proc/self/smaps.
+   */
+  std::size_t anonHugeBytes() const;
+
+  /**
+   * Unmap the blocks (and descriptors), leaving the disk unusable.
+   */
+  void unmapMemory();
   unsigned int bs;
   unsigned int bc;
-  DiskStatus stat = DiskStatus::NOT_READY;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+
+  // Sequence counters over the block numbers; see StripedSeqLock
+  StripedSeqLock stripes;
+
+  // Same-filled blocks (sameFill only): the repeated word of each block
+  // and a bitmap of the blocks stored that way, in one lazily committed
+  // anonymous mapping (reads as zeros, costs nothing until written).
+  // Both change only under the block's stripe, but a bitmap word spans
+  // stripes, so they are accessed through std::atomic_ref.
+  bool sameFill = false;
+  std::size_t pageSize = 0;
+  std::uint64_t* fillWords = nullptr;
+  std::uint64_t* filledMap = nullptr;
+  std::size_t descriptorBytes = 0;
+  std::atomic<std::size_t> filledCount = 0;
+
+  /**
+   * Return true if the block is stored as a repeated word.
+   */
+  bool isFilled(blocknumber_t block) const;
+
+  /**
+   * Copy one block in from buffer: as a descriptor if it is same-filled
+   * (returning its pages to the kernel), in full otherwise. Called with
+   * the block's stripe locked.
+   */
+  void storeBlock(blocknumber_t block, const char* buffer);
+
+  /**
+   * Copy one block out to buffer, expanding it if it is same-filled.
+   */
+  void loadBlock(blocknumber_t block, char* buffer) const;
 
   /**
    * printRAM prints out the ram in HEX. It shows you how data is stored.
@@ -35,7 +219,7 @@ class RAMVSSD : public VVSSD {
  public:
   /**
    * RAMVSSD is the constructor. It does not have to initalize all bytes to 0,
-   * that happens automatically.
+   * that happens automatically. Memory is provisioned LAZY.
    *
    * @param  {std::size_t} block_size  : the amount of bytes in each block.
    * @param  {std::size_t} block_count : the amount of blocks
@@ -43,7 +227,63 @@ class RAMVSSD : public VVSSD {
   RAMVSSD(std::size_t block_size, std::size_t block_count);
 
   /**
-   * ~RAMVSSD is the destructor. Frees memory
+   * RAMVSSD constructor with options.
+   *
+   * @param  {std::size_t} block_size  : the amount of bytes in each block.
+   * @param  {std::size_t} block_count : the amount of blocks
+   * @param  {Options} options         : provisioning and page size of the
+   *                                     memory
+   */
+  RAMVSSD(std::size_t block_size, std::size_t block_count, Options options);
+
+  /**
+   * RAMVSSD constructor from an image saved by checkpoint() (or any
+   * file FileVSSD can open). The disk has the image's geometry; if the
+   * file is missing or not an image, the disk reports ERROR. Memory is
+   * provisioned LAZY.
+   *
+   * @param  {std::string} filename : the image file
+   * @param  {Restore} restore      : COPY the blocks into fresh memory
+   *                                  or ADOPT the file as the memory
+   */
+  explicit RAMVSSD(const std::string& filename, Restore restore = COPY);
+
+  /**
+   * RAMVSSD constructor from an image, with options.
+   *
+   * @param  {std::string} filename : the image file
+   * @param  {Restore} restore      : COPY or ADOPT, as above
+   * @param  {Options} options      : as for a new disk; hugePages does
+   *                                  not apply to an adopted image
+   */
+  RAMVSSD(const std::string& filename, Restore restore, Options options);
+
+  /**
+   * Save the disk to an image file, replacing it. Blocks that are all
+   * zero are not written, leaving holes in the file. The image is
+   * written to filename.tmp and renamed over filename once synced, so
+   * the old image (even one this disk adopted) survives until then.
+   *
+   * @param  {std::string} filename : the image file
+   * @return OK if the image was written and synced, ERROR otherwise.
+   */
+  DiskStatus checkpoint(const std::string& filename);
+
+  /**
+   * Return the kind of pages that back the blocks; SMALL_PAGES unless
+   * huge pages were asked for and obtained (transparent ones: are in use
+   * for part of the disk now).
+   */
+  PageBacking pageBacking() const;
+
+  /**
+   * Return the number of blocks currently stored as a repeated word;
+   * always 0 without the sameFill option.
+   */
+  std::size_t sameFilledBlocks() const;
+
+  /**
+   * ~RAMVSSD is the destructor. Unmaps the memory
    *
    */
   virtual ~RAMVSSD();
@@ -95,6 +335,29 @@ class RAMVSSD : public VVSSD {
    */
   virtual DiskStatus write(blocknumber_t block, void* buffer);
 
+  /**
+   * Read a contiguous extent of blocks; lock-free unless writers keep
+   * the extent busy.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks while holding its stripes.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
   /**
    * Synchronize all in-memory structures out to the disk.
    *
@@ -102,3 +365,5 @@ class RAMVSSD : public VVSSD {
    */
   virtual DiskStatus sync();
 };
+
+  #endif /* RAMVSSD_H */
@@ -0,0 +1,211 @@
+/**
+ * See SharedRAMVSSD.h for header comment
+ */
+
+#include "SharedRAMVSSD.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+SharedRAMVSSD::SharedRAMVSSD(size_t block_size, size_t block_count,
+                             string name)
+    : name(name) {
+  // Start from an empty object: a stale disk's header must not survive
+  shm_unlink(name.c_str());
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create shared memory '" << name << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = create(block_size, block_count) ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+SharedRAMVSSD::SharedRAMVSSD(string name) : name(name) {
+  fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    cout << "ERROR: Shared memory '" << name
+         << "' does not exist. Unable to open.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = attach() ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+SharedRAMVSSD::SharedRAMVSSD(size_t block_size, size_t block_count) {
+  fd = memfd_create("SharedRAMVSSD", MFD_CLOEXEC);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create shared memory.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = create(block_size, block_count) ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+SharedRAMVSSD::SharedRAMVSSD(int descriptor) {
+  fd = fcntl(descriptor, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    cout << "ERROR: Descriptor " << descriptor << " is not open.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  stat = attach() ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+SharedRAMVSSD::~SharedRAMVSSD() {
+  // The lock's counters are in the mapping; drop the lock first
+  stripes.reset();
+  if (base != nullptr) munmap(base, mappedBytes);
+  if (fd >= 0) close(fd);
+}
+
+bool SharedRAMVSSD::unlink(const string& name) {
+  return shm_unlink(name.c_str()) == 0;
+}
+
+static_assert(sizeof(SharedRAMVSSD::Signature) + 3 * sizeof(uint64_t) <= 64,
+              "the shared header must fit ahead of the stripe counters");
+
+size_t SharedRAMVSSD::dataOffset(size_t block_count) {
+  // Counters go on the first cache line after the header
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t counters = 64 + StripedSeqLock::bytes(block_count);
+  return (counters + page - 1) / page * page;
+}
+
+bool SharedRAMVSSD::create(size_t block_size, size_t block_count) {
+  size_t size = dataOffset(block_count) + block_size * block_count;
+  // A fresh object reads as zeros, so the blocks need no clearing
+  if (ftruncate(fd, size) != 0) {
+    cout << "ERROR: Unable to size shared memory for " << size
+         << " bytes.\n";
+    return false;
+  }
+  void* mapped =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    cout << "ERROR: Unable to map shared memory.\n";
+    return false;
+  }
+  base = static_cast<char*>(mapped);
+  mappedBytes = size;
+  bs = block_size;
+  bc = block_count;
+
+  header = new (base) SharedHeader;
+  header->blockSize = bs;
+  header->blockCount = bc;
+  header->generation.store(0, memory_order_relaxed);
+  stripes = make_unique<StripedSeqLock>(base + 64, bc, true);
+  data = base + dataOffset(bc);
+
+  // Last: attaching processes trust everything before the signature
+  header->signature.store(Signature, memory_order_release);
+  return true;
+}
+
+bool SharedRAMVSSD::attach() {
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedHeader)) {
+    cout << "ERROR: Shared memory is too small to hold a disk.\n";
+    return false;
+  }
+  void* mapped = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    cout << "ERROR: Unable to map shared memory.\n";
+    return false;
+  }
+  base = static_cast<char*>(mapped);
+  mappedBytes = info.st_size;
+  header = reinterpret_cast<SharedHeader*>(base);
+
+  if (header->signature.load(memory_order_acquire) != Signature) {
+    cout << "ERROR: Shared memory does not hold a (finished) disk.\n";
+    return false;
+  }
+  bs = header->blockSize;
+  bc = header->blockCount;
+  if (mappedBytes != dataOffset(bc) + bs * bc) {
+    cout << "ERROR: Shared memory size does not match header information.\n";
+    return false;
+  }
+  stripes = make_unique<StripedSeqLock>(base + 64, bc, false);
+  data = base + dataOffset(bc);
+  return true;
+}
+
+int SharedRAMVSSD::descriptor() const { return fd; }
+
+uint64_t SharedRAMVSSD::generation() const {
+  return header == nullptr ? 0 : header->generation.load();
+}
+
+size_t SharedRAMVSSD::blockSize() const { return bs; }
+
+size_t SharedRAMVSSD::blockCount() const { return bc; }
+
+DiskStatus SharedRAMVSSD::status() const { return stat; }
+
+DiskStatus SharedRAMVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SharedRAMVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SharedRAMVSSD::readBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  // Nothing to work with if the memory could not be mapped
+  if (data == nullptr) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  char* seek = data + block * bs;
+  stripes->read(block, count, [&] { memcpy(buffer, seek, count * bs); });
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SharedRAMVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                      void* buffer) {
+  // Nothing to work with if the memory could not be mapped
+  if (data == nullptr) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  char* seek = data + block * bs;
+  stripes->write(block, count, [&] { memcpy(seek, buffer, count * bs); });
+  header->generation.fetch_add(1, memory_order_release);
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SharedRAMVSSD::sync() { return stat; }
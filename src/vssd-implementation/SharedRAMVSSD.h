@@ -0,0 +1,193 @@
+/**
+ * SharedRAMVSSD is a RAM disk that several processes use at once.
+ *
+ * The blocks live in a POSIX shared memory object, either named (any
+ * process can attach with the name) or an anonymous memfd (shared with
+ * child processes, or with others through the descriptor). Every
+ * process maps the same memory, so a block written by one is read by
+ * the others with no copy in between.
+ *
+ * The object starts with a small shared header: a signature, the
+ * geometry, a generation counter bumped by every write, and the striped
+ * sequence counters (see StripedSeqLock) that serialize writers and let
+ * readers check their copies, in every process alike. The blocks follow
+ * on the next page boundary:
+ *
+ *   | header | stripe counters | pad to page | block 0 | block 1 | ...
+ *
+ * The creator fills in the header and publishes the signature last, so
+ * a process attaching early sees either no disk or a complete one.
+ * A process that dies in the middle of a write leaves that write's
+ * stripes locked; recreate the disk in that case.
+ */
+
+#ifndef SHAREDRAMVSSD_H
+  #define SHAREDRAMVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "StripedSeqLock.h"
+#include "VVSSD.h"
+
+class SharedRAMVSSD : public VVSSD {
+ public:
+  /// "VSSDSHM1" as a little-endian word
+  static const std::uint64_t Signature = 0x314d485344535356ull;
+
+ private:
+  struct SharedHeader {
+    std::atomic<std::uint64_t> signature;
+    std::uint64_t blockSize;
+    std::uint64_t blockCount;
+    std::atomic<std::uint64_t> generation;
+  };
+
+  std::string name;
+  int fd = -1;
+  char* base = nullptr;
+  std::size_t mappedBytes = 0;
+  SharedHeader* header = nullptr;
+  char* data = nullptr;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  std::unique_ptr<StripedSeqLock> stripes;
+
+  /**
+   * Return the offset of block 0 in the object for the given count.
+   */
+  static std::size_t dataOffset(std::size_t block_count);
+
+  /**
+   * Size a fresh object in fd for the geometry, map it and publish the
+   * header. Returns false (after saying why) on failure.
+   */
+  bool create(std::size_t block_size, std::size_t block_count);
+
+  /**
+   * Map the existing object in fd and check its header. Returns false
+   * (after saying why) if it is not a complete disk.
+   */
+  bool attach();
+
+ public:
+  /**
+   * SharedRAMVSSD Constructor #1
+   * Creates a named disk, replacing any object with the name.
+   *
+   * @param  {std::size_t} block_size  : the amount of bytes in each block
+   * @param  {std::size_t} block_count : the amount of blocks
+   * @param  {std::string} name        : shm_open name, such as "/vssd0"
+   */
+  SharedRAMVSSD(std::size_t block_size, std::size_t block_count,
+                std::string name);
+
+  /**
+   * SharedRAMVSSD Constructor #2
+   * Attaches to a named disk another process created.
+   *
+   * @param  {std::string} name : shm_open name the disk was created with
+   */
+  explicit SharedRAMVSSD(std::string name);
+
+  /**
+   * SharedRAMVSSD Constructor #3
+   * Creates an anonymous (memfd) disk. Children forked afterwards share
+   * it; others can attach through descriptor().
+   *
+   * @param  {std::size_t} block_size  : the amount of bytes in each block
+   * @param  {std::size_t} block_count : the amount of blocks
+   */
+  SharedRAMVSSD(std::size_t block_size, std::size_t block_count);
+
+  /**
+   * SharedRAMVSSD Constructor #4
+   * Attaches to the disk behind a descriptor (which is duplicated; the
+   * caller keeps its own).
+   *
+   * @param  {int} descriptor : descriptor of a shared disk's object
+   */
+  explicit SharedRAMVSSD(int descriptor);
+
+  /**
+   * ~SharedRAMVSSD unmaps this process's view. The object itself lives
+   * until it is unlinked (named) or its last descriptor closes (memfd).
+   */
+  virtual ~SharedRAMVSSD();
+
+  /**
+   * Remove a named disk. Processes attached keep their mapping.
+   *
+   * @param  {std::string} name : shm_open name of the disk
+   * @return {bool}             : true if the name was removed
+   */
+  static bool unlink(const std::string& name);
+
+  /**
+   * Return the descriptor of the shared object, for passing on.
+   */
+  int descriptor() const;
+
+  /**
+   * Return the number of writes made to the disk by all processes.
+   */
+  std::uint64_t generation() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (this process's last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block if possible.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block if possible.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks; lock-free unless writers (in any
+   * process) keep the extent busy.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks while holding its stripes.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Nothing to flush; the memory is shared as it is written.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* SHAREDRAMVSSD_H */
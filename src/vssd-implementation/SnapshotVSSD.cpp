@@ -0,0 +1,236 @@
+/**
+ * See SnapshotVSSD.h for header comment
+ */
+
+#include "SnapshotVSSD.h"
+
+#include <iostream>
+
+using namespace std;
+
+SnapshotVSSD::SnapshotVSSD(unique_ptr<VVSSD> disk, unique_ptr<VVSSD> store)
+    : disk(move(disk)), store(move(store)) {
+  bc = this->disk->blockCount();
+  if (this->disk->status() != DiskStatus::OK ||
+      this->store->status() != DiskStatus::OK) {
+    cout << "ERROR: Disk or snapshot store is not ready.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (this->store->blockSize() != this->disk->blockSize()) {
+    cout << "ERROR: Snapshot store must have the disk's block size.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  writtenIn.assign(bc, 0);
+  refs.assign(this->store->blockCount(), 0);
+  // Hand out low slots first
+  for (slot_t slot = refs.size(); slot-- > 0;) freeSlots.push_back(slot);
+  stat = DiskStatus::OK;
+}
+
+SnapshotVSSD::~SnapshotVSSD() {}
+
+unique_ptr<SnapshotVSSD::Snapshot> SnapshotVSSD::snapshot() {
+  // Wait out writes in flight so the snapshot falls between them
+  auto held = locks.lock(0, bc, RangeLock::EXCLUSIVE);
+  lock_guard<mutex> hold(mtx);
+  epoch_t id = epoch++;
+  saved[id];
+  return unique_ptr<Snapshot>(new Snapshot(*this, id));
+}
+
+void SnapshotVSSD::release(epoch_t id) {
+  lock_guard<mutex> hold(mtx);
+  auto match = saved.find(id);
+  if (match == saved.end()) return;
+  for (auto [block, slot] : match->second)
+    if (--refs[slot] == 0) freeSlots.push_back(slot);
+  saved.erase(match);
+}
+
+size_t SnapshotVSSD::snapshotCount() const {
+  lock_guard<mutex> hold(mtx);
+  return saved.size();
+}
+
+size_t SnapshotVSSD::savedBlocks() const {
+  lock_guard<mutex> hold(mtx);
+  return refs.size() - freeSlots.size();
+}
+
+size_t SnapshotVSSD::blockSize() const { return disk->blockSize(); }
+
+size_t SnapshotVSSD::blockCount() const { return bc; }
+
+DiskStatus SnapshotVSSD::status() const { return stat; }
+
+DiskStatus SnapshotVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SnapshotVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SnapshotVSSD::readBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+  stat = disk->readBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus SnapshotVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks (or takes a snapshot) until
+  // we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  // Blocks some snapshot still shares with the live disk get a slot
+  vector<pair<blocknumber_t, slot_t>> copies;
+  {
+    lock_guard<mutex> hold(mtx);
+    for (size_t i = 0; i < count; i++) {
+      blocknumber_t b = block + i;
+      if (writtenIn[b] == epoch || saved.lower_bound(writtenIn[b]) == saved.end())
+        continue;
+      if (freeSlots.empty()) {
+        for (auto& copy : copies) freeSlots.push_back(copy.second);
+        cout << "ERROR: Snapshot store is full\n";
+        stat = DiskStatus::ERROR;
+        return stat;
+      }
+      copies.emplace_back(b, freeSlots.back());
+      freeSlots.pop_back();
+    }
+  }
+
+  // Save the old contents; the extent lock keeps snapshot readers off
+  // them meanwhile
+  vector<char> old(blockSize());
+  for (size_t i = 0; i < copies.size(); i++) {
+    DiskStatus ds = disk->read(copies[i].first, old.data());
+    if (ds == DiskStatus::OK) ds = store->write(copies[i].second, old.data());
+    if (ds != DiskStatus::OK) {
+      lock_guard<mutex> hold(mtx);
+      for (auto& copy : copies) freeSlots.push_back(copy.second);
+      stat = ds;
+      return stat;
+    }
+  }
+
+  {
+    lock_guard<mutex> hold(mtx);
+    for (auto [b, slot] : copies) {
+      // Snapshots released meanwhile no longer want the copy
+      for (auto s = saved.lower_bound(writtenIn[b]); s != saved.end(); ++s) {
+        s->second.emplace(b, slot);
+        refs[slot]++;
+      }
+      if (refs[slot] == 0) freeSlots.push_back(slot);
+    }
+    for (size_t i = 0; i < count; i++) writtenIn[block + i] = epoch;
+  }
+
+  stat = disk->writeBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus SnapshotVSSD::sync() {
+  DiskStatus ds = store->sync();
+  stat = (ds == DiskStatus::OK) ? disk->sync() : ds;
+  return stat;
+}
+
+DiskStatus SnapshotVSSD::readSnapshot(epoch_t id, blocknumber_t block,
+                                      size_t count, void* buffer) {
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    return DiskStatus::BLOCK_OUT_OF_RANGE;
+  }
+
+  // Writers save what we need before they change it
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  const slot_t None = refs.size();
+  vector<slot_t> slots(count, None);
+  {
+    lock_guard<mutex> hold(mtx);
+    auto& copies = saved.at(id);
+    if (!copies.empty())
+      for (size_t i = 0; i < count; i++)
+        if (auto match = copies.find(block + i); match != copies.end())
+          slots[i] = match->second;
+  }
+
+  // Saved copies one at a time; runs of shared blocks in one call
+  size_t bs = blockSize();
+  char* out = static_cast<char*>(buffer);
+  size_t i = 0;
+  while (i < count) {
+    DiskStatus ds;
+    if (slots[i] != None) {
+      ds = store->read(slots[i], out + i * bs);
+      i++;
+    } else {
+      size_t run = 1;
+      while (i + run < count && slots[i + run] == None) run++;
+      ds = disk->readBlocks(block + i, run, out + i * bs);
+      i += run;
+    }
+    if (ds != DiskStatus::OK) return ds;
+  }
+  return DiskStatus::OK;
+}
+
+SnapshotVSSD::Snapshot::Snapshot(SnapshotVSSD& origin, epoch_t id)
+    : origin(origin), id(id) {}
+
+SnapshotVSSD::Snapshot::~Snapshot() { origin.release(id); }
+
+size_t SnapshotVSSD::Snapshot::blockSize() const { return origin.blockSize(); }
+
+size_t SnapshotVSSD::Snapshot::blockCount() const {
+  return origin.blockCount();
+}
+
+DiskStatus SnapshotVSSD::Snapshot::status() const { return stat; }
+
+DiskStatus SnapshotVSSD::Snapshot::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SnapshotVSSD::Snapshot::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SnapshotVSSD::Snapshot::readBlocks(blocknumber_t block,
+                                              size_t count, void* buffer) {
+  stat = origin.readSnapshot(id, block, count, buffer);
+  return stat;
+}
+
+DiskStatus SnapshotVSSD::Snapshot::writeBlocks(blocknumber_t block,
+                                               size_t count, void* buffer) {
+  cout << "ERROR: Snapshots are read-only\n";
+  stat = DiskStatus::READ_ONLY;
+  return stat;
+}
+
+DiskStatus SnapshotVSSD::Snapshot::sync() { return stat; }
@@ -0,0 +1,204 @@
+/**
+ * SnapshotVSSD adds instant point-in-time snapshots to any disk (a
+ * RAMVSSD, a FileVSSD, ...).
+ *
+ * Taking a snapshot copies nothing: it only starts a new epoch. The
+ * first write to a block after a snapshot first saves the block's old
+ * contents to a store disk, and every snapshot that still shared the
+ * live block gets a reference to the saved copy. Later writes to the
+ * block in the same epoch go straight to the disk.
+ *
+ * A snapshot is its own read-only VVSSD: blocks it has a saved copy of
+ * come from the store, the rest from the live disk, which has not
+ * changed them since. Writing to one gives READ_ONLY. Destroying a
+ * snapshot drops its references, and saved copies no snapshot refers
+ * to any more go back to the store's free list. Snapshots must not
+ * outlive the SnapshotVSSD they came from.
+ *
+ * A RangeLock over block numbers makes a writer save a block's old
+ * contents and overwrite it while no reader, of the disk or of a
+ * snapshot, is looking at that block; taking a snapshot locks the
+ * whole disk for a moment, so it falls between writes.
+ */
+
+#ifndef SNAPSHOTVSSD_H
+  #define SNAPSHOTVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class SnapshotVSSD : public VVSSD {
+ public:
+  typedef std::uint64_t epoch_t;
+  typedef std::size_t slot_t;
+
+  /**
+   * A read-only view of the disk as it was when the snapshot was taken.
+   */
+  class Snapshot : public VVSSD {
+   private:
+    friend class SnapshotVSSD;
+    SnapshotVSSD& origin;
+    epoch_t id;
+    std::atomic<DiskStatus> stat = DiskStatus::OK;
+
+    Snapshot(SnapshotVSSD& origin, epoch_t id);
+
+   public:
+    /**
+     * ~Snapshot gives up the snapshot's saved blocks.
+     */
+    virtual ~Snapshot();
+
+    virtual std::size_t blockSize() const;
+    virtual std::size_t blockCount() const;
+    virtual DiskStatus status() const;
+    virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+    /**
+     * Refuse the write: returns READ_ONLY.
+     */
+    virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+    virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                  void* buffer);
+
+    /**
+     * Refuse the write: returns READ_ONLY.
+     */
+    virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                   void* buffer);
+
+    /**
+     * Nothing to flush in a snapshot; returns the status.
+     */
+    virtual DiskStatus sync();
+  };
+
+ private:
+  std::unique_ptr<VVSSD> disk;
+  std::unique_ptr<VVSSD> store;
+  std::size_t bc;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  /// snapshots taken so far; live writes belong to this epoch
+  epoch_t epoch = 0;
+  /// epoch of each block's last write; snapshots numbered from it up
+  /// still share the live block
+  std::vector<epoch_t> writtenIn;
+  /// saved copies of each live snapshot, by snapshot number
+  std::map<epoch_t, std::unordered_map<blocknumber_t, slot_t>> saved;
+  /// references to each store block, and the unreferenced ones
+  std::vector<std::uint32_t> refs;
+  std::vector<slot_t> freeSlots;
+
+  /**
+   * Read an extent as snapshot id sees it.
+   */
+  DiskStatus readSnapshot(epoch_t id, blocknumber_t block, std::size_t count,
+                          void* buffer);
+
+  /**
+   * Drop snapshot id and its references.
+   */
+  void release(epoch_t id);
+
+ public:
+  /**
+   * SnapshotVSSD Constructor
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk  : the live disk
+   * @param  {std::unique_ptr<VVSSD>} store : where old contents are saved;
+   *                                          same block size as the disk,
+   *                                          its block count bounds how
+   *                                          many copies can be kept
+   */
+  SnapshotVSSD(std::unique_ptr<VVSSD> disk, std::unique_ptr<VVSSD> store);
+
+  virtual ~SnapshotVSSD();
+
+  /**
+   * Take a snapshot of the disk as it is now.
+   *
+   * @return {std::unique_ptr<Snapshot>} : read-only view of this moment
+   */
+  std::unique_ptr<Snapshot> snapshot();
+
+  /**
+   * Return the number of snapshots alive.
+   */
+  std::size_t snapshotCount() const;
+
+  /**
+   * Return the number of store blocks holding saved copies.
+   */
+  std::size_t savedBlocks() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block of the live disk.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block of the live disk, saving its old contents
+   * first if a snapshot still needs them.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of the live disk under a shared lock on the
+   * extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of the live disk under an exclusive lock on
+   * the extent, saving old contents snapshots still need.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize the store, then the live disk.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* SNAPSHOTVSSD_H */
@@ -0,0 +1,358 @@
+/**
+ * See SparseFileVSSD.h for header comment
+ */
+
+#include "SparseFileVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "block_util.h"
+#include "fd_util.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+static const uint64_t Signature = 0x3146505344535356;  // "VSSDSPF1"
+/// signature, block size, block count, L2 entries, L1 entries
+static const size_t HeaderBytes = 4096;
+static const size_t TableBytes =
+    SparseFileVSSD::TableEntries * sizeof(uint64_t);
+
+/**
+ * Return the number of L1 entries for bc blocks.
+ */
+static size_t l1Entries(size_t bc) {
+  return (bc + SparseFileVSSD::TableEntries - 1) /
+         SparseFileVSSD::TableEntries;
+}
+
+/**
+ * Return where the first table or block goes: after the header and the
+ * L1 table, rounded up to whole pages.
+ */
+static off_t dataStart(size_t bc) {
+  return HeaderBytes + (l1Entries(bc) * sizeof(uint64_t) + 4095) / 4096 * 4096;
+}
+
+SparseFileVSSD::SparseFileVSSD(size_t block_size, size_t block_count,
+                               string filename, size_t cached_tables)
+    : fn(filename),
+      bs(block_size),
+      bc(block_count),
+      cacheLimit(max<size_t>(cached_tables, 1)) {
+  fd = ::open(fn.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Header, then an all-zero L1 table: nothing is allocated yet
+  char header[HeaderBytes] = {};
+  uint64_t fields[5] = {Signature, bs, bc, TableEntries, l1Entries(bc)};
+  memcpy(header, fields, sizeof(fields));
+  fileEnd = dataStart(bc);
+  if (!pwrite_all(fd, header, sizeof(header), 0) ||
+      ftruncate(fd, fileEnd) != 0) {
+    cout << "ERROR: Unable to initialize '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  l1.assign(l1Entries(bc), 0);
+  stat = DiskStatus::OK;
+}
+
+SparseFileVSSD::SparseFileVSSD(string filename, size_t cached_tables)
+    : fn(filename), cacheLimit(max<size_t>(cached_tables, 1)) {
+  fd = ::open(fn.c_str(), O_RDWR);
+  uint64_t fields[5] = {};
+  if (fd < 0 || !pread_all(fd, (char*)fields, sizeof(fields), 0)) {
+    cout << "ERROR: Unable to open '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (fields[0] != Signature || fields[1] == 0 || fields[3] != TableEntries ||
+      fields[4] != l1Entries(fields[2])) {
+    cout << "ERROR: '" << fn << "' is not a sparse image.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  // Refuse every block until the tables check out
+  size_t block_count = fields[2];
+  bs = fields[1];
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < dataStart(block_count)) {
+    cout << "ERROR: File size does not match header information.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  fileEnd = info.st_size;
+  l1.assign(l1Entries(block_count), 0);
+  if (!pread_all(fd, (char*)l1.data(), l1.size() * sizeof(uint64_t),
+                 HeaderBytes)) {
+    cout << "ERROR: Unable to read the L1 table of '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  size_t tables = 0;
+  for (uint64_t offset : l1) {
+    if (offset == 0) continue;
+    if (offset < (uint64_t)dataStart(block_count) ||
+        offset + TableBytes > (uint64_t)fileEnd) {
+      cout << "ERROR: The L1 table of '" << fn << "' is damaged.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    tables++;
+  }
+
+  // Everything after the L1 table is a table or a block (a crash may
+  // have left an unused tail, which is counted too)
+  allocated = (fileEnd - dataStart(block_count) - tables * TableBytes) / bs;
+  bc = block_count;
+  stat = DiskStatus::OK;
+}
+
+SparseFileVSSD::~SparseFileVSSD() {
+  if (fd >= 0) close(fd);
+}
+
+SparseFileVSSD::Table* SparseFileVSSD::table(size_t index) {
+  if (l1[index] == 0) return nullptr;
+
+  auto match = cache.find(index);
+  if (match != cache.end()) {
+    recent.splice(recent.begin(), recent, match->second.second);
+    return &match->second.first;
+  }
+
+  Table loaded(TableEntries);
+  if (!pread_all(fd, (char*)loaded.data(), TableBytes, l1[index])) {
+    cout << "ERROR: Unable to read an L2 table of '" << fn << "'.\n";
+    return nullptr;
+  }
+  for (uint64_t offset : loaded)
+    if (offset != 0 && (offset < (uint64_t)dataStart(bc) ||
+                        offset + bs > (uint64_t)fileEnd)) {
+      cout << "ERROR: An L2 table of '" << fn << "' is damaged.\n";
+      return nullptr;
+    }
+  misses++;
+
+  // Tables on disk are current, so the oldest can just go
+  if (cache.size() == cacheLimit) {
+    cache.erase(recent.back());
+    recent.pop_back();
+  }
+  recent.push_front(index);
+  auto& entry = cache[index];
+  entry.first = move(loaded);
+  entry.second = recent.begin();
+  return &entry.first;
+}
+
+SparseFileVSSD::Table* SparseFileVSSD::tableFor(size_t index) {
+  if (l1[index] != 0) return table(index);
+
+  // The new table is on disk before the L1 entry pointing at it
+  Table empty(TableEntries, 0);
+  off_t offset = fileEnd;
+  if (!pwrite_all(fd, (const char*)empty.data(), TableBytes, offset)) {
+    cout << "ERROR: Unable to write an L2 table to '" << fn << "'.\n";
+    return nullptr;
+  }
+  fileEnd += TableBytes;
+  uint64_t entry = offset;
+  if (!pwrite_all(fd, (const char*)&entry, sizeof(entry),
+                  HeaderBytes + index * sizeof(uint64_t))) {
+    cout << "ERROR: Unable to update the L1 table of '" << fn << "'.\n";
+    return nullptr;
+  }
+  l1[index] = offset;
+  return table(index);
+}
+
+bool SparseFileVSSD::lookup(blocknumber_t block, size_t count,
+                            vector<uint64_t>& offsets) {
+  offsets.assign(count, 0);
+  size_t i = 0;
+  while (i < count) {
+    size_t index = (block + i) / TableEntries;
+    size_t first = (block + i) % TableEntries;
+    size_t run = min(count - i, TableEntries - first);
+    if (l1[index] != 0) {
+      Table* l2 = table(index);
+      if (l2 == nullptr) return false;
+      copy_n(l2->begin() + first, run, offsets.begin() + i);
+    }
+    i += run;
+  }
+  return true;
+}
+
+size_t SparseFileVSSD::allocatedBlocks() const {
+  lock_guard<mutex> hold(mtx);
+  return allocated;
+}
+
+size_t SparseFileVSSD::tableMisses() const {
+  lock_guard<mutex> hold(mtx);
+  return misses;
+}
+
+size_t SparseFileVSSD::blockSize() const { return bs; }
+
+size_t SparseFileVSSD::blockCount() const { return bc; }
+
+DiskStatus SparseFileVSSD::status() const { return stat; }
+
+DiskStatus SparseFileVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SparseFileVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SparseFileVSSD::readBlocks(blocknumber_t block, size_t count,
+                                      void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  vector<uint64_t> offsets;
+  {
+    lock_guard<mutex> hold(mtx);
+    if (!lookup(block, count, offsets)) {
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+  }
+
+  // Unallocated runs are zeros; allocated runs adjacent in the file are
+  // read with one call
+  char* out = static_cast<char*>(buffer);
+  size_t i = 0;
+  while (i < count) {
+    size_t run = 1;
+    if (offsets[i] == 0) {
+      while (i + run < count && offsets[i + run] == 0) run++;
+      memset(out + i * bs, 0, run * bs);
+    } else {
+      while (i + run < count && offsets[i + run] == offsets[i] + run * bs)
+        run++;
+      if (!pread_all(fd, out + i * bs, run * bs, offsets[i])) {
+        cout << "ERROR: Unable to read block " << block + i << "\n";
+        stat = DiskStatus::ERROR;
+        return stat;
+      }
+    }
+    i += run;
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SparseFileVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                       void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  // New blocks get the end of the file, in order; zeros need no space
+  const char* in = static_cast<const char*>(buffer);
+  vector<uint64_t> offsets;
+  vector<size_t> fresh;
+  {
+    lock_guard<mutex> hold(mtx);
+    if (!lookup(block, count, offsets)) {
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    for (size_t i = 0; i < count; i++) {
+      uint64_t word;
+      if (offsets[i] != 0 ||
+          (bs % sizeof(word) == 0 &&
+           block_util::same_filled(in + i * bs, bs, word) && word == 0))
+        continue;
+      offsets[i] = fileEnd;
+      fileEnd += bs;
+      fresh.push_back(i);
+    }
+    allocated += fresh.size();
+  }
+
+  // The data goes in before any table points at it
+  size_t i = 0;
+  while (i < count) {
+    size_t run = 1;
+    if (offsets[i] == 0) {
+      i++;
+      continue;
+    }
+    while (i + run < count && offsets[i + run] == offsets[i] + run * bs)
+      run++;
+    if (!pwrite_all(fd, in + i * bs, run * bs, offsets[i])) {
+      cout << "ERROR: Unable to write block " << block + i << "\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    i += run;
+  }
+
+  // Publish the new blocks, one stretch of each L2 table at a time
+  lock_guard<mutex> hold(mtx);
+  i = 0;
+  while (i < fresh.size()) {
+    blocknumber_t b = block + fresh[i];
+    size_t index = b / TableEntries;
+    Table* l2 = tableFor(index);
+    if (l2 == nullptr) {
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    size_t first = b % TableEntries;
+    size_t last = first;
+    for (; i < fresh.size() && (block + fresh[i]) / TableEntries == index; i++) {
+      last = (block + fresh[i]) % TableEntries;
+      (*l2)[last] = offsets[fresh[i]];
+    }
+    if (!pwrite_all(fd, (const char*)(l2->data() + first),
+                    (last - first + 1) * sizeof(uint64_t),
+                    l1[index] + first * sizeof(uint64_t))) {
+      cout << "ERROR: Unable to update an L2 table of '" << fn << "'.\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+  }
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SparseFileVSSD::sync() {
+  stat = (fsync(fd) == 0) ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
@@ -0,0 +1,187 @@
+/**
+ * SparseFileVSSD is a file-backed disk whose image only holds the
+ * blocks that were written, whatever the filesystem under it, so it
+ * stays compact when copied or archived.
+ *
+ * The image is a header, an L1 table, and then L2 tables and data
+ * blocks in the order they were allocated. Each L1 entry gives the
+ * offset of an L2 table (0 for none), and each L2 entry the offset of
+ * one block's data (0 for a block never written, which reads as zeros).
+ * Writing a new block appends it to the end of the file, along with a
+ * new L2 table when its part of the disk had none; blocks written
+ * together are allocated together, so they can be read back together.
+ * Writing zeros to a block that was never written allocates nothing.
+ *
+ * The L1 table stays in memory. L2 tables are cached, least recently
+ * used out first, so a lookup costs at most two table reads from
+ * memory; a table not cached costs one pread. Tables are written
+ * through, so evicting one is free. Data goes to the file before the
+ * table entry that points at it, and a new L2 table before the L1
+ * entry.
+ *
+ * A RangeLock over block numbers keeps a writer's blocks, and their
+ * first allocation, from being seen half done by readers of the same
+ * blocks; a mutex guards the tables and the end of the file.
+ */
+
+#ifndef SPARSEFILEVSSD_H
+  #define SPARSEFILEVSSD_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class SparseFileVSSD : public VVSSD {
+ public:
+  /// entries in one L2 table (one 4 KiB page of offsets)
+  static const std::size_t TableEntries = 512;
+  /// L2 tables cached unless the constructor is told otherwise
+  static const std::size_t DefaultCachedTables = 256;
+
+ private:
+  typedef std::vector<std::uint64_t> Table;
+
+  std::string fn;
+  int fd = -1;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  Table l1;
+  off_t fileEnd = 0;
+  std::size_t allocated = 0;
+
+  /// cached L2 tables by L1 index, most recently used at the front
+  std::size_t cacheLimit;
+  std::list<std::size_t> recent;
+  std::unordered_map<std::size_t,
+                     std::pair<Table, std::list<std::size_t>::iterator>>
+      cache;
+  std::size_t misses = 0;
+
+  /**
+   * Return the L2 table for L1 index, reading it in if it is not
+   * cached, or null if it is not allocated or cannot be read. Called
+   * with mtx held.
+   */
+  Table* table(std::size_t index);
+
+  /**
+   * Return the L2 table for L1 index, allocating it if needed. Called
+   * with mtx held.
+   */
+  Table* tableFor(std::size_t index);
+
+  /**
+   * Return the data offset of each block of an extent (0 if
+   * unallocated). Called with mtx held.
+   */
+  bool lookup(blocknumber_t block, std::size_t count,
+              std::vector<std::uint64_t>& offsets);
+
+ public:
+  /**
+   * SparseFileVSSD Constructor #1
+   * Creates a new, empty image. Truncates if necessary.
+   *
+   * @param  {std::size_t} block_size    : amount of bytes in block
+   * @param  {std::size_t} block_count   : amount of blocks
+   * @param  {std::string} filename      : filename
+   * @param  {std::size_t} cached_tables : L2 tables kept in memory
+   */
+  SparseFileVSSD(std::size_t block_size, std::size_t block_count,
+                 std::string filename,
+                 std::size_t cached_tables = DefaultCachedTables);
+
+  /**
+   * SparseFileVSSD Constructor #2
+   * Opens an existing image.
+   *
+   * @param  {std::string} filename      : filename to open
+   * @param  {std::size_t} cached_tables : L2 tables kept in memory
+   */
+  SparseFileVSSD(std::string filename,
+                 std::size_t cached_tables = DefaultCachedTables);
+
+  virtual ~SparseFileVSSD();
+
+  /**
+   * Return the number of blocks holding data in the image.
+   */
+  std::size_t allocatedBlocks() const;
+
+  /**
+   * Return the number of L2 tables read from the file because they were
+   * not cached.
+   */
+  std::size_t tableMisses() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block if possible.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block if possible.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent, allocating the blocks not yet in the image.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize all in-memory structures out to the disk.
+   *
+   * @return returns a status code for the operation. OK if all went well.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* SPARSEFILEVSSD_H */
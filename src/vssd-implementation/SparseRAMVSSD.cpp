@@ -0,0 +1,146 @@
+/**
+ * See SparseRAMVSSD.h for header comment
+ */
+
+#include "SparseRAMVSSD.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+SparseRAMVSSD::SparseRAMVSSD(size_t block_size, size_t block_count)
+    : bs(block_size), bc(block_count), stripes(block_count) {
+  // As many blocks per chunk as fit in ChunkBytes, a power of 2 so a
+  // block's chunk is a shift away
+  chunkShift = 0;
+  while ((bs << (chunkShift + 1)) <= ChunkBytes) chunkShift++;
+  chunkBytes = bs << chunkShift;
+
+  size_t chunkCount = (bc + (size_t(1) << chunkShift) - 1) >> chunkShift;
+  leafCount = (chunkCount + LeafEntries - 1) / LeafEntries;
+  root = make_unique<atomic<Leaf*>[]>(leafCount);
+  for (size_t i = 0; i < leafCount; i++) root[i] = nullptr;
+
+  stat = DiskStatus::OK;
+}
+
+SparseRAMVSSD::~SparseRAMVSSD() {
+  for (size_t i = 0; i < leafCount; i++) {
+    Leaf* leaf = root[i];
+    if (leaf == nullptr) continue;
+    for (auto& chunk : leaf->chunks) delete[] chunk.load();
+    delete leaf;
+  }
+}
+
+char* SparseRAMVSSD::findChunk(size_t chunk) const {
+  Leaf* leaf = root[chunk / LeafEntries].load(memory_order_acquire);
+  if (leaf == nullptr) return nullptr;
+  return leaf->chunks[chunk % LeafEntries].load(memory_order_acquire);
+}
+
+char* SparseRAMVSSD::makeChunk(size_t chunk) {
+  atomic<Leaf*>& slot = root[chunk / LeafEntries];
+  Leaf* leaf = slot.load(memory_order_acquire);
+  if (leaf == nullptr) {
+    Leaf* made = new Leaf();
+    // On failure leaf is set to the table another writer published
+    if (slot.compare_exchange_strong(leaf, made, memory_order_acq_rel)) {
+      leaf = made;
+      leavesAllocated++;
+    } else {
+      delete made;
+    }
+  }
+
+  atomic<char*>& entry = leaf->chunks[chunk % LeafEntries];
+  char* data = entry.load(memory_order_acquire);
+  if (data == nullptr) {
+    char* made = new char[chunkBytes]();
+    if (entry.compare_exchange_strong(data, made, memory_order_acq_rel)) {
+      data = made;
+      chunksAllocated++;
+    } else {
+      delete[] made;
+    }
+  }
+  return data;
+}
+
+size_t SparseRAMVSSD::allocatedBytes() const {
+  return leafCount * sizeof(atomic<Leaf*>) + leavesAllocated * sizeof(Leaf) +
+         chunksAllocated * chunkBytes;
+}
+
+size_t SparseRAMVSSD::blockSize() const { return bs; }
+
+size_t SparseRAMVSSD::blockCount() const { return bc; }
+
+DiskStatus SparseRAMVSSD::status() const { return stat; }
+
+DiskStatus SparseRAMVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SparseRAMVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SparseRAMVSSD::readBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Copy chunk by chunk; chunks never written read as zeros
+  stripes.read(block, count, [&] {
+    char* out = static_cast<char*>(buffer);
+    size_t mask = (size_t(1) << chunkShift) - 1;
+    for (size_t b = block, left = count; left > 0;) {
+      size_t run = min(left, (mask + 1) - (b & mask));
+      const char* chunk = findChunk(b >> chunkShift);
+      if (chunk == nullptr)
+        memset(out, 0, run * bs);
+      else
+        memcpy(out, chunk + (b & mask) * bs, run * bs);
+      out += run * bs;
+      b += run;
+      left -= run;
+    }
+  });
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SparseRAMVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                      void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  stripes.write(block, count, [&] {
+    const char* in = static_cast<const char*>(buffer);
+    size_t mask = (size_t(1) << chunkShift) - 1;
+    for (size_t b = block, left = count; left > 0;) {
+      size_t run = min(left, (mask + 1) - (b & mask));
+      memcpy(makeChunk(b >> chunkShift) + (b & mask) * bs, in, run * bs);
+      in += run * bs;
+      b += run;
+      left -= run;
+    }
+  });
+
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus SparseRAMVSSD::sync() { return stat; }
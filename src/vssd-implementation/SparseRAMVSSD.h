@@ -0,0 +1,146 @@
+/**
+ * SparseRAMVSSD is a RAM disk whose memory grows with the data written
+ * to it rather than with its logical size.
+ *
+ * Blocks are stored in fixed-size chunks (ChunkBytes worth of blocks)
+ * allocated on the first write to any of their blocks. Chunks are found
+ * through a two-level radix table: the root, sized for the whole disk at
+ * construction, holds one pointer per LeafEntries chunks, and each leaf
+ * is allocated with its first chunk. A block that was never written has
+ * no chunk and reads as zeros without allocating anything. A disk of
+ * billions of blocks therefore costs a root of a few MiB plus the chunks
+ * actually in use; see allocatedBytes().
+ *
+ * Tables and chunks are published with a compare-and-swap, so writers
+ * to different stripes never wait on an allocator lock; a writer that
+ * loses the race frees its copy and uses the winner's. Nothing is freed
+ * before the disk is destroyed, which is what lets readers follow the
+ * pointers without a lock.
+ *
+ * Otherwise the disk behaves like RAMVSSD: readers take no lock, and an
+ * extent read never sees half of a concurrent write (see StripedSeqLock).
+ */
+
+#ifndef SPARSERAMVSSD_H
+  #define SPARSERAMVSSD_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "StripedSeqLock.h"
+#include "VVSSD.h"
+
+class SparseRAMVSSD : public VVSSD {
+ public:
+  /// bytes of blocks allocated together (fewer if a block is larger)
+  static const std::size_t ChunkBytes = 64 * 1024;
+  /// chunk pointers held by one leaf of the radix table
+  static const std::size_t LeafEntries = 1024;
+
+ private:
+  struct Leaf {
+    std::atomic<char*> chunks[LeafEntries] = {};
+  };
+
+  std::size_t bs;
+  std::size_t bc;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+
+  /// blocks per chunk is 1 << chunkShift
+  unsigned int chunkShift;
+  std::size_t chunkBytes;
+  std::size_t leafCount;
+  std::unique_ptr<std::atomic<Leaf*>[]> root;
+  std::atomic<std::size_t> chunksAllocated = 0;
+  std::atomic<std::size_t> leavesAllocated = 0;
+
+  StripedSeqLock stripes;
+
+  /**
+   * Return the chunk holding the numbered chunk's blocks, or nullptr if
+   * none of them has been written.
+   */
+  char* findChunk(std::size_t chunk) const;
+
+  /**
+   * Return the chunk holding the numbered chunk's blocks, allocating it
+   * (and its leaf) zeroed if need be.
+   */
+  char* makeChunk(std::size_t chunk);
+
+ public:
+  /**
+   * SparseRAMVSSD Constructor. Only the root table is allocated.
+   *
+   * @param  {std::size_t} block_size  : the amount of bytes in each block.
+   * @param  {std::size_t} block_count : the amount of blocks
+   */
+  SparseRAMVSSD(std::size_t block_size, std::size_t block_count);
+
+  /**
+   * ~SparseRAMVSSD frees every chunk and table.
+   */
+  virtual ~SparseRAMVSSD();
+
+  /**
+   * Return the bytes of memory holding the disk: the root table, the
+   * leaves and the chunks allocated so far.
+   */
+  std::size_t allocatedBytes() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block; unwritten blocks read as zeros.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block, allocating its chunk on first use.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks; lock-free unless writers keep
+   * the extent busy.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks while holding its stripes.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Nothing to flush; returns the status.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* SPARSERAMVSSD_H */
@@ -0,0 +1,222 @@
+/**
+ * See SpillRAMVSSD.h for header comment
+ */
+
+#include "SpillRAMVSSD.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "fd_util.h"
+
+using namespace std;
+
+SpillRAMVSSD::SpillRAMVSSD(size_t block_size, size_t block_count,
+                           size_t budget, string filename)
+    : bs(block_size), bc(block_count) {
+  fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    cout << "ERROR: Unable to create '" << filename << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  // Scratch only: gone from the directory now, and from the disk with us
+  ::unlink(filename.c_str());
+
+  size_t frameCount = max<size_t>(1, min<size_t>(budget / bs, bc));
+  frameCount = min<size_t>(frameCount, NoFrame - 1);
+  // Left uninitialized, the frame memory is only committed once used
+  memory.reset(new char[frameCount * bs]);
+  frames.resize(frameCount);
+  freeFrames.reserve(frameCount);
+  for (size_t f = frameCount; f > 0; f--) freeFrames.push_back(f - 1);
+
+  frameOf.assign(bc, NoFrame);
+  spilled.assign(bc, false);
+
+  stat = DiskStatus::OK;
+}
+
+SpillRAMVSSD::~SpillRAMVSSD() {
+  if (fd >= 0) close(fd);
+}
+
+char* SpillRAMVSSD::frameData(frame_t frame) const {
+  return memory.get() + (size_t)frame * bs;
+}
+
+bool SpillRAMVSSD::evict() {
+  // Sweep: spare (and clear) referenced frames, take the others. Two
+  // full turns always find a victim.
+  vector<frame_t> victims;
+  for (size_t step = 0;
+       step < 2 * frames.size() && victims.size() < EvictBatch; step++) {
+    Frame& frame = frames[hand];
+    if (frame.referenced)
+      frame.referenced = false;
+    else
+      victims.push_back(hand);
+    hand = (hand + 1) % frames.size();
+  }
+
+  // Changed victims go out in block order, runs of consecutive blocks
+  // staged and written together
+  vector<frame_t> dirty;
+  for (frame_t f : victims)
+    if (frames[f].dirty) dirty.push_back(f);
+  sort(dirty.begin(), dirty.end(), [&](frame_t a, frame_t b) {
+    return frames[a].block < frames[b].block;
+  });
+  vector<char> run;
+  for (size_t i = 0; i < dirty.size();) {
+    size_t j = i + 1;
+    while (j < dirty.size() &&
+           frames[dirty[j]].block == frames[dirty[j - 1]].block + 1)
+      j++;
+    run.resize((j - i) * bs);
+    for (size_t k = i; k < j; k++)
+      memcpy(run.data() + (k - i) * bs, frameData(dirty[k]), bs);
+    if (!fd_util::pwrite_all(fd, run.data(), run.size(),
+                             (off_t)frames[dirty[i]].block * bs)) {
+      cout << "ERROR: Unable to write the spill file\n";
+      return false;
+    }
+    i = j;
+  }
+
+  for (frame_t f : victims) {
+    Frame& frame = frames[f];
+    if (frame.dirty) spilled[frame.block] = true;
+    frameOf[frame.block] = NoFrame;
+    frame = Frame();
+    freeFrames.push_back(f);
+  }
+  evictionCount += victims.size();
+  return true;
+}
+
+SpillRAMVSSD::frame_t SpillRAMVSSD::allocate(blocknumber_t block) {
+  if (freeFrames.empty() && !evict()) return NoFrame;
+  frame_t f = freeFrames.back();
+  freeFrames.pop_back();
+  frames[f].block = block;
+  frames[f].referenced = false;
+  frames[f].dirty = false;
+  frameOf[block] = f;
+  return f;
+}
+
+DiskStatus SpillRAMVSSD::readBlock(blocknumber_t block, char* buffer) {
+  frame_t f = frameOf[block];
+  if (f == NoFrame) {
+    // Never written: zeros, and no frame spent on them
+    if (!spilled[block]) {
+      memset(buffer, 0, bs);
+      return DiskStatus::OK;
+    }
+    f = allocate(block);
+    if (f == NoFrame ||
+        !fd_util::pread_all(fd, frameData(f), bs, (off_t)block * bs)) {
+      if (f != NoFrame) {
+        frameOf[block] = NoFrame;
+        freeFrames.push_back(f);
+      }
+      cout << "ERROR: Unable to read block " << block << "\n";
+      return DiskStatus::ERROR;
+    }
+    faultCount++;
+  } else {
+    frames[f].referenced = true;
+  }
+  memcpy(buffer, frameData(f), bs);
+  return DiskStatus::OK;
+}
+
+DiskStatus SpillRAMVSSD::writeBlock(blocknumber_t block, const char* buffer) {
+  // The whole block is replaced, so a spilled copy need not be read in
+  frame_t f = frameOf[block];
+  if (f != NoFrame)
+    frames[f].referenced = true;
+  else if ((f = allocate(block)) == NoFrame)
+    return DiskStatus::ERROR;
+  frames[f].dirty = true;
+  memcpy(frameData(f), buffer, bs);
+  return DiskStatus::OK;
+}
+
+size_t SpillRAMVSSD::residentBytes() const {
+  lock_guard<mutex> hold(mtx);
+  return (frames.size() - freeFrames.size()) * bs;
+}
+
+uint64_t SpillRAMVSSD::faults() const {
+  lock_guard<mutex> hold(mtx);
+  return faultCount;
+}
+
+uint64_t SpillRAMVSSD::evictions() const {
+  lock_guard<mutex> hold(mtx);
+  return evictionCount;
+}
+
+size_t SpillRAMVSSD::blockSize() const { return bs; }
+
+size_t SpillRAMVSSD::blockCount() const { return bc; }
+
+DiskStatus SpillRAMVSSD::status() const {
+  lock_guard<mutex> hold(mtx);
+  return stat;
+}
+
+DiskStatus SpillRAMVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus SpillRAMVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus SpillRAMVSSD::readBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  lock_guard<mutex> hold(mtx);
+  if (fd < 0) return stat = DiskStatus::ERROR;
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  stat = DiskStatus::OK;
+  for (size_t i = 0; i < count && stat == DiskStatus::OK; i++)
+    stat = readBlock(block + i, static_cast<char*>(buffer) + i * bs);
+  return stat;
+}
+
+DiskStatus SpillRAMVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  lock_guard<mutex> hold(mtx);
+  if (fd < 0) return stat = DiskStatus::ERROR;
+
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  stat = DiskStatus::OK;
+  for (size_t i = 0; i < count && stat == DiskStatus::OK; i++)
+    stat = writeBlock(block + i, static_cast<const char*>(buffer) + i * bs);
+  return stat;
+}
+
+DiskStatus SpillRAMVSSD::sync() {
+  lock_guard<mutex> hold(mtx);
+  return stat;
+}
@@ -0,0 +1,183 @@
+/**
+ * SpillRAMVSSD is a RAM disk held to a memory budget, with a spill file
+ * for the blocks that do not fit.
+ *
+ * Blocks live in frames carved from budget bytes of memory. When every
+ * frame is in use and another block is needed, cold blocks are evicted
+ * by the CLOCK algorithm: a hand sweeps the frames, sparing (and
+ * clearing the reference bit of) each frame used since its last visit
+ * and taking the rest. A batch of victims is taken at once and the
+ * changed ones are written to the spill file sorted by block number,
+ * consecutive blocks coalesced into one sequential write. A block comes
+ * into memory unreferenced and earns its bit only when used again, so
+ * a single pass over the disk cannot flush the working set. A block that
+ * is not in memory is read back from the file on access; one never
+ * written reads as zeros without using a frame.
+ *
+ * The working set therefore runs at RAM speed while the memory used
+ * stays under the budget (plus a few bytes of index per block). The
+ * spill file is scratch space: it is unlinked as soon as it is opened
+ * and never outlives the disk.
+ *
+ * One mutex guards the disk; every call, extents included, is atomic.
+ */
+
+#ifndef SPILLRAMVSSD_H
+  #define SPILLRAMVSSD_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "VVSSD.h"
+
+class SpillRAMVSSD : public VVSSD {
+ public:
+  /// most frames evicted by one CLOCK sweep
+  static const std::size_t EvictBatch = 64;
+
+ private:
+  typedef std::uint32_t frame_t;
+  static constexpr frame_t NoFrame = UINT32_MAX;
+
+  struct Frame {
+    blocknumber_t block = 0;
+    bool referenced = false;
+    bool dirty = false;
+  };
+
+  std::size_t bs;
+  std::size_t bc;
+  DiskStatus stat = DiskStatus::NOT_READY;
+  mutable std::mutex mtx;
+
+  int fd = -1;
+  std::unique_ptr<char[]> memory;
+  std::vector<Frame> frames;
+  std::vector<frame_t> freeFrames;
+  std::size_t hand = 0;
+
+  /// frame holding each block, or NoFrame
+  std::vector<frame_t> frameOf;
+  /// blocks whose latest contents are in the spill file
+  std::vector<bool> spilled;
+
+  std::uint64_t faultCount = 0;
+  std::uint64_t evictionCount = 0;
+
+  /**
+   * Return the memory of a frame.
+   */
+  char* frameData(frame_t frame) const;
+
+  /**
+   * Return a free (unreferenced) frame for block, evicting a batch if
+   * none is free.
+   * Returns NoFrame if the spill file could not be written.
+   */
+  frame_t allocate(blocknumber_t block);
+
+  /**
+   * Run the CLOCK hand to free up to EvictBatch frames, writing changed
+   * victims to the spill file in block order. Returns false on an I/O
+   * error (the victims then stay in memory).
+   */
+  bool evict();
+
+  /**
+   * Copy one block out, faulting it in from the spill file if needed.
+   */
+  DiskStatus readBlock(blocknumber_t block, char* buffer);
+
+  /**
+   * Copy one block in, taking a frame for it if needed.
+   */
+  DiskStatus writeBlock(blocknumber_t block, const char* buffer);
+
+ public:
+  /**
+   * SpillRAMVSSD Constructor
+   *
+   * @param  {std::size_t} block_size  : the amount of bytes in each block
+   * @param  {std::size_t} block_count : the amount of blocks
+   * @param  {std::size_t} budget      : bytes of memory for blocks; at
+   *                                     least one block's worth is used
+   * @param  {std::string} filename    : spill file to create (replaced,
+   *                                     and unlinked once open)
+   */
+  SpillRAMVSSD(std::size_t block_size, std::size_t block_count,
+               std::size_t budget, std::string filename);
+
+  virtual ~SpillRAMVSSD();
+
+  /**
+   * Return the bytes of blocks currently in memory.
+   */
+  std::size_t residentBytes() const;
+
+  /**
+   * Return the number of blocks read back in from the spill file.
+   */
+  std::uint64_t faults() const;
+
+  /**
+   * Return the number of blocks evicted from memory.
+   */
+  std::uint64_t evictions() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block, from memory or the spill file.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block into memory, evicting others if need be.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Nothing to flush: the spill file is scratch; returns the status.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* SPILLRAMVSSD_H */
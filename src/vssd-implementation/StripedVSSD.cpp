@@ -0,0 +1,153 @@
+/**
+ * See StripedVSSD.h for header comment
+ */
+
+#include "StripedVSSD.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+StripedVSSD::StripedVSSD(vector<unique_ptr<VVSSD>> children,
+                         size_t stripe_blocks)
+    : children(move(children)), unit(stripe_blocks) {
+  if (this->children.empty() || unit == 0) {
+    cout << "ERROR: Striping needs at least one child and unit.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  bs = this->children.front()->blockSize();
+  size_t units = SIZE_MAX;
+  for (auto& child : this->children) {
+    if (child->status() != DiskStatus::OK || child->blockSize() != bs) {
+      cout << "ERROR: Children must be ready and share one block size.\n";
+      bs = 0;
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    units = min(units, child->blockCount() / unit);
+  }
+
+  bc = this->children.size() * units * unit;
+  lanes = make_unique<LanePool>(this->children.size());
+  stat = DiskStatus::OK;
+}
+
+StripedVSSD::~StripedVSSD() {}
+
+size_t StripedVSSD::stripeBlocks() const { return unit; }
+
+size_t StripedVSSD::childCount() const { return children.size(); }
+
+size_t StripedVSSD::blockSize() const { return bs; }
+
+size_t StripedVSSD::blockCount() const { return bc; }
+
+DiskStatus StripedVSSD::status() const { return stat; }
+
+DiskStatus StripedVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus StripedVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus StripedVSSD::transfer(blocknumber_t block, size_t count,
+                                 char* buffer, bool writing) {
+  /**
+   * One child's share of the extent: a contiguous run of its blocks,
+   * made of pieces of the caller's buffer (offset, length in blocks).
+   */
+  struct Part {
+    blocknumber_t first = 0;
+    size_t count = 0;
+    vector<pair<size_t, size_t>> pieces;
+  };
+
+  size_t n = children.size();
+  vector<Part> parts(n);
+  for (blocknumber_t b = block; b < block + count;) {
+    size_t u = b / unit;
+    size_t offset = b % unit;
+    size_t length = min(unit - offset, block + count - b);
+    Part& part = parts[u % n];
+    if (part.count == 0) part.first = (u / n) * unit + offset;
+    part.count += length;
+    part.pieces.emplace_back(b - block, length);
+    b += length;
+  }
+
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t c = 0; c < n; c++) {
+    if (parts[c].count == 0) continue;
+    jobs.emplace_back(c, [&, c]() {
+      Part& part = parts[c];
+      VVSSD& child = *children[c];
+      // A single piece needs no gathering
+      if (part.pieces.size() == 1) {
+        char* at = buffer + part.pieces[0].first * bs;
+        return writing ? child.writeBlocks(part.first, part.count, at)
+                       : child.readBlocks(part.first, part.count, at);
+      }
+      vector<char> staged(part.count * bs);
+      size_t done = 0;
+      if (writing) {
+        for (auto [offset, length] : part.pieces) {
+          memcpy(&staged[done * bs], buffer + offset * bs, length * bs);
+          done += length;
+        }
+        return child.writeBlocks(part.first, part.count, staged.data());
+      }
+      DiskStatus ds = child.readBlocks(part.first, part.count, staged.data());
+      if (ds != DiskStatus::OK) return ds;
+      for (auto [offset, length] : part.pieces) {
+        memcpy(buffer + offset * bs, &staged[done * bs], length * bs);
+        done += length;
+      }
+      return DiskStatus::OK;
+    });
+  }
+  return lanes->run(jobs);
+}
+
+DiskStatus StripedVSSD::readBlocks(blocknumber_t block, size_t count,
+                                   void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Readers of overlapping extents share; writers wait for us
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+  stat = transfer(block, count, static_cast<char*>(buffer), false);
+  return stat;
+}
+
+DiskStatus StripedVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+  stat = transfer(block, count, static_cast<char*>(buffer), true);
+  return stat;
+}
+
+DiskStatus StripedVSSD::sync() {
+  if (lanes == nullptr) return stat;
+  vector<pair<size_t, LanePool::Job>> jobs;
+  for (size_t c = 0; c < children.size(); c++)
+    jobs.emplace_back(c, [this, c] { return children[c]->sync(); });
+  stat = lanes->run(jobs);
+  return stat;
+}
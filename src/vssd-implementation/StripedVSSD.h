@@ -0,0 +1,133 @@
+/**
+ * StripedVSSD (RAID-0) spreads its blocks over several child disks
+ * (any VVSSDs, typically FileVSSDs on different devices) so their
+ * bandwidth adds up.
+ *
+ * The disk is cut into stripe units of stripeBlocks() blocks, dealt out
+ * to the children in turn: unit u lives on child u % N, as that child's
+ * unit u / N. The units of one child in an extent are therefore
+ * contiguous on that child, so an extent becomes at most one request per
+ * child. Those requests run in parallel, one lane per child (a
+ * LanePool, which keeps several requests in flight on each child when
+ * there are concurrent callers), the first on the calling thread; a
+ * child's part spanning several units goes through a buffer that
+ * gathers (or scatters) its units. The disk is as long as N times the
+ * largest whole number of units every child can hold.
+ *
+ * There is no redundancy: losing a child loses the disk. A RangeLock
+ * over the disk's block numbers spans the children, so an extent
+ * spread over several of them is still read and written as a whole.
+ */
+
+#ifndef STRIPEDVSSD_H
+  #define STRIPEDVSSD_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "LanePool.h"
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class StripedVSSD : public VVSSD {
+ public:
+  /// stripe unit (in blocks) unless the constructor is told otherwise
+  static const std::size_t DefaultStripeBlocks = 16;
+
+ private:
+  std::vector<std::unique_ptr<VVSSD>> children;
+  std::size_t unit = 0;
+  std::size_t bs = 0;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+  std::unique_ptr<LanePool> lanes;
+
+  /**
+   * Read (or write) an extent, one job per child it touches.
+   */
+  DiskStatus transfer(blocknumber_t block, std::size_t count, char* buffer,
+                      bool writing);
+
+ public:
+  /**
+   * StripedVSSD Constructor
+   * Stripes over children, which must all be ready and have the same
+   * block size.
+   *
+   * @param  {std::vector<std::unique_ptr<VVSSD>>} children : the disks
+   * @param  {std::size_t} stripe_blocks                    : blocks per
+   *                                                          stripe unit
+   */
+  StripedVSSD(std::vector<std::unique_ptr<VVSSD>> children,
+              std::size_t stripe_blocks = DefaultStripeBlocks);
+
+  virtual ~StripedVSSD();
+
+  /**
+   * Return the number of blocks in a stripe unit.
+   */
+  std::size_t stripeBlocks() const;
+
+  /**
+   * Return the number of child disks.
+   */
+  std::size_t childCount() const;
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block from its child.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Write indicated block to its child.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks under a shared lock on the extent,
+   * from all the children it touches in parallel.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Write a contiguous extent of blocks under an exclusive lock on the
+   * extent, to all the children it touches in parallel.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize every child, in parallel.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* STRIPEDVSSD_H */
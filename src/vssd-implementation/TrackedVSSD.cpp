@@ -0,0 +1,361 @@
+/**
+ * See TrackedVSSD.h for header comment
+ */
+
+#include "TrackedVSSD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "fd_util.h"
+#include "hash_util.h"
+
+using namespace std;
+using fd_util::pread_all;
+using fd_util::pwrite_all;
+
+static const uint64_t Signature = 0x3154424344535356;        // "VSSDCBT1"
+static const uint64_t StreamSignature = 0x31434e4944535356;  // "VSSDINC1"
+/// signature, block count, generation, in use, name length, image
+/// identity (device, inode, size, mtime), name
+static const size_t HeaderBytes = 4096;
+static const size_t IdentityStart = 5;
+static const size_t NameStart = 9 * sizeof(uint64_t);
+
+static bool nameFits(const string& checkpoint) {
+  if (checkpoint.size() <= HeaderBytes - NameStart) return true;
+  cout << "ERROR: Checkpoint name '" << checkpoint << "' is too long.\n";
+  return false;
+}
+
+TrackedVSSD::TrackedVSSD(unique_ptr<VVSSD> disk, string sidecar, string image)
+    : disk(move(disk)), fn(sidecar), image(image) {
+  bc = this->disk->blockCount();
+  if (this->disk->status() != DiskStatus::OK) {
+    cout << "ERROR: Disk is not ready.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  fd = ::open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    cout << "ERROR: Unable to open '" << fn << "'.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  lock_guard<mutex> hold(mtx);
+  changes.assign((bc + 7) / 8, 0);
+  uint64_t fields[9] = {};
+  if (info.st_size > 0) {
+    if (!pread_all(fd, (char*)fields, sizeof(fields), 0) ||
+        fields[0] != Signature || fields[4] > HeaderBytes - NameStart) {
+      cout << "ERROR: '" << fn << "' is not a change tracking file.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    if (fields[1] != bc) {
+      cout << "ERROR: '" << fn << "' tracks a disk of " << fields[1]
+           << " blocks, not " << bc << ".\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+    name.assign(fields[4], '\0');
+    if (!pread_all(fd, name.data(), name.size(), NameStart) ||
+        !pread_all(fd, (char*)changes.data(), changes.size(), HeaderBytes)) {
+      cout << "ERROR: Unable to read '" << fn << "'.\n";
+      stat = DiskStatus::ERROR;
+      return;
+    }
+  }
+
+  // A new sidecar, one not closed cleanly, or one whose image has been
+  // written without it since: every block may have changed
+  uint64_t id[4];
+  bool same = identify(id) &&
+              memcmp(id, &fields[IdentityStart], sizeof(id)) == 0;
+  gen = fields[2];
+  if (info.st_size == 0 || fields[3] != 0 || !same) {
+    gen++;
+    name.clear();
+    fill(changes.begin(), changes.end(), 0xff);
+    if (bc % 8 != 0) changes.back() = (1 << (bc % 8)) - 1;
+    if (!writeBitmap()) {
+      stat = DiskStatus::ERROR;
+      return;
+    }
+  }
+  stat = writeHeader(true) ? DiskStatus::OK : DiskStatus::ERROR;
+}
+
+TrackedVSSD::~TrackedVSSD() {
+  if (fd < 0) return;
+  // Only a sidecar that was opened properly is closed cleanly
+  lock_guard<mutex> hold(mtx);
+  if (gen != 0 && writeBitmap()) writeHeader(false);
+  close(fd);
+}
+
+bool TrackedVSSD::writeHeader(bool inUse) {
+  char header[HeaderBytes] = {};
+  uint64_t fields[9] = {Signature, bc, gen, inUse, name.size()};
+  // The image as it is left behind; only a clean close vouches for it
+  if (!inUse && !identify(&fields[IdentityStart]))
+    memset(&fields[IdentityStart], 0, 4 * sizeof(uint64_t));
+  if (!inUse && !image.empty()) fd_util::wait_past(fields[IdentityStart + 3]);
+  memcpy(header, fields, sizeof(fields));
+  memcpy(header + NameStart, name.data(), name.size());
+  if (!pwrite_all(fd, header, sizeof(header), 0) || fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to write the header of '" << fn << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+bool TrackedVSSD::writeBitmap() {
+  if (!pwrite_all(fd, (const char*)changes.data(), changes.size(),
+                  HeaderBytes) ||
+      fdatasync(fd) != 0) {
+    cout << "ERROR: Unable to write the bitmap of '" << fn << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+bool TrackedVSSD::identify(uint64_t id[4]) const {
+  memset(id, 0, 4 * sizeof(uint64_t));
+  return image.empty() || fd_util::file_identity(image.c_str(), id);
+}
+
+DiskStatus TrackedVSSD::checkpoint(const string& checkpoint) {
+  if (!nameFits(checkpoint)) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // No writes in flight
+  auto held = locks.lock(0, bc, RangeLock::EXCLUSIVE);
+  stat = startCheckpoint(checkpoint);
+  return stat;
+}
+
+DiskStatus TrackedVSSD::startCheckpoint(const string& checkpoint) {
+  // What was written is on the device before the bitmap forgets it
+  stat = disk->sync();
+  if (stat != DiskStatus::OK) return stat;
+
+  lock_guard<mutex> hold(mtx);
+  gen++;
+  name = checkpoint;
+  fill(changes.begin(), changes.end(), 0);
+  stat = (writeHeader(true) && writeBitmap()) ? DiskStatus::OK
+                                              : DiskStatus::ERROR;
+  return stat;
+}
+
+string TrackedVSSD::checkpointName() const {
+  lock_guard<mutex> hold(mtx);
+  return name;
+}
+
+uint64_t TrackedVSSD::generation() const {
+  lock_guard<mutex> hold(mtx);
+  return gen;
+}
+
+bool TrackedVSSD::changed(blocknumber_t block) const {
+  lock_guard<mutex> hold(mtx);
+  return block < bc && (changes[block / 8] & (1 << (block % 8)));
+}
+
+size_t TrackedVSSD::changedBlocks() const {
+  lock_guard<mutex> hold(mtx);
+  size_t count = 0;
+  for (uint8_t bits : changes) count += __builtin_popcount(bits);
+  return count;
+}
+
+DiskStatus TrackedVSSD::exportChanges(const string& since, ostream& out,
+                                      size_t* blocks) {
+  // Writers wait until the stream is done
+  auto held = locks.lock(0, bc, RangeLock::SHARED);
+  stat = exportLocked(since, out, blocks);
+  return stat;
+}
+
+DiskStatus TrackedVSSD::exportAndCheckpoint(const string& since, ostream& out,
+                                            const string& next,
+                                            size_t* blocks) {
+  if (!nameFits(next)) {
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+
+  // Writers wait from before the stream until the new checkpoint has
+  // started, so none can fall between the two
+  auto held = locks.lock(0, bc, RangeLock::EXCLUSIVE);
+  stat = exportLocked(since, out, blocks);
+  if (stat != DiskStatus::OK) return stat;
+  stat = startCheckpoint(next);
+  return stat;
+}
+
+DiskStatus TrackedVSSD::exportLocked(const string& since, ostream& out,
+                                     size_t* blocks) {
+  vector<uint8_t> bits;
+  uint64_t fields[5] = {StreamSignature, disk->blockSize(), bc, 0, 0};
+  {
+    lock_guard<mutex> hold(mtx);
+    if (since != name) {
+      cout << "ERROR: Changes are tracked since checkpoint '" << name
+           << "', not '" << since << "'.\n";
+      stat = DiskStatus::ERROR;
+      return stat;
+    }
+    bits = changes;
+    fields[3] = gen;
+    fields[4] = name.size();
+  }
+  out.write((const char*)fields, sizeof(fields));
+  out.write(since.data(), since.size());
+
+  // Runs of changed blocks, each with its place and a hash of its data
+  size_t bs = disk->blockSize();
+  vector<char> data(RunBlocks * bs);
+  size_t written = 0;
+  auto isChanged = [&](size_t b) { return bits[b / 8] & (1 << (b % 8)); };
+  for (size_t b = 0; b < bc;) {
+    if (!isChanged(b)) {
+      b++;
+      continue;
+    }
+    size_t run = 1;
+    while (run < RunBlocks && b + run < bc && isChanged(b + run)) run++;
+    stat = disk->readBlocks(b, run, data.data());
+    if (stat != DiskStatus::OK) return stat;
+    hash_util::Hash128 hash = hash_util::murmur3_128(data.data(), run * bs);
+    uint64_t record[4] = {b, run, hash.low, hash.high};
+    out.write((const char*)record, sizeof(record));
+    out.write(data.data(), run * bs);
+    written += run;
+    b += run;
+  }
+  uint64_t end[4] = {};
+  out.write((const char*)end, sizeof(end));
+  out.flush();
+
+  if (!out) {
+    cout << "ERROR: Unable to write the change stream.\n";
+    stat = DiskStatus::ERROR;
+    return stat;
+  }
+  if (blocks != nullptr) *blocks = written;
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+DiskStatus TrackedVSSD::importChanges(istream& in, VVSSD& disk,
+                                      size_t* blocks) {
+  size_t bs = disk.blockSize();
+  size_t bc = disk.blockCount();
+  uint64_t fields[5] = {};
+  in.read((char*)fields, sizeof(fields));
+  if (!in || fields[0] != StreamSignature ||
+      fields[4] > HeaderBytes - NameStart) {
+    cout << "ERROR: Not a change stream.\n";
+    return DiskStatus::ERROR;
+  }
+  if (fields[1] != bs || fields[2] != bc) {
+    cout << "ERROR: The change stream is for a disk of " << fields[2]
+         << " blocks of " << fields[1] << " bytes.\n";
+    return DiskStatus::ERROR;
+  }
+  in.ignore(fields[4]);
+
+  vector<char> data(RunBlocks * bs);
+  size_t written = 0;
+  while (true) {
+    uint64_t record[4];
+    in.read((char*)record, sizeof(record));
+    if (!in) {
+      cout << "ERROR: The change stream is truncated.\n";
+      return DiskStatus::ERROR;
+    }
+    if (record[1] == 0) break;
+    if (record[1] > RunBlocks || record[0] >= bc || record[1] > bc - record[0]) {
+      cout << "ERROR: The change stream is damaged.\n";
+      return DiskStatus::ERROR;
+    }
+    in.read(data.data(), record[1] * bs);
+    if (!in) {
+      cout << "ERROR: The change stream is truncated.\n";
+      return DiskStatus::ERROR;
+    }
+    hash_util::Hash128 hash =
+        hash_util::murmur3_128(data.data(), record[1] * bs);
+    if (hash.low != record[2] || hash.high != record[3]) {
+      cout << "ERROR: The change stream is damaged at block " << record[0]
+           << ".\n";
+      return DiskStatus::ERROR;
+    }
+    DiskStatus ds = disk.writeBlocks(record[0], record[1], data.data());
+    if (ds != DiskStatus::OK) return ds;
+    written += record[1];
+  }
+
+  if (blocks != nullptr) *blocks = written;
+  return DiskStatus::OK;
+}
+
+size_t TrackedVSSD::blockSize() const { return disk->blockSize(); }
+
+size_t TrackedVSSD::blockCount() const { return bc; }
+
+DiskStatus TrackedVSSD::status() const { return stat; }
+
+DiskStatus TrackedVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus TrackedVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus TrackedVSSD::readBlocks(blocknumber_t block, size_t count,
+                                   void* buffer) {
+  stat = disk->readBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus TrackedVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                    void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Exports and checkpoints see the mark and the data together
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+  {
+    lock_guard<mutex> hold(mtx);
+    for (size_t b = block; b < block + count; b++)
+      changes[b / 8] |= 1 << (b % 8);
+  }
+  stat = disk->writeBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus TrackedVSSD::sync() {
+  stat = disk->sync();
+  if (stat != DiskStatus::OK) return stat;
+  lock_guard<mutex> hold(mtx);
+  stat = writeBitmap() ? DiskStatus::OK : DiskStatus::ERROR;
+  return stat;
+}
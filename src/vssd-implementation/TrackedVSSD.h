@@ -0,0 +1,246 @@
+/**
+ * TrackedVSSD adds changed-block tracking to any disk (a RAMVSSD, a
+ * FileVSSD, ...): it remembers every block written since a named
+ * checkpoint, so a backup can copy just those blocks.
+ *
+ * The record is a bitmap with one bit per block, kept in a sidecar file
+ * next to the image along with the checkpoint's name and a generation
+ * number. The bitmap lives in memory and is written to the sidecar by
+ * sync() and when the disk is closed; meanwhile the sidecar is marked
+ * in use. A sidecar found in use was not closed cleanly, so its bitmap
+ * may have missed writes: the tracker starts over with every block
+ * marked changed, no checkpoint, and a new generation, and the next
+ * backup is a full one. A new sidecar starts the same way. The
+ * generation also goes up with every checkpoint, so two exports with
+ * the same generation cover the same changes.
+ *
+ * Given the image's filename, a clean close also records the image's
+ * device, inode, size and modification time, and the tracker starts
+ * over in the same way if they differ when it is next opened: the image
+ * was written (or replaced) by something other than the tracker.
+ * Nothing can notice such writes while the tracker has the image open,
+ * so every write made then must still go through the tracker.
+ *
+ * exportChanges() writes the blocks changed since the current checkpoint
+ * to a compact stream: a header, then runs of changed blocks, each with
+ * its first block, length and a hash of its data; importChanges() writes
+ * such a stream onto a disk of the same geometry. A backup that is to
+ * be followed by another uses exportAndCheckpoint(), which starts the
+ * next checkpoint as the stream ends, with no write in between.
+ *
+ * Writers lock their extent (a RangeLock) while they mark and write
+ * their blocks; exports and checkpoints lock the whole disk.
+ */
+
+#ifndef TRACKEDVSSD_H
+  #define TRACKEDVSSD_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class TrackedVSSD : public VVSSD {
+ public:
+  /// most blocks in one run of an exported stream
+  static const std::size_t RunBlocks = 256;
+
+ private:
+  std::unique_ptr<VVSSD> disk;
+  std::string fn;
+  std::string image;
+  int fd = -1;
+  std::size_t bc = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  std::vector<std::uint8_t> changes;
+  std::string name;
+  std::uint64_t gen = 0;
+
+  /**
+   * Write the header (marked in use or not) to the sidecar and flush
+   * it. Called with mtx held.
+   */
+  bool writeHeader(bool inUse);
+
+  /**
+   * Write the bitmap to the sidecar and flush it. Called with mtx held.
+   */
+  bool writeBitmap();
+
+  /**
+   * Set id to the image's device, inode, size and modification time
+   * (all zero without an image). Returns false if it cannot be found.
+   */
+  bool identify(std::uint64_t id[4]) const;
+
+  /**
+   * Write the stream of exportChanges(). Called with the whole disk
+   * locked.
+   */
+  DiskStatus exportLocked(const std::string& since, std::ostream& out,
+                          std::size_t* blocks);
+
+  /**
+   * Sync the disk and mark every block unchanged under a new checkpoint.
+   * Called with the whole disk locked exclusively.
+   */
+  DiskStatus startCheckpoint(const std::string& checkpoint);
+
+ public:
+  /**
+   * TrackedVSSD Constructor
+   * Tracks writes to disk in the sidecar, creating it (with every block
+   * marked changed) if it does not exist.
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : the disk to track
+   * @param  {std::string} sidecar         : filename of the bitmap
+   * @param  {std::string} image           : filename of the disk's image,
+   *                                         if it has one, to notice
+   *                                         writes made without the
+   *                                         tracker
+   */
+  TrackedVSSD(std::unique_ptr<VVSSD> disk, std::string sidecar,
+              std::string image = "");
+
+  /**
+   * ~TrackedVSSD writes the bitmap out and marks the sidecar closed.
+   */
+  virtual ~TrackedVSSD();
+
+  /**
+   * Start a new checkpoint: the disk is synced and every block is
+   * marked unchanged.
+   *
+   * @param  {std::string} checkpoint : name of the new checkpoint
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  DiskStatus checkpoint(const std::string& checkpoint);
+
+  /**
+   * Return the name of the current checkpoint ("" if there is none).
+   */
+  std::string checkpointName() const;
+
+  /**
+   * Return the generation of the current checkpoint.
+   */
+  std::uint64_t generation() const;
+
+  /**
+   * Return true if block was written since the checkpoint.
+   */
+  bool changed(blocknumber_t block) const;
+
+  /**
+   * Return the number of blocks written since the checkpoint.
+   */
+  std::size_t changedBlocks() const;
+
+  /**
+   * Write the blocks changed since the checkpoint to out. Refuses
+   * (with ERROR) unless since names the current checkpoint.
+   *
+   * @param  {std::string} since  : the checkpoint the backup starts from
+   * @param  {std::ostream} out   : where the stream goes
+   * @param  {std::size_t*} blocks : set to the number of blocks written
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  DiskStatus exportChanges(const std::string& since, std::ostream& out,
+                           std::size_t* blocks = nullptr);
+
+  /**
+   * exportChanges(), then checkpoint(next) once the stream is written,
+   * with writers held off throughout, so the next export takes up exactly
+   * where this one ends. If the stream cannot be written the checkpoint
+   * stays as it was.
+   *
+   * @param  {std::string} since  : the checkpoint the backup starts from
+   * @param  {std::ostream} out   : where the stream goes
+   * @param  {std::string} next   : name of the new checkpoint
+   * @param  {std::size_t*} blocks : set to the number of blocks written
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  DiskStatus exportAndCheckpoint(const std::string& since, std::ostream& out,
+                                 const std::string& next,
+                                 std::size_t* blocks = nullptr);
+
+  /**
+   * Write the blocks of a stream from exportChanges() onto disk, run by
+   * run. A damaged or truncated stream stops at the bad run (with
+   * ERROR); the runs before it are already written, and importing a
+   * good copy of the stream again finishes the job.
+   *
+   * @param  {std::istream} in    : the stream
+   * @param  {VVSSD} disk         : the disk to write; same geometry as
+   *                                the exported one
+   * @param  {std::size_t*} blocks : set to the number of blocks written
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  static DiskStatus importChanges(std::istream& in, VVSSD& disk,
+                                  std::size_t* blocks = nullptr);
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read indicated block from the disk.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Mark indicated block changed and write it.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks from the disk.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Mark a contiguous extent of blocks changed and write them, under an
+   * exclusive lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Sync the disk, then write the bitmap to the sidecar.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* TRACKEDVSSD_H */
@@ -0,0 +1,206 @@
+/**
+ * See VersionedVSSD.h for header comment
+ */
+
+#include "VersionedVSSD.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+VersionedVSSD::VersionedVSSD(unique_ptr<VVSSD> disk, unique_ptr<VVSSD> log)
+    : disk(move(disk)), log(move(log)) {
+  bc = this->disk->blockCount();
+  if (this->disk->status() != DiskStatus::OK ||
+      this->log->status() != DiskStatus::OK) {
+    cout << "ERROR: Disk or version log is not ready.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+  if (this->log->blockSize() != this->disk->blockSize() ||
+      this->log->blockCount() == 0) {
+    cout << "ERROR: Version log must have blocks of the disk's size.\n";
+    stat = DiskStatus::ERROR;
+    return;
+  }
+
+  capacity = this->log->blockCount();
+  writtenAt.assign(bc, 0);
+  newest.assign(bc, NoEntry);
+  entries.assign(capacity, Entry());
+  filling.assign(capacity, 0);
+  stat = DiskStatus::OK;
+}
+
+VersionedVSSD::~VersionedVSSD() {}
+
+VersionedVSSD::sequence_t VersionedVSSD::now() const {
+  lock_guard<mutex> hold(mtx);
+  return seq;
+}
+
+size_t VersionedVSSD::retainedVersions() const {
+  lock_guard<mutex> hold(mtx);
+  return next - tail;
+}
+
+DiskStatus VersionedVSSD::readAt(blocknumber_t block, sequence_t at,
+                                 void* buffer) {
+  return readBlocksAt(block, 1, at, buffer);
+}
+
+DiskStatus VersionedVSSD::readBlocksAt(blocknumber_t block, size_t count,
+                                       sequence_t at, void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Writers of these blocks wait, so current versions stay current
+  auto held = locks.lock(block, block + count, RangeLock::SHARED);
+
+  // Find each block's version: current, or an entry down its chain
+  vector<position_t> found(count, NoEntry);
+  {
+    lock_guard<mutex> hold(mtx);
+    for (size_t i = 0; i < count; i++) {
+      blocknumber_t b = block + i;
+      if (at >= writtenAt[b]) continue;
+      position_t p = newest[b];
+      while (p != NoEntry && p >= tail && entries[p % capacity].from > at)
+        p = entries[p % capacity].older;
+      if (p == NoEntry || p < tail) {
+        stat = DiskStatus::VERSION_UNAVAILABLE;
+        return stat;
+      }
+      found[i] = p;
+    }
+  }
+
+  // Runs of current versions in one call; old ones one at a time
+  size_t bs = blockSize();
+  char* out = static_cast<char*>(buffer);
+  size_t i = 0;
+  while (i < count) {
+    DiskStatus ds;
+    if (found[i] != NoEntry) {
+      ds = log->read(found[i] % capacity, out + i * bs);
+      i++;
+    } else {
+      size_t run = 1;
+      while (i + run < count && found[i + run] == NoEntry) run++;
+      ds = disk->readBlocks(block + i, run, out + i * bs);
+      i += run;
+    }
+    if (ds != DiskStatus::OK) {
+      stat = ds;
+      return stat;
+    }
+  }
+
+  // A write may have reused a log block since we looked it up
+  lock_guard<mutex> hold(mtx);
+  for (position_t p : found)
+    if (p != NoEntry && p < tail) {
+      stat = DiskStatus::VERSION_UNAVAILABLE;
+      return stat;
+    }
+  stat = DiskStatus::OK;
+  return stat;
+}
+
+size_t VersionedVSSD::blockSize() const { return disk->blockSize(); }
+
+size_t VersionedVSSD::blockCount() const { return bc; }
+
+DiskStatus VersionedVSSD::status() const { return stat; }
+
+DiskStatus VersionedVSSD::read(blocknumber_t block, void* buffer) {
+  return readBlocks(block, 1, buffer);
+}
+
+DiskStatus VersionedVSSD::write(blocknumber_t block, void* buffer) {
+  return writeBlocks(block, 1, buffer);
+}
+
+DiskStatus VersionedVSSD::readBlocks(blocknumber_t block, size_t count,
+                                     void* buffer) {
+  stat = disk->readBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus VersionedVSSD::writeBlocks(blocknumber_t block, size_t count,
+                                      void* buffer) {
+  // Range Checking (the whole extent; the sum may wrap)
+  if (block >= bc || count > bc - block) {
+    cout << "ERROR: Index out of range\n";
+    stat = DiskStatus::BLOCK_OUT_OF_RANGE;
+    return stat;
+  }
+
+  // Nobody else reads or writes these blocks until we are done
+  auto held = locks.lock(block, block + count, RangeLock::EXCLUSIVE);
+
+  // Claim log blocks for the old versions once no other write is still
+  // filling them; the oldest entries make way
+  sequence_t mine;
+  position_t first;
+  size_t slots = min(count, capacity);
+  {
+    unique_lock<mutex> hold(mtx);
+    filled.wait(hold, [&] {
+      for (size_t i = 0; i < slots; i++)
+        if (filling[(next + i) % capacity] != 0) return false;
+      return true;
+    });
+    mine = ++seq;
+    first = next;
+    next += count;
+    tail = max(tail, next > capacity ? next - capacity : 0);
+    for (size_t i = 0; i < slots; i++) filling[(first + i) % capacity] = mine;
+  }
+
+  // Copy the old versions out; when the extent outlasts the log, only
+  // its last blocks keep theirs
+  size_t bs = blockSize();
+  vector<char> old(count * bs);
+  DiskStatus ds = disk->readBlocks(block, count, old.data());
+  for (size_t i = count - slots; ds == DiskStatus::OK && i < count;) {
+    size_t slot = (first + i) % capacity;
+    size_t run = min(count - i, capacity - slot);
+    ds = log->writeBlocks(slot, run, old.data() + i * bs);
+    i += run;
+  }
+
+  {
+    lock_guard<mutex> hold(mtx);
+    for (size_t i = 0; i < slots; i++) filling[(first + i) % capacity] = 0;
+    if (ds == DiskStatus::OK)
+      for (size_t i = 0; i < count; i++) {
+        blocknumber_t b = block + i;
+        position_t p = first + i;
+        entries[p % capacity] = Entry{b, writtenAt[b], mine, newest[b]};
+        newest[b] = p;
+        writtenAt[b] = mine;
+      }
+  }
+  filled.notify_all();
+
+  if (ds != DiskStatus::OK) {
+    cout << "ERROR: Unable to save the old versions of blocks " << block
+         << " to " << block + count - 1 << "\n";
+    stat = ds;
+    return stat;
+  }
+  stat = disk->writeBlocks(block, count, buffer);
+  return stat;
+}
+
+DiskStatus VersionedVSSD::sync() {
+  DiskStatus ds = log->sync();
+  stat = (ds == DiskStatus::OK) ? disk->sync() : ds;
+  return stat;
+}
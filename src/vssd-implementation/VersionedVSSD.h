@@ -0,0 +1,190 @@
+/**
+ * VersionedVSSD keeps the recent past of any disk (a RAMVSSD, a
+ * FileVSSD, ...) so blocks can be read as they were at an earlier point:
+ * to see what a corrupted block held before, or to read a consistent
+ * image while writers carry on.
+ *
+ * Points in time are sequence numbers: every write (of a block or an
+ * extent) gets the next one, and now() is the latest handed out. Before
+ * a write replaces blocks, their old contents go to a log kept on a
+ * second disk, one block per entry, recording which block it was, the
+ * sequence that wrote it and the one that replaced it. Each block's
+ * entries form a chain, newest first, so readAt() follows one chain to
+ * the version that was current at the sequence asked for.
+ *
+ * The log is a ring as long as the log disk: when it is full, the
+ * oldest entries are dropped for new ones, so retention is bounded by
+ * the log's size. Reading a version that has been dropped gives
+ * VERSION_UNAVAILABLE. Everything but the disk itself is kept in
+ * memory and lost when the VersionedVSSD goes.
+ *
+ * read() and readBlocks() go straight to the disk: reading the current
+ * version costs nothing extra. Writes and point-in-time reads lock
+ * their extent (a RangeLock); a mutex guards the chains and the ring.
+ * A write waits to reuse a log block another write is still filling,
+ * and a point-in-time read checks after reading a log block that its
+ * entry was not dropped meanwhile.
+ */
+
+#ifndef VERSIONEDVSSD_H
+  #define VERSIONEDVSSD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "RangeLock.h"
+#include "VVSSD.h"
+
+class VersionedVSSD : public VVSSD {
+ public:
+  typedef std::uint64_t sequence_t;
+
+ private:
+  /// a position in the log; entry p lives in log block p % capacity
+  typedef std::uint64_t position_t;
+  static constexpr position_t NoEntry = UINT64_MAX;
+
+  /**
+   * An old version of a block, kept in the log.
+   */
+  struct Entry {
+    blocknumber_t block = 0;
+    /// the sequence that wrote this version (0: it predates them all)
+    sequence_t from = 0;
+    /// the sequence that replaced it
+    sequence_t until = 0;
+    /// the block's next older entry
+    position_t older = NoEntry;
+  };
+
+  std::unique_ptr<VVSSD> disk;
+  std::unique_ptr<VVSSD> log;
+  std::size_t bc = 0;
+  std::size_t capacity = 0;
+  std::atomic<DiskStatus> stat = DiskStatus::NOT_READY;
+  RangeLock locks;
+
+  /// guards everything below
+  mutable std::mutex mtx;
+  sequence_t seq = 0;
+  /// the sequence that wrote each block's current version
+  std::vector<sequence_t> writtenAt;
+  /// each block's newest entry in the log
+  std::vector<position_t> newest;
+  std::vector<Entry> entries;
+  /// entries before tail have been dropped; next is the next to use
+  position_t tail = 0;
+  position_t next = 0;
+  /// the sequence of the write filling each log block (0: none)
+  std::vector<sequence_t> filling;
+  /// signalled when a write stops filling log blocks
+  std::condition_variable filled;
+
+ public:
+  /**
+   * VersionedVSSD Constructor
+   * Keeps old versions of disk's blocks in log (which must have the
+   * same block size); both must be ready.
+   *
+   * @param  {std::unique_ptr<VVSSD>} disk : the disk to version
+   * @param  {std::unique_ptr<VVSSD>} log  : where old versions go; its
+   *                                         size bounds retention
+   */
+  VersionedVSSD(std::unique_ptr<VVSSD> disk, std::unique_ptr<VVSSD> log);
+
+  virtual ~VersionedVSSD();
+
+  /**
+   * Return the sequence of the latest write; reading at it later gives
+   * the disk as it is now.
+   */
+  sequence_t now() const;
+
+  /**
+   * Return the number of old versions in the log.
+   */
+  std::size_t retainedVersions() const;
+
+  /**
+   * Read indicated block as it was at sequence at (after the write
+   * with that sequence).
+   *
+   * @return OK, VERSION_UNAVAILABLE if that version was dropped from the
+   *         log, or another error code.
+   */
+  DiskStatus readAt(blocknumber_t block, sequence_t at, void* buffer);
+
+  /**
+   * Read a contiguous extent of blocks as they were at sequence at,
+   * under a shared lock on the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param at the sequence to read at
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK, VERSION_UNAVAILABLE if any version asked for was dropped
+   *         from the log, or another error code.
+   */
+  DiskStatus readBlocksAt(blocknumber_t block, std::size_t count,
+                          sequence_t at, void* buffer);
+
+  /**
+   * Return the size (in bytes) of the blocks used by this device.
+   */
+  virtual std::size_t blockSize() const;
+
+  /**
+   * Return the total number of blocks on the disk.
+   */
+  virtual std::size_t blockCount() const;
+
+  /**
+   * Return the status of the disk (typically the last call).
+   */
+  virtual DiskStatus status() const;
+
+  /**
+   * Read the current version of indicated block.
+   */
+  virtual DiskStatus read(blocknumber_t block, void* buffer);
+
+  /**
+   * Save indicated block's current version to the log, then write it.
+   */
+  virtual DiskStatus write(blocknumber_t block, void* buffer);
+
+  /**
+   * Read the current version of a contiguous extent of blocks.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void* buffer);
+
+  /**
+   * Save the current versions of a contiguous extent of blocks to the
+   * log, then write it, all as one sequence, under an exclusive lock on
+   * the extent.
+   *
+   * @param block the index of the first block; the extent must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void* buffer);
+
+  /**
+   * Synchronize the log and the disk.
+   */
+  virtual DiskStatus sync();
+};
+
+  #endif /* VERSIONEDVSSD_H */
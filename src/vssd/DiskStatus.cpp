@@ -12,6 +12,9 @@ string toString(DiskStatus ds) {
     {OK, "OK"},
     {NOT_READY, "NOT_READY"},
     {BLOCK_OUT_OF_RANGE, "BLOCK_OUT_OF_RANGE"},
+    {CANCELLED, "CANCELLED"},
+    {READ_ONLY, "READ_ONLY"},
+    {VERSION_UNAVAILABLE, "VERSION_UNAVAILABLE"},
     {ERROR, "ERROR"},
     {NOT_YET_IMPLEMENTED, "NOT_YET_IMPLEMENTED"},
     {NO_SUCH_STATUS, "NO_SUCH_STATUS"}
@@ -33,6 +36,9 @@ DiskStatus fromString(std::string status) {
     {"OK", OK},
     {"NOT_READY", NOT_READY},
     {"BLOCK_OUT_OF_RANGE", BLOCK_OUT_OF_RANGE},
+    {"CANCELLED", CANCELLED},
+    {"READ_ONLY", READ_ONLY},
+    {"VERSION_UNAVAILABLE", VERSION_UNAVAILABLE},
     {"ERROR", ERROR},
     {"NOT_YET_IMPLEMENTED", NOT_YET_IMPLEMENTED}
   };
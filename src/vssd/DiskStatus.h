@@ -12,6 +12,9 @@ enum DiskStatus {
     NOT_READY,
     BLOCK_OUT_OF_RANGE,
     // Implementation Error Codes Begin: Must update conversion maps, too
+    CANCELLED,  // queued request dropped: deadline passed or cancelled
+    READ_ONLY,  // write refused: the disk (e.g. a snapshot) is read-only
+    VERSION_UNAVAILABLE,  // old version asked for is no longer retained
     // Implementation Error Codes End
     ERROR,
     NOT_YET_IMPLEMENTED,
@@ -0,0 +1,35 @@
+#include "VVSSD.h"
+
+/**
+ * Default extent read: range check the whole extent, then read it a
+ * block at a time, stopping at the first failure.
+ */
+DiskStatus VVSSD::readBlocks(blocknumber_t block, std::size_t count,
+                             void * buffer) {
+  if (block + count > blockCount() || block + count < block)
+    return BLOCK_OUT_OF_RANGE;
+
+  char * next = static_cast<char *>(buffer);
+  for (std::size_t i = 0; i < count; ++i, next += blockSize()) {
+    DiskStatus ds = read(block + i, next);
+    if (ds != OK) return ds;
+  }
+  return OK;
+}
+
+/**
+ * Default extent write: range check the whole extent, then write it a
+ * block at a time, stopping at the first failure.
+ */
+DiskStatus VVSSD::writeBlocks(blocknumber_t block, std::size_t count,
+                              void * buffer) {
+  if (block + count > blockCount() || block + count < block)
+    return BLOCK_OUT_OF_RANGE;
+
+  char * next = static_cast<char *>(buffer);
+  for (std::size_t i = 0; i < count; ++i, next += blockSize()) {
+    DiskStatus ds = write(block + i, next);
+    if (ds != OK) return ds;
+  }
+  return OK;
+}
@@ -88,6 +88,40 @@ class VVSSD {
    */
   virtual DiskStatus write(blocknumber_t block, void * buffer) = 0;
 
+  /**
+   * Read a contiguous extent of blocks if possible.
+   *
+   * Read count blocks, starting with the indicated block, into the
+   * provided buffer. The default implementation reads one block at a
+   * time; implementations that can read the extent as a unit (and keep
+   * it consistent against concurrent writers) should override it.
+   *
+   * @param block the index of the first block to read; the whole extent
+   *        must be in range
+   * @param count the number of blocks to read
+   * @param buffer pointer to memory with room for count * blockSize() bytes
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus readBlocks(blocknumber_t block, std::size_t count,
+                                void * buffer);
+
+  /**
+   * Write a contiguous extent of blocks if possible.
+   *
+   * Write count blocks from the given buffer, starting with the
+   * indicated block. The default implementation writes one block at a
+   * time; implementations that can write the extent as a unit (so
+   * concurrent readers see all of it or none of it) should override it.
+   *
+   * @param block the index of the first block to write; the whole extent
+   *        must be in range
+   * @param count the number of blocks to write
+   * @param buffer pointer to count * blockSize() bytes of data
+   * @return OK if all is well, appropriate error code otherwise.
+   */
+  virtual DiskStatus writeBlocks(blocknumber_t block, std::size_t count,
+                                 void * buffer);
+
   /**
    * Synchronize all in-memory structures out to the disk.
    *